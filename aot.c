@@ -0,0 +1,353 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "aot.h"
+#include "memory.h"
+
+/*
+ * Every function in a program is reachable from the script through the constant tables, a nested function being a constant
+ * of the one that declares it. Both sides number the chunks in the same order, the script first and then depth first
+ * through the constants, so the n-th generated function belongs to the n-th chunk walked at startup.
+ */
+
+typedef void (*ChunkVisitor)(ObjFunction *function, int index, void *context);
+
+static int walkFunctions(ObjFunction *function, int index, ChunkVisitor visit, void *context) {
+    visit(function, index++, context);
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+        Value constant = function->chunk.constants.values[i];
+        if (IS_OBJ(constant) && IS_FUNCTION(constant)) {
+            index = walkFunctions(AS_FUNCTION(constant), index, visit, context);
+        }
+    }
+    return index;
+}
+
+// FNV-1a over the code and whatever the generated code assumes about the constants
+static uint32_t hashBytes(uint32_t hash, const void *bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        hash ^= ((const uint8_t*)bytes)[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t checksumChunk(Chunk *chunk) {
+    uint32_t hash = hashBytes(2166136261u, chunk->code, chunk->count);
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        uint8_t kind = IS_INT(constant) ? 1 : IS_NUMBER(constant) ? 2 : IS_STRING(constant) ? 3 : 4;
+        hash = hashBytes(hash, &kind, 1);
+        if (IS_NUMBER(constant)) {
+            double number = AS_NUMBER(constant);
+            hash = hashBytes(hash, &number, sizeof(double));
+        } else if (IS_STRING(constant)) {
+            hash = hashBytes(hash, AS_STRING(constant)->chars, AS_STRING(constant)->length);
+        }
+    }
+    return hash;
+}
+
+/*
+ * ---------------------------------------- Emitting C ----------------------------------------
+ */
+
+static void emitString(FILE *out, const char *string) {
+    fputc('"', out);
+    for (const char *c = string; *c != '\0'; c++) {
+        switch (*c) {
+            case '"': fputs("\\\"", out); break;
+            case '\\': fputs("\\\\", out); break;
+            case '\t': fputs("\\t", out); break;
+            case '\r': fputs("\\r", out); break;
+            case '\n':
+                fputs("\\n\"\n", out);
+                if (c[1] != '\0') fputc('"', out);
+                else return;
+                break;
+            default:
+                if ((unsigned char)*c < ' ') fprintf(out, "\\%03o", (unsigned char)*c);
+                else fputc(*c, out);
+                break;
+        }
+    }
+    fputs("\"\n", out);
+}
+
+static const char *const comparisons[] = {"<", "<=", ">", ">="};
+
+static void emitForStep(FILE *out, Chunk *chunk, int offset, int target) {
+    uint8_t *code = &chunk->code[offset];
+    uint8_t slot = code[1];
+    uint8_t flags = code[2];
+    uint8_t boundIndex = code[3];
+    Value step = chunk->constants.values[code[4]];
+    bool constantBound = (flags & FOR_STEP_CONSTANT_BOUND) != 0;
+
+    fprintf(out, "    {\n");
+    if (IS_INT(step) && (!constantBound || IS_INT(chunk->constants.values[boundIndex]))) {
+        // The step and a constant bound are known here, only the counter (and a bound in a local) have to be checked
+        fprintf(out, "        int32_t next;\n");
+        fprintf(out, "        if (IS_INT(slots[%d])", slot);
+        if (!constantBound) fprintf(out, " && IS_INT(slots[%d])", boundIndex);
+        fprintf(out, " && %s(AS_INT(slots[%d]), %d, &next)) {\n",
+                (flags & FOR_STEP_SUBTRACT) ? "subtractInts" : "addInts", slot, AS_INT(step));
+        fprintf(out, "            slots[%d] = INT_VAL(next);\n", slot);
+        if (constantBound) {
+            fprintf(out, "            if (next %s %d) goto L%d;\n",
+                    comparisons[flags & FOR_STEP_COMPARISON], AS_INT(chunk->constants.values[boundIndex]), target);
+        } else {
+            fprintf(out, "            if (next %s AS_INT(slots[%d])) goto L%d;\n", comparisons[flags & FOR_STEP_COMPARISON], boundIndex, target);
+        }
+        fprintf(out, "        } else {\n");
+    } else {
+        fprintf(out, "        {\n");
+    }
+    fprintf(out, "            AOT_SYNC();\n");
+    fprintf(out, "            int again = fastForStep(frame, frame->chunk->code + %d);\n", offset);
+    fprintf(out, "            if (again < 0) AOT_EXIT(%d);\n", offset);
+    fprintf(out, "            if (again) goto L%d;\n", target);
+    fprintf(out, "        }\n");
+    fprintf(out, "    }\n");
+}
+
+static uint32_t readIndex(uint8_t *code, bool isLong) {
+    return isLong ? ((uint32_t)code[1] << 24 | (uint32_t)code[2] << 16 | (uint32_t)code[3] << 8 | code[4]) : code[1];
+}
+
+static void emitInstruction(FILE *out, Chunk *chunk, int offset) {
+    uint8_t *code = &chunk->code[offset];
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+            fprintf(out, "    *top++ = constants[%u];\n", readIndex(code, code[0] == OP_CONSTANT_LONG));
+            break;
+        case OP_NIL: fprintf(out, "    *top++ = NIL_VAL;\n"); break;
+        case OP_TRUE: fprintf(out, "    *top++ = BOOL_VAL(true);\n"); break;
+        case OP_FALSE: fprintf(out, "    *top++ = BOOL_VAL(false);\n"); break;
+        case OP_POP: fprintf(out, "    top--;\n"); break;
+        case OP_GET_LOCAL: fprintf(out, "    *top++ = slots[%d];\n", code[1]); break;
+        case OP_SET_LOCAL: fprintf(out, "    slots[%d] = top[-1];\n", code[1]); break;
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+            fprintf(out, "    AOT_CHECK(fastGetGlobal(AS_STRING(constants[%u]), top), %d);\n",
+                    readIndex(code, code[0] == OP_GET_GLOBAL_LONG), offset);
+            fprintf(out, "    top++;\n");
+            break;
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_PERM:
+        case OP_DEFINE_GLOBAL_PERM_LONG: {
+            bool isLong = code[0] == OP_DEFINE_GLOBAL_LONG || code[0] == OP_DEFINE_GLOBAL_PERM_LONG;
+            bool permanent = code[0] == OP_DEFINE_GLOBAL_PERM || code[0] == OP_DEFINE_GLOBAL_PERM_LONG;
+            fprintf(out, "    AOT_SYNC();\n");
+            fprintf(out, "    fastDefineGlobal(AS_STRING(constants[%u]), top[-1], %s);\n", readIndex(code, isLong), permanent ? "true" : "false");
+            fprintf(out, "    top--;\n");
+            break;
+        }
+        case OP_SET_GLOBAL:
+        case OP_SET_GLOBAL_LONG:
+            fprintf(out, "    AOT_CHECK(fastSetGlobal(AS_STRING(constants[%u]), top[-1]), %d);\n",
+                    readIndex(code, code[0] == OP_SET_GLOBAL_LONG), offset);
+            break;
+        case OP_GET_UPVALUE: fprintf(out, "    *top++ = *frame->closure->upvalues[%d]->location;\n", code[1]); break;
+        case OP_SET_UPVALUE: fprintf(out, "    *frame->closure->upvalues[%d]->location = top[-1];\n", code[1]); break;
+        case OP_GET_ITEM:
+            fprintf(out, "    AOT_CHECK(fastGetItem(top), %d);\n", offset);
+            fprintf(out, "    top--;\n");
+            break;
+        case OP_SET_ITEM:
+            fprintf(out, "    AOT_CHECK(fastSetItem(top), %d);\n", offset);
+            fprintf(out, "    top -= 2;\n");
+            break;
+        case OP_GET_PROPERTY:
+            fprintf(out, "    AOT_CHECK(fastGetProperty(top, AS_STRING(constants[%d])), %d);\n", code[1], offset);
+            break;
+        case OP_SET_PROPERTY:
+            fprintf(out, "    AOT_CHECK(fastSetProperty(top, AS_STRING(constants[%d])), %d);\n", code[1], offset);
+            fprintf(out, "    top--;\n");
+            break;
+        case OP_EQUAL:
+            fprintf(out, "    top[-2] = BOOL_VAL(valuesEqual(top[-2], top[-1]));\n");
+            fprintf(out, "    top--;\n");
+            break;
+        case OP_GREATER: fprintf(out, "    AOT_COMPARISON(OP_GREATER, >, %d);\n", offset); break;
+        case OP_LESS: fprintf(out, "    AOT_COMPARISON(OP_LESS, <, %d);\n", offset); break;
+        case OP_ADD: fprintf(out, "    AOT_ARITHMETIC(OP_ADD, addInts, +, %d);\n", offset); break;
+        case OP_SUBTRACT: fprintf(out, "    AOT_ARITHMETIC(OP_SUBTRACT, subtractInts, -, %d);\n", offset); break;
+        case OP_MULTIPLY: fprintf(out, "    AOT_ARITHMETIC(OP_MULTIPLY, multiplyInts, *, %d);\n", offset); break;
+        case OP_DIVIDE: fprintf(out, "    AOT_ARITHMETIC(OP_DIVIDE, divideInts, /, %d);\n", offset); break;
+        case OP_MODULO:
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        case OP_SHIFT_LEFT:
+        case OP_SHIFT_RIGHT:
+            fprintf(out, "    AOT_SLOW(%d, %d);\n", code[0], offset);
+            fprintf(out, "    top--;\n");
+            break;
+        case OP_NOT: fprintf(out, "    top[-1] = BOOL_VAL(isFalsey(top[-1]));\n"); break;
+        case OP_NEGATE: fprintf(out, "    AOT_CHECK(fastNegate(top), %d);\n", offset); break;
+        case OP_PRINT:
+            fprintf(out, "    fastPrint(top[-1]);\n");
+            fprintf(out, "    top--;\n");
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            fprintf(out, "    goto L%d;\n", jumpTarget(chunk, offset));
+            break;
+        case OP_JUMP_IF_FALSE:
+            fprintf(out, "    if (isFalsey(top[-1])) goto L%d;\n", jumpTarget(chunk, offset));
+            break;
+        case OP_ITER_INIT:
+            fprintf(out, "    AOT_CHECK(fastIterInit(top), %d);\n", offset);
+            fprintf(out, "    top++;\n");
+            break;
+        case OP_ITER_NEXT:
+            fprintf(out, "    AOT_SYNC();\n");
+            fprintf(out, "    if (!fastIterNext(slots, %d, top)) goto L%d;\n", code[1], jumpTarget(chunk, offset));
+            fprintf(out, "    top++;\n");
+            break;
+        case OP_FOR_STEP:
+            emitForStep(out, chunk, offset, jumpTarget(chunk, offset));
+            break;
+        case OP_CHECK_CALLEE:
+            fprintf(out, "    if (!isCallee(top[-%d], AS_FUNCTION(constants[%d]))) goto L%d;\n", code[2] + 1, code[1],
+                    jumpTarget(chunk, offset));
+            break;
+        case OP_INLINE_RETURN:
+            fprintf(out, "    top[-%d] = top[-1];\n", code[1] + 1);
+            fprintf(out, "    top -= %d;\n", code[1]);
+            fprintf(out, "    goto L%d;\n", jumpTarget(chunk, offset));
+            break;
+        default:
+            // Calls, returns, closures, classes and collection literals belong to run()
+            fprintf(out, "    AOT_EXIT(%d);\n", offset);
+            break;
+    }
+}
+
+// run() hands a frame over at its start, after a call, and at the target of a loop's back edge
+static bool isEntry(Chunk *chunk, int offset, bool *backTargets) {
+    if (offset == 0 || backTargets[offset]) return true;
+    for (int previous = 0; previous < offset; previous += instructionLength(chunk, previous)) {
+        if (previous + instructionLength(chunk, previous) == offset) {
+            uint8_t op = chunk->code[previous];
+            return op == OP_CALL || op == OP_TAIL_CALL || op == OP_INVOKE || op == OP_SUPER_INVOKE;
+        }
+    }
+    return false;
+}
+
+static void emitFunction(ObjFunction *function, int index, void *context) {
+    FILE *out = (FILE*)context;
+    Chunk *chunk = &function->chunk;
+
+    bool *targets = ALLOCATE(bool, chunk->count + 1);
+    bool *backTargets = ALLOCATE(bool, chunk->count + 1);
+    memset(targets, 0, chunk->count + 1);
+    memset(backTargets, 0, chunk->count + 1);
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        int target = jumpTarget(chunk, offset);
+        if (target == -1) continue;
+        targets[target] = true;
+        if (target <= offset) backTargets[target] = true;
+    }
+
+    fprintf(out, "\n// %s\n", function->name != NULL ? function->name->chars : "<script>");
+    fprintf(out, "static void chunk%d(CallFrame *frame, int offset) {\n", index);
+    fprintf(out, "    Value *slots = frame->slots;\n");
+    fprintf(out, "    Value *constants = frame->chunk->constants.values;\n");
+    fprintf(out, "    Value *top = vm.stackTop;\n");
+    fprintf(out, "    (void)slots;\n");
+    fprintf(out, "    (void)constants;\n\n");
+    fprintf(out, "    switch (offset) {\n");
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (isEntry(chunk, offset, backTargets)) {
+            targets[offset] = true;
+            fprintf(out, "        case %d: goto L%d;\n", offset, offset);
+        }
+    }
+    fprintf(out, "        default: return;\n");
+    fprintf(out, "    }\n\n");
+
+    int line = -1;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        if (targets[offset]) fprintf(out, "L%d:\n", offset);
+        if (chunk->lines[offset] != line) {
+            line = chunk->lines[offset];
+            fprintf(out, "    // line %d\n", SOURCE_LINE(line));
+        }
+        emitInstruction(out, chunk, offset);
+    }
+    fprintf(out, "}\n");
+
+    FREE_ARRAY(bool, targets, chunk->count + 1);
+    FREE_ARRAY(bool, backTargets, chunk->count + 1);
+}
+
+static void emitTableEntry(ObjFunction *function, int index, void *context) {
+    fprintf((FILE*)context, "    {chunk%d, %uu},\n", index, checksumChunk(&function->chunk));
+}
+
+void emitC(ObjFunction *script, const char *source, const char *path, FILE *out) {
+    // Nothing below should collect, but the script isn't reachable from anywhere else
+    push(OBJ_VAL(script));
+
+    fprintf(out, "// Generated by cfer --emit-c from %s. Build it against the runtime (every .c file but main.c):\n", path);
+    fprintf(out, "// cc -O2 -I<cfer> this.c <cfer .c files but main.c> -lm\n\n");
+    fprintf(out, "#include \"aot.h\"\n\n");
+    fprintf(out, "static const char source[] =\n");
+    emitString(out, source);
+    fprintf(out, ";\n");
+
+    int count = walkFunctions(script, 0, emitFunction, out);
+
+    fprintf(out, "\nstatic const CompiledChunk chunks[] = {\n");
+    walkFunctions(script, 0, emitTableEntry, out);
+    fprintf(out, "};\n\n");
+    fprintf(out, "int main() {\n");
+    fprintf(out, "    return runCompiled(source, chunks, %d);\n", count);
+    fprintf(out, "}\n");
+
+    pop();
+}
+
+/*
+ * ---------------------------------------- Running compiled code ----------------------------------------
+ */
+
+typedef struct {
+    const CompiledChunk *chunks;
+    int count;
+} Attachment;
+
+static void attachChunk(ObjFunction *function, int index, void *context) {
+    Attachment *attachment = (Attachment*)context;
+    if (index < attachment->count && attachment->chunks[index].checksum == checksumChunk(&function->chunk)) {
+        function->compiled = attachment->chunks[index].code;
+    }
+}
+
+int runCompiled(const char *source, const CompiledChunk *chunks, int count) {
+    initVM();
+    // The generated code is for the chunks the compiler makes, not the ones the tier or the JIT would swap in,
+    // and the stack VM runs whatever it leaves to run()
+    vm.registerMode = false;
+    vm.tiering = false;
+    vm.jitting = false;
+    vm.compiledCode = true;
+
+    ObjFunction *script = compile(source);
+    if (script == NULL) return 65;
+
+    Attachment attachment = {chunks, count};
+    walkFunctions(script, 0, attachChunk, &attachment);
+
+    InterpretResult result = interpretFunction(script);
+    freeVM();
+    if (result == INTERPRET_COMPILE_ERROR) return 65;
+    if (result == INTERPRET_RUNTIME_ERROR) return 70;
+    return 0;
+}
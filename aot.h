@@ -0,0 +1,97 @@
+#ifndef CFER_AOT_H
+#define CFER_AOT_H
+
+#include <stdio.h>
+
+#include "compiler.h"
+#include "fastpath.h"
+#include "vm.h"
+
+/*
+ * Some programs run the same way every time, over different data. For those, cfer --emit-c file.fer translates the program
+ * ahead of time into C, one function per chunk, and the C compiler does the rest. Built against the runtime
+ * (every .c file but main.c) it becomes a standalone executable that runs the program with no dispatch loop in the hot paths:
+ *
+ * cfer --emit-c program.fer > program.c
+ * cc -O2 -I<cfer> program.c <every cfer .c file but main.c> -lm -o program
+ *
+ * Each instruction becomes a few lines of straight C working on the VM stack, jumps become gotos,
+ * and the operands and the constants the code depends on (a loop's step and bound, say) are written into it,
+ * so the C compiler can fold them. The generated code follows the same rules as the JIT (see jit.h):
+ * the stack stays in vm.stack, the common case is inline or goes through fastpath.h,
+ * and anything else (calls, returns, closures, errors) returns to run() with the frame's ip at that instruction.
+ * run() hands the frame back after calls and returns and on loop back edges.
+ *
+ * The executable still carries the program's source. At startup it compiles it as usual, which rebuilds all the objects
+ * (strings, functions, constants) the code refers to, and attaches each generated function to its chunk.
+ * Chunks are matched by the order they are reached from the script through the constants and checked against a checksum of their code and constants,
+ * so a runtime built from a different compiler runs the chunks that don't match in the interpreter instead.
+ */
+
+typedef void (*CompiledCode)(CallFrame *frame, int offset);
+
+typedef struct {
+    CompiledCode code;
+    uint32_t checksum;
+} CompiledChunk;
+
+void emitC(ObjFunction *script, const char *source, const char *path, FILE *out);
+int runCompiled(const char *source, const CompiledChunk *chunks, int count);
+
+/*
+ * The generated code is written in terms of these, which keeps it short, and keeps what it does next to the code
+ * that does the same thing in run(). frame, slots and top are the generated function's locals.
+ */
+
+#define AOT_SYNC() (vm.stackTop = top)
+
+#define AOT_EXIT(offset) \
+    do { \
+        frame->ip = frame->chunk->code + (offset); \
+        AOT_SYNC(); \
+        return; \
+    } while (false)
+
+#define AOT_SLOW(op, offset) \
+    do { \
+        AOT_SYNC(); \
+        if (!fastBinary(top, op)) AOT_EXIT(offset); \
+    } while (false)
+
+#define AOT_ARITHMETIC(op, intOp, operator, offset) \
+    do { \
+        Value a = top[-2]; \
+        Value b = top[-1]; \
+        int32_t result; \
+        if (IS_INT(a) && IS_INT(b) && intOp(AS_INT(a), AS_INT(b), &result)) { \
+            top[-2] = INT_VAL(result); \
+        } else if (IS_DOUBLE(a) && IS_DOUBLE(b)) { \
+            top[-2] = NUMBER_VAL(AS_NUMBER(a) operator AS_NUMBER(b)); \
+        } else { \
+            AOT_SLOW(op, offset); \
+        } \
+        top--; \
+    } while (false)
+
+#define AOT_COMPARISON(op, operator, offset) \
+    do { \
+        Value a = top[-2]; \
+        Value b = top[-1]; \
+        if (IS_INT(a) && IS_INT(b)) { \
+            top[-2] = BOOL_VAL(AS_INT(a) operator AS_INT(b)); \
+        } else if (IS_DOUBLE(a) && IS_DOUBLE(b)) { \
+            top[-2] = BOOL_VAL(AS_NUMBER(a) operator AS_NUMBER(b)); \
+        } else { \
+            AOT_SLOW(op, offset); \
+        } \
+        top--; \
+    } while (false)
+
+// For the helpers that return false to hand the instruction to run()
+#define AOT_CHECK(call, offset) \
+    do { \
+        AOT_SYNC(); \
+        if (!(call)) AOT_EXIT(offset); \
+    } while (false)
+
+#endif //CFER_AOT_H
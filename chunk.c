@@ -2,6 +2,7 @@
 
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "vm.h"
 
 void initChunk(Chunk *chunk) {
@@ -57,18 +58,76 @@ int addConstant(Chunk *chunk, Value value) {
     return chunk->constants.count - 1;
 }
 
+/*
+ * Instructions are variable length, so anything that walks a chunk needs to know how long each one is.
+ * OP_CLOSURE is the odd one out: its length depends on how many upvalues the function it wraps captures.
+ */
 
+int instructionLength(Chunk *chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_PERM:
+        case OP_SET_GLOBAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+        case OP_IMPORT:
+        case OP_GET_SUPER:
+        case OP_LIST:
+        case OP_DICTIONARY:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        case OP_CLASS:
+        case OP_METHOD:
+            return 2;
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE:
+            return 3;
+        case OP_ITER_NEXT:
+        case OP_INLINE_RETURN:
+            return 4;
+        case OP_CONSTANT_LONG:
+        case OP_GET_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_PERM_LONG:
+        case OP_SET_GLOBAL_LONG:
+        case OP_CHECK_CALLEE:
+            return 5;
+        case OP_FOR_STEP:
+            return 7;
+        case OP_CLOSURE: {
+            ObjFunction *function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 1]]);
+            return 2 + function->upvalueCount * 2;
+        }
+        default:
+            return 1;
+    }
+}
 
-
-
-
-
-
-
-
-
-
-
-
-
-
+int jumpTarget(Chunk *chunk, int offset) {
+    uint8_t *code = &chunk->code[offset];
+    switch (code[0]) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+            return offset + 3 + (code[1] << 8 | code[2]);
+        case OP_LOOP:
+            return offset + 3 - (code[1] << 8 | code[2]);
+        case OP_ITER_NEXT:
+        case OP_INLINE_RETURN:
+            return offset + 4 + (code[2] << 8 | code[3]);
+        case OP_CHECK_CALLEE:
+            return offset + 5 + (code[3] << 8 | code[4]);
+        case OP_FOR_STEP:
+            return offset + 7 - (code[5] << 8 | code[6]);
+        default:
+            return -1;
+    }
+}
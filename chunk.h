@@ -74,6 +74,12 @@ typedef enum {
     OP_SUBTRACT,
     OP_MULTIPLY,
     OP_DIVIDE,
+    OP_MODULO,
+    OP_BIT_AND,
+    OP_BIT_OR,
+    OP_BIT_XOR,
+    OP_SHIFT_LEFT,
+    OP_SHIFT_RIGHT,
     OP_NOT,
     OP_NEGATE,
     OP_LIST,
@@ -82,9 +88,15 @@ typedef enum {
     OP_JUMP,
     OP_JUMP_IF_FALSE,
     OP_LOOP,
+    OP_ITER_INIT,
+    OP_ITER_NEXT,
+    OP_FOR_STEP,
     OP_CALL,
+    OP_TAIL_CALL,
     OP_INVOKE,
     OP_SUPER_INVOKE,
+    OP_CHECK_CALLEE,
+    OP_INLINE_RETURN,
     OP_CLOSURE,
     OP_CLOSE_UPVALUE,
     OP_RETURN,
@@ -93,6 +105,28 @@ typedef enum {
     OP_METHOD
 } OpCode;
 
+/*
+ * OP_CHECK_CALLEE function, depth, offset jumps forward unless the callee depth slots below the top of the stack would run
+ * the function constant if it was called: a closure over it, an instance whose class has it as a method, or a superclass that has it as one.
+ * OP_INLINE_RETURN count, offset moves the top of the stack count slots down, pops the count values above it and jumps forward.
+ * They're the guard in front of a call the compiler inlines and the return out of it (see inlineCall()).
+ *
+ * OP_TAIL_CALL argCount is an OP_CALL whose result the function returns straight away, as in return f(x).
+ * The callee takes over the caller's frame instead of pushing one of its own (see tailCall() in vm.c), and the OP_RETURN after it
+ * only runs when the callee had no frame to begin with, a native for instance.
+ *
+ * OP_FOR_STEP slot, flags, bound, step, offset is the bottom of a counted for loop (see forStatement()).
+ * The low two bits of flags pick the comparison, the other bits say where the bound comes from and which way the counter moves.
+ */
+
+#define FOR_STEP_LESS           0
+#define FOR_STEP_LESS_EQUAL     1
+#define FOR_STEP_GREATER        2
+#define FOR_STEP_GREATER_EQUAL  3
+#define FOR_STEP_COMPARISON     3
+#define FOR_STEP_CONSTANT_BOUND 4
+#define FOR_STEP_SUBTRACT       8
+
 /*
  * Bytecode is a series of instructions. Eventually, we'll store some other data along with the instructions,
  * so let's create a struct to hold it all.
@@ -170,6 +204,29 @@ void freeChunk(Chunk *chunk);
 
 int addConstant(Chunk *chunk, Value value);
 
+/*
+ * instructionLength() is the size in bytes of the instruction at offset, operands included.
+ * jumpTarget() is the offset a jump, loop or fused loop instruction can transfer control to, or -1 for every other instruction.
+ */
+
+int instructionLength(Chunk *chunk, int offset);
+int jumpTarget(Chunk *chunk, int offset);
+
+/*
+ * Code the compiler inlined from another function (see inlineCall() in compiler.c) keeps that function's own lines,
+ * tagged with the inlined call they came from: an index into the owning function's inlineSites (see object.h).
+ * Both go into the one int, as a negative number, so every pass that copies lines along with their code
+ * (the peephole pass, the tier, the register translator) carries them along without knowing about it.
+ * SOURCE_LINE() is the line in the source either way, and INLINE_SITE() the site, or -1 for code that wasn't inlined.
+ */
+
+#define INLINE_LINE_SPAN 65536
+#define INLINE_SITES_MAX 32000
+
+#define INLINED_LINE(site, line) (-(((site) + 1) * INLINE_LINE_SPAN + (line)))
+#define SOURCE_LINE(line) ((line) < 0 ? -(line) % INLINE_LINE_SPAN : (line))
+#define INLINE_SITE(line) ((line) < 0 ? -(line) / INLINE_LINE_SPAN - 1 : -1)
+
 
 
 
@@ -5,6 +5,7 @@
 #include "common.h"
 #include "compiler.h"
 #include "memory.h"
+#include "optimizer.h"
 
 #include "debug.h"
 #include "scanner.h"
@@ -34,6 +35,9 @@ typedef struct {
  * If we call parsePrecedence(PREC_ASSIGNMENT), then it will parse the entire expression because + has higher precedence than the assignment.
  * If instead we call parsePrecedence(PREC_UNARY), it will compile the -a.b and stop there. It doesn't keep going through the + because the addition has
  * lower precedence than unary operators.
+ *
+ * The bitwise operators sit between the comparisons and the arithmetic, the way Python orders them rather than C.
+ * In C, x & 1 == 0 means x & (1 == 0), which is never what anybody meant. Here it means (x & 1) == 0.
  */
 
 typedef enum {
@@ -43,8 +47,12 @@ typedef enum {
     PREC_AND,           // and
     PREC_EQUALITY,      // == !=
     PREC_COMPARISON,    // < > <= >=
+    PREC_BIT_OR,        // |
+    PREC_BIT_XOR,       // ^
+    PREC_BIT_AND,       // &
+    PREC_SHIFT,         // << >>
     PREC_TERM,          // + -
-    PREC_FACTOR,        // * /
+    PREC_FACTOR,        // * / %
     PREC_UNARY,         // ! -
     PREC_CALL,          // . () []
     PREC_PRIMARY
@@ -86,6 +94,11 @@ typedef enum {
     TYPE_SCRIPT
 } FunctionType;
 
+/*
+ * start is where continue jumps back to. A loop whose continue target comes after its body (a fused counted for loop)
+ * sets start to -1, and continue statements leave forward jumps in continueJumps for the loop to patch once it knows where that is.
+ */
+
 typedef struct Loop {
     struct Loop *enclosing;
     int start;
@@ -93,29 +106,81 @@ typedef struct Loop {
     int *breakJumps;
     int breakCount;
     int breakCapacity;
+    int *continueJumps;
+    int continueCount;
+    int continueCapacity;
 } Loop;
 
+/*
+ * A call being inlined (see inlineCall()). base is the stack slot of the callee, which is also the first local of the inlined body,
+ * site is its entry in the function's inlineSites, and exitJumps are the jump operands of its OP_INLINE_RETURNs, all going to the end of the call.
+ */
+
+typedef struct Inline {
+    int base;
+    int site;
+    int *exitJumps;
+    int exitCount;
+    int exitCapacity;
+} Inline;
+
+/*
+ * markOffset and markHeight are a point in the chunk where we know how tall the stack is, see stackHeight().
+ * globalStart and globalEnd are where the last read of a global (globalName) starts and ends, and thisEnd is where the last this ends,
+ * so a call can tell it comes right after one of those. callEnd is where the last OP_CALL ends, so a return can tell it returns a call.
+ */
+
 typedef struct Compiler {
     struct Compiler *enclosing;
     ObjFunction *function;
     Loop *loop;
+    Inline *inlining;
     FunctionType type;
     Local locals[UINT8_COUNT];
     int localCount;
     Upvalue upvalues[UINT8_COUNT];
     int scopeDepth;
+    int markOffset;
+    int markHeight;
+    int globalStart;
+    int globalEnd;
+    Token globalName;
+    int thisEnd;
+    int callEnd;
 } Compiler;
 
 typedef struct ClassCompiler {
     struct ClassCompiler *enclosing;
+    Token name;
+    Token superclass;
     bool hasSuperclass;
 } ClassCompiler;
 
+/*
+ * A function the compiler may inline: a global function (owner is empty) or a method of the class named owner.
+ * parameters is its '(' token and source is where the scanner was right after it, so the function can be compiled again from there.
+ */
+
+typedef struct {
+    Token owner;
+    Token name;
+    ObjFunction *function;
+    Token parameters;
+    Scanner source;
+} Inlinable;
+
+#define INLINE_MAX_SIZE 64
+
 Parser parser;
 Compiler *current = NULL;
 ClassCompiler *currentClass = NULL;
 Chunk *compilingChunk;
 
+Inlinable *inlinables = NULL;
+int inlinableCount = 0;
+int inlinableCapacity = 0;
+Inlinable lastFunction;
+
 static Chunk* currentChunk() {
     return &current->function->chunk;
 }
@@ -227,7 +292,9 @@ static bool match(TokenType type) {
  */
 
 static void emitByte(uint8_t byte) {
-    writeChunk(currentChunk(), byte, parser.previous.line);
+    // Inlined code keeps its own line, tagged with the call it was inlined into (see chunk.h)
+    int line = parser.previous.line;
+    writeChunk(currentChunk(), byte, current->inlining != NULL ? INLINED_LINE(current->inlining->site, line) : line);
 }
 
 static void emitBytes(uint8_t byte1, uint8_t byte2) {
@@ -303,6 +370,13 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
     compiler->localCount = 0;
     compiler->scopeDepth = 0;
     compiler->loop = NULL;
+    compiler->inlining = NULL;
+    compiler->markOffset = 0;
+    compiler->markHeight = 1;
+    compiler->globalStart = -1;
+    compiler->globalEnd = -1;
+    compiler->thisEnd = -1;
+    compiler->callEnd = -1;
     compiler->function = newFunction();
     current = compiler;
     if (type != TYPE_SCRIPT) {
@@ -321,9 +395,13 @@ static void initCompiler(Compiler *compiler, FunctionType type) {
     }
 }
 
+static void recordMaxStack();
+
 static ObjFunction* endCompiler() {
     emitReturn();
+    recordMaxStack();
     ObjFunction *function = current->function;
+    if (!parser.hadError) optimizeChunk(currentChunk());
 #ifdef DEBUG_PRINT_CODE
     if (!parser.hadError) {
         disassembleChunk(currentChunk(), function->name != NULL ? function->name->chars : "<script>");
@@ -352,6 +430,7 @@ static void endScope() {
 }
 
 static void expression();
+static void block();
 static void statement();
 static void declaration();
 static ParseRule* getRule(TokenType type);
@@ -366,8 +445,17 @@ static bool identifiersEqual(Token *a, Token *b) {
     return memcmp(a->start, b->start, a->length) == 0;
 }
 
+static Token syntheticToken(const char *text) {
+    Token token;
+    token.start = text;
+    token.length = (int)strlen(text);
+    return token;
+}
+
 static int resolveLocal(Compiler *compiler, Token *name) {
-    for (int i = compiler->localCount - 1; i >= 0; i--) {
+    // An inlined body only sees its own locals, the caller's aren't in its scope
+    int first = compiler->inlining != NULL ? compiler->inlining->base : 0;
+    for (int i = compiler->localCount - 1; i >= first; i--) {
         Local *local = &compiler->locals[i];
         if (identifiersEqual(name, &local->name)) {
             if (local->depth == -1) {
@@ -514,6 +602,307 @@ static uint8_t argumentList() {
     return argCount;
 }
 
+/*
+ * ---------------------------------------- Inlining ----------------------------------------
+ *
+ * A call to a tiny function (a getter, abs(), clamp()) spends most of its time on the call itself:
+ * OP_CALL checks the callee and pushes a frame, OP_RETURN closes upvalues and pops it, and only in between does the real work happen.
+ * When the compiler can tell which function a call is going to run, it can compile the body of that function right there instead,
+ * working on the callee's slot and arguments exactly where the call would have found them.
+ *
+ * The compiler knows a function when the callee is a global that a fun declaration (or a perm aliasing one) gave it earlier in the source,
+ * this.name() for a method of the class being compiled or of its superclass, or super.name(). Only small functions qualify
+ * (see isInlinable()): no upvalues, no closures or classes of their own, no super, and no mention of their own name, so no recursion.
+ * Nor one that ends in a tail call: inlined, the tail call would become an ordinary one, and mutual recursion (even() returning odd(),
+ * odd() returning even()) would grow the stack again.
+ * Rather than copying bytecode, we compile the function again from its source at the call site. Its parameters become locals
+ * on top of the argument slots, its locals are locals of the caller's, and a return is an OP_INLINE_RETURN: it moves the result
+ * into the callee's slot, pops everything above it and jumps to the end of the call, all in one instruction.
+ *
+ * The name can be rebound and the method overridden by the time the code runs, so the inlined body sits behind a guard:
+ *
+ *            <callee> <arguments> [<superclass>]
+ *            OP_CHECK_CALLEE function, depth, call     is the callee still that function?
+ *            [OP_POP]                                   the superclass, for super
+ *            <the body, every return an OP_INLINE_RETURN to end>
+ * call:      OP_CALL / OP_INVOKE / OP_SUPER_INVOKE
+ * end:
+ *
+ * so a program that swaps the function out still calls the new one. Inlined code has no frame of its own,
+ * so its lines say which call it was inlined into (see chunk.h), and a runtime error in it still gets a line of the stack trace
+ * for the inlined function, on the line in its body, above the caller's on the line of the call.
+ */
+
+// How the instruction at offset changes the height of the stack, when control falls through it
+static int stackEffect(Chunk *chunk, int offset) {
+    uint8_t *code = &chunk->code[offset];
+    if (code[0] >= OP_EQUAL && code[0] <= OP_SHIFT_RIGHT) return -1;
+
+    switch (code[0]) {
+        case OP_CONSTANT:
+        case OP_CONSTANT_LONG:
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_GET_LOCAL:
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+        case OP_GET_UPVALUE:
+        case OP_IMPORT:
+        case OP_ITER_INIT:
+        case OP_ITER_NEXT:
+        case OP_CLOSURE:
+        case OP_CLASS:
+            return 1;
+        case OP_POP:
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_PERM:
+        case OP_DEFINE_GLOBAL_PERM_LONG:
+        case OP_SET_PROPERTY:
+        case OP_GET_SUPER:
+        case OP_GET_ITEM:
+        case OP_PRINT:
+        case OP_CLOSE_UPVALUE:
+        case OP_RETURN:
+        case OP_INHERIT:
+        case OP_METHOD:
+            return -1;
+        case OP_SET_ITEM: return -2;
+        case OP_LIST: return 1 - code[1];
+        case OP_DICTIONARY: return 1 - 2 * code[1];
+        case OP_CALL:
+        case OP_TAIL_CALL: return -code[1];
+        case OP_INVOKE: return -code[2];
+        case OP_SUPER_INVOKE: return -code[2] - 1;
+        case OP_INLINE_RETURN: return -code[1];
+        default: return 0;
+    }
+}
+
+/*
+ * The compiler doesn't keep count of the stack as it goes, but it knows the height at the start of every statement:
+ * one slot per local. Everything an expression emits falls through to the next instruction (and/or jump, but only over code
+ * that leaves the height where it was), so adding up the instructions since the last statement gives the height here.
+ *
+ * The same walk gives the function its maxStack (see object.h). Before a mark is moved, recordMaxStack() goes over the instructions
+ * since the last one and keeps the tallest height on the way. Every instruction comes after some mark, and endCompiler() takes care
+ * of the ones after the last, so each one is looked at exactly once. The peephole pass only ever makes the stack shorter,
+ * and the optimizing tier adds its temporaries to maxStack itself.
+ */
+
+// The height after the last instruction emitted, and in tallest the most it got to since the mark
+static int walkHeights(int *tallest) {
+    Chunk *chunk = currentChunk();
+    int height = current->markHeight;
+    *tallest = height;
+    for (int offset = current->markOffset; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        height += stackEffect(chunk, offset);
+        if (height > *tallest) *tallest = height;
+    }
+    return height;
+}
+
+static void recordMaxStack() {
+    int tallest;
+    walkHeights(&tallest);
+    if (tallest > current->function->maxStack) current->function->maxStack = tallest;
+}
+
+static void markHeight(int height) {
+    recordMaxStack();
+    current->markOffset = currentChunk()->count;
+    current->markHeight = height;
+}
+
+static int stackHeight() {
+    int tallest;
+    return walkHeights(&tallest);
+}
+
+static bool isInlinable(ObjFunction *function) {
+    if (function->upvalueCount > 0 || function->chunk.count > INLINE_MAX_SIZE) return false;
+
+    Chunk *chunk = &function->chunk;
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        switch (chunk->code[offset]) {
+            case OP_CLOSURE:
+            case OP_CLOSE_UPVALUE:
+            case OP_CLASS:
+            case OP_INHERIT:
+            case OP_METHOD:
+            case OP_IMPORT:
+            case OP_GET_SUPER:
+            case OP_SUPER_INVOKE:
+            case OP_TAIL_CALL:
+                return false;
+            default:
+                break;
+        }
+    }
+
+    // Names are interned, so any use of its own name (a call to itself, this.name()) shows up as the same string
+    for (int i = 0; i < chunk->constants.count; i++) {
+        Value constant = chunk->constants.values[i];
+        if (IS_STRING(constant) && AS_STRING(constant) == function->name) return false;
+    }
+    return true;
+}
+
+static void addInlinable(Token owner, Token name, Inlinable *function) {
+    if (inlinableCount == inlinableCapacity) {
+        int oldCapacity = inlinableCapacity;
+        inlinableCapacity = GROW_CAPACITY(oldCapacity);
+        inlinables = GROW_ARRAY(Inlinable, inlinables, oldCapacity, inlinableCapacity);
+    }
+
+    Inlinable *inlinable = &inlinables[inlinableCount++];
+    *inlinable = *function;
+    inlinable->owner = owner;
+    inlinable->name = name;
+}
+
+// The latest one wins, a later declaration with the same name replaces the binding
+static bool findInlinable(Token *owner, Token *name, Inlinable *found) {
+    for (int i = inlinableCount - 1; i >= 0; i--) {
+        if (identifiersEqual(&inlinables[i].owner, owner) && identifiersEqual(&inlinables[i].name, name)) {
+            *found = inlinables[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+static void emitCallInstruction(uint8_t op, uint8_t name, uint8_t argCount) {
+    if (op == OP_CALL) {
+        emitBytes(OP_CALL, argCount);
+        current->callEnd = currentChunk()->count;
+    } else {
+        emitBytes(op, name);
+        emitByte(argCount);
+    }
+}
+
+static void emitInlineExit() {
+    Inline *inlining = current->inlining;
+    if (inlining->exitCount == inlining->exitCapacity) {
+        int oldCapacity = inlining->exitCapacity;
+        inlining->exitCapacity = GROW_CAPACITY(oldCapacity);
+        inlining->exitJumps = GROW_ARRAY(int, inlining->exitJumps, oldCapacity, inlining->exitCapacity);
+    }
+
+    // The jump offset comes last, like OP_JUMP's, so patchJump() fills it in the same way
+    emitBytes(OP_INLINE_RETURN, (uint8_t)(current->localCount - inlining->base));
+    emitBytes(0xff, 0xff);
+    inlining->exitJumps[inlining->exitCount++] = currentChunk()->count - 2;
+}
+
+/*
+ * Emits the call op (OP_CALL, or OP_INVOKE / OP_SUPER_INVOKE of the method name) with callee inlined in front of it.
+ * The callee and its arguments (and the superclass, for super) have to be on the stack already.
+ * Returns false, having emitted nothing, if this call can't be inlined, and the caller emits the plain call instead.
+ */
+
+static bool inlineCall(Inlinable *callee, uint8_t op, uint8_t name, uint8_t argCount) {
+    if (current->inlining != NULL || callee->function->arity != argCount) return false;
+
+    int base = stackHeight() - argCount - 1 - (op == OP_SUPER_INVOKE);
+    int localCount = current->localCount;
+    if (base < 0 || (base > localCount ? base : localCount) + argCount + 1 + callee->function->chunk.count >= UINT8_MAX) return false;
+
+    // Locals above base can only be variables still waiting for their initializer, like x in var x = f(1). They don't have a slot yet.
+    Local hidden[UINT8_COUNT];
+    for (int i = base; i < localCount; i++) {
+        if (current->locals[i].depth != -1) return false;
+        hidden[i - base] = current->locals[i];
+    }
+
+    uint32_t function = makeConstant(OBJ_VAL(callee->function));
+    if (function > UINT8_MAX) return false;
+
+    // The body comes before the call in the source, so if the call's line fits in a tagged line, so do all of the body's
+    ObjFunction *caller = current->function;
+    if (caller->inlineSiteCount == INLINE_SITES_MAX || parser.previous.line >= INLINE_LINE_SPAN) return false;
+    if (caller->inlineSiteCount == caller->inlineSiteCapacity) {
+        int oldCapacity = caller->inlineSiteCapacity;
+        caller->inlineSiteCapacity = GROW_CAPACITY(oldCapacity);
+        caller->inlineSites = GROW_ARRAY(InlineSite, caller->inlineSites, oldCapacity, caller->inlineSiteCapacity);
+    }
+    caller->inlineSites[caller->inlineSiteCount].name = callee->function->name;
+    caller->inlineSites[caller->inlineSiteCount].line = parser.previous.line;
+
+    emitBytes(OP_CHECK_CALLEE, (uint8_t)function);
+    emitBytes(op == OP_SUPER_INVOKE ? 0 : argCount, 0xff);
+    emitByte(0xff);
+    int callJump = currentChunk()->count - 2;
+    if (op == OP_SUPER_INVOKE) emitByte(OP_POP);
+
+    // Every slot below base gets a local, so the body's locals land on their own slots
+    current->localCount = base;
+    for (int i = localCount; i < base; i++) {
+        current->locals[i].name = syntheticToken(" temporary");
+        current->locals[i].depth = current->scopeDepth;
+        current->locals[i].isCaptured = false;
+        current->locals[i].isPerm = false;
+    }
+
+    Inline inlining;
+    inlining.base = base;
+    inlining.site = caller->inlineSiteCount++;
+    inlining.exitJumps = NULL;
+    inlining.exitCount = 0;
+    inlining.exitCapacity = 0;
+
+    Token previous = parser.previous;
+    Token next = parser.current;
+    Scanner source = saveScanner();
+    Loop *loop = current->loop;
+    current->loop = NULL;
+    current->inlining = &inlining;
+    beginScope();
+
+    addLocal(syntheticToken(op == OP_CALL ? "" : "this"), false);
+    markInitialized();
+    parser.current = callee->parameters;
+    restoreScanner(callee->source);
+    consume(TOKEN_LEFT_PAREN, "Expect '(' after function.");
+    if (!check(TOKEN_RIGHT_PAREN)) {
+        do {
+            consume(TOKEN_IDENTIFIER, "Expect parameter name");
+            addLocal(parser.previous, false);
+            markInitialized();
+        } while (match(TOKEN_COMMA));
+    }
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
+    consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    block();
+
+    // Falling off the end of the body returns nil
+    emitByte(OP_NIL);
+    emitInlineExit();
+
+    current->scopeDepth--;
+    current->inlining = NULL;
+    current->loop = loop;
+    restoreScanner(source);
+    parser.previous = previous;
+    parser.current = next;
+    for (int i = base; i < localCount; i++) {
+        current->locals[i] = hidden[i - base];
+    }
+    current->localCount = localCount;
+
+    patchJump(callJump);
+    emitCallInstruction(op, name, argCount);
+    for (int i = 0; i < inlining.exitCount; i++) {
+        patchJump(inlining.exitJumps[i]);
+    }
+    FREE_ARRAY(int, inlining.exitJumps, inlining.exitCapacity);
+
+    markHeight(base + 1);
+    return true;
+}
+
 static void and_(bool canAssign) {
     int endJump = emitJump(OP_JUMP_IF_FALSE);
     emitByte(OP_POP);
@@ -600,26 +989,51 @@ static void binary(bool canAssign) {
         case TOKEN_MINUS:           emitByte(OP_SUBTRACT); break;
         case TOKEN_STAR:            emitByte(OP_MULTIPLY); break;
         case TOKEN_SLASH:           emitByte(OP_DIVIDE); break;
+        case TOKEN_PERCENT:         emitByte(OP_MODULO); break;
+        case TOKEN_AMPERSAND:       emitByte(OP_BIT_AND); break;
+        case TOKEN_PIPE:            emitByte(OP_BIT_OR); break;
+        case TOKEN_CARET:           emitByte(OP_BIT_XOR); break;
+        case TOKEN_LESS_LESS:       emitByte(OP_SHIFT_LEFT); break;
+        case TOKEN_GREATER_GREATER: emitByte(OP_SHIFT_RIGHT); break;
         default: return; // Unreachable
     }
 }
 
 static void call(bool canAssign) {
+    // Straight after reading a global, the callee may be a function we know
+    Inlinable callee;
+    Token none = syntheticToken("");
+    bool known = current->globalEnd == currentChunk()->count && findInlinable(&none, &current->globalName, &callee);
+
     uint8_t argCount = argumentList();
-    emitBytes(OP_CALL, argCount);
+    if (!known || !inlineCall(&callee, OP_CALL, 0, argCount)) {
+        emitCallInstruction(OP_CALL, 0, argCount);
+    }
+}
+
+// this.name() runs a method of the class being compiled, or of its superclass, unless a subclass overrides it
+static bool findMethod(Token *name, Inlinable *method) {
+    if (currentClass == NULL) return false;
+    if (findInlinable(&currentClass->name, name, method)) return true;
+    return currentClass->hasSuperclass && findInlinable(&currentClass->superclass, name, method);
 }
 
 static void dot(bool canAssign) {
+    bool onThis = current->thisEnd == currentChunk()->count;
     consume(TOKEN_IDENTIFIER, "Expect property name after '.'");
+    Token property = parser.previous;
     uint8_t name = identifierConstant(&parser.previous);
 
     if (canAssign && match(TOKEN_EQUAL)) {
         expression();
         emitBytes(OP_SET_PROPERTY, name);
     } else if (match(TOKEN_LEFT_PAREN)) {
+        Inlinable method;
+        bool known = onThis && findMethod(&property, &method);
         uint8_t argCount = argumentList();
-        emitBytes(OP_INVOKE, name);
-        emitByte(argCount);
+        if (!known || !inlineCall(&method, OP_INVOKE, name, argCount)) {
+            emitCallInstruction(OP_INVOKE, name, argCount);
+        }
     } else {
         emitBytes(OP_GET_PROPERTY, name);
     }
@@ -663,7 +1077,7 @@ static void grouping(bool canAssign) {
 
 static void number(bool canAssign) {
     double value = strtod(parser.previous.start, NULL);
-    emitConstant(NUMBER_VAL(value));
+    emitConstant(INT_OR_NUMBER_VAL(value));
 }
 
 static void or_(bool canAssign) {
@@ -708,7 +1122,7 @@ static void namedVariable(Token name, bool canAssign) {
     if (arg != -1) {
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
-    } else if ((arg = resolveUpvalue(current, &name)) != -1) {
+    } else if (current->inlining == NULL && (arg = resolveUpvalue(current, &name)) != -1) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
     } else {
@@ -731,6 +1145,7 @@ static void namedVariable(Token name, bool canAssign) {
             emitBytes(setOp, (uint8_t)arg);
         }
     } else {
+        int start = currentChunk()->count;
         if (arg > UINT8_MAX && getOp == OP_GET_GLOBAL) {
             emitByte(OP_GET_GLOBAL_LONG);
             emitBytes((arg >> 24) & 0xff, (arg >> 16) & 0xff);
@@ -738,6 +1153,11 @@ static void namedVariable(Token name, bool canAssign) {
         } else {
             emitBytes(getOp, (uint8_t)arg);
         }
+        if (getOp == OP_GET_GLOBAL) {
+            current->globalStart = start;
+            current->globalEnd = currentChunk()->count;
+            current->globalName = name;
+        }
     }
 }
 
@@ -745,13 +1165,6 @@ static void variable(bool canAssign) {
     namedVariable(parser.previous, canAssign);
 }
 
-static Token syntheticToken(const char *text) {
-    Token token;
-    token.start = text;
-    token.length = (int)strlen(text);
-    return token;
-}
-
 static void super_(bool canAssign) {
     if (currentClass == NULL) {
         error("Can't use 'super' outside of a class.");
@@ -761,14 +1174,18 @@ static void super_(bool canAssign) {
 
     consume(TOKEN_DOT, "Expect '.' after 'super'.");
     consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
+    Token method = parser.previous;
     uint8_t name = identifierConstant(&parser.previous);
 
     namedVariable(syntheticToken("this"), false);
     if (match(TOKEN_LEFT_PAREN)) {
+        Inlinable callee;
+        bool known = currentClass != NULL && currentClass->hasSuperclass && findInlinable(&currentClass->superclass, &method, &callee);
         uint8_t argCount = argumentList();
         namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_SUPER_INVOKE, name);
-        emitByte(argCount);
+        if (!known || !inlineCall(&callee, OP_SUPER_INVOKE, name, argCount)) {
+            emitCallInstruction(OP_SUPER_INVOKE, name, argCount);
+        }
     } else {
         namedVariable(syntheticToken("super"), false);
         emitBytes(OP_GET_SUPER, name);
@@ -783,6 +1200,7 @@ static void this_(bool canAssign) {
     }
 
     variable(false);
+    current->thisEnd = currentChunk()->count;
 }
 
 static void at_(bool canAssign) {
@@ -879,14 +1297,20 @@ ParseRule rules[] = {
     [TOKEN_COLON]           = {NULL,     NULL,          PREC_NONE},
     [TOKEN_SLASH]           = {NULL,     binary,        PREC_FACTOR},
     [TOKEN_STAR]            = {NULL,     binary,        PREC_FACTOR},
+    [TOKEN_PERCENT]         = {NULL,     binary,        PREC_FACTOR},
+    [TOKEN_AMPERSAND]       = {NULL,     binary,        PREC_BIT_AND},
+    [TOKEN_PIPE]            = {NULL,     binary,        PREC_BIT_OR},
+    [TOKEN_CARET]           = {NULL,     binary,        PREC_BIT_XOR},
     [TOKEN_BANG]            = {unary,    NULL,          PREC_NONE},
     [TOKEN_BANG_EQUAL]      = {NULL,     binary,        PREC_EQUALITY},
     [TOKEN_EQUAL]           = {NULL,     NULL,          PREC_NONE},
     [TOKEN_EQUAL_EQUAL]     = {NULL,     binary,        PREC_EQUALITY},
     [TOKEN_GREATER]         = {NULL,     binary,        PREC_COMPARISON},
     [TOKEN_GREATER_EQUAL]   = {NULL,     binary,        PREC_COMPARISON},
+    [TOKEN_GREATER_GREATER] = {NULL,     binary,        PREC_SHIFT},
     [TOKEN_LESS]            = {NULL,     binary,        PREC_COMPARISON},
     [TOKEN_LESS_EQUAL]      = {NULL,     binary,        PREC_COMPARISON},
+    [TOKEN_LESS_LESS]       = {NULL,     binary,        PREC_SHIFT},
     [TOKEN_IDENTIFIER]      = {variable, NULL,          PREC_NONE},
     [TOKEN_STRING]          = {string,   NULL,          PREC_NONE},
     [TOKEN_NUMBER]          = {number,   NULL,          PREC_NONE},
@@ -897,6 +1321,7 @@ ParseRule rules[] = {
     [TOKEN_FOR]             = {NULL,     NULL,          PREC_NONE},
     [TOKEN_FUN]             = {NULL,     NULL,          PREC_NONE},
     [TOKEN_IF]              = {NULL,     NULL,          PREC_NONE},
+    [TOKEN_IN]              = {NULL,     NULL,          PREC_NONE},
     [TOKEN_NIL]             = {literal,  NULL,          PREC_NONE},
     [TOKEN_OR]              = {NULL,     or_,           PREC_OR},
     [TOKEN_PRINT]           = {NULL,     NULL,          PREC_NONE},
@@ -994,6 +1419,9 @@ static void function(FunctionType type) {
     initCompiler(&compiler, type);
     beginScope();
 
+    Token parameters = parser.current;
+    Scanner source = saveScanner();
+
     consume(TOKEN_LEFT_PAREN, "Expect ')' after function.");
     if (!check(TOKEN_RIGHT_PAREN)) {
         do {
@@ -1007,6 +1435,8 @@ static void function(FunctionType type) {
     }
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after parameters.");
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
+    // The body starts out with the callee and its arguments on the stack
+    markHeight(current->localCount);
     block();
 
     ObjFunction *function = endCompiler();
@@ -1016,10 +1446,16 @@ static void function(FunctionType type) {
         emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
         emitByte(compiler.upvalues[i].index);
     }
+
+    // The declaration decides whether it can be inlined and under which name
+    lastFunction.function = type != TYPE_INITIALIZER && !parser.hadError && isInlinable(function) ? function : NULL;
+    lastFunction.parameters = parameters;
+    lastFunction.source = source;
 }
 
 static void method() {
     consume(TOKEN_IDENTIFIER, "Expect method name.");
+    Token name = parser.previous;
     uint8_t constant = identifierConstant(&parser.previous);
 
     FunctionType type = TYPE_METHOD;
@@ -1029,6 +1465,7 @@ static void method() {
 
     function(type);
     emitBytes(OP_METHOD, constant);
+    if (lastFunction.function != NULL) addInlinable(currentClass->name, name, &lastFunction);
 }
 
 static void classDeclaration() {
@@ -1041,6 +1478,7 @@ static void classDeclaration() {
     defineVariable(nameConstant, false);
 
     ClassCompiler classCompiler;
+    classCompiler.name = className;
     classCompiler.hasSuperclass = false;
     classCompiler.enclosing = currentClass;
     currentClass = &classCompiler;
@@ -1048,6 +1486,7 @@ static void classDeclaration() {
     if (match(TOKEN_LESS)) {
         consume(TOKEN_IDENTIFIER, "Expect superclass name.");
         variable(false);
+        classCompiler.superclass = parser.previous;
 
         if (identifiersEqual(&className, &parser.previous)) {
             error("A class can't inherit from itself");
@@ -1079,9 +1518,13 @@ static void classDeclaration() {
 
 static void funDeclaration() {
     uint8_t global = parseVariable("Expect function name.", false);
+    Token name = parser.previous;
     markInitialized();
     function(TYPE_FUNCTION);
     defineVariable(global, false);
+
+    Token none = syntheticToken("");
+    if (current->scopeDepth == 0 && lastFunction.function != NULL) addInlinable(none, name, &lastFunction);
 }
 
 static void varDeclaration() {
@@ -1098,13 +1541,23 @@ static void varDeclaration() {
 
 static void permDeclaration() {
     uint8_t global = parseVariable("Expect variable name.", true);
+    Token name = parser.previous;
 
+    int start = currentChunk()->count;
     if (match(TOKEN_EQUAL)) {
         expression();
     } else {
         error("Permanent variable must be initialized.");
     }
     consume(TOKEN_SEMICOLON, "Expect ';' after variable declaration.");
+
+    // perm name = someFunction; makes name another way to call a function we can inline
+    Token none = syntheticToken("");
+    Inlinable function;
+    if (current->scopeDepth == 0 && current->globalStart == start && current->globalEnd == currentChunk()->count
+        && findInlinable(&none, &current->globalName, &function)) {
+        addInlinable(none, name, &function);
+    }
     defineVariable(global, true);
 }
 
@@ -1114,9 +1567,42 @@ static void expressionStatement() {
     emitByte(OP_POP);
 }
 
+static void beginLoop(Loop *loop, int start) {
+    loop->start = start;
+    loop->scopeDepth = current->scopeDepth;
+    loop->enclosing = current->loop;
+    loop->breakJumps = NULL;
+    loop->breakCount = 0;
+    loop->breakCapacity = 0;
+    loop->continueJumps = NULL;
+    loop->continueCount = 0;
+    loop->continueCapacity = 0;
+    current->loop = loop;
+}
+
+static void addLoopJump(int **jumps, int *count, int *capacity, int jump) {
+    if (*capacity < *count + 1) {
+        int oldCapacity = *capacity;
+        *capacity = GROW_CAPACITY(oldCapacity);
+        *jumps = GROW_ARRAY(int, *jumps, oldCapacity, *capacity);
+    }
+    (*jumps)[(*count)++] = jump;
+}
+
+// Points every pending break at the current end of the chunk and leaves the loop
+static void endLoop(Loop *loop) {
+    for (int i = 0; i < loop->breakCount; i++) {
+        patchJump(loop->breakJumps[i]);
+    }
+    FREE_ARRAY(int, loop->breakJumps, loop->breakCapacity);
+    FREE_ARRAY(int, loop->continueJumps, loop->continueCapacity);
+    current->loop = loop->enclosing;
+}
+
 static void breakStatement() {
     if (current->loop == NULL) {
         error("Can't use 'break' outside of a loop.");
+        return;
     }
     consume(TOKEN_SEMICOLON, "Expect ';' after 'break'.");
 
@@ -1124,66 +1610,252 @@ static void breakStatement() {
 
     int jump = emitJump(OP_JUMP);
     Loop *loop = current->loop;
-    if (loop->breakCapacity < loop->breakCount + 1) {
-        int oldCapacity = loop->breakCapacity;
-        loop->breakCapacity = GROW_CAPACITY(oldCapacity);
-        loop->breakJumps = GROW_ARRAY(int, loop->breakJumps, oldCapacity, loop->breakCapacity);
-    }
-    loop->breakJumps[loop->breakCount++] = jump;
+    addLoopJump(&loop->breakJumps, &loop->breakCount, &loop->breakCapacity, jump);
 }
 
 static void continueStatement() {
     if (current->loop == NULL) {
         error("Can't use 'continue' outside of a loop.");
+        return;
     }
     consume(TOKEN_SEMICOLON, "Expect ';' after 'continue'.");
 
     discardLocals();
-    emitLoop(current->loop->start);
+
+    Loop *loop = current->loop;
+    if (loop->start == -1) {
+        int jump = emitJump(OP_JUMP);
+        addLoopJump(&loop->continueJumps, &loop->continueCount, &loop->continueCapacity, jump);
+    } else {
+        emitLoop(loop->start);
+    }
+}
+
+/*
+ * Most for loops count: for (var i = 0; i < n; i = i + 1). Compiled the ordinary way, every trip around such a loop runs
+ * a jump to the increment, the increment (four instructions), a jump back to the condition, the condition (three or four instructions),
+ * a conditional jump and a pop. OP_FOR_STEP does all of that in one instruction:
+ * it adds the step to the counter, compares it against the bound and jumps back to the top of the body if the loop should go on.
+ *
+ * We're a single pass compiler, so we can't look ahead at the clauses to decide how to compile them.
+ * Instead we compile them as usual and then look at the bytes we just emitted. If the condition came out as
+ *
+ *     OP_GET_LOCAL i, (OP_GET_LOCAL n | OP_CONSTANT number), OP_LESS (or one of the other comparisons)
+ *
+ * and the increment as
+ *
+ *     OP_GET_LOCAL i, OP_CONSTANT number, (OP_ADD | OP_SUBTRACT), OP_SET_LOCAL i
+ *
+ * the loop is a counted loop and forStatement() swaps the increment for an OP_FOR_STEP after the body.
+ * The condition stays in front of the body, where it runs exactly once to decide whether to enter the loop at all.
+ *
+ * The bound is a local slot or a constant, never an arbitrary expression, so reading it again on every step is as cheap as keeping a copy of it,
+ * and the loop behaves exactly as before even if the body assigns to the bound. Anything else (a global bound, i < len(xs), i = i * 2)
+ * compiles the ordinary way.
+ */
+
+typedef struct {
+    uint8_t slot;
+    uint8_t flags;
+    uint8_t bound;
+    uint8_t step;
+} ForStep;
+
+static bool matchForStep(int conditionStart, int conditionEnd, int incrementStart, int incrementEnd, ForStep *step) {
+    Chunk *chunk = currentChunk();
+    uint8_t *code = chunk->code;
+
+    int conditionLength = conditionEnd - conditionStart;
+    if (conditionLength != 5 && conditionLength != 6) return false;
+
+    uint8_t *condition = code + conditionStart;
+    if (condition[0] != OP_GET_LOCAL) return false;
+
+    step->slot = condition[1];
+    step->bound = condition[3];
+    if (condition[2] == OP_CONSTANT) {
+        if (!IS_NUMBER(chunk->constants.values[step->bound])) return false;
+        step->flags = FOR_STEP_CONSTANT_BOUND;
+    } else if (condition[2] == OP_GET_LOCAL) {
+        step->flags = 0;
+    } else {
+        return false;
+    }
+
+    if (conditionLength == 5 && condition[4] == OP_LESS) {
+        step->flags |= FOR_STEP_LESS;
+    } else if (conditionLength == 5 && condition[4] == OP_GREATER) {
+        step->flags |= FOR_STEP_GREATER;
+    } else if (conditionLength == 6 && condition[4] == OP_GREATER && condition[5] == OP_NOT) {
+        step->flags |= FOR_STEP_LESS_EQUAL;
+    } else if (conditionLength == 6 && condition[4] == OP_LESS && condition[5] == OP_NOT) {
+        step->flags |= FOR_STEP_GREATER_EQUAL;
+    } else {
+        return false;
+    }
+
+    if (incrementEnd - incrementStart != 7) return false;
+
+    uint8_t *increment = code + incrementStart;
+    if (increment[0] != OP_GET_LOCAL || increment[1] != step->slot) return false;
+    if (increment[2] != OP_CONSTANT || !IS_NUMBER(chunk->constants.values[increment[3]])) return false;
+    if (increment[4] == OP_SUBTRACT) {
+        step->flags |= FOR_STEP_SUBTRACT;
+    } else if (increment[4] != OP_ADD) {
+        return false;
+    }
+    if (increment[5] != OP_SET_LOCAL || increment[6] != step->slot) return false;
+
+    step->step = increment[3];
+    return true;
+}
+
+static void emitForStep(ForStep *step, int bodyStart) {
+    emitBytes(OP_FOR_STEP, step->slot);
+    emitBytes(step->flags, step->bound);
+    emitByte(step->step);
+
+    int offset = currentChunk()->count - bodyStart + 2;
+    if (offset > UINT16_MAX) error("Loop body too large.");
+
+    emitByte((offset >> 8) & 0xff);
+    emitByte(offset & 0xff);
+}
+
+/*
+ * for (x in sequence) walks a list, float array, dictionary (its keys), string (one character at a time) or range.
+ * The "var" in front of the name is optional, either way x is a new local that only lives inside the loop.
+ *
+ * The sequence and a cursor into it live in two hidden locals. Their names start with a space, so no Fer code can refer to them.
+ * Each trip around the loop is a single OP_ITER_NEXT. It looks at the cursor, and either pushes the next element
+ * (which becomes x) and moves the cursor along, or jumps out of the loop when there's nothing left:
+ *
+ *            <sequence>
+ *            OP_ITER_INIT             checks the sequence can be iterated and pushes the cursor
+ * start:     OP_ITER_NEXT slot, exit
+ *            <body>
+ *            pop x
+ *            OP_LOOP start
+ * exit:      pop the cursor and sequence
+ *
+ * x is declared in a scope of its own inside the loop, so every iteration gets a fresh variable.
+ * A closure created in the body captures that iteration's x, not one shared by all of them.
+ * That also means break and continue already know to discard it: it is deeper than the loop's scope.
+ */
+
+static void forInStatement() {
+    Token name = parser.previous;
+    consume(TOKEN_IN, "Expect 'in' after loop variable.");
+    expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after for-in sequence.");
+
+    emitByte(OP_ITER_INIT);
+    addLocal(syntheticToken(" sequence"), false);
+    markInitialized();
+    addLocal(syntheticToken(" cursor"), false);
+    markInitialized();
+    uint8_t sequenceSlot = (uint8_t)(current->localCount - 2);
+
+    int loopStart = currentChunk()->count;
+    emitBytes(OP_ITER_NEXT, sequenceSlot);
+    emitByte(0xff);
+    emitByte(0xff);
+    int exitJump = currentChunk()->count - 2;
+
+    Loop loop;
+    beginLoop(&loop, loopStart);
+
+    beginScope();
+    addLocal(name, false);
+    markInitialized();
+    statement();
+    endScope();
+
+    emitLoop(loopStart);
+    patchJump(exitJump);
+
+    endLoop(&loop);
 }
 
 static void forStatement() {
     beginScope();
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
-    if (match(TOKEN_SEMICOLON)) {
-        // No initializer
-    } else if (match(TOKEN_VAR)) {
+
+    bool hasVar = match(TOKEN_VAR);
+    if (check(TOKEN_IDENTIFIER) && peekToken().type == TOKEN_IN) {
+        advance();
+        forInStatement();
+        endScope();
+        return;
+    }
+
+    if (hasVar) {
         varDeclaration();
+    } else if (match(TOKEN_SEMICOLON)) {
+        // No initializer
     } else {
         expressionStatement();
     }
 
     int loopStart = currentChunk()->count;
     int exitJump = -1;
+    int conditionEnd = -1;
     if (!match(TOKEN_SEMICOLON)) {
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+        conditionEnd = currentChunk()->count;
 
         // Jump out of the loop if the condition is false
         exitJump = emitJump(OP_JUMP_IF_FALSE);
         emitByte(OP_POP); // Cleans the stack
     }
 
+    ForStep step;
+    bool fused = false;
     if (!match(TOKEN_RIGHT_PAREN)) {
         int bodyJump = emitJump(OP_JUMP);
         int incrementStart = currentChunk()->count;
         expression();
+        int incrementEnd = currentChunk()->count;
         emitByte(OP_POP);
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clauses");
 
-        emitLoop(loopStart);
-        loopStart = incrementStart;
-        patchJump(bodyJump);
+        if (conditionEnd != -1 && matchForStep(loopStart, conditionEnd, incrementStart, incrementEnd, &step)) {
+            // Throw away the jump over the increment and the increment itself, OP_FOR_STEP after the body replaces them
+            currentChunk()->count = bodyJump - 1;
+            fused = true;
+        } else {
+            emitLoop(loopStart);
+            loopStart = incrementStart;
+            patchJump(bodyJump);
+        }
+    }
+
+    if (fused) {
+        int bodyStart = currentChunk()->count;
+
+        Loop loop;
+        beginLoop(&loop, -1);
+        statement();
+
+        for (int i = 0; i < loop.continueCount; i++) {
+            patchJump(loop.continueJumps[i]);
+        }
+        emitForStep(&step, bodyStart);
+
+        // Falling out of OP_FOR_STEP leaves nothing on the stack, unlike the first check of the condition
+        int endJump = emitJump(OP_JUMP);
+        patchJump(exitJump);
+        emitByte(OP_POP);
+        patchJump(endJump);
+
+        endLoop(&loop);
+        endScope();
+        return;
     }
 
     Loop loop;
-    loop.start = loopStart;
-    loop.scopeDepth = current->scopeDepth;
-    loop.enclosing = current->loop;
-    loop.breakJumps = NULL;
-    loop.breakCount = 0;
-    loop.breakCapacity = 0;
-    current->loop = &loop;
+    beginLoop(&loop, loopStart);
 
     statement();
     emitLoop(loopStart);
@@ -1193,11 +1865,7 @@ static void forStatement() {
         emitByte(OP_POP);
     }
 
-    for (int i = 0; i < loop.breakCount; i++) {
-        patchJump(loop.breakJumps[i]);
-    }
-    FREE_ARRAY(int, loop.breakJumps, loop.breakCapacity);
-    current->loop = loop.enclosing;
+    endLoop(&loop);
 
     endScope();
 }
@@ -1226,6 +1894,17 @@ static void printStatement() {
 }
 
 static void returnStatement() {
+    if (current->inlining != NULL) {
+        if (match(TOKEN_SEMICOLON)) {
+            emitByte(OP_NIL);
+        } else {
+            expression();
+            consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+        }
+        emitInlineExit();
+        return;
+    }
+
     if (current->type == TYPE_SCRIPT) {
         error("Can't return from top-level code.");
     }
@@ -1239,6 +1918,9 @@ static void returnStatement() {
 
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
+
+        // return f(x): the call is the last thing the function does, so it can hand its frame over (see OP_TAIL_CALL)
+        if (current->callEnd == currentChunk()->count) currentChunk()->code[current->callEnd - 2] = OP_TAIL_CALL;
         emitByte(OP_RETURN);
     }
 }
@@ -1247,13 +1929,7 @@ static void whileStatement() {
     int loopStart = currentChunk()->count;
 
     Loop loop;
-    loop.start = loopStart;
-    loop.scopeDepth = current->scopeDepth;
-    loop.enclosing = current->loop;
-    loop.breakJumps = NULL;
-    loop.breakCount = 0;
-    loop.breakCapacity = 0;
-    current->loop = &loop;
+    beginLoop(&loop, loopStart);
 
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
     expression();
@@ -1267,12 +1943,7 @@ static void whileStatement() {
     patchJump(exitJump);
     emitByte(OP_POP);
 
-    for (int i = 0; i < loop.breakCount; i++) {
-        patchJump(loop.breakJumps[i]);
-    }
-
-    FREE_ARRAY(int, loop.breakJumps, loop.breakCapacity);
-    current->loop = loop.enclosing;
+    endLoop(&loop);
 }
 
 static void importStatement() {
@@ -1308,6 +1979,7 @@ static void synchronize() {
 }
 
 static void declaration() {
+    markHeight(current->localCount);
     if (match(TOKEN_CLASS)) {
       classDeclaration();
     } else if (match(TOKEN_FUN)) {
@@ -1323,6 +1995,7 @@ static void declaration() {
 }
 
 static void statement() {
+    markHeight(current->localCount);
     if (match(TOKEN_PRINT)) {
         printStatement();
     } else if (match(TOKEN_RETURN)) {
@@ -1370,6 +2043,11 @@ ObjFunction* compile(const char *source) {
         declaration();
     }
     ObjFunction *function = endCompiler();
+
+    FREE_ARRAY(Inlinable, inlinables, inlinableCapacity);
+    inlinables = NULL;
+    inlinableCount = 0;
+    inlinableCapacity = 0;
     return parser.hadError ? NULL : function;
 }
 
@@ -3,6 +3,7 @@
 #include "debug.h"
 #include "object.h"
 #include "chunk.h"
+#include "registers.h"
 #include "value.h"
 
 /*
@@ -85,6 +86,38 @@ static int jumpInstruction(const char *name, int sign, Chunk *chunk, int offset)
     return offset + 3;
 }
 
+static int iterInstruction(const char *name, Chunk *chunk, int offset) {
+    uint8_t slot = chunk->code[offset + 1];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+    jump |= chunk->code[offset + 3];
+    printf("%-16s %4d -> %d\n", name, slot, offset + 4 + jump);
+    return offset + 4;
+}
+
+static int forStepInstruction(const char *name, Chunk *chunk, int offset) {
+    static const char *comparisons[] = {"<", "<=", ">", ">="};
+
+    uint8_t slot = chunk->code[offset + 1];
+    uint8_t flags = chunk->code[offset + 2];
+    uint8_t bound = chunk->code[offset + 3];
+    uint8_t step = chunk->code[offset + 4];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 5] << 8);
+    jump |= chunk->code[offset + 6];
+
+    printf("%-16s %4d %c= '", name, slot, flags & FOR_STEP_SUBTRACT ? '-' : '+');
+    printValue(chunk->constants.values[step]);
+    printf("' %s ", comparisons[flags & FOR_STEP_COMPARISON]);
+    if (flags & FOR_STEP_CONSTANT_BOUND) {
+        printf("'");
+        printValue(chunk->constants.values[bound]);
+        printf("'");
+    } else {
+        printf("slot %d", bound);
+    }
+    printf(" -> %d\n", offset + 7 - jump);
+    return offset + 7;
+}
+
 static int constantInstruction(const char *name, Chunk *chunk, int offset) {
     uint8_t constant = chunk->code[offset + 1];
     printf("%-16s %4d '", name, constant);
@@ -136,6 +169,17 @@ static int invokeInstruction(const char *name, Chunk *chunk, int offset) {
     return offset + 3;
 }
 
+static int checkCalleeInstruction(const char *name, Chunk *chunk, int offset) {
+    uint8_t constant = chunk->code[offset + 1];
+    uint8_t depth = chunk->code[offset + 2];
+    uint16_t jump = (uint16_t)(chunk->code[offset + 3] << 8);
+    jump |= chunk->code[offset + 4];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' under %d -> %d\n", depth, offset + 5 + jump);
+    return offset + 5;
+}
+
 
 /*
  * The core of the "debug" module is this function.
@@ -153,7 +197,7 @@ int disassembleInstruction(Chunk *chunk, int offset) {
     if (offset >0 && chunk->lines[offset] == chunk->lines[offset-1]) {
         printf("   | ");
     } else {
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", SOURCE_LINE(chunk->lines[offset]));
     }
 
     uint8_t instruction = chunk->code[offset];
@@ -218,12 +262,24 @@ int disassembleInstruction(Chunk *chunk, int offset) {
             return simpleInstruction("OP_MULTIPLY", offset);
         case OP_DIVIDE:
             return simpleInstruction("OP_DIVIDE", offset);
+        case OP_MODULO:
+            return simpleInstruction("OP_MODULO", offset);
+        case OP_BIT_AND:
+            return simpleInstruction("OP_BIT_AND", offset);
+        case OP_BIT_OR:
+            return simpleInstruction("OP_BIT_OR", offset);
+        case OP_BIT_XOR:
+            return simpleInstruction("OP_BIT_XOR", offset);
+        case OP_SHIFT_LEFT:
+            return simpleInstruction("OP_SHIFT_LEFT", offset);
+        case OP_SHIFT_RIGHT:
+            return simpleInstruction("OP_SHIFT_RIGHT", offset);
         case OP_NOT:
             return simpleInstruction("OP_NOT", offset);
         case OP_NEGATE:
             return simpleInstruction("OP_NEGATE", offset);
         case OP_IMPORT:
-            return simpleInstruction("OP_IMPORT", offset);
+            return constantInstruction("OP_IMPORT", chunk, offset);
         case OP_PRINT:
             return simpleInstruction("OP_PRINT", offset);
         case OP_JUMP:
@@ -232,12 +288,24 @@ int disassembleInstruction(Chunk *chunk, int offset) {
             return jumpInstruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
         case OP_LOOP:
             return jumpInstruction("OP_LOOP", -1, chunk, offset);
+        case OP_ITER_INIT:
+            return simpleInstruction("OP_ITER_INIT", offset);
+        case OP_ITER_NEXT:
+            return iterInstruction("OP_ITER_NEXT", chunk, offset);
+        case OP_FOR_STEP:
+            return forStepInstruction("OP_FOR_STEP", chunk, offset);
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
+        case OP_TAIL_CALL:
+            return byteInstruction("OP_TAIL_CALL", chunk, offset);
         case OP_INVOKE:
             return invokeInstruction("OP_INVOKE", chunk, offset);
         case OP_SUPER_INVOKE:
             return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
+        case OP_CHECK_CALLEE:
+            return checkCalleeInstruction("OP_CHECK_CALLEE", chunk, offset);
+        case OP_INLINE_RETURN:
+            return iterInstruction("OP_INLINE_RETURN", chunk, offset);
         case OP_CLOSURE: {
             offset++;
             uint8_t constant = chunk->code[offset++];
@@ -255,9 +323,9 @@ int disassembleInstruction(Chunk *chunk, int offset) {
             return offset;
         }
         case OP_LIST:
-            return simpleInstruction("OP_LIST", offset);
+            return byteInstruction("OP_LIST", chunk, offset);
         case OP_DICTIONARY:
-            return simpleInstruction("OP_DICTIONARY", offset);
+            return byteInstruction("OP_DICTIONARY", chunk, offset);
         case OP_CLOSE_UPVALUE:
             return simpleInstruction("OP_CLOSE_UPVALUE", offset);
         case OP_RETURN:
@@ -273,3 +341,212 @@ int disassembleInstruction(Chunk *chunk, int offset) {
             return offset + 1;
     }
 }
+
+/*
+ * ---------------------------------------- REGISTER CODE ----------------------------------------
+ *
+ * The register formats have more operand layouts than the stack ones, so instead of a helper per layout the names live in a table
+ * and the switch only groups the instructions by what their operands look like. The header also prints the code size,
+ * which together with disassembleChunk() gives the size of both formats for the same function.
+ */
+
+static const char *registerNames[] = {
+    [R_MOVE] = "R_MOVE",
+    [R_LOAD_CONSTANT] = "R_LOAD_CONSTANT",
+    [R_LOAD_CONSTANT_LONG] = "R_LOAD_CONSTANT_LONG",
+    [R_LOAD_NIL] = "R_LOAD_NIL",
+    [R_LOAD_TRUE] = "R_LOAD_TRUE",
+    [R_LOAD_FALSE] = "R_LOAD_FALSE",
+    [R_GET_GLOBAL] = "R_GET_GLOBAL",
+    [R_GET_GLOBAL_LONG] = "R_GET_GLOBAL_LONG",
+    [R_DEFINE_GLOBAL] = "R_DEFINE_GLOBAL",
+    [R_DEFINE_GLOBAL_LONG] = "R_DEFINE_GLOBAL_LONG",
+    [R_DEFINE_GLOBAL_PERM] = "R_DEFINE_GLOBAL_PERM",
+    [R_DEFINE_GLOBAL_PERM_LONG] = "R_DEFINE_GLOBAL_PERM_LONG",
+    [R_SET_GLOBAL] = "R_SET_GLOBAL",
+    [R_SET_GLOBAL_LONG] = "R_SET_GLOBAL_LONG",
+    [R_GET_UPVALUE] = "R_GET_UPVALUE",
+    [R_SET_UPVALUE] = "R_SET_UPVALUE",
+    [R_GET_ITEM] = "R_GET_ITEM",
+    [R_SET_ITEM] = "R_SET_ITEM",
+    [R_GET_PROPERTY] = "R_GET_PROPERTY",
+    [R_SET_PROPERTY] = "R_SET_PROPERTY",
+    [R_GET_SUPER] = "R_GET_SUPER",
+    [R_EQUAL] = "R_EQUAL",
+    [R_GREATER] = "R_GREATER",
+    [R_LESS] = "R_LESS",
+    [R_ADD] = "R_ADD",
+    [R_SUBTRACT] = "R_SUBTRACT",
+    [R_MULTIPLY] = "R_MULTIPLY",
+    [R_DIVIDE] = "R_DIVIDE",
+    [R_MODULO] = "R_MODULO",
+    [R_BIT_AND] = "R_BIT_AND",
+    [R_BIT_OR] = "R_BIT_OR",
+    [R_BIT_XOR] = "R_BIT_XOR",
+    [R_SHIFT_LEFT] = "R_SHIFT_LEFT",
+    [R_SHIFT_RIGHT] = "R_SHIFT_RIGHT",
+    [R_EQUAL_CONSTANT] = "R_EQUAL_CONSTANT",
+    [R_GREATER_CONSTANT] = "R_GREATER_CONSTANT",
+    [R_LESS_CONSTANT] = "R_LESS_CONSTANT",
+    [R_ADD_CONSTANT] = "R_ADD_CONSTANT",
+    [R_SUBTRACT_CONSTANT] = "R_SUBTRACT_CONSTANT",
+    [R_MULTIPLY_CONSTANT] = "R_MULTIPLY_CONSTANT",
+    [R_DIVIDE_CONSTANT] = "R_DIVIDE_CONSTANT",
+    [R_MODULO_CONSTANT] = "R_MODULO_CONSTANT",
+    [R_NOT] = "R_NOT",
+    [R_NEGATE] = "R_NEGATE",
+    [R_LIST] = "R_LIST",
+    [R_DICTIONARY] = "R_DICTIONARY",
+    [R_IMPORT] = "R_IMPORT",
+    [R_PRINT] = "R_PRINT",
+    [R_JUMP] = "R_JUMP",
+    [R_JUMP_IF_FALSE] = "R_JUMP_IF_FALSE",
+    [R_LOOP] = "R_LOOP",
+    [R_ITER_INIT] = "R_ITER_INIT",
+    [R_ITER_NEXT] = "R_ITER_NEXT",
+    [R_FOR_STEP] = "R_FOR_STEP",
+    [R_CALL] = "R_CALL",
+    [R_TAIL_CALL] = "R_TAIL_CALL",
+    [R_INVOKE] = "R_INVOKE",
+    [R_SUPER_INVOKE] = "R_SUPER_INVOKE",
+    [R_CHECK_CALLEE] = "R_CHECK_CALLEE",
+    [R_CLOSURE] = "R_CLOSURE",
+    [R_CLOSE_UPVALUE] = "R_CLOSE_UPVALUE",
+    [R_RETURN] = "R_RETURN",
+    [R_CLASS] = "R_CLASS",
+    [R_INHERIT] = "R_INHERIT",
+    [R_METHOD] = "R_METHOD",
+};
+
+void disassembleRegisterChunk(Chunk *chunk, const char *name) {
+    printf("== %s (registers, %d bytes) ==\n", name, chunk->count);
+
+    for (int offset = 0; offset < chunk->count;) {
+        offset = disassembleRegisterInstruction(chunk, offset);
+    }
+}
+
+static void printConstant(Chunk *chunk, uint32_t constant) {
+    printf(" '");
+    printValueDebug(chunk->constants.values[constant]);
+    printf("'");
+}
+
+static uint32_t readLongOperand(uint8_t *code) {
+    return (uint32_t)code[0] << 24 | (uint32_t)code[1] << 16 | (uint32_t)code[2] << 8 | (uint32_t)code[3];
+}
+
+int disassembleRegisterInstruction(Chunk *chunk, int offset) {
+    printf("%04d ", offset);
+    if (offset > 0 && chunk->lines[offset] == chunk->lines[offset - 1]) {
+        printf("   | ");
+    } else {
+        printf("%4d ", SOURCE_LINE(chunk->lines[offset]));
+    }
+
+    uint8_t *code = &chunk->code[offset];
+    if (code[0] > R_METHOD) {
+        printf("Unknown opcode %d\n", code[0]);
+        return offset + 1;
+    }
+
+    int length = registerInstructionLength(chunk, offset);
+    printf("%-20s", registerNames[code[0]]);
+
+    switch (code[0]) {
+        case R_LOAD_CONSTANT:
+        case R_GET_GLOBAL:
+        case R_DEFINE_GLOBAL:
+        case R_DEFINE_GLOBAL_PERM:
+        case R_SET_GLOBAL:
+        case R_GET_SUPER:
+        case R_IMPORT:
+        case R_CLASS:
+        case R_METHOD:
+            printf(" r%d", code[1]);
+            printConstant(chunk, code[2]);
+            break;
+        case R_LOAD_CONSTANT_LONG:
+        case R_GET_GLOBAL_LONG:
+        case R_DEFINE_GLOBAL_LONG:
+        case R_DEFINE_GLOBAL_PERM_LONG:
+        case R_SET_GLOBAL_LONG:
+            printf(" r%d", code[1]);
+            printConstant(chunk, readLongOperand(&code[2]));
+            break;
+        case R_GET_UPVALUE:
+        case R_SET_UPVALUE:
+            printf(" r%d upvalue %d", code[1], code[2]);
+            break;
+        case R_LIST:
+        case R_DICTIONARY:
+        case R_CALL:
+        case R_TAIL_CALL:
+            printf(" r%d %d", code[1], code[2]);
+            break;
+        case R_GET_PROPERTY:
+            printf(" r%d r%d", code[1], code[2]);
+            printConstant(chunk, code[3]);
+            break;
+        case R_CHECK_CALLEE:
+            printf(" r%d", code[1]);
+            printConstant(chunk, code[2]);
+            printf(" -> %d", offset + 5 + (code[3] << 8 | code[4]));
+            break;
+        case R_SET_PROPERTY:
+            printf(" r%d r%d r%d", code[1], code[2], code[3]);
+            printConstant(chunk, code[4]);
+            break;
+        case R_INVOKE:
+        case R_SUPER_INVOKE:
+            printf(" r%d", code[1]);
+            printConstant(chunk, code[2]);
+            printf(" (%d args)", code[3]);
+            break;
+        case R_JUMP:
+            printf(" -> %d", offset + 3 + (code[1] << 8 | code[2]));
+            break;
+        case R_LOOP:
+            printf(" -> %d", offset + 3 - (code[1] << 8 | code[2]));
+            break;
+        case R_JUMP_IF_FALSE:
+            printf(" r%d -> %d", code[1], offset + 4 + (code[2] << 8 | code[3]));
+            break;
+        case R_ITER_NEXT:
+            printf(" r%d r%d -> %d", code[1], code[2], offset + 5 + (code[3] << 8 | code[4]));
+            break;
+        case R_FOR_STEP:
+            printf(" r%d %c=", code[1], code[2] & FOR_STEP_SUBTRACT ? '-' : '+');
+            printConstant(chunk, code[4]);
+            if (code[2] & FOR_STEP_CONSTANT_BOUND) {
+                printConstant(chunk, code[3]);
+            } else {
+                printf(" r%d", code[3]);
+            }
+            printf(" -> %d", offset + 7 - (code[5] << 8 | code[6]));
+            break;
+        case R_CLOSURE: {
+            printf(" r%d", code[1]);
+            printConstant(chunk, code[2]);
+            printf("\n");
+            for (int i = 3; i < length; i += 2) {
+                printf("%04d      |                     %s %d\n", offset + i, code[i] ? "local" : "upvalue", code[i + 1]);
+            }
+            return offset + length;
+        }
+        default:
+            if (code[0] >= R_EQUAL_CONSTANT && code[0] <= R_MODULO_CONSTANT) {
+                printf(" r%d r%d", code[1], code[2]);
+                printConstant(chunk, code[3]);
+                break;
+            }
+            // Everything else is just registers
+            for (int i = 1; i < length; i++) {
+                printf(" r%d", code[i]);
+            }
+            break;
+    }
+
+    printf("\n");
+    return offset + length;
+}
@@ -14,6 +14,10 @@
 void disassembleChunk(Chunk *chunk, const char *name);
 int disassembleInstruction(Chunk *chunk, int offset);
 
+// The same for register code (see registers.h). Registers are printed as r0, r1...
+void disassembleRegisterChunk(Chunk *chunk, const char *name);
+int disassembleRegisterInstruction(Chunk *chunk, int offset);
+
 void printValueDebug(Value value);
 
 #endif //CFER_DEBUG_H
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "dictionary.h"
+#include "memory.h"
+#include "object.h"
+#include "value.h"
+#include "vm.h"
+
+#define INDEX_EMPTY (-1)
+#define INDEX_DUMMY (-2)
+
+#define DICTIONARY_MIN_SIZE 8
+
+/*
+ * Only two thirds of the index slots can ever point at an entry, which keeps the probe sequences short.
+ * The entry array is sized to match, so it fills up right when the index hits that load.
+ */
+
+#define USABLE_SIZE(indexSize) (((indexSize) * 2) / 3)
+
+static int indexWidth(int indexSize) {
+    if (indexSize <= INT8_MAX + 1) return 1;
+    if (indexSize <= INT16_MAX + 1) return 2;
+    return 4;
+}
+
+static inline int getIndex(Dictionary *dictionary, int slot) {
+    if (dictionary->indexSize <= INT8_MAX + 1) return ((int8_t*)dictionary->indices)[slot];
+    if (dictionary->indexSize <= INT16_MAX + 1) return ((int16_t*)dictionary->indices)[slot];
+    return ((int32_t*)dictionary->indices)[slot];
+}
+
+static inline void setIndex(Dictionary *dictionary, int slot, int index) {
+    if (dictionary->indexSize <= INT8_MAX + 1) {
+        ((int8_t*)dictionary->indices)[slot] = (int8_t)index;
+    } else if (dictionary->indexSize <= INT16_MAX + 1) {
+        ((int16_t*)dictionary->indices)[slot] = (int16_t)index;
+    } else {
+        ((int32_t*)dictionary->indices)[slot] = (int32_t)index;
+    }
+}
+
+/*
+ * Number keys are the whole point of not going through str(), so their hash has to be cheap.
+ * Integral values (by far the most common keys, think ids and indices) are hashed as the integer itself.
+ * That also makes 0 and -0, which compare equal, hash the same. Anything else hashes its raw bits.
+ * Either way the bits get xor-ed with the hash seed and run through the murmur3 finalizer, so crafted ids can't all pile up in the same bucket.
+ */
+
+static inline uint32_t mixBits(uint64_t bits) {
+    bits ^= vm.hashSeed;
+    bits ^= bits >> 33;
+    bits *= 0xff51afd7ed558ccdULL;
+    bits ^= bits >> 33;
+    bits *= 0xc4ceb9fe1a85ec53ULL;
+    bits ^= bits >> 33;
+    return (uint32_t)bits;
+}
+
+static uint32_t hashNumber(double number) {
+    if (number >= -9007199254740992.0 && number <= 9007199254740992.0) {
+        int64_t integer = (int64_t)number;
+        if ((double)integer == number) return mixBits((uint64_t)integer);
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    return mixBits(bits);
+}
+
+static uint32_t hashValue(Value key) {
+    if (IS_STRING(key)) return AS_STRING(key)->hash;
+    if (IS_INT(key)) return mixBits((uint64_t)(int64_t)AS_INT(key)); // The same hash hashNumber() gives the equal double
+    if (IS_NUMBER(key)) return hashNumber(AS_NUMBER(key));
+    if (IS_OBJ(key)) return mixBits((uint64_t)(uintptr_t)AS_OBJ(key));
+    if (IS_BOOL(key)) return mixBits(AS_BOOL(key) ? 3 : 2);
+    return mixBits(1); // nil
+}
+
+static inline bool keysEqual(Value a, Value b) {
+#ifdef NAN_BOXING
+    if (a == b) return true;
+    return IS_NUMBER(a) && IS_NUMBER(b) && AS_NUMBER(a) == AS_NUMBER(b);
+#else
+    return valuesEqual(a, b);
+#endif
+}
+
+void initDictionary(Dictionary *dictionary) {
+    dictionary->count = 0;
+    dictionary->used = 0;
+    dictionary->capacity = 0;
+    dictionary->entries = NULL;
+    dictionary->indexSize = 0;
+    dictionary->indices = NULL;
+}
+
+void freeDictionary(Dictionary *dictionary) {
+    FREE_ARRAY(DictionaryEntry, dictionary->entries, dictionary->capacity);
+    FREE_ARRAY(uint8_t, dictionary->indices, dictionary->indexSize * indexWidth(dictionary->indexSize));
+    initDictionary(dictionary);
+}
+
+/*
+ * Returns the index slot that holds the key, or -1 if it isn't there.
+ * Linear probing skips over dummies (slots whose entry was deleted) and stops at the first empty slot.
+ */
+
+static int findSlot(Dictionary *dictionary, Value key, uint32_t hash) {
+    int mask = dictionary->indexSize - 1;
+    int slot = (int)(hash & (uint32_t)mask);
+    for (;;) {
+        int index = getIndex(dictionary, slot);
+        if (index == INDEX_EMPTY) return -1;
+        if (index >= 0 && keysEqual(dictionary->entries[index].key, key)) return slot;
+        slot = (slot + 1) & mask;
+    }
+}
+
+static int findFreeSlot(Dictionary *dictionary, uint32_t hash) {
+    int mask = dictionary->indexSize - 1;
+    int slot = (int)(hash & (uint32_t)mask);
+    while (getIndex(dictionary, slot) >= 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/*
+ * Growing, shrinking and compacting are all the same operation: pick an index size that gives the live entries room to double,
+ * copy them (in order, leaving the holes behind) into a fresh entry array and rebuild the index from scratch.
+ */
+
+static void rebuild(Dictionary *dictionary) {
+    int indexSize = DICTIONARY_MIN_SIZE;
+    while (USABLE_SIZE(indexSize) < dictionary->count * 2 + 1) {
+        indexSize *= 2;
+    }
+
+    int capacity = USABLE_SIZE(indexSize);
+    int width = indexWidth(indexSize);
+    DictionaryEntry *entries = ALLOCATE(DictionaryEntry, capacity);
+    void *indices = ALLOCATE(uint8_t, indexSize * width);
+
+    int used = 0;
+    for (int i = 0; i < dictionary->used; i++) {
+        if (IS_EMPTY(dictionary->entries[i].key)) continue;
+        entries[used++] = dictionary->entries[i];
+    }
+
+    FREE_ARRAY(DictionaryEntry, dictionary->entries, dictionary->capacity);
+    FREE_ARRAY(uint8_t, dictionary->indices, dictionary->indexSize * indexWidth(dictionary->indexSize));
+    dictionary->entries = entries;
+    dictionary->capacity = capacity;
+    dictionary->indices = indices;
+    dictionary->indexSize = indexSize;
+    dictionary->used = used;
+    dictionary->count = used;
+
+    // 0xff in every byte reads back as INDEX_EMPTY at any width
+    memset(indices, 0xff, indexSize * width);
+    for (int i = 0; i < used; i++) {
+        setIndex(dictionary, findFreeSlot(dictionary, hashValue(entries[i].key)), i);
+    }
+}
+
+bool dictionaryGet(Dictionary *dictionary, Value key, Value *value) {
+    if (dictionary->count == 0) return false;
+
+    int slot = findSlot(dictionary, key, hashValue(key));
+    if (slot == -1) return false;
+
+    *value = dictionary->entries[getIndex(dictionary, slot)].value;
+    return true;
+}
+
+bool dictionarySet(Dictionary *dictionary, Value key, Value value) {
+    uint32_t hash = hashValue(key);
+    if (dictionary->count > 0) {
+        int slot = findSlot(dictionary, key, hash);
+        if (slot != -1) {
+            dictionary->entries[getIndex(dictionary, slot)].value = value;
+            return false;
+        }
+    }
+
+    if (dictionary->used == dictionary->capacity) {
+        rebuild(dictionary);
+    }
+
+    int index = dictionary->used++;
+    dictionary->entries[index].key = key;
+    dictionary->entries[index].value = value;
+    setIndex(dictionary, findFreeSlot(dictionary, hash), index);
+    dictionary->count++;
+    return true;
+}
+
+bool dictionaryDelete(Dictionary *dictionary, Value key) {
+    if (dictionary->count == 0) return false;
+
+    int slot = findSlot(dictionary, key, hashValue(key));
+    if (slot == -1) return false;
+
+    DictionaryEntry *entry = &dictionary->entries[getIndex(dictionary, slot)];
+    entry->key = EMPTY_VAL;
+    entry->value = NIL_VAL;
+    setIndex(dictionary, slot, INDEX_DUMMY);
+    dictionary->count--;
+
+    // Give the memory back once most of a big dictionary has been deleted
+    if (dictionary->indexSize > DICTIONARY_MIN_SIZE && dictionary->count < dictionary->capacity / 8) {
+        rebuild(dictionary);
+    }
+    return true;
+}
+
+void markDictionary(Dictionary *dictionary) {
+    for (int i = 0; i < dictionary->used; i++) {
+        DictionaryEntry *entry = &dictionary->entries[i];
+        markValue(entry->key);
+        markValue(entry->value);
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef CFER_DICTIONARY_H
+#define CFER_DICTIONARY_H
+
+#include "common.h"
+#include "value.h"
+
+/*
+ * Dictionaries don't use Table. A Table keeps its entries scattered across a sparse array in hash order,
+ * which is what we want for globals or fields, but a dictionary gets iterated and printed all the time
+ * and walking every empty slot to do that adds up.
+ *
+ * Instead, we use the same "compact" layout CPython uses for its dicts. Entries go into a dense array in insertion order.
+ * The hash table itself is a separate, sparse array of indices into that entry array.
+ * Those indices are as narrow as the table allows: one byte each while it has at most 128 slots, two bytes up to 32768 slots, and four bytes after that.
+ *
+ * Keys can be any Value, not just strings. Strings hash to their (seeded) string hash, numbers to a mix of their bits
+ * and everything else to its identity, which agrees with how valuesEqual() compares them.
+ *
+ * Deleting an entry leaves a hole (an EMPTY_VAL key) in the entry array, that gets squeezed out the next time the dictionary is rebuilt.
+ * count is the number of live entries, used is how far into the entry array we've written.
+ */
+
+typedef struct {
+    Value key;
+    Value value;
+} DictionaryEntry;
+
+typedef struct {
+    int count;
+    int used;
+    int capacity;
+    DictionaryEntry *entries;
+    int indexSize;
+    void *indices;
+} Dictionary;
+
+void initDictionary(Dictionary *dictionary);
+void freeDictionary(Dictionary *dictionary);
+bool dictionaryGet(Dictionary *dictionary, Value key, Value *value);
+bool dictionarySet(Dictionary *dictionary, Value key, Value value);
+bool dictionaryDelete(Dictionary *dictionary, Value key);
+void markDictionary(Dictionary *dictionary);
+
+#endif //CFER_DICTIONARY_H
@@ -0,0 +1,210 @@
+#include <stdio.h>
+
+#include "dictionary.h"
+#include "fastpath.h"
+
+bool fastGetGlobal(ObjString *name, Value *result) {
+    return tableGet(&vm.globals, name, result);
+}
+
+bool fastSetGlobal(ObjString *name, Value value) {
+    Value dummy;
+    if (tableGet(&vm.globalPerms, name, &dummy) || !tableGet(&vm.globals, name, &dummy)) return false;
+    tableSet(&vm.globals, name, value);
+    return true;
+}
+
+void fastDefineGlobal(ObjString *name, Value value, bool permanent) {
+    tableSet(&vm.globals, name, value);
+    if (permanent) tableSet(&vm.globalPerms, name, BOOL_VAL(true));
+}
+
+Value fastEqual(Value a, Value b) {
+    return BOOL_VAL(valuesEqual(a, b));
+}
+
+// Every binary operator but ==, on numbers. A string + string is left to run(), it allocates the result.
+bool fastBinary(Value *top, int op) {
+    Value a = top[-2];
+    Value b = top[-1];
+    int32_t result;
+
+    if (op >= OP_BIT_AND) {
+        int32_t x;
+        int32_t y;
+        if (!toInt32(a, &x) || !toInt32(b, &y)) return false;
+        switch (op) {
+            case OP_BIT_AND: result = x & y; break;
+            case OP_BIT_OR: result = x | y; break;
+            case OP_BIT_XOR: result = x ^ y; break;
+            case OP_SHIFT_LEFT: result = (int32_t)((uint32_t)x << (y & 31)); break;
+            default: result = x >> (y & 31); break;
+        }
+        top[-2] = INT_VAL(result);
+        return true;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+    bool ints = IS_INT(a) && IS_INT(b);
+    switch (op) {
+        case OP_GREATER:
+            top[-2] = ints ? BOOL_VAL(AS_INT(a) > AS_INT(b)) : BOOL_VAL(AS_NUMBER(a) > AS_NUMBER(b));
+            return true;
+        case OP_LESS:
+            top[-2] = ints ? BOOL_VAL(AS_INT(a) < AS_INT(b)) : BOOL_VAL(AS_NUMBER(a) < AS_NUMBER(b));
+            return true;
+        case OP_ADD:
+            top[-2] = ints && addInts(AS_INT(a), AS_INT(b), &result) ? INT_VAL(result) : NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(a));
+            return true;
+        case OP_SUBTRACT:
+            top[-2] = ints && subtractInts(AS_INT(a), AS_INT(b), &result) ? INT_VAL(result) : NUMBER_VAL(AS_NUMBER(a) - AS_NUMBER(b));
+            return true;
+        case OP_MULTIPLY:
+            top[-2] = ints && multiplyInts(AS_INT(a), AS_INT(b), &result) ? INT_VAL(result) : NUMBER_VAL(AS_NUMBER(a) * AS_NUMBER(b));
+            return true;
+        case OP_DIVIDE:
+            top[-2] = ints && divideInts(AS_INT(a), AS_INT(b), &result) ? INT_VAL(result) : NUMBER_VAL(AS_NUMBER(a) / AS_NUMBER(b));
+            return true;
+        case OP_MODULO:
+            top[-2] = ints && moduloInts(AS_INT(a), AS_INT(b), &result)
+                ? INT_VAL(result) : NUMBER_VAL(moduloNumbers(AS_NUMBER(a), AS_NUMBER(b)));
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool fastNegate(Value *top) {
+    Value operand = top[-1];
+    if (!IS_NUMBER(operand)) return false;
+    if (IS_INT(operand) && AS_INT(operand) != 0 && AS_INT(operand) != INT32_MIN) {
+        top[-1] = INT_VAL(-AS_INT(operand));
+    } else {
+        top[-1] = NUMBER_VAL(-AS_NUMBER(operand));
+    }
+    return true;
+}
+
+// Only integer keys, a double that happens to be whole goes through run()
+bool fastGetItem(Value *top) {
+    Value target = top[-2];
+    Value key = top[-1];
+
+    if (IS_DICTIONARY(target)) {
+        if (!dictionaryGet(&AS_DICTIONARY(target)->items, key, &top[-2])) top[-2] = NIL_VAL;
+        return true;
+    }
+
+    if (!IS_INT(key)) return false;
+    int index = AS_INT(key);
+    if (IS_LIST(target)) {
+        ObjList *list = AS_LIST(target);
+        if (index < 0 || index >= list->count) return false;
+        top[-2] = list->values[index];
+        return true;
+    }
+    if (IS_FLOAT_ARRAY(target)) {
+        ObjFloatArray *array = AS_FLOAT_ARRAY(target);
+        if (index < 0 || index >= array->count) return false;
+        top[-2] = NUMBER_VAL(array->values[index]);
+        return true;
+    }
+    return false;
+}
+
+bool fastSetItem(Value *top) {
+    Value target = top[-3];
+    Value key = top[-2];
+    Value item = top[-1];
+
+    if (IS_DICTIONARY(target)) {
+        dictionarySet(&AS_DICTIONARY(target)->items, key, item);
+        top[-3] = item;
+        return true;
+    }
+
+    if (!IS_INT(key)) return false;
+    int index = AS_INT(key);
+    if (IS_LIST(target)) {
+        ObjList *list = AS_LIST(target);
+        if (index < 0 || index >= list->count) return false;
+        list->values[index] = item;
+        top[-3] = item;
+        return true;
+    }
+    if (IS_FLOAT_ARRAY(target) && IS_NUMBER(item)) {
+        ObjFloatArray *array = AS_FLOAT_ARRAY(target);
+        if (index < 0 || index >= array->count) return false;
+        array->values[index] = AS_NUMBER(item);
+        top[-3] = item;
+        return true;
+    }
+    return false;
+}
+
+// Fields only, binding a method allocates and is left to run()
+bool fastGetProperty(Value *top, ObjString *name) {
+    return IS_INSTANCE(top[-1]) && tableGet(&AS_INSTANCE(top[-1])->fields, name, &top[-1]);
+}
+
+bool fastSetProperty(Value *top, ObjString *name) {
+    if (!IS_INSTANCE(top[-2])) return false;
+    tableSet(&AS_INSTANCE(top[-2])->fields, name, top[-1]);
+    top[-2] = top[-1];
+    return true;
+}
+
+void fastPrint(Value value) {
+    printValue(value);
+    printf("\n");
+}
+
+// A dictionary is iterated over a snapshot of its keys (see iterateNext()), which run() takes
+bool fastIterInit(Value *top) {
+    if (!isIterable(top[-1]) || IS_DICTIONARY(top[-1])) return false;
+    top[0] = INT_VAL(0);
+    return true;
+}
+
+bool fastIterNext(Value *slots, int slot, Value *top) {
+    int cursor = AS_INT(slots[slot + 1]);
+    if (!iterateNext(slots[slot], &cursor, top)) return false;
+    slots[slot + 1] = INT_VAL(cursor);
+    return true;
+}
+
+// The whole of OP_FOR_STEP, for when the inline integer path doesn't apply. Returns 1 to loop again, 0 to leave, -1 for run().
+int fastForStep(CallFrame *frame, uint8_t *ip) {
+    uint8_t slot = ip[1];
+    uint8_t flags = ip[2];
+    Value step = frame->chunk->constants.values[ip[4]];
+    Value counter = frame->slots[slot];
+    Value bound = (flags & FOR_STEP_CONSTANT_BOUND) ? frame->chunk->constants.values[ip[3]] : frame->slots[ip[3]];
+
+    int32_t nextInt;
+    if (IS_INT(counter) && IS_INT(step) && IS_INT(bound)
+        && ((flags & FOR_STEP_SUBTRACT) ? subtractInts(AS_INT(counter), AS_INT(step), &nextInt)
+                                        : addInts(AS_INT(counter), AS_INT(step), &nextInt))) {
+        frame->slots[slot] = INT_VAL(nextInt);
+        int32_t limit = AS_INT(bound);
+        switch (flags & FOR_STEP_COMPARISON) {
+            case FOR_STEP_LESS:       return nextInt < limit;
+            case FOR_STEP_LESS_EQUAL: return nextInt <= limit;
+            case FOR_STEP_GREATER:    return nextInt > limit;
+            default:                  return nextInt >= limit;
+        }
+    }
+
+    if (!IS_NUMBER(counter) || !IS_NUMBER(bound)) return -1;
+
+    double next = (flags & FOR_STEP_SUBTRACT) ? AS_NUMBER(counter) - AS_NUMBER(step) : AS_NUMBER(counter) + AS_NUMBER(step);
+    frame->slots[slot] = NUMBER_VAL(next);
+    double limit = AS_NUMBER(bound);
+    switch (flags & FOR_STEP_COMPARISON) {
+        case FOR_STEP_LESS:       return next < limit;
+        case FOR_STEP_LESS_EQUAL: return !(next > limit);
+        case FOR_STEP_GREATER:    return next > limit;
+        default:                  return !(next < limit);
+    }
+}
+
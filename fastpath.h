@@ -0,0 +1,31 @@
+#ifndef CFER_FASTPATH_H
+#define CFER_FASTPATH_H
+
+#include "vm.h"
+
+/*
+ * The common case of the instructions that compiled code (the JIT's templates, see jit.h, and the C that --emit-c writes,
+ * see aot.h) doesn't do inline. Each one does what run() would for the usual operands and returns false for anything else,
+ * leaving the stack untouched so run() can redo the instruction with its full semantics, and report the error if it's one.
+ * None of them ever reports an error itself.
+ *
+ * top is the compiled code's top of the stack. The caller writes it back to vm.stackTop first,
+ * so the ones that can allocate are safe, every value they work with is still on the stack.
+ */
+
+bool fastGetGlobal(ObjString *name, Value *result);
+bool fastSetGlobal(ObjString *name, Value value);
+void fastDefineGlobal(ObjString *name, Value value, bool permanent);
+Value fastEqual(Value a, Value b);
+bool fastBinary(Value *top, int op);
+bool fastNegate(Value *top);
+bool fastGetItem(Value *top);
+bool fastSetItem(Value *top);
+bool fastGetProperty(Value *top, ObjString *name);
+bool fastSetProperty(Value *top, ObjString *name);
+void fastPrint(Value value);
+bool fastIterInit(Value *top);
+bool fastIterNext(Value *slots, int slot, Value *top);
+int fastForStep(CallFrame *frame, uint8_t *ip);
+
+#endif //CFER_FASTPATH_H
@@ -0,0 +1,671 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fastpath.h"
+#include "jit.h"
+#include "memory.h"
+
+#ifdef JIT_SUPPORTED
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+/*
+ * ---------------------------------------- Assembler ----------------------------------------
+ *
+ * Just enough of an x86-64 encoder for the templates. Memory operands are always [base + disp32],
+ * which wastes a few bytes on small displacements but means one encoding covers every case.
+ *
+ * While native code runs, four registers have a fixed job. They're all callee-saved, so the helpers leave them alone:
+ * rbx holds frame->slots, r12 the top of the stack, r13 the frame, r14 the tag of an integer Value (so the payload can be or'd in)
+ * and r15 FALSE_VAL (TRUE_VAL is one more, NIL_VAL one less).
+ */
+
+typedef enum {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15
+} Register;
+
+#define SLOTS RBX
+#define TOP R12
+#define FRAME R13
+#define INT_TAG R14
+#define FALSE_REG R15
+
+typedef enum {
+    CC_OVERFLOW = 0x0,
+    CC_EQUAL = 0x4,
+    CC_NOT_EQUAL = 0x5,
+    CC_SIGN = 0x8,
+    CC_LESS = 0xc,
+    CC_GREATER_EQUAL = 0xd,
+    CC_LESS_EQUAL = 0xe,
+    CC_GREATER = 0xf
+} Condition;
+
+// The upper half of every integer Value
+#define INT_HIGH ((uint32_t)((QNAN | TAG_INT) >> 32))
+
+typedef struct {
+    int at;             // where the rel32 is in the code
+    int target;         // the chunk offset it goes to (or exits at)
+} Fixup;
+
+typedef struct {
+    Chunk *chunk;
+    uint8_t *code;
+    int count;
+    int capacity;
+    int epilogue;
+    int *entries;
+    Fixup *jumps;
+    int jumpCount;
+    int jumpCapacity;
+    Fixup *exits;
+    int exitCount;
+    int exitCapacity;
+} Assembler;
+
+static void emitByte(Assembler *as, uint8_t byte) {
+    if (as->count == as->capacity) {
+        int oldCapacity = as->capacity;
+        as->capacity = GROW_CAPACITY(oldCapacity);
+        as->code = GROW_ARRAY(uint8_t, as->code, oldCapacity, as->capacity);
+    }
+    as->code[as->count++] = byte;
+}
+
+static void emit32(Assembler *as, uint32_t value) {
+    for (int i = 0; i < 4; i++) emitByte(as, (value >> (8 * i)) & 0xff);
+}
+
+static void emit64(Assembler *as, uint64_t value) {
+    for (int i = 0; i < 8; i++) emitByte(as, (value >> (8 * i)) & 0xff);
+}
+
+static void patch32(Assembler *as, int at, int32_t value) {
+    for (int i = 0; i < 4; i++) as->code[at + i] = ((uint32_t)value >> (8 * i)) & 0xff;
+}
+
+static void emitRex(Assembler *as, bool wide, int reg, int rm) {
+    uint8_t rex = 0x40 | (wide ? 8 : 0) | (reg >= 8 ? 4 : 0) | (rm >= 8 ? 1 : 0);
+    if (rex != 0x40) emitByte(as, rex);
+}
+
+// opcode reg, [base + disp]
+static void emitMemory(Assembler *as, uint8_t opcode, int reg, int base, int32_t disp) {
+    emitRex(as, true, reg, base);
+    emitByte(as, opcode);
+    emitByte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) emitByte(as, 0x24);
+    emit32(as, (uint32_t)disp);
+}
+
+static void emitLoad(Assembler *as, int reg, int base, int32_t disp) {
+    emitMemory(as, 0x8b, reg, base, disp);
+}
+
+static void emitStore(Assembler *as, int base, int32_t disp, int reg) {
+    emitMemory(as, 0x89, reg, base, disp);
+}
+
+// opcode rm, reg between registers: 0x89 mov, 0x01 add, 0x29 sub, 0x39 cmp, 0x09 or
+static void emitRegisters(Assembler *as, uint8_t opcode, int rm, int reg, bool wide) {
+    emitRex(as, wide, reg, rm);
+    emitByte(as, opcode);
+    emitByte(as, 0xc0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+// 0x81 /extension rm, imm32: 0 add, 5 sub, 7 cmp
+static void emitImmediate(Assembler *as, int extension, int rm, int32_t imm, bool wide) {
+    emitRex(as, wide, 0, rm);
+    emitByte(as, 0x81);
+    emitByte(as, 0xc0 | (extension << 3) | (rm & 7));
+    emit32(as, (uint32_t)imm);
+}
+
+static void emitMoveImmediate(Assembler *as, int reg, uint64_t imm) {
+    emitRex(as, true, 0, reg);
+    emitByte(as, 0xb8 + (reg & 7));
+    emit64(as, imm);
+}
+
+static void emitCall(Assembler *as, void *function) {
+    // Helpers may allocate, and a collection needs to see the whole stack
+    emitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm.stackTop);
+    emitStore(as, RAX, 0, TOP);
+    emitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)function);
+    emitByte(as, 0xff);
+    emitByte(as, 0xd0);
+}
+
+static void emitTestAl(Assembler *as) {
+    emitByte(as, 0x84);
+    emitByte(as, 0xc0);
+}
+
+static void addFixup(Fixup **fixups, int *count, int *capacity, int at, int target) {
+    if (*count == *capacity) {
+        int oldCapacity = *capacity;
+        *capacity = GROW_CAPACITY(oldCapacity);
+        *fixups = GROW_ARRAY(Fixup, *fixups, oldCapacity, *capacity);
+    }
+    (*fixups)[*count].at = at;
+    (*fixups)[*count].target = target;
+    (*count)++;
+}
+
+// A jmp (cc < 0) or jcc to the code of the instruction at target in the chunk
+static void emitJumpTo(Assembler *as, int cc, int target) {
+    if (cc < 0) {
+        emitByte(as, 0xe9);
+    } else {
+        emitByte(as, 0x0f);
+        emitByte(as, 0x80 + cc);
+    }
+    addFixup(&as->jumps, &as->jumpCount, &as->jumpCapacity, as->count, target);
+    emit32(as, 0);
+}
+
+// A jcc that leaves the native code at the instruction at offset
+static void emitExitIf(Assembler *as, int cc, int offset) {
+    emitByte(as, 0x0f);
+    emitByte(as, 0x80 + cc);
+    addFixup(&as->exits, &as->exitCount, &as->exitCapacity, as->count, offset);
+    emit32(as, 0);
+}
+
+static void emitExit(Assembler *as, int offset) {
+    emitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)(as->chunk->code + offset));
+    emitByte(as, 0xe9);
+    emit32(as, (uint32_t)(as->epilogue - (as->count + 4)));
+}
+
+// A jump within a template, patched by landHere() once its destination is emitted
+static int emitLocalJump(Assembler *as, int cc) {
+    if (cc < 0) {
+        emitByte(as, 0xe9);
+    } else {
+        emitByte(as, 0x0f);
+        emitByte(as, 0x80 + cc);
+    }
+    emit32(as, 0);
+    return as->count - 4;
+}
+
+static void landHere(Assembler *as, int at) {
+    patch32(as, at, as->count - (at + 4));
+}
+
+static void emitPush(Assembler *as, int reg) {
+    emitStore(as, TOP, 0, reg);
+    emitImmediate(as, 0, TOP, sizeof(Value), true);
+}
+
+static void emitDrop(Assembler *as, int count) {
+    emitImmediate(as, 5, TOP, count * (int)sizeof(Value), true);
+}
+
+static void emitPushConstant(Assembler *as, Value value) {
+    emitMoveImmediate(as, RAX, value);
+    emitPush(as, RAX);
+}
+
+// Jumps to slow unless reg holds an integer Value, clobbers rdx
+static int emitIntCheck(Assembler *as, int reg) {
+    emitRegisters(as, 0x89, RDX, reg, true);
+    emitRex(as, true, 0, RDX);
+    emitByte(as, 0xc1);
+    emitByte(as, 0xc0 | (5 << 3) | RDX);    // shr rdx, 32
+    emitByte(as, 32);
+    emitImmediate(as, 7, RDX, (int32_t)INT_HIGH, false);
+    return emitLocalJump(as, CC_NOT_EQUAL);
+}
+
+/*
+ * ---------------------------------------- Templates ----------------------------------------
+ */
+
+static void emitBinaryHelper(Assembler *as, int op, int offset) {
+    emitRegisters(as, 0x89, RDI, TOP, true);
+    emitByte(as, 0xbe);                     // mov esi, op
+    emit32(as, (uint32_t)op);
+    emitCall(as, (void*)fastBinary);
+    emitTestAl(as);
+    emitExitIf(as, CC_EQUAL, offset);
+    emitDrop(as, 1);
+}
+
+// +, -, < and > on two integers inline, anything else through fastBinary()
+static void emitIntegerBinary(Assembler *as, int op, int offset) {
+    emitLoad(as, RAX, TOP, -16);
+    emitLoad(as, RCX, TOP, -8);
+    int notLeft = emitIntCheck(as, RAX);
+    int notRight = emitIntCheck(as, RCX);
+
+    int overflow = -1;
+    if (op == OP_ADD || op == OP_SUBTRACT) {
+        emitRegisters(as, op == OP_ADD ? 0x01 : 0x29, RAX, RCX, false);
+        overflow = emitLocalJump(as, CC_OVERFLOW);
+        emitRegisters(as, 0x09, RAX, INT_TAG, true);
+    } else {
+        emitRegisters(as, 0x39, RAX, RCX, false);
+        emitByte(as, 0x0f);
+        emitByte(as, 0x90 + (op == OP_LESS ? CC_LESS : CC_GREATER));
+        emitByte(as, 0xc0);                 // setcc al
+        emitByte(as, 0x0f);
+        emitByte(as, 0xb6);
+        emitByte(as, 0xc0);                 // movzx eax, al
+        emitRegisters(as, 0x01, RAX, FALSE_REG, true);
+    }
+    emitStore(as, TOP, -16, RAX);
+    emitDrop(as, 1);
+    int done = emitLocalJump(as, -1);
+
+    landHere(as, notLeft);
+    landHere(as, notRight);
+    if (overflow != -1) landHere(as, overflow);
+    emitBinaryHelper(as, op, offset);
+    landHere(as, done);
+}
+
+// Jumps to target if rax is nil or false
+static void emitJumpIfFalsey(Assembler *as, int target) {
+    emitRegisters(as, 0x39, RAX, FALSE_REG, true);
+    emitJumpTo(as, CC_EQUAL, target);
+    emitRegisters(as, 0x89, RCX, FALSE_REG, true);
+    emitImmediate(as, 5, RCX, 1, true);
+    emitRegisters(as, 0x39, RAX, RCX, true);
+    emitJumpTo(as, CC_EQUAL, target);
+}
+
+static void emitForStep(Assembler *as, uint8_t *code, int offset, int target) {
+    uint8_t slot = code[1];
+    uint8_t flags = code[2];
+    uint8_t boundIndex = code[3];
+    Value step = as->chunk->constants.values[code[4]];
+    Value constantBound = as->chunk->constants.values[boundIndex];
+    bool constant = (flags & FOR_STEP_CONSTANT_BOUND) != 0;
+
+    int slow[3];
+    int slowCount = 0;
+    int done = -1;
+    if (IS_INT(step) && (!constant || IS_INT(constantBound))) {
+        emitLoad(as, RAX, SLOTS, slot * (int)sizeof(Value));
+        slow[slowCount++] = emitIntCheck(as, RAX);
+        if (!constant) {
+            emitLoad(as, RCX, SLOTS, boundIndex * (int)sizeof(Value));
+            slow[slowCount++] = emitIntCheck(as, RCX);
+        }
+
+        emitByte(as, (flags & FOR_STEP_SUBTRACT) ? 0x2d : 0x05);   // add/sub eax, imm32
+        emit32(as, (uint32_t)AS_INT(step));
+        slow[slowCount++] = emitLocalJump(as, CC_OVERFLOW);
+        emitRegisters(as, 0x89, RDX, RAX, true);
+        emitRegisters(as, 0x09, RDX, INT_TAG, true);
+        emitStore(as, SLOTS, slot * (int)sizeof(Value), RDX);
+
+        if (constant) {
+            emitByte(as, 0x3d);                                     // cmp eax, imm32
+            emit32(as, (uint32_t)AS_INT(constantBound));
+        } else {
+            emitRegisters(as, 0x39, RAX, RCX, false);
+        }
+        static const Condition conditions[] = {CC_LESS, CC_LESS_EQUAL, CC_GREATER, CC_GREATER_EQUAL};
+        emitJumpTo(as, conditions[flags & FOR_STEP_COMPARISON], target);
+        done = emitLocalJump(as, -1);
+    }
+
+    for (int i = 0; i < slowCount; i++) landHere(as, slow[i]);
+    emitRegisters(as, 0x89, RDI, FRAME, true);
+    emitMoveImmediate(as, RSI, (uint64_t)(uintptr_t)code);
+    emitCall(as, (void*)fastForStep);
+    emitByte(as, 0x85);
+    emitByte(as, 0xc0);                     // test eax, eax
+    emitExitIf(as, CC_SIGN, offset);
+    emitJumpTo(as, CC_NOT_EQUAL, target);
+    if (done != -1) landHere(as, done);
+}
+
+static ObjString* readName(Chunk *chunk, uint8_t *code, bool isLong) {
+    uint32_t index = isLong ? ((uint32_t)code[1] << 24 | (uint32_t)code[2] << 16 | (uint32_t)code[3] << 8 | code[4]) : code[1];
+    return AS_STRING(chunk->constants.values[index]);
+}
+
+static void emitInstruction(Assembler *as, int offset) {
+    uint8_t *code = &as->chunk->code[offset];
+    Value *constants = as->chunk->constants.values;
+
+    switch (code[0]) {
+        case OP_CONSTANT: emitPushConstant(as, constants[code[1]]); break;
+        case OP_CONSTANT_LONG:
+            emitPushConstant(as, constants[(uint32_t)code[1] << 24 | (uint32_t)code[2] << 16 | (uint32_t)code[3] << 8 | code[4]]);
+            break;
+        case OP_NIL: emitPushConstant(as, NIL_VAL); break;
+        case OP_TRUE: emitPushConstant(as, TRUE_VAL); break;
+        case OP_FALSE: emitPushConstant(as, FALSE_VAL); break;
+        case OP_POP: emitDrop(as, 1); break;
+        case OP_GET_LOCAL:
+            emitLoad(as, RAX, SLOTS, code[1] * (int)sizeof(Value));
+            emitPush(as, RAX);
+            break;
+        case OP_SET_LOCAL:
+            emitLoad(as, RAX, TOP, -8);
+            emitStore(as, SLOTS, code[1] * (int)sizeof(Value), RAX);
+            break;
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+            emitMoveImmediate(as, RDI, (uint64_t)(uintptr_t)readName(as->chunk, code, code[0] == OP_GET_GLOBAL_LONG));
+            emitRegisters(as, 0x89, RSI, TOP, true);
+            emitCall(as, (void*)fastGetGlobal);
+            emitTestAl(as);
+            emitExitIf(as, CC_EQUAL, offset);
+            emitImmediate(as, 0, TOP, sizeof(Value), true);
+            break;
+        case OP_DEFINE_GLOBAL:
+        case OP_DEFINE_GLOBAL_LONG:
+        case OP_DEFINE_GLOBAL_PERM:
+        case OP_DEFINE_GLOBAL_PERM_LONG: {
+            bool isLong = code[0] == OP_DEFINE_GLOBAL_LONG || code[0] == OP_DEFINE_GLOBAL_PERM_LONG;
+            bool permanent = code[0] == OP_DEFINE_GLOBAL_PERM || code[0] == OP_DEFINE_GLOBAL_PERM_LONG;
+            emitMoveImmediate(as, RDI, (uint64_t)(uintptr_t)readName(as->chunk, code, isLong));
+            emitLoad(as, RSI, TOP, -8);
+            emitByte(as, 0xba);             // mov edx, permanent
+            emit32(as, permanent);
+            emitCall(as, (void*)fastDefineGlobal);
+            emitDrop(as, 1);
+            break;
+        }
+        case OP_SET_GLOBAL:
+        case OP_SET_GLOBAL_LONG:
+            emitMoveImmediate(as, RDI, (uint64_t)(uintptr_t)readName(as->chunk, code, code[0] == OP_SET_GLOBAL_LONG));
+            emitLoad(as, RSI, TOP, -8);
+            emitCall(as, (void*)fastSetGlobal);
+            emitTestAl(as);
+            emitExitIf(as, CC_EQUAL, offset);
+            break;
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+            emitLoad(as, RAX, FRAME, offsetof(CallFrame, closure));
+            emitLoad(as, RAX, RAX, offsetof(ObjClosure, upvalues));
+            emitLoad(as, RAX, RAX, code[1] * (int)sizeof(ObjUpvalue*));
+            emitLoad(as, RAX, RAX, offsetof(ObjUpvalue, location));
+            if (code[0] == OP_GET_UPVALUE) {
+                emitLoad(as, RAX, RAX, 0);
+                emitPush(as, RAX);
+            } else {
+                emitLoad(as, RCX, TOP, -8);
+                emitStore(as, RAX, 0, RCX);
+            }
+            break;
+        case OP_GET_ITEM:
+        case OP_SET_ITEM:
+            emitRegisters(as, 0x89, RDI, TOP, true);
+            emitCall(as, code[0] == OP_GET_ITEM ? (void*)fastGetItem : (void*)fastSetItem);
+            emitTestAl(as);
+            emitExitIf(as, CC_EQUAL, offset);
+            emitDrop(as, code[0] == OP_GET_ITEM ? 1 : 2);
+            break;
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            emitRegisters(as, 0x89, RDI, TOP, true);
+            emitMoveImmediate(as, RSI, (uint64_t)(uintptr_t)readName(as->chunk, code, false));
+            emitCall(as, code[0] == OP_GET_PROPERTY ? (void*)fastGetProperty : (void*)fastSetProperty);
+            emitTestAl(as);
+            emitExitIf(as, CC_EQUAL, offset);
+            if (code[0] == OP_SET_PROPERTY) emitDrop(as, 1);
+            break;
+        case OP_EQUAL:
+            emitLoad(as, RDI, TOP, -16);
+            emitLoad(as, RSI, TOP, -8);
+            emitCall(as, (void*)fastEqual);
+            emitStore(as, TOP, -16, RAX);
+            emitDrop(as, 1);
+            break;
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+            emitIntegerBinary(as, code[0], offset);
+            break;
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        case OP_SHIFT_LEFT:
+        case OP_SHIFT_RIGHT:
+            emitBinaryHelper(as, code[0], offset);
+            break;
+        case OP_NOT: {
+            // FALSE_VAL + (value is nil or false)
+            emitLoad(as, RAX, TOP, -8);
+            emitRegisters(as, 0x39, RAX, FALSE_REG, true);
+            emitByte(as, 0x0f);
+            emitByte(as, 0x94);
+            emitByte(as, 0xc2);             // sete dl
+            emitRegisters(as, 0x89, RCX, FALSE_REG, true);
+            emitImmediate(as, 5, RCX, 1, true);
+            emitRegisters(as, 0x39, RAX, RCX, true);
+            emitByte(as, 0x0f);
+            emitByte(as, 0x94);
+            emitByte(as, 0xc1);             // sete cl
+            emitByte(as, 0x08);
+            emitByte(as, 0xca);             // or dl, cl
+            emitByte(as, 0x0f);
+            emitByte(as, 0xb6);
+            emitByte(as, 0xc2);             // movzx eax, dl
+            emitRegisters(as, 0x01, RAX, FALSE_REG, true);
+            emitStore(as, TOP, -8, RAX);
+            break;
+        }
+        case OP_NEGATE:
+            emitRegisters(as, 0x89, RDI, TOP, true);
+            emitCall(as, (void*)fastNegate);
+            emitTestAl(as);
+            emitExitIf(as, CC_EQUAL, offset);
+            break;
+        case OP_PRINT:
+            emitLoad(as, RDI, TOP, -8);
+            emitCall(as, (void*)fastPrint);
+            emitDrop(as, 1);
+            break;
+        case OP_JUMP:
+        case OP_LOOP:
+            emitJumpTo(as, -1, jumpTarget(as->chunk, offset));
+            break;
+        case OP_JUMP_IF_FALSE:
+            emitLoad(as, RAX, TOP, -8);
+            emitJumpIfFalsey(as, jumpTarget(as->chunk, offset));
+            break;
+        case OP_ITER_INIT:
+            emitRegisters(as, 0x89, RDI, TOP, true);
+            emitCall(as, (void*)fastIterInit);
+            emitTestAl(as);
+            emitExitIf(as, CC_EQUAL, offset);
+            emitImmediate(as, 0, TOP, sizeof(Value), true);
+            break;
+        case OP_ITER_NEXT:
+            emitRegisters(as, 0x89, RDI, SLOTS, true);
+            emitByte(as, 0xbe);             // mov esi, slot
+            emit32(as, code[1]);
+            emitRegisters(as, 0x89, RDX, TOP, true);
+            emitCall(as, (void*)fastIterNext);
+            emitTestAl(as);
+            emitJumpTo(as, CC_EQUAL, jumpTarget(as->chunk, offset));
+            emitImmediate(as, 0, TOP, sizeof(Value), true);
+            break;
+        case OP_FOR_STEP:
+            emitForStep(as, code, offset, jumpTarget(as->chunk, offset));
+            break;
+        case OP_CHECK_CALLEE:
+            emitLoad(as, RDI, TOP, -(code[2] + 1) * (int)sizeof(Value));
+            emitMoveImmediate(as, RSI, (uint64_t)(uintptr_t)AS_FUNCTION(constants[code[1]]));
+            emitCall(as, (void*)isCallee);
+            emitTestAl(as);
+            emitJumpTo(as, CC_EQUAL, jumpTarget(as->chunk, offset));
+            break;
+        case OP_INLINE_RETURN:
+            emitLoad(as, RAX, TOP, -8);
+            emitStore(as, TOP, -(code[1] + 1) * (int)sizeof(Value), RAX);
+            if (code[1] > 0) emitDrop(as, code[1]);
+            emitJumpTo(as, -1, jumpTarget(as->chunk, offset));
+            break;
+        default:
+            // Calls, returns, closures, classes and collection literals belong to run()
+            emitExit(as, offset);
+            break;
+    }
+}
+
+/*
+ * Native code is entered with the frame in rdi and the address to start at in rsi. The prologue saves the registers the
+ * templates use and loads them, the epilogue (reached from every exit with the instruction to resume at in rax)
+ * writes the frame's ip and the stack top back and returns. Five pushes keep the stack 16-byte aligned for the helpers.
+ */
+
+static void emitPrologue(Assembler *as) {
+    emitByte(as, 0x53);                                 // push rbx
+    emitByte(as, 0x41); emitByte(as, 0x54);             // push r12
+    emitByte(as, 0x41); emitByte(as, 0x55);             // push r13
+    emitByte(as, 0x41); emitByte(as, 0x56);             // push r14
+    emitByte(as, 0x41); emitByte(as, 0x57);             // push r15
+    emitRegisters(as, 0x89, FRAME, RDI, true);
+    emitLoad(as, SLOTS, FRAME, offsetof(CallFrame, slots));
+    emitMoveImmediate(as, RAX, (uint64_t)(uintptr_t)&vm.stackTop);
+    emitLoad(as, TOP, RAX, 0);
+    emitMoveImmediate(as, INT_TAG, QNAN | TAG_INT);
+    emitMoveImmediate(as, FALSE_REG, FALSE_VAL);
+    emitByte(as, 0xff); emitByte(as, 0xe6);             // jmp rsi
+
+    as->epilogue = as->count;
+    emitStore(as, FRAME, offsetof(CallFrame, ip), RAX);
+    emitMoveImmediate(as, RCX, (uint64_t)(uintptr_t)&vm.stackTop);
+    emitStore(as, RCX, 0, TOP);
+    emitByte(as, 0x41); emitByte(as, 0x5f);             // pop r15
+    emitByte(as, 0x41); emitByte(as, 0x5e);             // pop r14
+    emitByte(as, 0x41); emitByte(as, 0x5d);             // pop r13
+    emitByte(as, 0x41); emitByte(as, 0x5c);             // pop r12
+    emitByte(as, 0x5b);                                 // pop rbx
+    emitByte(as, 0xc3);                                 // ret
+}
+
+/*
+ * ---------------------------------------- Code cache ----------------------------------------
+ */
+
+static size_t cacheSize = 0;
+static bool cacheClosed = false;
+static FILE *perfMap = NULL;
+
+static void recordInPerfMap(ObjFunction *function, Chunk *chunk, uint8_t *code, int length) {
+    if (perfMap == NULL) {
+        char path[64];
+        snprintf(path, sizeof(path), "/tmp/perf-%d.map", (int)getpid());
+        perfMap = fopen(path, "w");
+        if (perfMap == NULL) return;
+    }
+    fprintf(perfMap, "%lx %x fer:%s%s\n", (unsigned long)(uintptr_t)code, length,
+            function->name != NULL ? function->name->chars : "script", chunk == function->optimized ? " (optimized)" : "");
+    fflush(perfMap);
+}
+
+static JitCode* compileChunk(ObjFunction *function, Chunk *chunk) {
+    Assembler as;
+    memset(&as, 0, sizeof(Assembler));
+    as.chunk = chunk;
+    as.entries = ALLOCATE(int, chunk->count);
+
+    emitPrologue(&as);
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        as.entries[offset] = as.count;
+        emitInstruction(&as, offset);
+    }
+
+    for (int i = 0; i < as.jumpCount; i++) {
+        patch32(&as, as.jumps[i].at, as.entries[as.jumps[i].target] - (as.jumps[i].at + 4));
+    }
+    // Each exit gets a stub that loads its ip and goes to the epilogue
+    for (int i = 0; i < as.exitCount; i++) {
+        patch32(&as, as.exits[i].at, as.count - (as.exits[i].at + 4));
+        emitExit(&as, as.exits[i].target);
+    }
+
+    long pageSize = sysconf(_SC_PAGESIZE);
+    size_t size = ((size_t)as.count + pageSize - 1) / pageSize * pageSize;
+    uint8_t *code = NULL;
+    if (cacheSize + size <= JIT_CACHE_MAX) {
+        code = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) code = NULL;
+    }
+
+    JitCode *jit = NULL;
+    if (code != NULL) {
+        memcpy(code, as.code, as.count);
+        if (mprotect(code, size, PROT_READ | PROT_EXEC) == 0) {
+            cacheSize += size;
+            jit = ALLOCATE(JitCode, 1);
+            jit->chunk = chunk;
+            jit->code = code;
+            jit->size = size;
+            jit->entries = as.entries;
+            jit->next = NULL;
+            recordInPerfMap(function, chunk, code, as.count);
+        } else {
+            munmap(code, size);
+        }
+    }
+
+    if (jit == NULL) {
+        // Out of room (or memory), leave everything else to the interpreter from now on
+        cacheClosed = true;
+        FREE_ARRAY(int, as.entries, chunk->count);
+    }
+    FREE_ARRAY(uint8_t, as.code, as.capacity);
+    FREE_ARRAY(Fixup, as.jumps, as.jumpCapacity);
+    FREE_ARRAY(Fixup, as.exits, as.exitCapacity);
+    return jit;
+}
+
+typedef void (*JitEntry)(CallFrame *frame, uint8_t *start);
+
+void jitRun(CallFrame *frame) {
+    ObjFunction *function = frame->closure->function;
+    JitCode *jit = function->jit;
+    while (jit != NULL && jit->chunk != frame->chunk) jit = jit->next;
+
+    if (jit == NULL) {
+        if (cacheClosed) return;
+        jit = compileChunk(function, frame->chunk);
+        if (jit == NULL) return;
+        jit->next = function->jit;
+        function->jit = jit;
+    }
+
+    ((JitEntry)(void*)jit->code)(frame, jit->code + jit->entries[frame->ip - frame->chunk->code]);
+}
+
+// Has to run before the chunks are freed, the entries are sized by them
+void freeJitCode(JitCode *jit) {
+    while (jit != NULL) {
+        JitCode *next = jit->next;
+        munmap(jit->code, jit->size);
+        cacheSize -= jit->size;
+        FREE_ARRAY(int, jit->entries, jit->chunk->count);
+        FREE(JitCode, jit);
+        jit = next;
+    }
+}
+
+#else
+
+void jitRun(CallFrame *frame) {
+}
+
+void freeJitCode(JitCode *jit) {
+}
+
+#endif
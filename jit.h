@@ -0,0 +1,56 @@
+#ifndef CFER_JIT_H
+#define CFER_JIT_H
+
+#include "vm.h"
+
+/*
+ * Even with the optimizing tier, every instruction of a hot loop still goes through run()'s dispatch:
+ * fetch the opcode, jump through the switch, decode the operands again, and only then do the work.
+ * The baseline JIT removes that layer. It turns a hot chunk into x86-64 machine code by stitching together a small template
+ * for each instruction, in the order they appear, so OP_GET_LOCAL 3 becomes two moves and OP_JUMP becomes a jmp.
+ * Operands are baked into the code, constants become immediates, and jumps go straight to the code of their target.
+ *
+ * The value stack stays exactly where it is, in vm.stack, so the native code and run() can hand a frame back and forth
+ * at any instruction boundary. Only three things live in machine registers while native code runs:
+ * the frame's slots, the frame itself, and the top of the stack, which is written back to vm.stackTop before anything
+ * that could trigger a collection.
+ *
+ * The templates only cover the common case. Adding two integers or comparing them is done inline,
+ * and the other arithmetic, globals, fields, subscripts and iteration call back into the C helpers in fastpath.h.
+ * Anything else, and any case a template or helper doesn't handle (an error, a string concatenation, a method binding),
+ * is an exit: the native code stores the ip of that instruction in the frame and returns, and run() carries on from there
+ * with its full semantics, error messages included. Calls and returns always exit, since frames belong to run().
+ * run() goes back into native code after every call and return and on every loop back edge, see ENTER_NATIVE() in vm.c.
+ *
+ * A chunk is compiled once its function's hotness (the counter the tier uses) reaches JIT_THRESHOLD.
+ * By then the tier has had its chance, so a function it improved gets its optimized chunk compiled, and the original one
+ * only if calls that fail the tier's guards keep running it.
+ *
+ * Native code lives in memory mapped straight from the OS. It's written while the pages are writable and then switched
+ * to executable, never both at once (W^X), and the cache stops taking new code past JIT_CACHE_MAX bytes.
+ * Every piece of code is also listed in /tmp/perf-<pid>.map, so `perf report` shows fer:name instead of raw addresses.
+ *
+ * The JIT needs NaN boxing (a Value has to fit in a machine register) and an x86-64 Linux machine.
+ * It's off unless FER_JIT=on is set in the environment, and it only runs alongside the stack VM.
+ */
+
+#if defined(NAN_BOXING) && defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED
+#endif
+
+#define JIT_THRESHOLD 2000
+#define JIT_CACHE_MAX (64 * 1024 * 1024)
+
+typedef struct JitCode {
+    Chunk *chunk;               // the chunk this is the machine code for
+    uint8_t *code;
+    size_t size;                // the size of the mapping, a whole number of pages
+    int *entries;               // the offset in code of each instruction, by its offset in the chunk
+    struct JitCode *next;       // the code for the function's other chunk, if there is one
+} JitCode;
+
+// Runs frame from frame->ip in native code, compiling its chunk first if needed, until it gets to an instruction the JIT leaves to run()
+void jitRun(CallFrame *frame);
+void freeJitCode(JitCode *jit);
+
+#endif //CFER_JIT_H
@@ -0,0 +1,347 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernels.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#include <immintrin.h>
+#define KERNELS_X86
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+/*
+ * ---------------------------------------- SCALAR ----------------------------------------
+ *
+ * These work everywhere and are what every other version falls back to for the last few elements
+ * that don't fill a whole register.
+ */
+
+static double sumScalar(const double *x, int count) {
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += x[i];
+    }
+    return sum;
+}
+
+static double minScalar(const double *x, int count) {
+    double min = x[0];
+    for (int i = 1; i < count; i++) {
+        if (x[i] < min) min = x[i];
+    }
+    return min;
+}
+
+static double maxScalar(const double *x, int count) {
+    double max = x[0];
+    for (int i = 1; i < count; i++) {
+        if (x[i] > max) max = x[i];
+    }
+    return max;
+}
+
+static double dotScalar(const double *x, const double *y, int count) {
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += x[i] * y[i];
+    }
+    return sum;
+}
+
+static void axpyScalar(double a, const double *x, double *y, int count) {
+    for (int i = 0; i < count; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static void scaleScalar(double a, const double *x, double *out, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = a * x[i];
+    }
+}
+
+static void addScalar(const double *x, const double *y, double *out, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = x[i] + y[i];
+    }
+}
+
+static void subScalar(const double *x, const double *y, double *out, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = x[i] - y[i];
+    }
+}
+
+static void mulScalar(const double *x, const double *y, double *out, int count) {
+    for (int i = 0; i < count; i++) {
+        out[i] = x[i] * y[i];
+    }
+}
+
+#ifdef KERNELS_X86
+
+/*
+ * ---------------------------------------- SSE2 ----------------------------------------
+ *
+ * SSE2 is part of the x86-64 baseline, so there's nothing to check before using these.
+ * An SSE register holds two doubles. The reductions keep two of them going so consecutive adds don't wait on each other.
+ * Loads are unaligned: list storage and float array buffers come from realloc() and only promise 16 byte alignment at best.
+ */
+
+static double sumSSE2(const double *x, int count) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(x + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(x + i + 2));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + sumScalar(x + i, count - i);
+}
+
+static double minSSE2(const double *x, int count) {
+    if (count < 2) return minScalar(x, count);
+
+    __m128d acc = _mm_loadu_pd(x);
+    int i = 2;
+    for (; i + 2 <= count; i += 2) {
+        acc = _mm_min_pd(acc, _mm_loadu_pd(x + i));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double min = lanes[0] < lanes[1] ? lanes[0] : lanes[1];
+    for (; i < count; i++) {
+        if (x[i] < min) min = x[i];
+    }
+    return min;
+}
+
+static double maxSSE2(const double *x, int count) {
+    if (count < 2) return maxScalar(x, count);
+
+    __m128d acc = _mm_loadu_pd(x);
+    int i = 2;
+    for (; i + 2 <= count; i += 2) {
+        acc = _mm_max_pd(acc, _mm_loadu_pd(x + i));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    double max = lanes[0] > lanes[1] ? lanes[0] : lanes[1];
+    for (; i < count; i++) {
+        if (x[i] > max) max = x[i];
+    }
+    return max;
+}
+
+static double dotSSE2(const double *x, const double *y, int count) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+        acc1 = _mm_add_pd(acc1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+    }
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + dotScalar(x + i, y + i, count - i);
+}
+
+static void axpySSE2(double a, const double *x, double *y, int count) {
+    __m128d scale = _mm_set1_pd(a);
+
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d product = _mm_mul_pd(scale, _mm_loadu_pd(x + i));
+        _mm_storeu_pd(y + i, _mm_add_pd(_mm_loadu_pd(y + i), product));
+    }
+    axpyScalar(a, x + i, y + i, count - i);
+}
+
+static void scaleSSE2(double a, const double *x, double *out, int count) {
+    __m128d scale = _mm_set1_pd(a);
+
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(out + i, _mm_mul_pd(scale, _mm_loadu_pd(x + i)));
+    }
+    scaleScalar(a, x + i, out + i, count - i);
+}
+
+static void addSSE2(const double *x, const double *y, double *out, int count) {
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(out + i, _mm_add_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    }
+    addScalar(x + i, y + i, out + i, count - i);
+}
+
+static void subSSE2(const double *x, const double *y, double *out, int count) {
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(out + i, _mm_sub_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    }
+    subScalar(x + i, y + i, out + i, count - i);
+}
+
+static void mulSSE2(const double *x, const double *y, double *out, int count) {
+    int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        _mm_storeu_pd(out + i, _mm_mul_pd(_mm_loadu_pd(x + i), _mm_loadu_pd(y + i)));
+    }
+    mulScalar(x + i, y + i, out + i, count - i);
+}
+
+/*
+ * ---------------------------------------- AVX2 ----------------------------------------
+ *
+ * Same shape as the SSE2 versions with four doubles per register.
+ * They're compiled for AVX2 through the target attribute, so the rest of the interpreter doesn't need -mavx2,
+ * and only ever get called after initKernels() has seen the CPU support it.
+ * We stay away from FMA on purpose: a fused multiply-add rounds once instead of twice, so dot() and axpy() would give
+ * different answers on different machines.
+ */
+
+AVX2_TARGET static double sumAVX2(const double *x, int count) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(x + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(x + i + 4));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + sumScalar(x + i, count - i);
+}
+
+AVX2_TARGET static double minAVX2(const double *x, int count) {
+    if (count < 4) return minScalar(x, count);
+
+    __m256d acc = _mm256_loadu_pd(x);
+    int i = 4;
+    for (; i + 4 <= count; i += 4) {
+        acc = _mm256_min_pd(acc, _mm256_loadu_pd(x + i));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double min = minScalar(lanes, 4);
+    for (; i < count; i++) {
+        if (x[i] < min) min = x[i];
+    }
+    return min;
+}
+
+AVX2_TARGET static double maxAVX2(const double *x, int count) {
+    if (count < 4) return maxScalar(x, count);
+
+    __m256d acc = _mm256_loadu_pd(x);
+    int i = 4;
+    for (; i + 4 <= count; i += 4) {
+        acc = _mm256_max_pd(acc, _mm256_loadu_pd(x + i));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    double max = maxScalar(lanes, 4);
+    for (; i < count; i++) {
+        if (x[i] > max) max = x[i];
+    }
+    return max;
+}
+
+AVX2_TARGET static double dotAVX2(const double *x, const double *y, int count) {
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        acc0 = _mm256_add_pd(acc0, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+        acc1 = _mm256_add_pd(acc1, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+    }
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + dotScalar(x + i, y + i, count - i);
+}
+
+AVX2_TARGET static void axpyAVX2(double a, const double *x, double *y, int count) {
+    __m256d scale = _mm256_set1_pd(a);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d product = _mm256_mul_pd(scale, _mm256_loadu_pd(x + i));
+        _mm256_storeu_pd(y + i, _mm256_add_pd(_mm256_loadu_pd(y + i), product));
+    }
+    axpyScalar(a, x + i, y + i, count - i);
+}
+
+AVX2_TARGET static void scaleAVX2(double a, const double *x, double *out, int count) {
+    __m256d scale = _mm256_set1_pd(a);
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(scale, _mm256_loadu_pd(x + i)));
+    }
+    scaleScalar(a, x + i, out + i, count - i);
+}
+
+AVX2_TARGET static void addAVX2(const double *x, const double *y, double *out, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+    addScalar(x + i, y + i, out + i, count - i);
+}
+
+AVX2_TARGET static void subAVX2(const double *x, const double *y, double *out, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_sub_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+    subScalar(x + i, y + i, out + i, count - i);
+}
+
+AVX2_TARGET static void mulAVX2(const double *x, const double *y, double *out, int count) {
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm256_storeu_pd(out + i, _mm256_mul_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i)));
+    }
+    mulScalar(x + i, y + i, out + i, count - i);
+}
+
+#endif
+
+Kernels kernels = {
+    sumScalar, minScalar, maxScalar, dotScalar, axpyScalar, scaleScalar, addScalar, subScalar, mulScalar, "scalar"
+};
+
+/*
+ * Setting FER_KERNELS=scalar (or sse2) in the environment caps the selection, which is handy to compare results or timings
+ * across the different versions on one machine.
+ */
+
+void initKernels() {
+    const char *cap = getenv("FER_KERNELS");
+    if (cap != NULL && strcmp(cap, "scalar") == 0) return;
+
+#ifdef KERNELS_X86
+    kernels = (Kernels){sumSSE2, minSSE2, maxSSE2, dotSSE2, axpySSE2, scaleSSE2, addSSE2, subSSE2, mulSSE2, "sse2"};
+    if (cap != NULL && strcmp(cap, "sse2") == 0) return;
+
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        kernels = (Kernels){sumAVX2, minAVX2, maxAVX2, dotAVX2, axpyAVX2, scaleAVX2, addAVX2, subAVX2, mulAVX2, "avx2"};
+    }
+#endif
+}
@@ -0,0 +1,33 @@
+#ifndef CFER_KERNELS_H
+#define CFER_KERNELS_H
+
+#include "common.h"
+
+/*
+ * Kernels are the tight loops behind the vector natives. They only ever see plain double arrays,
+ * so they don't know (or care) whether the numbers came out of a float array or a list.
+ *
+ * Each kernel has a portable scalar version and, on x86, SSE2 and AVX2 versions.
+ * initKernels() checks what the CPU supports once, at startup, and points the table below at the widest version it can run.
+ * The vector versions keep several partial sums going at once, so reductions can differ from a left to right loop in the last few bits.
+ * The elementwise kernels (add, sub, mul, scale) are safe to call with out pointing at one of the inputs.
+ */
+
+typedef struct {
+    double (*sum)(const double *x, int count);
+    double (*min)(const double *x, int count);
+    double (*max)(const double *x, int count);
+    double (*dot)(const double *x, const double *y, int count);
+    void (*axpy)(double a, const double *x, double *y, int count);
+    void (*scale)(double a, const double *x, double *out, int count);
+    void (*add)(const double *x, const double *y, double *out, int count);
+    void (*sub)(const double *x, const double *y, double *out, int count);
+    void (*mul)(const double *x, const double *y, double *out, int count);
+    const char *name;
+} Kernels;
+
+extern Kernels kernels;
+
+void initKernels();
+
+#endif //CFER_KERNELS_H
@@ -1,6 +1,7 @@
 #include <stdlib.h>
 
 #include "compiler.h"
+#include "jit.h"
 #include "memory.h"
 #include "value.h"
 #include "vm.h"
@@ -130,6 +131,11 @@ static void blackenObject(Obj *object) {
             ObjFunction *function = (ObjFunction*)object;
             markObject((Obj*)function->name);
             markArray(&function->chunk.constants);
+            for (int i = 0; i < function->inlineSiteCount; i++) {
+                markObject((Obj*)function->inlineSites[i].name);
+            }
+            if (function->optimized != NULL) markArray(&function->optimized->constants);
+            if (function->registers != NULL) markArray(&function->registers->constants);
             break;
         }
         case OBJ_INSTANCE: {
@@ -147,7 +153,7 @@ static void blackenObject(Obj *object) {
         }
         case OBJ_DICTIONARY: {
             ObjDictionary *dictionary = (ObjDictionary*)object;
-            markTable(&dictionary->table);
+            markDictionary(&dictionary->items);
             break;
         }
         case OBJ_UPVALUE:
@@ -155,6 +161,9 @@ static void blackenObject(Obj *object) {
             break;
         case OBJ_NATIVE:
         case OBJ_STRING:
+        case OBJ_FLOAT_ARRAY:
+        case OBJ_MATRIX:
+        case OBJ_RANGE:
             break;
     }
 }
@@ -182,7 +191,17 @@ static void freeObject(Obj *object) {
         }
         case OBJ_FUNCTION: {
             ObjFunction *function = (ObjFunction*)object;
+            freeJitCode(function->jit);
             freeChunk(&function->chunk);
+            FREE_ARRAY(InlineSite, function->inlineSites, function->inlineSiteCapacity);
+            if (function->optimized != NULL) {
+                freeChunk(function->optimized);
+                FREE(Chunk, function->optimized);
+            }
+            if (function->registers != NULL) {
+                freeChunk(function->registers);
+                FREE(Chunk, function->registers);
+            }
             FREE(ObjFunction, object);
             break;
         }
@@ -209,10 +228,25 @@ static void freeObject(Obj *object) {
         }
         case OBJ_DICTIONARY: {
             ObjDictionary *dictionary = (ObjDictionary*)object;
-            freeTable(&dictionary->table);
+            freeDictionary(&dictionary->items);
             FREE(ObjDictionary, dictionary);
             break;
         }
+        case OBJ_FLOAT_ARRAY: {
+            ObjFloatArray *array = (ObjFloatArray*)object;
+            FREE_ARRAY(double, array->values, array->count);
+            FREE(ObjFloatArray, object);
+            break;
+        }
+        case OBJ_MATRIX: {
+            ObjMatrix *matrix = (ObjMatrix*)object;
+            FREE_ARRAY(double, matrix->values, matrix->rows * matrix->cols);
+            FREE(ObjMatrix, object);
+            break;
+        }
+        case OBJ_RANGE:
+            FREE(ObjRange, object);
+            break;
         case OBJ_UPVALUE:
             FREE(ObjUpvalue, object);
             break;
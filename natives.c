@@ -4,17 +4,22 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <limits.h>
 
 #include "vm.h"
+#include "kernels.h"
 #include "natives.h"
+#include "sort.h"
 #include "memory.h"
 #include "common.h"
 
 static void ensureListCapacity(ObjList *list, int capacityNeeded) {
     if (list->capacity < capacityNeeded) {
         int oldCapacity = list->capacity;
-        list->capacity = GROW_CAPACITY(oldCapacity);
-        list->values = GROW_ARRAY(Value, list->values, oldCapacity, list->capacity);
+        int capacity = GROW_CAPACITY(oldCapacity);
+        while (capacity < capacityNeeded) capacity = GROW_CAPACITY(capacity);
+        list->values = GROW_ARRAY(Value, list->values, oldCapacity, capacity);
+        list->capacity = capacity;
     }
 }
 
@@ -193,12 +198,12 @@ static Value powNative(int argCount, Value *args) {
 
 static Value floorNative(int argCount, Value *args) {
     if (argCount != 1 || !IS_NUMBER(args[0])) return NIL_VAL;
-    return NUMBER_VAL(floor(AS_NUMBER(args[0])));
+    return INT_OR_NUMBER_VAL(floor(AS_NUMBER(args[0])));
 }
 
 static Value ceilNative(int argCount, Value *args) {
     if (argCount != 1 || !IS_NUMBER(args[0])) return NIL_VAL;
-    return NUMBER_VAL(ceil(AS_NUMBER(args[0])));
+    return INT_OR_NUMBER_VAL(ceil(AS_NUMBER(args[0])));
 }
 
 static Value randomNative(int argCount, Value *args) {
@@ -235,15 +240,21 @@ static Value lengthNative(int argCount, Value *args) {
 
     if (IS_LIST(args[0])) {
         ObjList* list = AS_LIST(args[0]);
-        return NUMBER_VAL(list->count);
+        return INT_VAL(list->count);
     }
     else if (IS_STRING(args[0])) {
         ObjString* str = AS_STRING(args[0]);
-        return NUMBER_VAL(str->length);
+        return INT_VAL(str->length);
     }
     else if (IS_DICTIONARY(args[0])) {
         ObjDictionary* dict = AS_DICTIONARY(args[0]);
-        return NUMBER_VAL(dict->table.count);
+        return INT_VAL(dict->items.count);
+    }
+    else if (IS_FLOAT_ARRAY(args[0])) {
+        return INT_VAL(AS_FLOAT_ARRAY(args[0])->count);
+    }
+    else if (IS_RANGE(args[0])) {
+        return INT_VAL(AS_RANGE(args[0])->count);
     }
 
     return NIL_VAL;
@@ -274,16 +285,15 @@ static Value insertLsNative(int argCount, Value *args) {
     if (argCount != 3 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
 
     ObjList *list = AS_LIST(args[0]);
-    int index = (int)AS_NUMBER(args[1]);
+    double position = AS_NUMBER(args[1]);
     Value item = args[2];
 
-    if (index < 0 || index > list->count) return NIL_VAL;
+    // Checked as a double first: casting NaN or anything outside the int range is undefined
+    if (!(position >= 0 && position <= list->count)) return NIL_VAL;
+    int index = (int)position;
     ensureListCapacity(list, list->count + 1);
 
-    for (int i = list->count; i > index; i--) {
-        list->values[i] = list->values[i - 1];
-    }
-
+    memmove(list->values + index + 1, list->values + index, sizeof(Value) * (list->count - index));
     list->values[index] = item;
     list->count++;
 
@@ -294,20 +304,133 @@ static Value removeLsNative(int argCount, Value *args) {
     if (argCount != 2 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
 
     ObjList *list = AS_LIST(args[0]);
-    int index = (int)AS_NUMBER(args[1]);
+    double position = AS_NUMBER(args[1]);
 
-    if (index < 0 || index >= list->count) return NIL_VAL;
+    if (!(position >= 0 && position < list->count)) return NIL_VAL;
+    int index = (int)position;
 
     Value removed = list->values[index];
-
-    for (int i = index; i < list->count - 1; i++) {
-        list->values[i] = list->values[i + 1];
-    }
+    memmove(list->values + index, list->values + index + 1, sizeof(Value) * (list->count - index - 1));
 
     list->count--;
     return removed;
 }
 
+/*
+ * The bulk operations below size their destination once and copy with memcpy, instead of growing one push at a time.
+ * Copying Values around is fine as far as the GC is concerned: they're just references, and every list involved is reachable
+ * (through args, or pushed on the stack for new ones) before anything gets allocated.
+ */
+
+static ObjList* newListWithCapacity(int capacity) {
+    ObjList *list = newList();
+    push(OBJ_VAL(list));
+    ensureListCapacity(list, capacity);
+    pop();
+    return list;
+}
+
+/*
+ * Negative indices count from the end, and anything out of range is clamped, so slice() never fails on bounds.
+ * An index that isn't finite has nowhere sensible to clamp to (and NaN would get past every comparison into the cast),
+ * so sliceLsNative() turns those away first.
+ */
+
+static int clampIndex(double index, int count) {
+    if (index < 0) index += count;
+    if (index < 0) return 0;
+    if (index > count) return count;
+    return (int)index;
+}
+
+static Value sliceLsNative(int argCount, Value *args) {
+    if (argCount < 2 || argCount > 3 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
+    if (argCount == 3 && !IS_NUMBER(args[2])) return NIL_VAL;
+    if (!isfinite(AS_NUMBER(args[1])) || (argCount == 3 && !isfinite(AS_NUMBER(args[2])))) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    int start = clampIndex(AS_NUMBER(args[1]), list->count);
+    int end = argCount == 3 ? clampIndex(AS_NUMBER(args[2]), list->count) : list->count;
+    int count = end > start ? end - start : 0;
+
+    ObjList *slice = newListWithCapacity(count);
+    if (count > 0) memcpy(slice->values, list->values + start, sizeof(Value) * count);
+    slice->count = count;
+    return OBJ_VAL(slice);
+}
+
+// extend(list, list) is allowed, which is why the source count is read before growing and the source pointer after
+static Value extendLsNative(int argCount, Value *args) {
+    if (argCount != 2 || !IS_LIST(args[0]) || !IS_LIST(args[1])) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    ObjList *source = AS_LIST(args[1]);
+    int count = source->count;
+
+    if (count == 0) return args[0];
+
+    ensureListCapacity(list, list->count + count);
+    memcpy(list->values + list->count, source->values, sizeof(Value) * count);
+    list->count += count;
+    return args[0];
+}
+
+static Value concatLsNative(int argCount, Value *args) {
+    if (argCount != 2 || !IS_LIST(args[0]) || !IS_LIST(args[1])) return NIL_VAL;
+
+    ObjList *a = AS_LIST(args[0]);
+    ObjList *b = AS_LIST(args[1]);
+
+    ObjList *result = newListWithCapacity(a->count + b->count);
+    if (a->count > 0) memcpy(result->values, a->values, sizeof(Value) * a->count);
+    if (b->count > 0) memcpy(result->values + a->count, b->values, sizeof(Value) * b->count);
+    result->count = a->count + b->count;
+    return OBJ_VAL(result);
+}
+
+static Value reverseLsNative(int argCount, Value *args) {
+    if (argCount != 1 || !IS_LIST(args[0])) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    for (int i = 0, j = list->count - 1; i < j; i++, j--) {
+        Value tmp = list->values[i];
+        list->values[i] = list->values[j];
+        list->values[j] = tmp;
+    }
+    return args[0];
+}
+
+static Value fillLsNative(int argCount, Value *args) {
+    if (argCount != 2 || !IS_NUMBER(args[0])) return NIL_VAL;
+    double size = AS_NUMBER(args[0]);
+    // The same check as floatArray(), written so NaN fails it too
+    if (!(size >= 0 && size <= INT_MAX / 2) || size != floor(size)) {
+        return nativeError("fill() count must be a whole number from 0 to %d.", INT_MAX / 2);
+    }
+
+    int count = (int)size;
+    ObjList *list = newListWithCapacity(count);
+    for (int i = 0; i < count; i++) {
+        list->values[i] = args[1];
+    }
+    list->count = count;
+    return OBJ_VAL(list);
+}
+
+// reserve() only ever grows the backing array, it never changes the count or shrinks
+static Value reserveLsNative(int argCount, Value *args) {
+    if (argCount != 2 || !IS_LIST(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    double capacity = AS_NUMBER(args[1]);
+    if (capacity > list->capacity && capacity <= INT_MAX / 2) {
+        int oldCapacity = list->capacity;
+        list->values = GROW_ARRAY(Value, list->values, oldCapacity, (int)capacity);
+        list->capacity = (int)capacity;
+    }
+    return args[0];
+}
+
 static Value containsLsNative(int argCount, Value *args) {
     if (argCount != 2 || !IS_LIST(args[0])) return NIL_VAL;
 
@@ -329,15 +452,12 @@ static Value keysDctNative(int argCount, Value *args) {
     ObjDictionary *dict = AS_DICTIONARY(args[0]);
     ObjList *list = newList();
     push(OBJ_VAL(list));
+    ensureListCapacity(list, dict->items.count);
 
-    for (int i = 0; i < dict->table.capacity; i++) {
-        Entry *entry = &dict->table.entries[i];
-        if (entry->key != NULL) {
-            Value keyVal = OBJ_VAL(entry->key);
-            push(keyVal);
-            ensureListCapacity(list, list->count + 1);
-            list->values[list->count++] = keyVal;
-            pop();
+    for (int i = 0; i < dict->items.used; i++) {
+        DictionaryEntry *entry = &dict->items.entries[i];
+        if (!IS_EMPTY(entry->key)) {
+            list->values[list->count++] = entry->key;
         }
     }
 
@@ -345,23 +465,409 @@ static Value keysDctNative(int argCount, Value *args) {
     return OBJ_VAL(list);
 }
 
+static int callableArity(Value callee) {
+    if (IS_CLOSURE(callee)) return AS_CLOSURE(callee)->function->arity;
+    if (IS_BOUND_METHOD(callee)) return AS_BOUND_METHOD(callee)->method->function->arity;
+    if (IS_NATIVE(callee)) return AS_NATIVE(callee)->arity;
+    if (IS_CLASS(callee)) {
+        Value initializer;
+        if (tableGet(&AS_CLASS(callee)->methods, vm.initString, &initializer)) return AS_CLOSURE(initializer)->function->arity;
+        return 0;
+    }
+    return -1;
+}
+
+// A private copy of a list, left on the stack. It keeps every element alive even if a callback empties the original list.
+static ObjList* pushSnapshot(ObjList *list) {
+    ObjList *snapshot = newList();
+    push(OBJ_VAL(snapshot));
+    ensureListCapacity(snapshot, list->count);
+    if (list->count > 0) memcpy(snapshot->values, list->values, sizeof(Value) * list->count);
+    snapshot->count = list->count;
+    return snapshot;
+}
+
+static void replaceContents(ObjList *list, Value *values, int count) {
+    ensureListCapacity(list, count);
+    if (count > 0) memcpy(list->values, values, sizeof(Value) * count);
+    list->count = count;
+}
+
+/*
+ * The key function runs exactly once per element. The keys are collected in a list on the stack so the GC can see them
+ * while we're still calling out for the rest, then the (key, element) pairs are sorted without calling back into Fer at all.
+ */
+
+static Value sortByKey(Value listValue, Value keyFunction) {
+    ObjList *list = AS_LIST(listValue);
+    ObjList *snapshot = pushSnapshot(list);
+    int count = snapshot->count;
+
+    ObjList *keys = newList();
+    push(OBJ_VAL(keys));
+    ensureListCapacity(keys, count);
+
+    bool numbers = true;
+    bool strings = true;
+    for (int i = 0; i < count; i++) {
+        Value key;
+        if (!vmCall(keyFunction, 1, &snapshot->values[i], &key)) return NIL_VAL;
+
+        keys->values[keys->count++] = key;
+        if (!IS_NUMBER(key)) numbers = false;
+        if (!IS_STRING(key)) strings = false;
+    }
+
+    if (!numbers && !strings) {
+        return nativeError("sort() key function must return only numbers or only strings.");
+    }
+
+    KeyedValue *pairs = malloc(sizeof(KeyedValue) * (count > 0 ? count : 1));
+    for (int i = 0; i < count; i++) {
+        pairs[i].key = keys->values[i];
+        pairs[i].value = snapshot->values[i];
+        pairs[i].index = i;
+    }
+
+    if (numbers) {
+        sortKeyedNumbers(pairs, count);
+    } else {
+        sortKeyedStrings(pairs, count);
+    }
+
+    for (int i = 0; i < count; i++) {
+        snapshot->values[i] = pairs[i].value;
+    }
+    free(pairs);
+
+    replaceContents(list, snapshot->values, count);
+    pop(); // keys
+    pop(); // snapshot
+    return listValue;
+}
+
+/*
+ * The comparator can allocate (and so collect), and sorting briefly holds elements only in C locals,
+ * so we sort a scratch copy while the snapshot keeps every element reachable.
+ */
+
+static Value sortWithCallback(Value listValue, Value comparator) {
+    ObjList *list = AS_LIST(listValue);
+    ObjList *snapshot = pushSnapshot(list);
+    int count = snapshot->count;
+
+    Value *work = malloc(sizeof(Value) * (count > 0 ? count : 1));
+    if (count > 0) memcpy(work, snapshot->values, sizeof(Value) * count);
+
+    if (!sortWithComparator(work, count, comparator)) {
+        free(work);
+        return NIL_VAL;
+    }
+
+    replaceContents(list, work, count);
+    free(work);
+    pop(); // snapshot
+    return listValue;
+}
+
+/*
+ * sort(list) sorts a list of numbers or a list of strings in place and returns it.
+ * Mixing the two (or anything else) is a runtime error, there's no order between them that wouldn't be surprising.
+ *
+ * sort(list, fn) takes either a key function (one parameter) that maps each element to the number or string to sort it by,
+ * or a comparator (two parameters) that decides the order of any two elements.
+ */
+
+static Value sortLsNative(int argCount, Value *args) {
+    if (argCount < 1 || argCount > 2 || !IS_LIST(args[0])) return nativeError("sort() expects a list.");
+
+    ObjList *list = AS_LIST(args[0]);
+    if (argCount == 2) {
+        int arity = callableArity(args[1]);
+        if (arity == 1) return sortByKey(args[0], args[1]);
+        if (arity == 2) return sortWithCallback(args[0], args[1]);
+        return nativeError("sort() expects a key function with one parameter or a comparator with two.");
+    }
+
+    if (list->count < 2) return args[0];
+
+    bool numbers = true;
+    bool strings = true;
+    for (int i = 0; i < list->count && (numbers || strings); i++) {
+        if (!IS_NUMBER(list->values[i])) numbers = false;
+        if (!IS_STRING(list->values[i])) strings = false;
+    }
+
+    if (numbers) {
+        sortNumbers(list->values, list->count);
+    } else if (strings) {
+        sortStrings(list->values, list->count);
+    } else {
+        return nativeError("sort() can only sort a list of numbers or a list of strings.");
+    }
+    return args[0];
+}
+
+/*
+ * The higher-order natives walk the live list, so a callback that pushes to or pops from it changes what's left to visit, just like a for loop would.
+ * Results go into the result list, which sits on the stack, so they stay reachable while the next callback runs.
+ * Its capacity is reserved for the elements the list has to begin with, but a callback that grows the list means it has to grow too,
+ * and that can run the GC. So a value waiting to be stored, or an element filter() is holding on to, sits on the stack as well
+ * until it's in the result: the callback may have removed the element from the list and overwritten its own parameter.
+ * The function is copied out of args before the first call, a callback can grow the VM stack and args would point into the old one.
+ */
+
+static bool checkCallback(const char *name, int argCount, int expected, Value *args) {
+    if (argCount == expected && IS_LIST(args[0]) && callableArity(args[1]) >= 0) return true;
+    nativeError("%s() expects a list and a function.", name);
+    return false;
+}
+
+static Value mapLsNative(int argCount, Value *args) {
+    if (!checkCallback("map", argCount, 2, args)) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    Value function = args[1];
+    ObjList *result = newList();
+    push(OBJ_VAL(result));
+    ensureListCapacity(result, list->count);
+
+    for (int i = 0; i < list->count; i++) {
+        Value mapped;
+        if (!vmCall(function, 1, &list->values[i], &mapped)) return NIL_VAL;
+
+        push(mapped);
+        ensureListCapacity(result, result->count + 1);
+        result->values[result->count++] = mapped;
+        pop();
+    }
+
+    pop();
+    return OBJ_VAL(result);
+}
+
+static Value filterLsNative(int argCount, Value *args) {
+    if (!checkCallback("filter", argCount, 2, args)) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    Value function = args[1];
+    ObjList *result = newList();
+    push(OBJ_VAL(result));
+    ensureListCapacity(result, list->count);
+
+    for (int i = 0; i < list->count; i++) {
+        Value element = list->values[i];
+        push(element);
+        Value keep;
+        if (!vmCall(function, 1, &element, &keep)) return NIL_VAL;
+
+        if (!isFalsey(keep)) {
+            ensureListCapacity(result, result->count + 1);
+            result->values[result->count++] = element;
+        }
+        pop();
+    }
+
+    pop();
+    return OBJ_VAL(result);
+}
+
+/*
+ * reduce(list, fn, initial) folds from the left, calling fn(accumulator, element).
+ * Without an initial value the first element is used and the fold starts from the second, which makes an empty list an error.
+ */
+
+static Value reduceLsNative(int argCount, Value *args) {
+    if (argCount != 2 && argCount != 3) return nativeError("reduce() expects a list, a function and an optional initial value.");
+    if (!checkCallback("reduce", 2, 2, args)) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    Value function = args[1];
+    int start = 0;
+    Value accumulator;
+    if (argCount == 3) {
+        accumulator = args[2];
+    } else if (list->count > 0) {
+        accumulator = list->values[0];
+        start = 1;
+    } else {
+        return nativeError("reduce() of an empty list with no initial value.");
+    }
+
+    for (int i = start; i < list->count; i++) {
+        Value callArgs[2] = {accumulator, list->values[i]};
+        if (!vmCall(function, 2, callArgs, &accumulator)) return NIL_VAL;
+    }
+
+    return accumulator;
+}
+
+static Value forEachLsNative(int argCount, Value *args) {
+    if (!checkCallback("forEach", argCount, 2, args)) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    Value function = args[1];
+    for (int i = 0; i < list->count; i++) {
+        Value ignored;
+        if (!vmCall(function, 1, &list->values[i], &ignored)) return NIL_VAL;
+    }
+
+    return NIL_VAL;
+}
+
+// any() stops at the first element the function accepts, all() at the first one it rejects
+static Value anyLsNative(int argCount, Value *args) {
+    if (!checkCallback("any", argCount, 2, args)) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    Value function = args[1];
+    for (int i = 0; i < list->count; i++) {
+        Value result;
+        if (!vmCall(function, 1, &list->values[i], &result)) return NIL_VAL;
+        if (!isFalsey(result)) return BOOL_VAL(true);
+    }
+
+    return BOOL_VAL(false);
+}
+
+static Value allLsNative(int argCount, Value *args) {
+    if (!checkCallback("all", argCount, 2, args)) return NIL_VAL;
+
+    ObjList *list = AS_LIST(args[0]);
+    Value function = args[1];
+    for (int i = 0; i < list->count; i++) {
+        Value result;
+        if (!vmCall(function, 1, &list->values[i], &result)) return NIL_VAL;
+        if (isFalsey(result)) return BOOL_VAL(false);
+    }
+
+    return BOOL_VAL(true);
+}
+
 static Value hasKeyDctNative(int argCount, Value *args) {
-    if (argCount != 2 || !IS_DICTIONARY(args[0]) || !IS_STRING(args[1])) return NIL_VAL;
+    if (argCount != 2 || !IS_DICTIONARY(args[0])) return NIL_VAL;
 
     ObjDictionary *dict = AS_DICTIONARY(args[0]);
-    ObjString *key = AS_STRING(args[1]);
     Value dummy;
 
-    return BOOL_VAL(tableGet(&dict->table, key, &dummy));
+    return BOOL_VAL(dictionaryGet(&dict->items, args[1], &dummy));
 }
 
 static Value deleteKeyDctNative(int argCount, Value *args) {
-    if (argCount != 2 || !IS_DICTIONARY(args[0]) || !IS_STRING(args[1])) return NIL_VAL;
+    if (argCount != 2 || !IS_DICTIONARY(args[0])) return NIL_VAL;
 
     ObjDictionary *dict = AS_DICTIONARY(args[0]);
-    ObjString *key = AS_STRING(args[1]);
 
-    return BOOL_VAL(tableDelete(&dict->table, key));
+    return BOOL_VAL(dictionaryDelete(&dict->items, args[1]));
+}
+
+/*
+ * floatArray(list) packs a list of numbers into a float array, floatArray(n, fill) makes one of n copies of fill (0 if left out).
+ * A size that isn't a whole number in range (negative, fractional, NaN, too big to allocate) is a runtime error.
+ * Anything else, including a list with a non number in it, gives back nil.
+ */
+
+static Value floatArrayNative(int argCount, Value *args) {
+    if (argCount < 1 || argCount > 2) return NIL_VAL;
+
+    if (argCount == 1 && IS_LIST(args[0])) {
+        ObjList *list = AS_LIST(args[0]);
+        for (int i = 0; i < list->count; i++) {
+            if (!IS_NUMBER(list->values[i])) return NIL_VAL;
+        }
+
+        ObjFloatArray *array = newFloatArray(list->count);
+        for (int i = 0; i < list->count; i++) {
+            array->values[i] = AS_NUMBER(list->values[i]);
+        }
+        return OBJ_VAL(array);
+    }
+
+    if (!IS_NUMBER(args[0])) return NIL_VAL;
+    double size = AS_NUMBER(args[0]);
+    // Written so NaN fails it too
+    if (!(size >= 0 && size <= INT_MAX / 2) || size != floor(size)) {
+        return nativeError("floatArray() size must be a whole number from 0 to %d.", INT_MAX / 2);
+    }
+    if (argCount == 2 && !IS_NUMBER(args[1])) return NIL_VAL;
+
+    double fill = argCount == 2 ? AS_NUMBER(args[1]) : 0;
+    ObjFloatArray *array = newFloatArray((int)size);
+    if (fill != 0) {
+        for (int i = 0; i < array->count; i++) {
+            array->values[i] = fill;
+        }
+    }
+    return OBJ_VAL(array);
+}
+
+static Value matrixToList(ObjMatrix *matrix) {
+    ObjList *rows = newList();
+    push(OBJ_VAL(rows));
+    ensureListCapacity(rows, matrix->rows);
+
+    for (int row = 0; row < matrix->rows; row++) {
+        ObjList *list = newList();
+        rows->values[rows->count++] = OBJ_VAL(list);
+        ensureListCapacity(list, matrix->cols);
+        for (int col = 0; col < matrix->cols; col++) {
+            list->values[list->count++] = NUMBER_VAL(matrix->values[row * matrix->cols + col]);
+        }
+    }
+
+    pop();
+    return OBJ_VAL(rows);
+}
+
+static Value rangeToList(ObjRange *range) {
+    ObjList *list = newList();
+    push(OBJ_VAL(list));
+    ensureListCapacity(list, range->count);
+
+    for (int i = 0; i < range->count; i++) {
+        list->values[list->count++] = INT_OR_NUMBER_VAL(range->start + i * range->step);
+    }
+
+    pop();
+    return OBJ_VAL(list);
+}
+
+static Value toListNative(int argCount, Value *args) {
+    if (argCount != 1) return NIL_VAL;
+    if (IS_MATRIX(args[0])) return matrixToList(AS_MATRIX(args[0]));
+    if (IS_RANGE(args[0])) return rangeToList(AS_RANGE(args[0]));
+    if (!IS_FLOAT_ARRAY(args[0])) return NIL_VAL;
+
+    ObjFloatArray *array = AS_FLOAT_ARRAY(args[0]);
+    ObjList *list = newList();
+    push(OBJ_VAL(list));
+    ensureListCapacity(list, array->count);
+
+    for (int i = 0; i < array->count; i++) {
+        list->values[list->count++] = NUMBER_VAL(array->values[i]);
+    }
+
+    pop();
+    return OBJ_VAL(list);
+}
+
+/*
+ * range(end), range(start, end) or range(start, end, step) is the numbers from start (default 0) up to but not including end,
+ * step (default 1) apart. A negative step counts down. The numbers are never stored, so range(1000000) costs the same as range(10).
+ */
+
+static Value rangeNative(int argCount, Value *args) {
+    if (argCount < 1 || argCount > 3) return nativeError("range() takes 1 to 3 arguments but got %d.", argCount);
+    for (int i = 0; i < argCount; i++) {
+        if (!IS_NUMBER(args[i])) return nativeError("range() arguments must be numbers.");
+    }
+
+    double start = argCount == 1 ? 0 : AS_NUMBER(args[0]);
+    double end = argCount == 1 ? AS_NUMBER(args[0]) : AS_NUMBER(args[1]);
+    double step = argCount == 3 ? AS_NUMBER(args[2]) : 1;
+    if (step == 0 || isnan(step)) return nativeError("range() step must not be 0.");
+
+    return OBJ_VAL(newRange(start, end, step));
 }
 
 /*
@@ -380,6 +886,9 @@ static Value typeofNative(int argCount, Value *args) {
     else if (IS_STRING(v)) typeStr = "string";
     else if (IS_LIST(v)) typeStr = "list";
     else if (IS_DICTIONARY(v)) typeStr = "dictionary";
+    else if (IS_FLOAT_ARRAY(v)) typeStr = "floatArray";
+    else if (IS_MATRIX(v)) typeStr = "matrix";
+    else if (IS_RANGE(v)) typeStr = "range";
     else if (IS_FUNCTION(v) || IS_CLOSURE(v) || IS_NATIVE(v) || IS_BOUND_METHOD(v)) typeStr = "function";
     else if (IS_CLASS(v)) typeStr = "class";
     else if (IS_INSTANCE(v)) typeStr = "instance";
@@ -465,6 +974,542 @@ static Value writeFileNative(int argCount, Value *args) {
     return BOOL_VAL(true);
 }
 
+/*
+ * ----------------------------------------- VECTOR LIBRARY -----------------------------------------
+ *
+ * A vector is either a float array or a list holding nothing but numbers.
+ * The actual loops live in kernels.c, all we do here is find a plain double array to hand them.
+ *
+ * A float array already is one. With NaN boxing, so is a list of numbers: a boxed double is just its bits,
+ * so once we've checked every element is a number we can pass list->values straight through without copying.
+ * Numbers stored in the integer encoding are the exception, viewVector() rewrites those elements as the equal double first.
+ * That's invisible to the program (the value is the same number either way) and leaves the list ready for the next call.
+ * Without NaN boxing the numbers have to be unpacked into a scratch buffer first (and packed back if the kernel wrote to them).
+ *
+ * Unlike most natives, these report a runtime error for bad arguments instead of returning nil,
+ * a sum() that quietly comes back nil is much harder to track down than one that stops the program.
+ */
+
+typedef struct {
+    double *values;
+    int count;
+    bool copied;
+} VectorView;
+
+static bool viewVector(const char *name, Value value, VectorView *view) {
+    if (IS_FLOAT_ARRAY(value)) {
+        ObjFloatArray *array = AS_FLOAT_ARRAY(value);
+        view->values = array->values;
+        view->count = array->count;
+        view->copied = false;
+        return true;
+    }
+
+    if (!IS_LIST(value)) {
+        nativeError("%s() expects a float array or a list of numbers.", name);
+        return false;
+    }
+
+    ObjList *list = AS_LIST(value);
+    for (int i = 0; i < list->count; i++) {
+        if (!IS_NUMBER(list->values[i])) {
+            nativeError("%s() expects a list of numbers, element %d is not a number.", name, i);
+            return false;
+        }
+    }
+
+    view->count = list->count;
+#ifdef NAN_BOXING
+    for (int i = 0; i < list->count; i++) {
+        if (IS_INT(list->values[i])) list->values[i] = NUMBER_VAL(AS_INT(list->values[i]));
+    }
+    view->values = (double*)list->values;
+    view->copied = false;
+#else
+    view->values = malloc(sizeof(double) * (list->count > 0 ? list->count : 1));
+    for (int i = 0; i < list->count; i++) {
+        view->values[i] = AS_NUMBER(list->values[i]);
+    }
+    view->copied = true;
+#endif
+    return true;
+}
+
+// Writes a view that a kernel modified back into the list it was unpacked from, then lets go of the scratch buffer.
+static void releaseVector(Value value, VectorView *view, bool modified) {
+    if (!view->copied) return;
+
+    if (modified) {
+        ObjList *list = AS_LIST(value);
+        for (int i = 0; i < view->count; i++) {
+            list->values[i] = NUMBER_VAL(view->values[i]);
+        }
+    }
+    free(view->values);
+}
+
+/*
+ * Results come back as the same kind of vector as the first argument, written through a VectorView like the arguments are read.
+ * beginVectorResult() allocates the result, keeps it on the stack so the GC can see it, and points the view where the kernel should write.
+ * A list's count is only set in endVectorResult(), after the kernel has filled it with numbers, so the GC never walks half written Values.
+ */
+
+static Value beginVectorResult(Value like, int count, VectorView *out) {
+    out->count = count;
+    if (IS_FLOAT_ARRAY(like)) {
+        ObjFloatArray *array = newFloatArray(count);
+        push(OBJ_VAL(array));
+        out->values = array->values;
+        out->copied = false;
+        return OBJ_VAL(array);
+    }
+
+    ObjList *list = newList();
+    push(OBJ_VAL(list));
+    ensureListCapacity(list, count);
+#ifdef NAN_BOXING
+    out->values = (double*)list->values;
+    out->copied = false;
+#else
+    out->values = malloc(sizeof(double) * (count > 0 ? count : 1));
+    out->copied = true;
+#endif
+    return OBJ_VAL(list);
+}
+
+static Value endVectorResult(Value result, VectorView *out) {
+    if (IS_LIST(result)) {
+        releaseVector(result, out, true);
+        AS_LIST(result)->count = out->count;
+    }
+    pop();
+    return result;
+}
+
+static Value sumNative(int argCount, Value *args) {
+    VectorView x;
+    if (argCount != 1 || !viewVector("sum", args[0], &x)) return NIL_VAL;
+
+    double sum = kernels.sum(x.values, x.count);
+    releaseVector(args[0], &x, false);
+    return NUMBER_VAL(sum);
+}
+
+static Value meanNative(int argCount, Value *args) {
+    VectorView x;
+    if (argCount != 1 || !viewVector("mean", args[0], &x)) return NIL_VAL;
+    if (x.count == 0) {
+        releaseVector(args[0], &x, false);
+        return nativeError("mean() of an empty vector.");
+    }
+
+    double mean = kernels.sum(x.values, x.count) / x.count;
+    releaseVector(args[0], &x, false);
+    return NUMBER_VAL(mean);
+}
+
+static Value minNative(int argCount, Value *args) {
+    VectorView x;
+    if (argCount != 1 || !viewVector("min", args[0], &x)) return NIL_VAL;
+    if (x.count == 0) {
+        releaseVector(args[0], &x, false);
+        return nativeError("min() of an empty vector.");
+    }
+
+    double min = kernels.min(x.values, x.count);
+    releaseVector(args[0], &x, false);
+    return NUMBER_VAL(min);
+}
+
+static Value maxNative(int argCount, Value *args) {
+    VectorView x;
+    if (argCount != 1 || !viewVector("max", args[0], &x)) return NIL_VAL;
+    if (x.count == 0) {
+        releaseVector(args[0], &x, false);
+        return nativeError("max() of an empty vector.");
+    }
+
+    double max = kernels.max(x.values, x.count);
+    releaseVector(args[0], &x, false);
+    return NUMBER_VAL(max);
+}
+
+static Value dotNative(int argCount, Value *args) {
+    if (argCount != 2) return nativeError("dot() expects two vectors.");
+
+    VectorView x, y;
+    if (!viewVector("dot", args[0], &x)) return NIL_VAL;
+    if (!viewVector("dot", args[1], &y)) {
+        releaseVector(args[0], &x, false);
+        return NIL_VAL;
+    }
+
+    Value result;
+    if (x.count != y.count) {
+        result = nativeError("dot() expects vectors of the same length, got %d and %d.", x.count, y.count);
+    } else {
+        result = NUMBER_VAL(kernels.dot(x.values, y.values, x.count));
+    }
+
+    releaseVector(args[0], &x, false);
+    releaseVector(args[1], &y, false);
+    return result;
+}
+
+// axpy(a, x, y) does y = a * x + y in place and returns y.
+static Value axpyNative(int argCount, Value *args) {
+    if (argCount != 3 || !IS_NUMBER(args[0])) return nativeError("axpy() expects a number and two vectors.");
+
+    VectorView x, y;
+    if (!viewVector("axpy", args[1], &x)) return NIL_VAL;
+    if (!viewVector("axpy", args[2], &y)) {
+        releaseVector(args[1], &x, false);
+        return NIL_VAL;
+    }
+
+    bool sameLength = x.count == y.count;
+    if (sameLength) {
+        kernels.axpy(AS_NUMBER(args[0]), x.values, y.values, x.count);
+    }
+
+    releaseVector(args[1], &x, false);
+    releaseVector(args[2], &y, sameLength);
+
+    if (!sameLength) return nativeError("axpy() expects vectors of the same length, got %d and %d.", x.count, y.count);
+    return args[2];
+}
+
+static Value scaleNative(int argCount, Value *args) {
+    if (argCount != 2 || !IS_NUMBER(args[1])) return nativeError("scale() expects a vector and a number.");
+
+    VectorView x;
+    if (!viewVector("scale", args[0], &x)) return NIL_VAL;
+
+    VectorView out;
+    Value result = beginVectorResult(args[0], x.count, &out);
+    kernels.scale(AS_NUMBER(args[1]), x.values, out.values, x.count);
+    releaseVector(args[0], &x, false);
+    return endVectorResult(result, &out);
+}
+
+static Value addNative(int argCount, Value *args) {
+    if (argCount != 2) return nativeError("add() expects two vectors.");
+
+    VectorView x, y;
+    if (!viewVector("add", args[0], &x)) return NIL_VAL;
+    if (!viewVector("add", args[1], &y)) {
+        releaseVector(args[0], &x, false);
+        return NIL_VAL;
+    }
+
+    if (x.count != y.count) {
+        releaseVector(args[0], &x, false);
+        releaseVector(args[1], &y, false);
+        return nativeError("add() expects vectors of the same length, got %d and %d.", x.count, y.count);
+    }
+
+    VectorView out;
+    Value result = beginVectorResult(args[0], x.count, &out);
+    kernels.add(x.values, y.values, out.values, x.count);
+    releaseVector(args[0], &x, false);
+    releaseVector(args[1], &y, false);
+    return endVectorResult(result, &out);
+}
+
+/*
+ * ----------------------------------------- MATRIX LIBRARY -----------------------------------------
+ *
+ * Matrices are dense, row-major and made of doubles (see ObjMatrix).
+ * Everything row shaped goes through the same kernels as the vector library, so it picks up SSE2/AVX2 for free.
+ */
+
+#define MATRIX_BLOCK 64
+
+static bool checkMatrix(const char *name, Value value) {
+    if (IS_MATRIX(value)) return true;
+    nativeError("%s() expects a matrix.", name);
+    return false;
+}
+
+static bool checkSameShape(const char *name, ObjMatrix *a, ObjMatrix *b) {
+    if (a->rows == b->rows && a->cols == b->cols) return true;
+    nativeError("%s() expects matrices of the same shape, got %dx%d and %dx%d.", name, a->rows, a->cols, b->rows, b->cols);
+    return false;
+}
+
+static bool checkIndex(const char *name, ObjMatrix *matrix, Value row, Value col) {
+    if (!IS_NUMBER(row) || !IS_NUMBER(col)) {
+        nativeError("%s() expects a row and column number.", name);
+        return false;
+    }
+
+    // Compared as doubles, so NaN and huge indices are out of bounds before anything casts them to int
+    double r = AS_NUMBER(row);
+    double c = AS_NUMBER(col);
+    if (!(r >= 0 && r < matrix->rows && c >= 0 && c < matrix->cols)) {
+        nativeError("%s() index (%g, %g) is out of bounds for a %dx%d matrix.", name, r, c, matrix->rows, matrix->cols);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Like floatArray()'s size, dimensions have to be whole numbers (written so NaN fails too) and the matrix can hold
+ * at most INT_MAX / 2 elements, so asking for a huge one is a runtime error instead of an allocation that takes the process down.
+ */
+
+static bool checkDimensions(const char *name, double rows, double cols) {
+    if (!(rows >= 0 && rows <= INT_MAX / 2 && cols >= 0 && cols <= INT_MAX / 2)
+        || rows != floor(rows) || cols != floor(cols) || rows * cols > INT_MAX / 2) {
+        nativeError("%s() dimensions %gx%g are not valid, they must be whole numbers with at most %d elements.", name, rows, cols, INT_MAX / 2);
+        return false;
+    }
+    return true;
+}
+
+/*
+ * matrix(rows, cols) and matrix(rows, cols, fill) make a matrix of one value (0 if left out),
+ * matrix(list) copies a list of rows, where every row is a list of numbers or a float array of the same length.
+ */
+
+static Value matrixNative(int argCount, Value *args) {
+    if (argCount == 1 && IS_LIST(args[0])) {
+        ObjList *rows = AS_LIST(args[0]);
+        int cols = 0;
+
+        for (int row = 0; row < rows->count; row++) {
+            VectorView view;
+            if (!viewVector("matrix", rows->values[row], &view)) return NIL_VAL;
+            releaseVector(rows->values[row], &view, false);
+
+            if (row == 0) cols = view.count;
+            if (view.count != cols) {
+                return nativeError("matrix() rows must all have the same length, row %d has %d instead of %d.", row, view.count, cols);
+            }
+        }
+
+        if (!checkDimensions("matrix", rows->count, cols)) return NIL_VAL;
+
+        ObjMatrix *matrix = newMatrix(rows->count, cols);
+        for (int row = 0; row < rows->count; row++) {
+            VectorView view;
+            viewVector("matrix", rows->values[row], &view);
+            if (cols > 0) memcpy(matrix->values + row * cols, view.values, sizeof(double) * cols);
+            releaseVector(rows->values[row], &view, false);
+        }
+        return OBJ_VAL(matrix);
+    }
+
+    if ((argCount != 2 && argCount != 3) || !IS_NUMBER(args[0]) || !IS_NUMBER(args[1]) || (argCount == 3 && !IS_NUMBER(args[2]))) {
+        return nativeError("matrix() expects a list of rows, or a row count, a column count and an optional fill value.");
+    }
+
+    if (!checkDimensions("matrix", AS_NUMBER(args[0]), AS_NUMBER(args[1]))) return NIL_VAL;
+    int rows = (int)AS_NUMBER(args[0]);
+    int cols = (int)AS_NUMBER(args[1]);
+
+    ObjMatrix *matrix = newMatrix(rows, cols);
+    double fill = argCount == 3 ? AS_NUMBER(args[2]) : 0;
+    if (fill != 0) {
+        for (int i = 0; i < rows * cols; i++) {
+            matrix->values[i] = fill;
+        }
+    }
+    return OBJ_VAL(matrix);
+}
+
+static Value identityNative(int argCount, Value *args) {
+    if (argCount != 1 || !IS_NUMBER(args[0])) return nativeError("identity() expects a size.");
+
+    if (!checkDimensions("identity", AS_NUMBER(args[0]), AS_NUMBER(args[0]))) return NIL_VAL;
+    int size = (int)AS_NUMBER(args[0]);
+
+    ObjMatrix *matrix = newMatrix(size, size);
+    for (int i = 0; i < size; i++) {
+        matrix->values[i * size + i] = 1;
+    }
+    return OBJ_VAL(matrix);
+}
+
+static Value shapeNative(int argCount, Value *args) {
+    if (argCount != 1 || !checkMatrix("shape", args[0])) return NIL_VAL;
+
+    ObjMatrix *matrix = AS_MATRIX(args[0]);
+    ObjList *list = newList();
+    push(OBJ_VAL(list));
+    ensureListCapacity(list, 2);
+    list->values[list->count++] = NUMBER_VAL(matrix->rows);
+    list->values[list->count++] = NUMBER_VAL(matrix->cols);
+    pop();
+    return OBJ_VAL(list);
+}
+
+static Value mgetNative(int argCount, Value *args) {
+    if (argCount != 3 || !checkMatrix("mget", args[0])) return NIL_VAL;
+
+    ObjMatrix *matrix = AS_MATRIX(args[0]);
+    if (!checkIndex("mget", matrix, args[1], args[2])) return NIL_VAL;
+
+    return NUMBER_VAL(matrix->values[(int)AS_NUMBER(args[1]) * matrix->cols + (int)AS_NUMBER(args[2])]);
+}
+
+static Value msetNative(int argCount, Value *args) {
+    if (argCount != 4 || !checkMatrix("mset", args[0])) return NIL_VAL;
+
+    ObjMatrix *matrix = AS_MATRIX(args[0]);
+    if (!checkIndex("mset", matrix, args[1], args[2])) return NIL_VAL;
+    if (!IS_NUMBER(args[3])) return nativeError("mset() can only store numbers.");
+
+    matrix->values[(int)AS_NUMBER(args[1]) * matrix->cols + (int)AS_NUMBER(args[2])] = AS_NUMBER(args[3]);
+    return args[3];
+}
+
+static Value rowNative(int argCount, Value *args) {
+    if (argCount != 2 || !checkMatrix("row", args[0])) return NIL_VAL;
+
+    ObjMatrix *matrix = AS_MATRIX(args[0]);
+    if (!checkIndex("row", matrix, args[1], NUMBER_VAL(0))) return NIL_VAL;
+
+    ObjFloatArray *row = newFloatArray(matrix->cols);
+    memcpy(row->values, matrix->values + (int)AS_NUMBER(args[1]) * matrix->cols, sizeof(double) * matrix->cols);
+    return OBJ_VAL(row);
+}
+
+/*
+ * The naive triple loop walks down a column of b for every element of the result, which touches a new cache line on every step
+ * once b stops fitting in cache. Instead we go i-k-j, so the innermost loop runs along a row of b and a row of c at the same time:
+ * c[i][j..] += a[i][k] * b[k][j..], which is exactly one axpy.
+ * On top of that the loops are tiled in MATRIX_BLOCK sized blocks, so the block of b we're using stays in cache
+ * while every row of a in the current block passes over it.
+ */
+
+static void multiplyBlocked(ObjMatrix *a, ObjMatrix *b, ObjMatrix *c) {
+    int n = a->rows;
+    int m = a->cols;
+    int p = b->cols;
+
+    for (int ii = 0; ii < n; ii += MATRIX_BLOCK) {
+        int iEnd = ii + MATRIX_BLOCK < n ? ii + MATRIX_BLOCK : n;
+
+        for (int kk = 0; kk < m; kk += MATRIX_BLOCK) {
+            int kEnd = kk + MATRIX_BLOCK < m ? kk + MATRIX_BLOCK : m;
+
+            for (int jj = 0; jj < p; jj += MATRIX_BLOCK) {
+                int width = jj + MATRIX_BLOCK < p ? MATRIX_BLOCK : p - jj;
+
+                for (int i = ii; i < iEnd; i++) {
+                    double *cRow = c->values + i * p + jj;
+                    for (int k = kk; k < kEnd; k++) {
+                        double scale = a->values[i * m + k];
+                        if (scale == 0) continue;
+                        kernels.axpy(scale, b->values + k * p + jj, cRow, width);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static Value matmulNative(int argCount, Value *args) {
+    if (argCount != 2 || !checkMatrix("matmul", args[0]) || !checkMatrix("matmul", args[1])) return NIL_VAL;
+
+    ObjMatrix *a = AS_MATRIX(args[0]);
+    ObjMatrix *b = AS_MATRIX(args[1]);
+    if (a->cols != b->rows) {
+        return nativeError("matmul() can't multiply a %dx%d matrix by a %dx%d one.", a->rows, a->cols, b->rows, b->cols);
+    }
+
+    ObjMatrix *c = newMatrix(a->rows, b->cols);
+    multiplyBlocked(a, b, c);
+    return OBJ_VAL(c);
+}
+
+/*
+ * Transposing reads rows and writes columns (or the other way round), so one side always strides through memory.
+ * Doing it in small square tiles keeps both the rows being read and the columns being written in cache.
+ */
+
+#define TRANSPOSE_BLOCK 32
+
+static Value transposeNative(int argCount, Value *args) {
+    if (argCount != 1 || !checkMatrix("transpose", args[0])) return NIL_VAL;
+
+    ObjMatrix *a = AS_MATRIX(args[0]);
+    ObjMatrix *t = newMatrix(a->cols, a->rows);
+
+    for (int ii = 0; ii < a->rows; ii += TRANSPOSE_BLOCK) {
+        int iEnd = ii + TRANSPOSE_BLOCK < a->rows ? ii + TRANSPOSE_BLOCK : a->rows;
+        for (int jj = 0; jj < a->cols; jj += TRANSPOSE_BLOCK) {
+            int jEnd = jj + TRANSPOSE_BLOCK < a->cols ? jj + TRANSPOSE_BLOCK : a->cols;
+            for (int i = ii; i < iEnd; i++) {
+                for (int j = jj; j < jEnd; j++) {
+                    t->values[j * a->rows + i] = a->values[i * a->cols + j];
+                }
+            }
+        }
+    }
+    return OBJ_VAL(t);
+}
+
+typedef void (*ElementwiseKernel)(const double *x, const double *y, double *out, int count);
+
+static Value elementwise(const char *name, ElementwiseKernel kernel, int argCount, Value *args) {
+    if (argCount != 2 || !checkMatrix(name, args[0]) || !checkMatrix(name, args[1])) return NIL_VAL;
+
+    ObjMatrix *a = AS_MATRIX(args[0]);
+    ObjMatrix *b = AS_MATRIX(args[1]);
+    if (!checkSameShape(name, a, b)) return NIL_VAL;
+
+    ObjMatrix *c = newMatrix(a->rows, a->cols);
+    kernel(a->values, b->values, c->values, a->rows * a->cols);
+    return OBJ_VAL(c);
+}
+
+static Value maddNative(int argCount, Value *args) {
+    return elementwise("madd", kernels.add, argCount, args);
+}
+
+static Value msubNative(int argCount, Value *args) {
+    return elementwise("msub", kernels.sub, argCount, args);
+}
+
+static Value mmulNative(int argCount, Value *args) {
+    return elementwise("mmul", kernels.mul, argCount, args);
+}
+
+static Value mscaleNative(int argCount, Value *args) {
+    if (argCount != 2 || !checkMatrix("mscale", args[0])) return NIL_VAL;
+    if (!IS_NUMBER(args[1])) return nativeError("mscale() expects a matrix and a number.");
+
+    ObjMatrix *a = AS_MATRIX(args[0]);
+    ObjMatrix *c = newMatrix(a->rows, a->cols);
+    kernels.scale(AS_NUMBER(args[1]), a->values, c->values, a->rows * a->cols);
+    return OBJ_VAL(c);
+}
+
+static Value rowSumsNative(int argCount, Value *args) {
+    if (argCount != 1 || !checkMatrix("rowSums", args[0])) return NIL_VAL;
+
+    ObjMatrix *a = AS_MATRIX(args[0]);
+    ObjFloatArray *sums = newFloatArray(a->rows);
+    for (int row = 0; row < a->rows; row++) {
+        sums->values[row] = kernels.sum(a->values + row * a->cols, a->cols);
+    }
+    return OBJ_VAL(sums);
+}
+
+// Summing down the columns would stride through memory, adding whole rows into the result reads it in order instead
+static Value colSumsNative(int argCount, Value *args) {
+    if (argCount != 1 || !checkMatrix("colSums", args[0])) return NIL_VAL;
+
+    ObjMatrix *a = AS_MATRIX(args[0]);
+    ObjFloatArray *sums = newFloatArray(a->cols);
+    for (int row = 0; row < a->rows; row++) {
+        kernels.add(sums->values, a->values + row * a->cols, sums->values, a->cols);
+    }
+    return OBJ_VAL(sums);
+}
+
 /*
  * ----------------------------------------- UTILS LIBRARY -----------------------------------------
  */
@@ -497,9 +1542,25 @@ void defineAllNatives() {
     defineNative("insert", insertLsNative, 3);
     defineNative("remove", removeLsNative, 2);
     defineNative("contains", containsLsNative, 2);
+    defineNative("slice", sliceLsNative, 3);
+    defineNative("extend", extendLsNative, 2);
+    defineNative("concat", concatLsNative, 2);
+    defineNative("reverse", reverseLsNative, 1);
+    defineNative("fill", fillLsNative, 2);
+    defineNative("reserve", reserveLsNative, 2);
+    defineNative("sort", sortLsNative, 1);
+    defineNative("map", mapLsNative, 2);
+    defineNative("filter", filterLsNative, 2);
+    defineNative("reduce", reduceLsNative, 2);
+    defineNative("forEach", forEachLsNative, 2);
+    defineNative("any", anyLsNative, 2);
+    defineNative("all", allLsNative, 2);
     defineNative("keys", keysDctNative, 1);
     defineNative("hasKey", hasKeyDctNative, 2);
     defineNative("delete", deleteKeyDctNative, 2);
+    defineNative("floatArray", floatArrayNative, 1);
+    defineNative("toList", toListNative, 1);
+    defineNative("range", rangeNative, 1);
 
     // Types
     defineNative("typeof", typeofNative, 1);
@@ -528,4 +1589,32 @@ void defineIONatives() {
     defineNative("read", readFileNative, 1);
     defineNative("write", writeFileNative, 2);
     defineNative("exit", exitNative, 1);
+}
+
+void defineVectorNatives() {
+    defineNative("sum", sumNative, 1);
+    defineNative("mean", meanNative, 1);
+    defineNative("min", minNative, 1);
+    defineNative("max", maxNative, 1);
+    defineNative("dot", dotNative, 2);
+    defineNative("axpy", axpyNative, 3);
+    defineNative("scale", scaleNative, 2);
+    defineNative("add", addNative, 2);
+}
+
+void defineMatrixNatives() {
+    defineNative("matrix", matrixNative, 1);
+    defineNative("identity", identityNative, 1);
+    defineNative("shape", shapeNative, 1);
+    defineNative("mget", mgetNative, 3);
+    defineNative("mset", msetNative, 4);
+    defineNative("row", rowNative, 2);
+    defineNative("matmul", matmulNative, 2);
+    defineNative("transpose", transposeNative, 1);
+    defineNative("madd", maddNative, 2);
+    defineNative("msub", msubNative, 2);
+    defineNative("mmul", mmulNative, 2);
+    defineNative("mscale", mscaleNative, 2);
+    defineNative("rowSums", rowSumsNative, 1);
+    defineNative("colSums", colSumsNative, 1);
 }
\ No newline at end of file
@@ -5,5 +5,7 @@ void defineAllNatives();
 void defineTimeNatives();
 void defineMathNatives();
 void defineIONatives();
+void defineVectorNatives();
+void defineMatrixNatives();
 
 #endif //CFER_NATIVES_H
\ No newline at end of file
@@ -1,3 +1,5 @@
+#include <limits.h>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -65,8 +67,20 @@ ObjFunction* newFunction() {
     ObjFunction *function = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity = 0;
     function->upvalueCount = 0;
+    function->maxStack = 0;
     function->name = NULL;
     initChunk(&function->chunk);
+    function->hotness = 0;
+    function->tierAttempted = false;
+    function->numberParams = 0;
+    function->optimized = NULL;
+    function->registers = NULL;
+    function->registerCount = 0;
+    function->inlineSites = NULL;
+    function->inlineSiteCount = 0;
+    function->inlineSiteCapacity = 0;
+    function->jit = NULL;
+    function->compiled = NULL;
     return function;
 }
 
@@ -104,18 +118,63 @@ static ObjString* allocateString(char *chars, int length, uint32_t hash) {
 }
 
 /*
- * This algorithm is called "FNV-1a"
+ * This algorithm used to be FNV-1a. FNV is fast but completely deterministic, so anyone who can feed strings into a dictionary
+ * (through split() or read(), for example) can precompute a pile of keys that all land in the same bucket and turn every insert into a linear scan.
+ *
+ * Instead, we use HalfSipHash-1-3, a keyed hash with a 64-bit key. The key is vm.hashSeed, chosen at random once per process in initVM(),
+ * so the bucket a string ends up in can't be predicted from outside. It still works on 32-bit words, so it stays cheap for the short strings we hash the most.
  */
 
+#define ROTL32(x, b) (uint32_t)(((x) << (b)) | ((x) >> (32 - (b))))
+
+#define SIP_ROUND() \
+    do { \
+        v0 += v1; v1 = ROTL32(v1, 5); v1 ^= v0; v0 = ROTL32(v0, 16); \
+        v2 += v3; v3 = ROTL32(v3, 8); v3 ^= v2; \
+        v0 += v3; v3 = ROTL32(v3, 7); v3 ^= v0; \
+        v2 += v1; v1 = ROTL32(v1, 13); v1 ^= v2; v2 = ROTL32(v2, 16); \
+    } while (false)
+
 static uint32_t hashString(const char *key, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)key[i];
-        hash *= 16777619;
+    uint32_t k0 = (uint32_t)vm.hashSeed;
+    uint32_t k1 = (uint32_t)(vm.hashSeed >> 32);
+
+    uint32_t v0 = k0;
+    uint32_t v1 = k1;
+    uint32_t v2 = 0x6c796765 ^ k0;
+    uint32_t v3 = 0x74656462 ^ k1;
+
+    const uint8_t *in = (const uint8_t*)key;
+    const uint8_t *end = in + (length - (length % 4));
+    for (; in != end; in += 4) {
+        uint32_t m = (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+        v3 ^= m;
+        SIP_ROUND();
+        v0 ^= m;
+    }
+
+    uint32_t b = (uint32_t)length << 24;
+    switch (length & 3) {
+        case 3: b |= (uint32_t)in[2] << 16; // Fallthrough
+        case 2: b |= (uint32_t)in[1] << 8;  // Fallthrough
+        case 1: b |= (uint32_t)in[0]; break;
+        case 0: break;
     }
-    return hash;
+
+    v3 ^= b;
+    SIP_ROUND();
+    v0 ^= b;
+
+    v2 ^= 0xff;
+    SIP_ROUND();
+    SIP_ROUND();
+    SIP_ROUND();
+
+    return v1 ^ v3;
 }
 
+#undef SIP_ROUND
+
 ObjString* takeString(char *chars, int length) {
     uint32_t hash = hashString(chars, length);
     ObjString *interned = tableFindString(&vm.strings, chars, length, hash);
@@ -199,10 +258,54 @@ ObjList* newList() {
 
 ObjDictionary* newDictionary() {
     ObjDictionary *dictionary = ALLOCATE_OBJ(ObjDictionary, OBJ_DICTIONARY);
-    initTable(&dictionary->table);
+    initDictionary(&dictionary->items);
     return dictionary;
 }
 
+/*
+ * The buffer is allocated before the object so a collection triggered by either allocation never sees a half built array.
+ * Elements start out as 0.
+ */
+
+ObjFloatArray* newFloatArray(int count) {
+    double *values = ALLOCATE(double, count);
+    for (int i = 0; i < count; i++) {
+        values[i] = 0;
+    }
+
+    ObjFloatArray *array = ALLOCATE_OBJ(ObjFloatArray, OBJ_FLOAT_ARRAY);
+    array->count = count;
+    array->values = values;
+    return array;
+}
+
+ObjMatrix* newMatrix(int rows, int cols) {
+    int count = rows * cols;
+    double *values = ALLOCATE(double, count);
+    for (int i = 0; i < count; i++) {
+        values[i] = 0;
+    }
+
+    ObjMatrix *matrix = ALLOCATE_OBJ(ObjMatrix, OBJ_MATRIX);
+    matrix->rows = rows;
+    matrix->cols = cols;
+    matrix->values = values;
+    return matrix;
+}
+
+ObjRange* newRange(double start, double end, double step) {
+    ObjRange *range = ALLOCATE_OBJ(ObjRange, OBJ_RANGE);
+    range->start = start;
+    range->end = end;
+    range->step = step;
+
+    double count = ceil((end - start) / step);
+    if (!(count > 0)) count = 0;
+    if (count > INT_MAX) count = INT_MAX;
+    range->count = (int)count;
+    return range;
+}
+
 ObjUpvalue* newUpvalue(Value *slot) {
     ObjUpvalue *upvalue = ALLOCATE_OBJ(ObjUpvalue, OBJ_UPVALUE);
     upvalue->closed = NIL_VAL;
@@ -230,20 +333,58 @@ static void printList(ObjList *list) {
     printf("]");
 }
 
+static void printFloatArray(ObjFloatArray *array) {
+    printf("floatArray[");
+    for (int i = 0; i < array->count; i++) {
+        printf("%g", array->values[i]);
+        if (i != array->count - 1) {
+            printf(", ");
+        }
+    }
+    printf("]");
+}
+
+static void printMatrix(ObjMatrix *matrix) {
+    printf("matrix[");
+    for (int row = 0; row < matrix->rows; row++) {
+        printf("[");
+        for (int col = 0; col < matrix->cols; col++) {
+            printf("%g", matrix->values[row * matrix->cols + col]);
+            if (col != matrix->cols - 1) {
+                printf(", ");
+            }
+        }
+        printf("]");
+        if (row != matrix->rows - 1) {
+            printf(", ");
+        }
+    }
+    printf("]");
+}
+
+static void printRange(ObjRange *range) {
+    printf("range(%g, %g, %g)", range->start, range->end, range->step);
+}
+
 static void printDictionary(ObjDictionary *dictionary) {
     printf("{");
 
     int count = 0;
-    for (int i = 0; i < dictionary->table.capacity; i++) {
-        Entry *entry = &dictionary->table.entries[i];
+    for (int i = 0; i < dictionary->items.used; i++) {
+        DictionaryEntry *entry = &dictionary->items.entries[i];
 
-        if (entry->key == NULL) continue;
+        if (IS_EMPTY(entry->key)) continue;
 
         if (count > 0) {
             printf(", ");
         }
 
-        printf("\"%s\": ", entry->key->chars);
+        if (IS_STRING(entry->key)) {
+            printf("\"%s\": ", AS_CSTRING(entry->key));
+        } else {
+            printValue(entry->key);
+            printf(": ");
+        }
         printValue(entry->value);
 
         count++;
@@ -281,6 +422,15 @@ void printObject(Value value) {
         case OBJ_DICTIONARY:
             printDictionary(AS_DICTIONARY(value));
             break;
+        case OBJ_FLOAT_ARRAY:
+            printFloatArray(AS_FLOAT_ARRAY(value));
+            break;
+        case OBJ_MATRIX:
+            printMatrix(AS_MATRIX(value));
+            break;
+        case OBJ_RANGE:
+            printRange(AS_RANGE(value));
+            break;
         case OBJ_UPVALUE:
             printf("upvalue");
             break;
@@ -3,6 +3,7 @@
 
 #include "common.h"
 #include "chunk.h"
+#include "dictionary.h"
 #include "table.h"
 #include "value.h"
 
@@ -17,6 +18,9 @@
 #define IS_STRING(value)        isObjType(value, OBJ_STRING)
 #define IS_LIST(value)          isObjType(value, OBJ_LIST)
 #define IS_DICTIONARY(value)    isObjType(value, OBJ_DICTIONARY)
+#define IS_FLOAT_ARRAY(value)   isObjType(value, OBJ_FLOAT_ARRAY)
+#define IS_MATRIX(value)        isObjType(value, OBJ_MATRIX)
+#define IS_RANGE(value)         isObjType(value, OBJ_RANGE)
 
 #define AS_BOUND_METHOD(value)  ((ObjBoundMethod*)AS_OBJ(value))
 #define AS_CLASS(value)         ((ObjClass*)AS_OBJ(value))
@@ -28,6 +32,9 @@
 #define AS_CSTRING(value)       (((ObjString*)AS_OBJ(value))->chars)
 #define AS_LIST(value)          ((ObjList*)AS_OBJ(value))
 #define AS_DICTIONARY(value)    ((ObjDictionary*)AS_OBJ(value))
+#define AS_FLOAT_ARRAY(value)   ((ObjFloatArray*)AS_OBJ(value))
+#define AS_MATRIX(value)        ((ObjMatrix*)AS_OBJ(value))
+#define AS_RANGE(value)         ((ObjRange*)AS_OBJ(value))
 
 typedef enum {
     OBJ_BOUND_METHOD,
@@ -39,6 +46,9 @@ typedef enum {
     OBJ_STRING,
     OBJ_LIST,
     OBJ_DICTIONARY,
+    OBJ_FLOAT_ARRAY,
+    OBJ_MATRIX,
+    OBJ_RANGE,
     OBJ_UPVALUE
 } ObjType;
 
@@ -53,14 +63,51 @@ struct Obj {
  * Thus, ObjFunction has te same Obj header that all object types share.
  * The arity field stores the number of parameters the function expects.
  * That will be handy for reporting readable runtime errors.
+ *
+ * The last four fields belong to the optimizing tier (see tier.h). hotness counts calls and loop iterations,
+ * once it crosses TIER_THRESHOLD the function is analysed once (tierAttempted), and if that found something to improve,
+ * optimized holds a second version of the chunk. It's only valid while the parameters in numberParams are numbers,
+ * bit i standing for parameter i + 1, and call() checks that before picking it.
+ *
+ * maxStack is the most values its frame ever holds on the stack, slot zero included, worked out by the compiler (see markHeight()),
+ * so call() can make room for all of them up front.
+ *
+ * registers is the function compiled to the register format (see registers.h), built on its first call when the VM runs that format,
+ * and registerCount is how many frame slots it needs.
+ *
+ * inlineSites has one entry for every call the compiler inlined into the function (see inlineCall() in compiler.c):
+ * the name of the function it inlined and the line of the call, so a runtime error in inlined code can still list both.
+ *
+ * jit is the machine code the baseline JIT made out of the function's chunks (see jit.h), one entry per chunk it compiled.
+ * compiled is the C function --emit-c generated for the function's own chunk, in a program built from that C (see aot.h).
  */
 
+struct JitCode;
+struct CallFrame;
+
+typedef struct {
+    ObjString *name;
+    int line;
+} InlineSite;
+
 typedef struct {
     Obj obj;
     int arity;
     int upvalueCount;
+    int maxStack;
     Chunk chunk;
     ObjString *name;
+    uint32_t hotness;
+    bool tierAttempted;
+    uint64_t numberParams;
+    Chunk *optimized;
+    Chunk *registers;
+    int registerCount;
+    InlineSite *inlineSites;
+    int inlineSiteCount;
+    int inlineSiteCapacity;
+    struct JitCode *jit;
+    void (*compiled)(struct CallFrame *frame, int offset);
 } ObjFunction;
 
 typedef Value (*NativeFn)(int argCount, Value *args);
@@ -118,9 +165,49 @@ typedef struct {
 
 typedef struct {
     Obj obj;
-    Table table;
+    Dictionary items;
 } ObjDictionary;
 
+/*
+ * A float array is a fixed-length run of plain doubles.
+ * Unlike a list, the elements aren't Values, so there's nothing to type check per element and nothing for the GC to trace,
+ * and the buffer can be handed straight to C code (a native can walk values[0..count) like any other double array).
+ * The length is fixed when the array is created, the only way to change an element is to assign it a number.
+ */
+
+typedef struct {
+    Obj obj;
+    int count;
+    double *values;
+} ObjFloatArray;
+
+/*
+ * A matrix is a float array with a shape. The rows are stored one after the other (row-major),
+ * so element (row, col) lives at values[row * cols + col] and a whole row is a contiguous run the kernels can work on.
+ */
+
+typedef struct {
+    Obj obj;
+    int rows;
+    int cols;
+    double *values;
+} ObjMatrix;
+
+/*
+ * A range is the numbers start, start + step, start + 2 * step, ... up to but not including end.
+ * It never materializes them: a for-in loop asks for element i and gets start + i * step back.
+ * Computing each element from its index, instead of adding step over and over, keeps fractional steps from drifting.
+ * count is worked out once, when the range is created.
+ */
+
+typedef struct {
+    Obj obj;
+    double start;
+    double end;
+    double step;
+    int count;
+} ObjRange;
+
 typedef struct ObjUpvalue {
     Obj obj;
     Value *location;
@@ -163,6 +250,9 @@ ObjString* takeString(char *chars, int length);
 ObjString* copyString(const char *chars, int length);
 ObjList* newList();
 ObjDictionary* newDictionary();
+ObjFloatArray* newFloatArray(int count);
+ObjMatrix* newMatrix(int rows, int cols);
+ObjRange* newRange(double start, double end, double step);
 ObjUpvalue* newUpvalue(Value *slot);
 void printObject(Value value);
 
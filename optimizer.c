@@ -0,0 +1,593 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "optimizer.h"
+#include "vm.h"
+
+/*
+ * Rewriting bytecode in place is awkward: every instruction we remove shifts everything after it,
+ * and every jump across it ends up pointing at the wrong byte. So we don't.
+ * The chunk is first decoded into an array of instructions. A jump stores the index of the instruction it lands on instead of
+ * a byte offset, and removing an instruction only clears its live flag. Nothing moves until every pass is done,
+ * then layout() writes the live instructions out again and works out the new offsets.
+ *
+ * A jump that lands on a removed instruction lands on the next live one instead. That is always what we want:
+ * the removed instructions are ones that turned out to do nothing (a push followed by a pop, a jump to the very next instruction),
+ * so starting just after them is the same as starting at them.
+ *
+ * Any rewrite that merges instructions has to make sure nothing jumps into the middle of them. In 1 + 2 the addition
+ * only becomes the constant 3 if no jump lands on the 2 or on the OP_ADD with some other value on the stack. isTarget tracks that.
+ * It's worked out fresh before each round, and moved along with a removed instruction to the one after it,
+ * so it can say yes when the answer is no (which only costs us a missed rewrite), but never the other way round.
+ */
+
+typedef struct {
+    int offset;                 // where the instruction starts in the original code
+    int length;
+    int line;
+    int target;                 // the instruction a jump lands on, -1 for everything that isn't a jump
+    bool live;
+    bool isTarget;
+    uint8_t replacement[5];     // the instruction's new bytes, once a pass has rewritten it
+    bool replaced;
+} Instruction;
+
+typedef struct {
+    Chunk *chunk;
+    Instruction *instructions;
+    int count;
+} Optimizer;
+
+static uint8_t* instructionBytes(Optimizer *optimizer, int index) {
+    Instruction *instruction = &optimizer->instructions[index];
+    return instruction->replaced ? instruction->replacement : &optimizer->chunk->code[instruction->offset];
+}
+
+static uint8_t opcodeAt(Optimizer *optimizer, int index) {
+    return instructionBytes(optimizer, index)[0];
+}
+
+static int nextLive(Optimizer *optimizer, int index) {
+    do {
+        index++;
+    } while (index < optimizer->count && !optimizer->instructions[index].live);
+    return index;
+}
+
+static int previousLive(Optimizer *optimizer, int index) {
+    do {
+        index--;
+    } while (index >= 0 && !optimizer->instructions[index].live);
+    return index;
+}
+
+// Where a jump to index really ends up, once the removed instructions in the way are skipped
+static int resolve(Optimizer *optimizer, int index) {
+    while (index < optimizer->count && !optimizer->instructions[index].live) index++;
+    return index;
+}
+
+static void removeInstruction(Optimizer *optimizer, int index) {
+    Instruction *instruction = &optimizer->instructions[index];
+    instruction->live = false;
+
+    int next = nextLive(optimizer, index);
+    if (instruction->isTarget && next < optimizer->count) optimizer->instructions[next].isTarget = true;
+}
+
+static bool isUnconditionalJump(uint8_t opcode) {
+    return opcode == OP_JUMP || opcode == OP_LOOP;
+}
+
+static void markTargets(Optimizer *optimizer) {
+    for (int i = 0; i < optimizer->count; i++) {
+        optimizer->instructions[i].isTarget = false;
+    }
+
+    for (int i = 0; i < optimizer->count; i++) {
+        Instruction *instruction = &optimizer->instructions[i];
+        if (!instruction->live || instruction->target == -1) continue;
+
+        instruction->target = resolve(optimizer, instruction->target);
+        if (instruction->target < optimizer->count) optimizer->instructions[instruction->target].isTarget = true;
+    }
+}
+
+/*
+ * ---------------------------------------- CONSTANTS ----------------------------------------
+ */
+
+static bool constantAt(Optimizer *optimizer, int index, Value *value) {
+    uint8_t *code = instructionBytes(optimizer, index);
+    switch (code[0]) {
+        case OP_CONSTANT:
+            *value = optimizer->chunk->constants.values[code[1]];
+            return true;
+        case OP_CONSTANT_LONG:
+            *value = optimizer->chunk->constants.values[(uint32_t)code[1] << 24 | (uint32_t)code[2] << 16 |
+                                                        (uint32_t)code[3] << 8 | (uint32_t)code[4]];
+            return true;
+        case OP_NIL: *value = NIL_VAL; return true;
+        case OP_TRUE: *value = BOOL_VAL(true); return true;
+        case OP_FALSE: *value = BOOL_VAL(false); return true;
+        default:
+            return false;
+    }
+}
+
+/*
+ * Folding produces the same handful of values over and over (0, 1, true), so we reuse a constant that's already in the chunk
+ * before adding a new one. "The same" has to mean the same bits here, valuesEqual() says 0 and -0 are equal, and 1 and 1.0,
+ * and the VM can tell both of those apart.
+ */
+
+static bool sameConstant(Value a, Value b) {
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    if (a.type != b.type) return false;
+    if (IS_NUMBER(a)) return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+    return valuesEqual(a, b);
+#endif
+}
+
+static void replaceWithConstant(Optimizer *optimizer, int index, Value value) {
+    Instruction *instruction = &optimizer->instructions[index];
+    instruction->replaced = true;
+
+    if (IS_NIL(value) || IS_BOOL(value)) {
+        instruction->replacement[0] = IS_NIL(value) ? OP_NIL : AS_BOOL(value) ? OP_TRUE : OP_FALSE;
+        instruction->length = 1;
+        return;
+    }
+
+    ValueArray *constants = &optimizer->chunk->constants;
+    int constant = -1;
+    for (int i = 0; i < constants->count; i++) {
+        if (sameConstant(constants->values[i], value)) {
+            constant = i;
+            break;
+        }
+    }
+    if (constant == -1) constant = addConstant(optimizer->chunk, value);
+
+    // Same cutoff as emitConstant()
+    if (constant < UINT8_MAX) {
+        instruction->replacement[0] = OP_CONSTANT;
+        instruction->replacement[1] = (uint8_t)constant;
+        instruction->length = 2;
+    } else {
+        instruction->replacement[0] = OP_CONSTANT_LONG;
+        instruction->replacement[1] = (constant >> 24) & 0xff;
+        instruction->replacement[2] = (constant >> 16) & 0xff;
+        instruction->replacement[3] = (constant >> 8) & 0xff;
+        instruction->replacement[4] = constant & 0xff;
+        instruction->length = 5;
+    }
+}
+
+/*
+ * These mirror the instructions in run() exactly, integer fast paths included, so a folded 7 / 2 is the same 3.5
+ * and a folded 2 * 3 is the same integer 6 the VM would have made. Each returns false for operands the instruction would reject,
+ * and the instruction is left in to report the error when it runs.
+ */
+
+static bool foldBinary(uint8_t opcode, Value a, Value b, Value *result) {
+    if (opcode == OP_EQUAL) {
+        *result = BOOL_VAL(valuesEqual(a, b));
+        return true;
+    }
+
+    if (opcode == OP_ADD && IS_STRING(a) && IS_STRING(b)) {
+        ObjString *left = AS_STRING(a);
+        ObjString *right = AS_STRING(b);
+
+        int length = left->length + right->length;
+        char *chars = ALLOCATE(char, length + 1);
+        memcpy(chars, left->chars, left->length);
+        memcpy(chars + left->length, right->chars, right->length);
+        chars[length] = '\0';
+
+        *result = OBJ_VAL(takeString(chars, length));
+        return true;
+    }
+
+    int32_t x;
+    int32_t y;
+    if (opcode >= OP_BIT_AND && opcode <= OP_SHIFT_RIGHT) {
+        if (!toInt32(a, &x) || !toInt32(b, &y)) return false;
+
+        switch (opcode) {
+            case OP_BIT_AND: *result = INT_VAL(x & y); break;
+            case OP_BIT_OR: *result = INT_VAL(x | y); break;
+            case OP_BIT_XOR: *result = INT_VAL(x ^ y); break;
+            case OP_SHIFT_LEFT: *result = INT_VAL((int32_t)((uint32_t)x << (y & 31))); break;
+            default: *result = INT_VAL(x >> (y & 31)); break;
+        }
+        return true;
+    }
+
+    if (!IS_NUMBER(a) || !IS_NUMBER(b)) return false;
+
+    bool ints = IS_INT(a) && IS_INT(b);
+    int32_t integer;
+    double left = AS_NUMBER(a);
+    double right = AS_NUMBER(b);
+
+    switch (opcode) {
+        case OP_GREATER: *result = BOOL_VAL(left > right); return true;
+        case OP_LESS: *result = BOOL_VAL(left < right); return true;
+        case OP_ADD:
+            *result = ints && addInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer) : NUMBER_VAL(left + right);
+            return true;
+        case OP_SUBTRACT:
+            *result = ints && subtractInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer) : NUMBER_VAL(left - right);
+            return true;
+        case OP_MULTIPLY:
+            *result = ints && multiplyInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer) : NUMBER_VAL(left * right);
+            return true;
+        case OP_DIVIDE:
+            *result = ints && divideInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer) : NUMBER_VAL(left / right);
+            return true;
+        case OP_MODULO:
+            *result = ints && moduloInts(AS_INT(a), AS_INT(b), &integer) ? INT_VAL(integer)
+                                                                         : NUMBER_VAL(moduloNumbers(left, right));
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool foldUnary(uint8_t opcode, Value value, Value *result) {
+    if (opcode == OP_NOT) {
+        *result = BOOL_VAL(isFalsey(value));
+        return true;
+    }
+
+    if (!IS_NUMBER(value)) return false;
+    if (IS_INT(value) && AS_INT(value) != 0 && AS_INT(value) != INT32_MIN) {
+        *result = INT_VAL(-AS_INT(value));
+    } else {
+        *result = NUMBER_VAL(-AS_NUMBER(value));
+    }
+    return true;
+}
+
+static bool isBinary(uint8_t opcode) {
+    return opcode == OP_EQUAL || opcode == OP_GREATER || opcode == OP_LESS || (opcode >= OP_ADD && opcode <= OP_SHIFT_RIGHT);
+}
+
+/*
+ * ---------------------------------------- PASSES ----------------------------------------
+ *
+ * Each pass makes one sweep over the live instructions and returns whether it changed anything.
+ * One rewrite often opens up another (folding -(2 * 3) takes two rounds, and an if (false) only becomes dead code once its
+ * condition is folded), so optimizeChunk() keeps running all of them until a whole round goes by without a change.
+ */
+
+static bool foldConstants(Optimizer *optimizer) {
+    bool changed = false;
+
+    for (int i = 0; i < optimizer->count; i++) {
+        Instruction *instruction = &optimizer->instructions[i];
+        if (!instruction->live || instruction->isTarget) continue;
+
+        uint8_t opcode = opcodeAt(optimizer, i);
+        int operand = previousLive(optimizer, i);
+        Value a;
+        Value b;
+        Value result;
+
+        if (isBinary(opcode)) {
+            int first = operand >= 0 ? previousLive(optimizer, operand) : -1;
+            if (first < 0 || optimizer->instructions[operand].isTarget) continue;
+            if (!constantAt(optimizer, first, &a) || !constantAt(optimizer, operand, &b)) continue;
+            if (!foldBinary(opcode, a, b, &result)) continue;
+
+            replaceWithConstant(optimizer, first, result);
+            removeInstruction(optimizer, operand);
+            removeInstruction(optimizer, i);
+            changed = true;
+        } else if (opcode == OP_NOT || opcode == OP_NEGATE) {
+            if (operand < 0) continue;
+
+            if (constantAt(optimizer, operand, &a)) {
+                if (!foldUnary(opcode, a, &result)) continue;
+                replaceWithConstant(optimizer, operand, result);
+                removeInstruction(optimizer, i);
+                changed = true;
+                continue;
+            }
+
+            // !!!x is !x. Two nots on their own turn x into a bool, so !!x has to stay as it is
+            int first = previousLive(optimizer, operand);
+            if (opcode == OP_NOT && first >= 0 && opcodeAt(optimizer, operand) == OP_NOT &&
+                opcodeAt(optimizer, first) == OP_NOT && !optimizer->instructions[operand].isTarget) {
+                removeInstruction(optimizer, operand);
+                removeInstruction(optimizer, i);
+                changed = true;
+            }
+        } else if (opcode == OP_JUMP_IF_FALSE) {
+            // A condition known at compile time: the jump either always happens or never does
+            if (operand < 0 || !constantAt(optimizer, operand, &a)) continue;
+
+            if (isFalsey(a)) {
+                instruction->replaced = true;
+                memcpy(instruction->replacement, &optimizer->chunk->code[instruction->offset], 3);
+                instruction->replacement[0] = OP_JUMP;
+            } else {
+                removeInstruction(optimizer, i);
+            }
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+/*
+ * An expression statement like 1; or x; pushes a value only for OP_POP to throw it away,
+ * and so does the condition of while (true) once its jump is gone. Only pushes that can't fail or have side effects qualify,
+ * a global can be undefined and an upvalue or local can't.
+ */
+
+static bool removePushPop(Optimizer *optimizer) {
+    bool changed = false;
+
+    for (int i = 0; i < optimizer->count; i++) {
+        Instruction *instruction = &optimizer->instructions[i];
+        if (!instruction->live || instruction->isTarget || opcodeAt(optimizer, i) != OP_POP) continue;
+
+        int push = previousLive(optimizer, i);
+        if (push < 0) continue;
+
+        switch (opcodeAt(optimizer, push)) {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE:
+            case OP_GET_LOCAL:
+            case OP_GET_UPVALUE:
+                removeInstruction(optimizer, push);
+                removeInstruction(optimizer, i);
+                changed = true;
+                break;
+            default:
+                break;
+        }
+    }
+
+    return changed;
+}
+
+/*
+ * A jump that lands on another jump can go straight to where that one goes, the way break out of a nested if does.
+ * OP_JUMP_IF_FALSE leaves its condition on the stack, so when it lands on another OP_JUMP_IF_FALSE that one sees the same false value
+ * and jumps too. A jump to an OP_RETURN might as well return, and a jump to the instruction right after it does nothing.
+ *
+ * OP_JUMP and OP_LOOP only differ in direction, which layout() picks from the target, so we treat them as one here.
+ * OP_JUMP_IF_FALSE can only go forward. The hop count stops us from chasing a cycle of jumps (an empty while (true) {}) forever.
+ */
+
+static bool threadJumps(Optimizer *optimizer) {
+    bool changed = false;
+
+    for (int i = 0; i < optimizer->count; i++) {
+        Instruction *instruction = &optimizer->instructions[i];
+        if (!instruction->live) continue;
+
+        uint8_t opcode = opcodeAt(optimizer, i);
+        bool conditional = opcode == OP_JUMP_IF_FALSE;
+        if (!conditional && !isUnconditionalJump(opcode)) continue;
+
+        int target = resolve(optimizer, instruction->target);
+        int best = target;
+        for (int hops = 0; hops < optimizer->count && target < optimizer->count; hops++) {
+            uint8_t next = opcodeAt(optimizer, target);
+            if (!isUnconditionalJump(next) && !(conditional && next == OP_JUMP_IF_FALSE)) break;
+
+            target = resolve(optimizer, optimizer->instructions[target].target);
+            if (!conditional || target > i) best = target;
+        }
+
+        if (best != instruction->target) {
+            instruction->target = best;
+            if (best < optimizer->count) optimizer->instructions[best].isTarget = true;
+            changed = true;
+        }
+
+        if (best == nextLive(optimizer, i)) {
+            removeInstruction(optimizer, i);
+            changed = true;
+        } else if (!conditional && best < optimizer->count && opcodeAt(optimizer, best) == OP_RETURN) {
+            instruction->replaced = true;
+            instruction->replacement[0] = OP_RETURN;
+            instruction->length = 1;
+            instruction->target = -1;
+            changed = true;
+        }
+    }
+
+    return changed;
+}
+
+/*
+ * Walks every path out of the first instruction and drops what it never reached:
+ * the code after a return or a break, the other branch of an if (true), the implicit return after a function's last return.
+ */
+
+static bool removeUnreachable(Optimizer *optimizer) {
+    bool *reached = ALLOCATE(bool, optimizer->count);
+    int *worklist = ALLOCATE(int, optimizer->count);
+    memset(reached, 0, sizeof(bool) * optimizer->count);
+
+    int pending = 0;
+    int first = resolve(optimizer, 0);
+    if (first < optimizer->count) {
+        reached[first] = true;
+        worklist[pending++] = first;
+    }
+
+    while (pending > 0) {
+        int index = worklist[--pending];
+        uint8_t opcode = opcodeAt(optimizer, index);
+
+        int successors[2] = {-1, -1};
+        if (opcode != OP_RETURN && opcode != OP_INLINE_RETURN && !isUnconditionalJump(opcode)) {
+            successors[0] = nextLive(optimizer, index);
+        }
+        if (optimizer->instructions[index].target != -1) {
+            successors[1] = resolve(optimizer, optimizer->instructions[index].target);
+        }
+
+        for (int i = 0; i < 2; i++) {
+            int successor = successors[i];
+            if (successor < 0 || successor >= optimizer->count || reached[successor]) continue;
+            reached[successor] = true;
+            worklist[pending++] = successor;
+        }
+    }
+
+    bool changed = false;
+    for (int i = 0; i < optimizer->count; i++) {
+        if (optimizer->instructions[i].live && !reached[i]) {
+            optimizer->instructions[i].live = false;
+            changed = true;
+        }
+    }
+
+    FREE_ARRAY(bool, reached, optimizer->count);
+    FREE_ARRAY(int, worklist, optimizer->count);
+    return changed;
+}
+
+/*
+ * ---------------------------------------- LAYOUT ----------------------------------------
+ *
+ * Writes the live instructions out into fresh code and line arrays. Offsets are known for every instruction before the first byte
+ * is written, so forward and backward jumps are both filled in on the way.
+ * Threading can make a jump longer than the one it replaced. If any jump no longer fits in its 16 bits
+ * we keep the chunk the compiler wrote and return false.
+ */
+
+static bool writeJump(uint8_t *code, int at, int distance) {
+    if (distance < 0 || distance > UINT16_MAX) return false;
+    code[at] = (distance >> 8) & 0xff;
+    code[at + 1] = distance & 0xff;
+    return true;
+}
+
+static bool layout(Optimizer *optimizer) {
+    Chunk *chunk = optimizer->chunk;
+    int *offsets = ALLOCATE(int, optimizer->count + 1);
+
+    int count = 0;
+    for (int i = 0; i < optimizer->count; i++) {
+        offsets[i] = count;
+        if (optimizer->instructions[i].live) count += optimizer->instructions[i].length;
+    }
+    offsets[optimizer->count] = count;
+
+    uint8_t *code = ALLOCATE(uint8_t, count);
+    int *lines = ALLOCATE(int, count);
+    bool fits = true;
+
+    for (int i = 0; i < optimizer->count && fits; i++) {
+        Instruction *instruction = &optimizer->instructions[i];
+        if (!instruction->live) continue;
+
+        int at = offsets[i];
+        memcpy(&code[at], instructionBytes(optimizer, i), instruction->length);
+        for (int k = 0; k < instruction->length; k++) {
+            lines[at + k] = instruction->replaced ? instruction->line : chunk->lines[instruction->offset + k];
+        }
+
+        if (instruction->target == -1) continue;
+
+        int target = offsets[resolve(optimizer, instruction->target)];
+        int end = at + instruction->length;
+        switch (code[at]) {
+            case OP_JUMP:
+            case OP_LOOP:
+                code[at] = target >= end ? OP_JUMP : OP_LOOP;
+                fits = writeJump(code, at + 1, target >= end ? target - end : end - target);
+                break;
+            case OP_JUMP_IF_FALSE:
+                fits = writeJump(code, at + 1, target - end);
+                break;
+            case OP_ITER_NEXT:
+            case OP_INLINE_RETURN:
+                fits = writeJump(code, at + 2, target - end);
+                break;
+            case OP_CHECK_CALLEE:
+                fits = writeJump(code, at + 3, target - end);
+                break;
+            case OP_FOR_STEP:
+                fits = writeJump(code, at + 5, end - target);
+                break;
+            default:
+                break;
+        }
+    }
+
+    FREE_ARRAY(int, offsets, optimizer->count + 1);
+
+    if (!fits) {
+        FREE_ARRAY(uint8_t, code, count);
+        FREE_ARRAY(int, lines, count);
+        return false;
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    chunk->code = code;
+    chunk->lines = lines;
+    chunk->count = count;
+    chunk->capacity = count;
+    return true;
+}
+
+void optimizeChunk(Chunk *chunk) {
+    if (chunk->count == 0) return;
+
+    Optimizer optimizer;
+    optimizer.chunk = chunk;
+    optimizer.count = 0;
+
+    int *indexAt = ALLOCATE(int, chunk->count);
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        indexAt[offset] = optimizer.count++;
+    }
+
+    optimizer.instructions = ALLOCATE(Instruction, optimizer.count);
+    for (int offset = 0, i = 0; offset < chunk->count; offset += optimizer.instructions[i++].length) {
+        Instruction *instruction = &optimizer.instructions[i];
+        instruction->offset = offset;
+        instruction->length = instructionLength(chunk, offset);
+        instruction->line = chunk->lines[offset];
+        instruction->live = true;
+        instruction->isTarget = false;
+        instruction->replaced = false;
+
+        int destination = jumpTarget(chunk, offset);
+        instruction->target = destination == -1 ? -1 : destination < chunk->count ? indexAt[destination] : optimizer.count;
+    }
+    FREE_ARRAY(int, indexAt, chunk->count);
+
+    bool changed = false;
+    for (;;) {
+        markTargets(&optimizer);
+        bool progress = foldConstants(&optimizer);
+        progress |= removePushPop(&optimizer);
+        progress |= threadJumps(&optimizer);
+        progress |= removeUnreachable(&optimizer);
+        if (!progress) break;
+        changed = true;
+    }
+
+    if (changed) layout(&optimizer);
+    FREE_ARRAY(Instruction, optimizer.instructions, optimizer.count);
+}
@@ -0,0 +1,18 @@
+#ifndef CFER_OPTIMIZER_H
+#define CFER_OPTIMIZER_H
+
+#include "chunk.h"
+
+/*
+ * The compiler writes bytecode as it parses, one expression at a time, so it never gets to see the code around what it's emitting.
+ * optimizeChunk() gets a second look once a function is finished. It's a peephole pass: it only ever looks at a few neighbouring
+ * instructions at a time, and rewrites them into something shorter that does the same thing.
+ *
+ * It folds constant arithmetic and comparisons, drops values that are pushed only to be popped again, threads jumps that land on
+ * other jumps, and removes code nothing can reach. Jump offsets and line numbers are rewritten to match the new layout.
+ * Anything that could raise a runtime error (1 + "a", a division of a string) is left alone so the error still happens, on its line.
+ */
+
+void optimizeChunk(Chunk *chunk);
+
+#endif //CFER_OPTIMIZER_H
@@ -0,0 +1,689 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "registers.h"
+
+#ifdef DEBUG_PRINT_CODE
+#include "debug.h"
+#endif
+
+/*
+ * compileRegisters() replays the stack code with a model of the stack. Instead of values, each model slot says where its value
+ * can be found: already in the slot's own register, in some local's register, or in the constant table.
+ * GET_LOCAL and CONSTANT don't emit anything, they just push a slot that points somewhere else.
+ * An instruction reads its operands from wherever they are and writes its result to the register its result slot maps to.
+ *
+ * A slot that points at a local has to be copied into its own register before that local changes, or it'd see the new value.
+ * A SET_LOCAL can change it, and so can any call, since a closure may assign the local through an upvalue.
+ * Copying a value into its own slot's register is called materializing it. At jumps and jump targets every slot is materialized,
+ * so all the paths that meet at a label agree on where everything is.
+ */
+
+typedef enum {
+    SLOT_REGISTER,      // the value is in the slot's own register
+    SLOT_LOCAL,         // the value is in register index
+    SLOT_CONSTANT,      // the value is constant index
+    SLOT_NIL,
+    SLOT_TRUE,
+    SLOT_FALSE
+} SlotKind;
+
+typedef struct {
+    SlotKind kind;
+    uint32_t index;
+} Slot;
+
+typedef struct {
+    int operand;        // where the 16-bit offset goes in the register code
+    int end;            // the end of the jump instruction, which offsets are relative to
+    int target;         // the offset of the target in the stack code
+    bool backward;
+} Patch;
+
+typedef struct {
+    ObjFunction *function;
+    Chunk *in;
+    Chunk *out;
+    int line;
+
+    Slot stack[UINT8_COUNT];
+    int height;
+    int maxHeight;
+
+    // The register written by the instruction just emitted, and where in the code it's named. A SET_LOCAL right after it
+    // can change the destination to the local instead of copying the value over.
+    int lastResult;
+    int lastDestination;
+
+    int *labels;        // register code offset of each stack code offset
+    int *heights;       // stack height at each jump target, -1 until a jump to it is seen
+    bool *targets;
+    Patch *patches;
+    int patchCount;
+    int patchCapacity;
+    bool failed;
+} Translator;
+
+static void emitByte(Translator *translator, uint8_t byte) {
+    writeChunk(translator->out, byte, translator->line);
+}
+
+static void emitOp(Translator *translator, RegisterOpCode op) {
+    translator->lastResult = -1;
+    emitByte(translator, op);
+}
+
+// For an instruction whose first operand is the register it writes
+static void emitResult(Translator *translator, RegisterOpCode op, int destination) {
+    emitByte(translator, op);
+    translator->lastResult = destination;
+    translator->lastDestination = translator->out->count;
+    emitByte(translator, (uint8_t)destination);
+}
+
+static void emitLoad(Translator *translator, Slot slot, int destination) {
+    switch (slot.kind) {
+        case SLOT_LOCAL:
+            emitResult(translator, R_MOVE, destination);
+            emitByte(translator, (uint8_t)slot.index);
+            break;
+        case SLOT_CONSTANT:
+            if (slot.index <= UINT8_MAX) {
+                emitResult(translator, R_LOAD_CONSTANT, destination);
+                emitByte(translator, (uint8_t)slot.index);
+            } else {
+                emitResult(translator, R_LOAD_CONSTANT_LONG, destination);
+                emitByte(translator, (slot.index >> 24) & 0xff);
+                emitByte(translator, (slot.index >> 16) & 0xff);
+                emitByte(translator, (slot.index >> 8) & 0xff);
+                emitByte(translator, slot.index & 0xff);
+            }
+            break;
+        case SLOT_NIL: emitResult(translator, R_LOAD_NIL, destination); break;
+        case SLOT_TRUE: emitResult(translator, R_LOAD_TRUE, destination); break;
+        case SLOT_FALSE: emitResult(translator, R_LOAD_FALSE, destination); break;
+        case SLOT_REGISTER:
+            emitResult(translator, R_MOVE, destination);
+            emitByte(translator, (uint8_t)destination);
+            break;
+    }
+}
+
+static void materialize(Translator *translator, int position) {
+    Slot *slot = &translator->stack[position];
+    if (slot->kind == SLOT_REGISTER) return;
+    emitLoad(translator, *slot, position);
+    slot->kind = SLOT_REGISTER;
+}
+
+static void materializeAll(Translator *translator) {
+    for (int position = 0; position < translator->height; position++) {
+        materialize(translator, position);
+    }
+}
+
+static void materializeRange(Translator *translator, int from) {
+    for (int position = from; position < translator->height; position++) {
+        materialize(translator, position);
+    }
+}
+
+// The register an instruction can read the value at position from
+static uint8_t operand(Translator *translator, int position) {
+    Slot *slot = &translator->stack[position];
+    if (slot->kind == SLOT_LOCAL) return (uint8_t)slot->index;
+    materialize(translator, position);
+    return (uint8_t)position;
+}
+
+static void push(Translator *translator, SlotKind kind, uint32_t index) {
+    // One register past the highest slot is kept free as scratch space for R_LIST and R_DICTIONARY
+    if (translator->height >= UINT8_MAX) {
+        translator->failed = true;
+        return;
+    }
+    translator->stack[translator->height].kind = kind;
+    translator->stack[translator->height].index = index;
+    translator->height++;
+    if (translator->height > translator->maxHeight) translator->maxHeight = translator->height;
+}
+
+static void pushRegister(Translator *translator) {
+    push(translator, SLOT_REGISTER, 0);
+}
+
+static void emitJump(Translator *translator, int target, bool backward) {
+    if (translator->patchCount == translator->patchCapacity) {
+        int oldCapacity = translator->patchCapacity;
+        translator->patchCapacity = GROW_CAPACITY(oldCapacity);
+        translator->patches = GROW_ARRAY(Patch, translator->patches, oldCapacity, translator->patchCapacity);
+    }
+
+    Patch *patch = &translator->patches[translator->patchCount++];
+    patch->operand = translator->out->count;
+    patch->end = translator->out->count + 2;
+    patch->target = target;
+    patch->backward = backward;
+    emitByte(translator, 0xff);
+    emitByte(translator, 0xff);
+
+    if (translator->heights[target] == -1) {
+        translator->heights[target] = translator->height;
+    } else if (translator->heights[target] != translator->height) {
+        translator->failed = true;
+    }
+}
+
+static uint32_t readLong(uint8_t *code) {
+    return (uint32_t)code[0] << 24 | (uint32_t)code[1] << 16 | (uint32_t)code[2] << 8 | (uint32_t)code[3];
+}
+
+// Instructions that name a constant the same way in both formats: an opcode, the register, then the constant index as it was
+static void emitWithConstant(Translator *translator, RegisterOpCode op, uint8_t reg, uint8_t *code, int constantBytes) {
+    emitOp(translator, op);
+    emitByte(translator, reg);
+    for (int i = 0; i < constantBytes; i++) {
+        emitByte(translator, code[1 + i]);
+    }
+}
+
+static void translateInstruction(Translator *translator, int offset) {
+    uint8_t *code = &translator->in->code[offset];
+    int top = translator->height - 1;
+
+    if (code[0] >= OP_EQUAL && code[0] <= OP_SHIFT_RIGHT) {
+        if (translator->height < 2) {
+            translator->failed = true;
+            return;
+        }
+
+        int destination = top - 1;
+        uint8_t left = operand(translator, destination);
+        Slot right = translator->stack[top];
+
+        if (right.kind == SLOT_CONSTANT && right.index <= UINT8_MAX && code[0] <= OP_MODULO) {
+            emitResult(translator, R_EQUAL_CONSTANT + (code[0] - OP_EQUAL), destination);
+            emitByte(translator, left);
+            emitByte(translator, (uint8_t)right.index);
+        } else {
+            uint8_t rightRegister = operand(translator, top);
+            emitResult(translator, R_EQUAL + (code[0] - OP_EQUAL), destination);
+            emitByte(translator, left);
+            emitByte(translator, rightRegister);
+        }
+
+        translator->height--;
+        translator->stack[destination].kind = SLOT_REGISTER;
+        return;
+    }
+
+    switch (code[0]) {
+        case OP_CONSTANT: push(translator, SLOT_CONSTANT, code[1]); break;
+        case OP_CONSTANT_LONG: push(translator, SLOT_CONSTANT, readLong(&code[1])); break;
+        case OP_NIL: push(translator, SLOT_NIL, 0); break;
+        case OP_TRUE: push(translator, SLOT_TRUE, 0); break;
+        case OP_FALSE: push(translator, SLOT_FALSE, 0); break;
+        case OP_POP:
+            translator->height--;
+            translator->lastResult = -1;
+            break;
+        case OP_GET_LOCAL:
+            if (code[1] >= translator->height) {
+                translator->failed = true;
+                break;
+            }
+            materialize(translator, code[1]);
+            push(translator, SLOT_LOCAL, code[1]);
+            break;
+        case OP_SET_LOCAL: {
+            uint8_t local = code[1];
+            if (local >= top) {
+                translator->failed = true;
+                break;
+            }
+
+            // Anything still reading the local's old value has to take a copy first
+            for (int position = local + 1; position < translator->height; position++) {
+                if (translator->stack[position].kind == SLOT_LOCAL && translator->stack[position].index == local) {
+                    materialize(translator, position);
+                }
+            }
+
+            Slot *value = &translator->stack[top];
+            if (value->kind == SLOT_REGISTER && translator->lastResult == top) {
+                translator->out->code[translator->lastDestination] = local;
+                value->kind = SLOT_LOCAL;
+                value->index = local;
+            } else {
+                emitLoad(translator, value->kind == SLOT_REGISTER ? (Slot){SLOT_LOCAL, (uint32_t)top} : *value, local);
+            }
+
+            translator->lastResult = -1;
+            translator->stack[local].kind = SLOT_REGISTER;
+            break;
+        }
+        case OP_GET_ITEM: {
+            uint8_t target = operand(translator, top - 1);
+            uint8_t key = operand(translator, top);
+            emitResult(translator, R_GET_ITEM, top - 1);
+            emitByte(translator, target);
+            emitByte(translator, key);
+            translator->height--;
+            translator->stack[top - 1].kind = SLOT_REGISTER;
+            break;
+        }
+        case OP_SET_ITEM: {
+            uint8_t target = operand(translator, top - 2);
+            uint8_t key = operand(translator, top - 1);
+            uint8_t item = operand(translator, top);
+            emitResult(translator, R_SET_ITEM, top - 2);
+            emitByte(translator, target);
+            emitByte(translator, key);
+            emitByte(translator, item);
+            translator->height -= 2;
+            translator->stack[top - 2].kind = SLOT_REGISTER;
+            break;
+        }
+        case OP_GET_GLOBAL:
+        case OP_GET_GLOBAL_LONG:
+            pushRegister(translator);
+            emitResult(translator, code[0] == OP_GET_GLOBAL ? R_GET_GLOBAL : R_GET_GLOBAL_LONG, top + 1);
+            for (int i = 1; i < instructionLength(translator->in, offset); i++) {
+                emitByte(translator, code[i]);
+            }
+            break;
+        case OP_DEFINE_GLOBAL:
+            emitWithConstant(translator, R_DEFINE_GLOBAL, operand(translator, top), code, 1);
+            translator->height--;
+            break;
+        case OP_DEFINE_GLOBAL_LONG:
+            emitWithConstant(translator, R_DEFINE_GLOBAL_LONG, operand(translator, top), code, 4);
+            translator->height--;
+            break;
+        case OP_DEFINE_GLOBAL_PERM:
+            emitWithConstant(translator, R_DEFINE_GLOBAL_PERM, operand(translator, top), code, 1);
+            translator->height--;
+            break;
+        case OP_DEFINE_GLOBAL_PERM_LONG:
+            emitWithConstant(translator, R_DEFINE_GLOBAL_PERM_LONG, operand(translator, top), code, 4);
+            translator->height--;
+            break;
+        case OP_SET_GLOBAL:
+            emitWithConstant(translator, R_SET_GLOBAL, operand(translator, top), code, 1);
+            break;
+        case OP_SET_GLOBAL_LONG:
+            emitWithConstant(translator, R_SET_GLOBAL_LONG, operand(translator, top), code, 4);
+            break;
+        case OP_GET_UPVALUE:
+            pushRegister(translator);
+            emitResult(translator, R_GET_UPVALUE, top + 1);
+            emitByte(translator, code[1]);
+            break;
+        case OP_SET_UPVALUE:
+            emitWithConstant(translator, R_SET_UPVALUE, operand(translator, top), code, 1);
+            break;
+        case OP_GET_PROPERTY: {
+            uint8_t instance = operand(translator, top);
+            emitResult(translator, R_GET_PROPERTY, top);
+            emitByte(translator, instance);
+            emitByte(translator, code[1]);
+            translator->stack[top].kind = SLOT_REGISTER;
+            break;
+        }
+        case OP_SET_PROPERTY: {
+            uint8_t instance = operand(translator, top - 1);
+            uint8_t value = operand(translator, top);
+            emitResult(translator, R_SET_PROPERTY, top - 1);
+            emitByte(translator, instance);
+            emitByte(translator, value);
+            emitByte(translator, code[1]);
+            translator->height--;
+            translator->stack[top - 1].kind = SLOT_REGISTER;
+            break;
+        }
+        case OP_GET_SUPER:
+            materializeRange(translator, top - 1);
+            emitWithConstant(translator, R_GET_SUPER, top - 1, code, 1);
+            translator->height--;
+            break;
+        case OP_NOT:
+        case OP_NEGATE: {
+            uint8_t value = operand(translator, top);
+            emitResult(translator, code[0] == OP_NOT ? R_NOT : R_NEGATE, top);
+            emitByte(translator, value);
+            translator->stack[top].kind = SLOT_REGISTER;
+            break;
+        }
+        case OP_LIST:
+        case OP_DICTIONARY: {
+            int count = code[0] == OP_LIST ? code[1] : code[1] * 2;
+            int first = translator->height - count;
+            if (first < 0) {
+                translator->failed = true;
+                break;
+            }
+            materializeRange(translator, first);
+            emitWithConstant(translator, code[0] == OP_LIST ? R_LIST : R_DICTIONARY, first, code, 1);
+            translator->height = first;
+            pushRegister(translator);
+            break;
+        }
+        case OP_IMPORT:
+            materializeAll(translator);
+            emitWithConstant(translator, R_IMPORT, translator->height, code, 1);
+            pushRegister(translator);
+            break;
+        case OP_PRINT: {
+            uint8_t value = operand(translator, top);
+            emitOp(translator, R_PRINT);
+            emitByte(translator, value);
+            translator->height--;
+            break;
+        }
+        case OP_JUMP:
+        case OP_LOOP:
+            materializeAll(translator);
+            emitOp(translator, code[0] == OP_JUMP ? R_JUMP : R_LOOP);
+            emitJump(translator, jumpTarget(translator->in, offset), code[0] == OP_LOOP);
+            break;
+        case OP_JUMP_IF_FALSE:
+            materializeAll(translator);
+            emitOp(translator, R_JUMP_IF_FALSE);
+            emitByte(translator, (uint8_t)top);
+            emitJump(translator, jumpTarget(translator->in, offset), false);
+            break;
+        case OP_ITER_INIT:
+            materialize(translator, top);
+            emitOp(translator, R_ITER_INIT);
+            emitByte(translator, (uint8_t)top);
+            pushRegister(translator);
+            break;
+        case OP_ITER_NEXT:
+            materializeAll(translator);
+            emitOp(translator, R_ITER_NEXT);
+            emitByte(translator, code[1]);
+            emitByte(translator, (uint8_t)translator->height);
+            emitJump(translator, jumpTarget(translator->in, offset), false);
+            pushRegister(translator);
+            break;
+        case OP_FOR_STEP:
+            materializeAll(translator);
+            emitOp(translator, R_FOR_STEP);
+            for (int i = 1; i < 5; i++) {
+                emitByte(translator, code[i]);
+            }
+            emitJump(translator, jumpTarget(translator->in, offset), true);
+            break;
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            // A call can run any code, including closures that assign this function's locals, so nothing may still point at one
+            int base = translator->height - code[1] - 1;
+            materializeAll(translator);
+            emitOp(translator, code[0] == OP_CALL ? R_CALL : R_TAIL_CALL);
+            emitByte(translator, (uint8_t)base);
+            emitByte(translator, code[1]);
+            translator->height = base;
+            pushRegister(translator);
+            break;
+        }
+        case OP_INVOKE:
+        case OP_SUPER_INVOKE: {
+            int base = translator->height - code[2] - 1 - (code[0] == OP_SUPER_INVOKE);
+            materializeAll(translator);
+            emitOp(translator, code[0] == OP_INVOKE ? R_INVOKE : R_SUPER_INVOKE);
+            emitByte(translator, (uint8_t)base);
+            emitByte(translator, code[1]);
+            emitByte(translator, code[2]);
+            translator->height = base;
+            pushRegister(translator);
+            break;
+        }
+        case OP_CHECK_CALLEE:
+            if (code[2] > top) {
+                translator->failed = true;
+                break;
+            }
+            materializeAll(translator);
+            emitOp(translator, R_CHECK_CALLEE);
+            emitByte(translator, (uint8_t)(top - code[2]));
+            emitByte(translator, code[1]);
+            emitJump(translator, jumpTarget(translator->in, offset), false);
+            break;
+        case OP_INLINE_RETURN: {
+            // The result lands in the callee's register and the rest is dropped, so this is a move and a jump
+            int base = top - code[1];
+            if (base < 0) {
+                translator->failed = true;
+                break;
+            }
+            Slot *value = &translator->stack[top];
+            if (value->kind == SLOT_REGISTER && translator->lastResult == top) {
+                translator->out->code[translator->lastDestination] = (uint8_t)base;
+            } else if (top != base) {
+                emitLoad(translator, value->kind == SLOT_REGISTER ? (Slot){SLOT_LOCAL, (uint32_t)top} : *value, base);
+            }
+            translator->lastResult = -1;
+            translator->height = base;
+            pushRegister(translator);
+            materializeAll(translator);
+            emitOp(translator, R_JUMP);
+            emitJump(translator, jumpTarget(translator->in, offset), false);
+            break;
+        }
+        case OP_CLOSURE: {
+            // The upvalues capture registers, so the locals have to actually be in them
+            materializeAll(translator);
+            emitOp(translator, R_CLOSURE);
+            emitByte(translator, (uint8_t)translator->height);
+            for (int i = 1; i < instructionLength(translator->in, offset); i++) {
+                emitByte(translator, code[i]);
+            }
+            pushRegister(translator);
+            break;
+        }
+        case OP_CLOSE_UPVALUE:
+            materialize(translator, top);
+            emitOp(translator, R_CLOSE_UPVALUE);
+            emitByte(translator, (uint8_t)top);
+            translator->height--;
+            break;
+        case OP_RETURN: {
+            uint8_t value = operand(translator, top);
+            emitOp(translator, R_RETURN);
+            emitByte(translator, value);
+            translator->height--;
+            break;
+        }
+        case OP_CLASS:
+            pushRegister(translator);
+            emitWithConstant(translator, R_CLASS, top + 1, code, 1);
+            break;
+        case OP_INHERIT:
+            materializeRange(translator, top - 1);
+            emitOp(translator, R_INHERIT);
+            emitByte(translator, (uint8_t)(top - 1));
+            translator->height--;
+            break;
+        case OP_METHOD:
+            materializeRange(translator, top - 1);
+            emitWithConstant(translator, R_METHOD, top - 1, code, 1);
+            translator->height--;
+            break;
+        default:
+            translator->failed = true;
+            break;
+    }
+
+    if (translator->height < 0) translator->failed = true;
+}
+
+static bool endsFlow(uint8_t opcode) {
+    return opcode == OP_JUMP || opcode == OP_LOOP || opcode == OP_RETURN || opcode == OP_INLINE_RETURN;
+}
+
+static bool patchJumps(Translator *translator) {
+    for (int i = 0; i < translator->patchCount; i++) {
+        Patch *patch = &translator->patches[i];
+        int label = translator->labels[patch->target];
+        int distance = patch->backward ? patch->end - label : label - patch->end;
+        if (label == -1 || distance < 0 || distance > UINT16_MAX) return false;
+
+        translator->out->code[patch->operand] = (distance >> 8) & 0xff;
+        translator->out->code[patch->operand + 1] = distance & 0xff;
+    }
+    return true;
+}
+
+// Translates the whole chunk, returning true if it skipped code that turned out to be the target of a backward jump
+static bool translateCode(Translator *translator) {
+    Chunk *in = translator->in;
+    translator->out->count = 0;
+    translator->patchCount = 0;
+    translator->height = 0;
+    translator->maxHeight = 0;
+    translator->lastResult = -1;
+    for (int offset = 0; offset <= in->count; offset++) {
+        translator->labels[offset] = -1;
+    }
+
+    // The callee and the parameters are already in their registers when the function starts
+    for (int slot = 0; slot <= translator->function->arity; slot++) {
+        pushRegister(translator);
+    }
+
+    bool reachable = true;
+    bool skippedTarget = false;
+    for (int offset = 0; offset < in->count && !translator->failed; offset += instructionLength(in, offset)) {
+        if (translator->targets[offset] || !reachable) {
+            if (reachable) {
+                materializeAll(translator);
+                if (translator->heights[offset] == -1) {
+                    translator->heights[offset] = translator->height;
+                } else if (translator->heights[offset] != translator->height) {
+                    translator->failed = true;
+                }
+            } else if (translator->heights[offset] != -1) {
+                translator->height = translator->heights[offset];
+                for (int position = 0; position < translator->height; position++) {
+                    translator->stack[position].kind = SLOT_REGISTER;
+                }
+                reachable = true;
+            } else {
+                // Nothing jumps here and nothing falls through either, at least not that we know of yet
+                if (translator->targets[offset]) skippedTarget = true;
+                continue;
+            }
+            translator->lastResult = -1;
+        }
+
+        translator->labels[offset] = translator->out->count;
+        translator->line = in->lines[offset];
+        translateInstruction(translator, offset);
+        if (endsFlow(in->code[offset])) reachable = false;
+    }
+
+    if (!skippedTarget) return false;
+    for (int i = 0; i < translator->patchCount; i++) {
+        int target = translator->patches[i].target;
+        if (translator->labels[target] == -1 && translator->heights[target] != -1) return true;
+    }
+    return false;
+}
+
+bool compileRegisters(ObjFunction *function) {
+    Chunk *in = &function->chunk;
+    Chunk *out = ALLOCATE(Chunk, 1);
+    initChunk(out);
+    for (int i = 0; i < in->constants.count; i++) {
+        writeValueArray(&out->constants, in->constants.values[i]);
+    }
+
+    Translator translator;
+    memset(&translator, 0, sizeof(Translator));
+    translator.function = function;
+    translator.in = in;
+    translator.out = out;
+    translator.labels = ALLOCATE(int, in->count + 1);
+    translator.heights = ALLOCATE(int, in->count + 1);
+    translator.targets = ALLOCATE(bool, in->count + 1);
+    for (int offset = 0; offset <= in->count; offset++) {
+        translator.heights[offset] = -1;
+        translator.targets[offset] = false;
+    }
+    for (int offset = 0; offset < in->count; offset += instructionLength(in, offset)) {
+        int target = jumpTarget(in, offset);
+        if (target != -1) translator.targets[target] = true;
+    }
+
+    /*
+     * A piece of code that's only reached by jumping backwards to it (the increment clause of a for loop, which sits between
+     * the condition and the body) only gets its height once the jump is seen, after it's been skipped over as dead code.
+     * When that happens the translation runs again, this time knowing the height, until nothing is skipped that shouldn't be.
+     */
+    bool skipped;
+    do {
+        skipped = translateCode(&translator);
+    } while (skipped && !translator.failed);
+
+    bool ok = !translator.failed && patchJumps(&translator);
+
+    FREE_ARRAY(int, translator.labels, in->count + 1);
+    FREE_ARRAY(int, translator.heights, in->count + 1);
+    FREE_ARRAY(bool, translator.targets, in->count + 1);
+    FREE_ARRAY(Patch, translator.patches, translator.patchCapacity);
+
+    if (!ok) {
+        freeChunk(out);
+        FREE(Chunk, out);
+        return false;
+    }
+
+    function->registers = out;
+    function->registerCount = translator.maxHeight + 1;
+
+#ifdef DEBUG_PRINT_CODE
+    disassembleRegisterChunk(out, function->name != NULL ? function->name->chars : "<script>");
+#endif
+    return true;
+}
+
+int registerInstructionLength(Chunk *chunk, int offset) {
+    switch (chunk->code[offset]) {
+        case R_LOAD_NIL:
+        case R_LOAD_TRUE:
+        case R_LOAD_FALSE:
+        case R_PRINT:
+        case R_ITER_INIT:
+        case R_CLOSE_UPVALUE:
+        case R_RETURN:
+        case R_INHERIT:
+            return 2;
+        case R_GET_ITEM:
+        case R_GET_PROPERTY:
+        case R_JUMP_IF_FALSE:
+        case R_INVOKE:
+        case R_SUPER_INVOKE:
+            return 4;
+        case R_SET_ITEM:
+        case R_SET_PROPERTY:
+        case R_ITER_NEXT:
+        case R_CHECK_CALLEE:
+            return 5;
+        case R_LOAD_CONSTANT_LONG:
+        case R_GET_GLOBAL_LONG:
+        case R_DEFINE_GLOBAL_LONG:
+        case R_DEFINE_GLOBAL_PERM_LONG:
+        case R_SET_GLOBAL_LONG:
+            return 6;
+        case R_FOR_STEP:
+            return 7;
+        case R_CLOSURE: {
+            ObjFunction *function = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 2]]);
+            return 3 + function->upvalueCount * 2;
+        }
+        default:
+            if (chunk->code[offset] >= R_EQUAL && chunk->code[offset] <= R_MODULO_CONSTANT) return 4;
+            return 3;
+    }
+}
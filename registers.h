@@ -0,0 +1,104 @@
+#ifndef CFER_REGISTERS_H
+#define CFER_REGISTERS_H
+
+#include "object.h"
+
+/*
+ * The stack VM moves every value through the top of the stack. Even a = b + c on three locals is four instructions:
+ * push b, push c, add, store into a (and a fifth to pop the result of the assignment).
+ * Most of that work is shuffling, the only instruction doing anything useful is the add.
+ *
+ * The register format names where its operands are instead. A register is just a slot of the call frame,
+ * the same slots the stack VM uses for locals and temporaries, so a = b + c becomes a single R_ADD a b c.
+ * Since the height of the stack at every instruction is known when the code is compiled, every stack slot has a fixed register,
+ * and the register code is produced by compileRegisters() from the finished stack chunk: it walks the stack code keeping track of
+ * what each stack slot holds, and only copies a value into its slot when something actually needs it there.
+ * A local or a constant that's only read by the next instruction never moves at all.
+ *
+ * Operands below are written as A (a register written), B, C and D (registers read), k (a constant index), and n (a count).
+ * Instructions that take a run of values (calls, list and dictionary literals) still expect them in consecutive registers,
+ * exactly where the stack VM would have them.
+ *
+ * Setting FER_VM=register runs programs on this format instead of the stack one.
+ */
+
+typedef enum {
+    R_MOVE,                     // A B          A = B
+    R_LOAD_CONSTANT,            // A k
+    R_LOAD_CONSTANT_LONG,       // A k32
+    R_LOAD_NIL,                 // A
+    R_LOAD_TRUE,                // A
+    R_LOAD_FALSE,               // A
+    R_GET_GLOBAL,               // A k
+    R_GET_GLOBAL_LONG,          // A k32
+    R_DEFINE_GLOBAL,            // B k
+    R_DEFINE_GLOBAL_LONG,       // B k32
+    R_DEFINE_GLOBAL_PERM,       // B k
+    R_DEFINE_GLOBAL_PERM_LONG,  // B k32
+    R_SET_GLOBAL,               // B k
+    R_SET_GLOBAL_LONG,          // B k32
+    R_GET_UPVALUE,              // A index
+    R_SET_UPVALUE,              // B index
+    R_GET_ITEM,                 // A B C        A = B[C]
+    R_SET_ITEM,                 // A B C D      B[C] = D, A = D
+    R_GET_PROPERTY,             // A B k        A = B.k
+    R_SET_PROPERTY,             // A B C k      B.k = C, A = C
+    R_GET_SUPER,                // A k          A = super.k, with the receiver in A and the superclass in A + 1
+    // The binary operators, in the same order as the OpCodes
+    R_EQUAL,                    // A B C        A = B == C
+    R_GREATER,
+    R_LESS,
+    R_ADD,
+    R_SUBTRACT,
+    R_MULTIPLY,
+    R_DIVIDE,
+    R_MODULO,
+    R_BIT_AND,
+    R_BIT_OR,
+    R_BIT_XOR,
+    R_SHIFT_LEFT,
+    R_SHIFT_RIGHT,
+    // The same, with a constant on the right: i < 10, n + 1
+    R_EQUAL_CONSTANT,           // A B k        A = B == k
+    R_GREATER_CONSTANT,
+    R_LESS_CONSTANT,
+    R_ADD_CONSTANT,
+    R_SUBTRACT_CONSTANT,
+    R_MULTIPLY_CONSTANT,
+    R_DIVIDE_CONSTANT,
+    R_MODULO_CONSTANT,
+    R_NOT,                      // A B
+    R_NEGATE,                   // A B
+    R_LIST,                     // A n          the elements are in A .. A + n - 1, A + n is scratch
+    R_DICTIONARY,               // A n          n key/value pairs from A on, A + 2n is scratch
+    R_IMPORT,                   // A k
+    R_PRINT,                    // B
+    R_JUMP,                     // offset
+    R_JUMP_IF_FALSE,            // B offset
+    R_LOOP,                     // offset
+    R_ITER_INIT,                // A            the sequence is in A, the cursor goes in A + 1
+    R_ITER_NEXT,                // A D offset   the next element goes in D
+    R_FOR_STEP,                 // same operands as OP_FOR_STEP
+    R_CALL,                     // A n          the callee is in A and its arguments after it, the result lands in A
+    R_TAIL_CALL,                // A n          the same, for a call in tail position, see OP_TAIL_CALL
+    R_INVOKE,                   // A k n
+    R_SUPER_INVOKE,             // A k n        the superclass is after the arguments
+    R_CHECK_CALLEE,             // B k offset   jumps unless calling B would run the function k, see OP_CHECK_CALLEE
+    R_CLOSURE,                  // A k, then a pair of bytes per upvalue like OP_CLOSURE
+    R_CLOSE_UPVALUE,            // A
+    R_RETURN,                   // B
+    R_CLASS,                    // A k
+    R_INHERIT,                  // A            the superclass is in A and the subclass in A + 1
+    R_METHOD                    // A k          the class is in A and the method in A + 1
+} RegisterOpCode;
+
+/*
+ * Fills in function->registers and function->registerCount, the number of frame slots the register code uses.
+ * Returns false if the function can't be expressed in the format (more than 255 slots, or a jump too far for 16 bits).
+ */
+
+bool compileRegisters(ObjFunction *function);
+
+int registerInstructionLength(Chunk *chunk, int offset);
+
+#endif //CFER_REGISTERS_H
@@ -4,13 +4,6 @@
 #include "common.h"
 #include "scanner.h"
 
-typedef struct {
-    const char *start;
-    const char *current;
-    int line;
-} Scanner;
-
-
 Scanner scanner;
 
 void initScanner(const char *source) {
@@ -187,6 +180,7 @@ static TokenType identifierType() {
                     case 'o': return checkKeyword(2, 6, "ntinue", TOKEN_CONTINUE);
                 }
             }
+            break;
         case 'e': return checkKeyword(1, 3, "lse", TOKEN_ELSE);
         case 'f':
             if (scanner.current - scanner.start > 1) {
@@ -202,8 +196,10 @@ static TokenType identifierType() {
                 switch (scanner.start[1]) {
                     case 'f': return checkKeyword(2, 0, "", TOKEN_IF);
                     case 'm': return checkKeyword(2, 4, "port", TOKEN_IMPORT);
+                    case 'n': return checkKeyword(2, 0, "", TOKEN_IN);
                 }
             }
+            break;
         case 'n': return checkKeyword(1, 2, "il", TOKEN_NIL);
         case 'o': return checkKeyword(1, 1, "r", TOKEN_OR);
         case 'p':
@@ -297,16 +293,42 @@ Token scanToken() {
         case '+': return makeToken(TOKEN_PLUS);
         case '/': return makeToken(TOKEN_SLASH);
         case '*': return makeToken(TOKEN_STAR);
+        case '%': return makeToken(TOKEN_PERCENT);
+        case '&': return makeToken(TOKEN_AMPERSAND);
+        case '|': return makeToken(TOKEN_PIPE);
+        case '^': return makeToken(TOKEN_CARET);
         case '!':
             return makeToken(match('=') ? TOKEN_BANG_EQUAL : TOKEN_BANG);
         case '=':
             return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
         case '<':
+            if (match('<')) return makeToken(TOKEN_LESS_LESS);
             return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
         case '>':
+            if (match('>')) return makeToken(TOKEN_GREATER_GREATER);
             return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
         case '"': return string();
     }
 
     return errorToken("Unexpected character.");
-}
\ No newline at end of file
+}
+/*
+ * The compiler normally sees one token ahead (parser.current). A couple of spots need to see one further,
+ * for example to tell "for (x in list)" apart from "for (x = 0; ...)" while x is still the current token.
+ * peekToken() scans the next token and then puts the scanner back exactly where it was, so the token will be scanned again normally.
+ */
+
+Token peekToken() {
+    Scanner saved = scanner;
+    Token token = scanToken();
+    scanner = saved;
+    return token;
+}
+
+Scanner saveScanner() {
+    return scanner;
+}
+
+void restoreScanner(Scanner saved) {
+    scanner = saved;
+}
@@ -8,11 +8,12 @@ typedef enum {
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_COLON, TOKEN_SLASH, TOKEN_STAR,
+    TOKEN_PERCENT, TOKEN_AMPERSAND, TOKEN_PIPE, TOKEN_CARET,
     // One or two character tokens
     TOKEN_BANG, TOKEN_BANG_EQUAL,
     TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
-    TOKEN_GREATER, TOKEN_GREATER_EQUAL,
-    TOKEN_LESS, TOKEN_LESS_EQUAL,
+    TOKEN_GREATER, TOKEN_GREATER_EQUAL, TOKEN_GREATER_GREATER,
+    TOKEN_LESS, TOKEN_LESS_EQUAL, TOKEN_LESS_LESS,
     // Literals
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
     // Keywords
@@ -20,7 +21,7 @@ typedef enum {
     TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
     TOKEN_PRINT, TOKEN_RETURN, TOKEN_SUPER, TOKEN_THIS,
     TOKEN_TRUE, TOKEN_VAR, TOKEN_PERM, TOKEN_WHILE,
-    TOKEN_BREAK, TOKEN_CONTINUE, TOKEN_IMPORT,
+    TOKEN_BREAK, TOKEN_CONTINUE, TOKEN_IMPORT, TOKEN_IN,
 
     TOKEN_ERROR, TOKEN_EOF
 } TokenType;
@@ -40,7 +41,18 @@ typedef struct {
     int line;
 } Token;
 
+typedef struct {
+    const char *start;
+    const char *current;
+    int line;
+} Scanner;
+
 void initScanner(const char *source);
 Token scanToken();
+Token peekToken();
+
+// The compiler reads some source twice (see inlineCall()). These save where the scanner is and put it back there later.
+Scanner saveScanner();
+void restoreScanner(Scanner saved);
 
 #endif //CFER_SCANNER_H
\ No newline at end of file
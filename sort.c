@@ -0,0 +1,123 @@
+#include <string.h>
+
+#include "object.h"
+#include "sort.h"
+#include "vm.h"
+
+/*
+ * Strings are interned, so two references to the same object are the same string and we can skip the compare entirely.
+ * Otherwise it's a plain byte-wise compare, with the shorter string first when one is a prefix of the other.
+ */
+
+static inline int compareStrings(ObjString *a, ObjString *b) {
+    if (a == b) return 0;
+
+    int length = a->length < b->length ? a->length : b->length;
+    int result = memcmp(a->chars, b->chars, (size_t)length);
+    if (result != 0) return result;
+    return a->length - b->length;
+}
+
+#define SORT_NAME(name) name ## Numbers
+#define SORT_TYPE Value
+#define SORT_LESS(a, b) (AS_NUMBER(a) < AS_NUMBER(b))
+#include "sortimpl.h"
+#undef SORT_NAME
+#undef SORT_TYPE
+#undef SORT_LESS
+
+#define SORT_NAME(name) name ## Strings
+#define SORT_TYPE Value
+#define SORT_LESS(a, b) (compareStrings(AS_STRING(a), AS_STRING(b)) < 0)
+#include "sortimpl.h"
+#undef SORT_NAME
+#undef SORT_TYPE
+#undef SORT_LESS
+
+#define SORT_NAME(name) name ## KeyedNumbers
+#define SORT_TYPE KeyedValue
+#define SORT_LESS(a, b) (AS_NUMBER((a).key) < AS_NUMBER((b).key) \
+    || (AS_NUMBER((a).key) == AS_NUMBER((b).key) && (a).index < (b).index))
+#include "sortimpl.h"
+#undef SORT_NAME
+#undef SORT_TYPE
+#undef SORT_LESS
+
+static inline bool keyedStringLess(KeyedValue *a, KeyedValue *b) {
+    int result = compareStrings(AS_STRING(a->key), AS_STRING(b->key));
+    return result < 0 || (result == 0 && a->index < b->index);
+}
+
+#define SORT_NAME(name) name ## KeyedStrings
+#define SORT_TYPE KeyedValue
+#define SORT_LESS(a, b) keyedStringLess(&(a), &(b))
+#include "sortimpl.h"
+#undef SORT_NAME
+#undef SORT_TYPE
+#undef SORT_LESS
+
+/*
+ * A comparator returns a number (negative when a goes first, like C's qsort) or a boolean (true when a goes first).
+ * Once one call fails we stop calling out and treat every pair as ordered, which lets the sort wind down quickly.
+ * The comparator itself can call sort(), so the current one is saved and restored around each sort instead of living in one global.
+ */
+
+typedef struct {
+    Value comparator;
+    bool failed;
+} Comparison;
+
+static Comparison *currentComparison = NULL;
+
+static bool lessByComparator(Value a, Value b) {
+    if (currentComparison->failed) return false;
+
+    Value args[2] = {a, b};
+    Value result;
+    if (!vmCall(currentComparison->comparator, 2, args, &result)) {
+        currentComparison->failed = true;
+        return false;
+    }
+
+    if (IS_BOOL(result)) return AS_BOOL(result);
+    if (IS_NUMBER(result)) return AS_NUMBER(result) < 0;
+
+    nativeError("sort() comparator must return a number or a boolean.");
+    currentComparison->failed = true;
+    return false;
+}
+
+#define SORT_NAME(name) name ## Comparator
+#define SORT_TYPE Value
+#define SORT_LESS(a, b) lessByComparator(a, b)
+#include "sortimpl.h"
+#undef SORT_NAME
+#undef SORT_TYPE
+#undef SORT_LESS
+
+void sortNumbers(Value *values, int count) {
+    pdqsortNumbers(values, values + count);
+}
+
+void sortStrings(Value *values, int count) {
+    pdqsortStrings(values, values + count);
+}
+
+void sortKeyedNumbers(KeyedValue *values, int count) {
+    pdqsortKeyedNumbers(values, values + count);
+}
+
+void sortKeyedStrings(KeyedValue *values, int count) {
+    pdqsortKeyedStrings(values, values + count);
+}
+
+bool sortWithComparator(Value *values, int count, Value comparator) {
+    Comparison comparison = {comparator, false};
+    Comparison *enclosing = currentComparison;
+
+    currentComparison = &comparison;
+    pdqsortComparator(values, values + count);
+    currentComparison = enclosing;
+
+    return !comparison.failed;
+}
@@ -0,0 +1,29 @@
+#ifndef CFER_SORT_H
+#define CFER_SORT_H
+
+#include "common.h"
+#include "value.h"
+
+/*
+ * In-place sorts over arrays of Values, used by the sort() native.
+ * Each one expects every element to already be of the right type, the caller checks that first.
+ *
+ * sortKeyed*() sort elements by a key computed beforehand, ties keep their original order (index breaks them).
+ * sortWithComparator() asks a Fer function for every comparison and returns false if one of those calls failed,
+ * in which case the array is left in some unspecified order and the error is already on its way.
+ * Only the keyed sorts are stable.
+ */
+
+typedef struct {
+    Value key;
+    Value value;
+    int index;
+} KeyedValue;
+
+void sortNumbers(Value *values, int count);
+void sortStrings(Value *values, int count);
+void sortKeyedNumbers(KeyedValue *values, int count);
+void sortKeyedStrings(KeyedValue *values, int count);
+bool sortWithComparator(Value *values, int count, Value comparator);
+
+#endif //CFER_SORT_H
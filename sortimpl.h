@@ -0,0 +1,237 @@
+/*
+ * This file is a template for pattern-defeating quicksort (pdqsort), included once per element type by sort.c.
+ * Before including it, define:
+ *
+ * SORT_NAME(name)  turns a base name into the name of this copy, e.g. name ## Numbers
+ * SORT_TYPE        the element type
+ * SORT_LESS(a, b)  true when a must come before b
+ *
+ * Writing it once and stamping it out per type means every copy compares its elements inline,
+ * instead of going through a function pointer on each of the n log n comparisons.
+ *
+ * pdqsort is a quicksort that keeps an eye on itself:
+ * - Small ranges are finished with insertion sort.
+ * - The pivot is the median of 3, or of 3 medians of 3 (Tukey's ninther) for large ranges.
+ * - If a partition didn't have to move anything, the range was probably already sorted, and a bounded insertion sort checks that
+ *   cheaply. Sorted and reverse sorted input become linear.
+ * - If the pivot is equal to the one before it, every element equal to the pivot is split off in one go, so lists with lots of
+ *   duplicates don't go quadratic.
+ * - Badly unbalanced partitions shuffle a few elements to break patterns, and after too many of them we give up and heapsort,
+ *   which caps the worst case at O(n log n).
+ *
+ * Unlike the original, every scan is bounds checked. That costs a compare per step, but it means a SORT_LESS that isn't a consistent
+ * ordering (NaNs, or a user supplied comparator that lies) can only produce an unsorted result, never walk off the array.
+ */
+
+#define SORT_INSERTION_LIMIT 24
+#define SORT_NINTHER_LIMIT 128
+#define SORT_PARTIAL_INSERTION_LIMIT 8
+
+static inline void SORT_NAME(swap)(SORT_TYPE *a, SORT_TYPE *b) {
+    SORT_TYPE tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static inline void SORT_NAME(sort2)(SORT_TYPE *a, SORT_TYPE *b) {
+    if (SORT_LESS(*b, *a)) SORT_NAME(swap)(a, b);
+}
+
+static inline void SORT_NAME(sort3)(SORT_TYPE *a, SORT_TYPE *b, SORT_TYPE *c) {
+    SORT_NAME(sort2)(a, b);
+    SORT_NAME(sort2)(b, c);
+    SORT_NAME(sort2)(a, b);
+}
+
+static void SORT_NAME(insertionSort)(SORT_TYPE *begin, SORT_TYPE *end) {
+    if (begin == end) return;
+
+    for (SORT_TYPE *current = begin + 1; current < end; current++) {
+        SORT_TYPE value = *current;
+        SORT_TYPE *sift = current;
+        while (sift > begin && SORT_LESS(value, sift[-1])) {
+            *sift = sift[-1];
+            sift--;
+        }
+        *sift = value;
+    }
+}
+
+// Like insertionSort(), but gives up (and returns false) once it has moved more than a handful of elements
+static bool SORT_NAME(partialInsertionSort)(SORT_TYPE *begin, SORT_TYPE *end) {
+    if (begin == end) return true;
+
+    int moved = 0;
+    for (SORT_TYPE *current = begin + 1; current < end; current++) {
+        if (!SORT_LESS(*current, current[-1])) continue;
+
+        SORT_TYPE value = *current;
+        SORT_TYPE *sift = current;
+        while (sift > begin && SORT_LESS(value, sift[-1])) {
+            *sift = sift[-1];
+            sift--;
+        }
+        *sift = value;
+
+        moved += (int)(current - sift);
+        if (moved > SORT_PARTIAL_INSERTION_LIMIT) return false;
+    }
+    return true;
+}
+
+static void SORT_NAME(siftDown)(SORT_TYPE *heap, int root, int count) {
+    for (;;) {
+        int child = root * 2 + 1;
+        if (child >= count) return;
+        if (child + 1 < count && SORT_LESS(heap[child], heap[child + 1])) child++;
+        if (!SORT_LESS(heap[root], heap[child])) return;
+        SORT_NAME(swap)(&heap[root], &heap[child]);
+        root = child;
+    }
+}
+
+static void SORT_NAME(heapSort)(SORT_TYPE *begin, SORT_TYPE *end) {
+    int count = (int)(end - begin);
+    for (int i = count / 2 - 1; i >= 0; i--) {
+        SORT_NAME(siftDown)(begin, i, count);
+    }
+    for (int i = count - 1; i > 0; i--) {
+        SORT_NAME(swap)(&begin[0], &begin[i]);
+        SORT_NAME(siftDown)(begin, 0, i);
+    }
+}
+
+/*
+ * Partitions around the pivot in *begin. Elements less than the pivot end up to its left, the rest to its right.
+ * Returns where the pivot landed, and whether the range was already partitioned (no swaps needed).
+ */
+
+static SORT_TYPE* SORT_NAME(partitionRight)(SORT_TYPE *begin, SORT_TYPE *end, bool *alreadyPartitioned) {
+    SORT_TYPE pivot = *begin;
+    SORT_TYPE *first = begin;
+    SORT_TYPE *last = end;
+
+    while (++first < end && SORT_LESS(*first, pivot));
+    while (--last > begin && last >= first && !SORT_LESS(*last, pivot));
+
+    *alreadyPartitioned = first >= last;
+
+    while (first < last) {
+        SORT_NAME(swap)(first, last);
+        while (++first < end && SORT_LESS(*first, pivot));
+        while (--last > begin && !SORT_LESS(*last, pivot));
+    }
+
+    SORT_TYPE *pivotPosition = first - 1;
+    *begin = *pivotPosition;
+    *pivotPosition = pivot;
+    return pivotPosition;
+}
+
+/*
+ * The mirror image of partitionRight(): elements equal to the pivot go to its left.
+ * We only use it when the pivot equals the element just before the range, which means nothing in the range is less than it,
+ * so everything that ends up on the left is equal to the pivot and already in its final place.
+ */
+
+static SORT_TYPE* SORT_NAME(partitionLeft)(SORT_TYPE *begin, SORT_TYPE *end) {
+    SORT_TYPE pivot = *begin;
+    SORT_TYPE *first = begin;
+    SORT_TYPE *last = end;
+
+    while (--last > begin && SORT_LESS(pivot, *last));
+    while (++first < end && first <= last && !SORT_LESS(pivot, *first));
+
+    while (first < last) {
+        SORT_NAME(swap)(first, last);
+        while (--last > begin && SORT_LESS(pivot, *last));
+        while (++first < end && !SORT_LESS(pivot, *first));
+    }
+
+    *begin = *last;
+    *last = pivot;
+    return last;
+}
+
+static void SORT_NAME(pdqsortLoop)(SORT_TYPE *begin, SORT_TYPE *end, int badAllowed, bool leftmost) {
+    for (;;) {
+        int size = (int)(end - begin);
+        if (size < SORT_INSERTION_LIMIT) {
+            SORT_NAME(insertionSort)(begin, end);
+            return;
+        }
+
+        // Move the chosen pivot to *begin
+        int half = size / 2;
+        if (size > SORT_NINTHER_LIMIT) {
+            SORT_NAME(sort3)(begin, begin + half, end - 1);
+            SORT_NAME(sort3)(begin + 1, begin + (half - 1), end - 2);
+            SORT_NAME(sort3)(begin + 2, begin + (half + 1), end - 3);
+            SORT_NAME(sort3)(begin + (half - 1), begin + half, begin + (half + 1));
+            SORT_NAME(swap)(begin, begin + half);
+        } else {
+            SORT_NAME(sort3)(begin + half, begin, end - 1);
+        }
+
+        // begin[-1] is the pivot of an enclosing partition, so nothing in this range is less than it
+        if (!leftmost && !SORT_LESS(begin[-1], *begin)) {
+            begin = SORT_NAME(partitionLeft)(begin, end) + 1;
+            continue;
+        }
+
+        bool alreadyPartitioned;
+        SORT_TYPE *pivot = SORT_NAME(partitionRight)(begin, end, &alreadyPartitioned);
+
+        int leftSize = (int)(pivot - begin);
+        int rightSize = (int)(end - (pivot + 1));
+
+        if (leftSize < size / 8 || rightSize < size / 8) {
+            if (--badAllowed == 0) {
+                SORT_NAME(heapSort)(begin, end);
+                return;
+            }
+
+            if (leftSize >= SORT_INSERTION_LIMIT) {
+                SORT_NAME(swap)(begin, begin + leftSize / 4);
+                SORT_NAME(swap)(pivot - 1, pivot - leftSize / 4);
+                if (leftSize > SORT_NINTHER_LIMIT) {
+                    SORT_NAME(swap)(begin + 1, begin + (leftSize / 4 + 1));
+                    SORT_NAME(swap)(begin + 2, begin + (leftSize / 4 + 2));
+                    SORT_NAME(swap)(pivot - 2, pivot - (leftSize / 4 + 1));
+                    SORT_NAME(swap)(pivot - 3, pivot - (leftSize / 4 + 2));
+                }
+            }
+
+            if (rightSize >= SORT_INSERTION_LIMIT) {
+                SORT_NAME(swap)(pivot + 1, pivot + (1 + rightSize / 4));
+                SORT_NAME(swap)(end - 1, end - rightSize / 4);
+                if (rightSize > SORT_NINTHER_LIMIT) {
+                    SORT_NAME(swap)(pivot + 2, pivot + (2 + rightSize / 4));
+                    SORT_NAME(swap)(pivot + 3, pivot + (3 + rightSize / 4));
+                    SORT_NAME(swap)(end - 2, end - (1 + rightSize / 4));
+                    SORT_NAME(swap)(end - 3, end - (2 + rightSize / 4));
+                }
+            }
+        } else if (alreadyPartitioned
+                   && SORT_NAME(partialInsertionSort)(begin, pivot)
+                   && SORT_NAME(partialInsertionSort)(pivot + 1, end)) {
+            return;
+        }
+
+        SORT_NAME(pdqsortLoop)(begin, pivot, badAllowed, leftmost);
+        begin = pivot + 1;
+        leftmost = false;
+    }
+}
+
+static void SORT_NAME(pdqsort)(SORT_TYPE *begin, SORT_TYPE *end) {
+    int badAllowed = 1;
+    for (int size = (int)(end - begin); size > 1; size >>= 1) {
+        badAllowed++;
+    }
+    SORT_NAME(pdqsortLoop)(begin, end, badAllowed, true);
+}
+
+#undef SORT_INSERTION_LIMIT
+#undef SORT_NINTHER_LIMIT
+#undef SORT_PARTIAL_INSERTION_LIMIT
@@ -1,109 +1,266 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TABLE_SSE2
+#endif
+
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
+#define TABLE_MAX_LOAD 0.875
+#define TABLE_MAX_TOMBSTONES 0.25
+#define TABLE_MIN_LOAD 0.125
+
+/*
+ * Slots are grouped in runs of GROUP_WIDTH, which is the number of control bytes a single SSE2 compare looks at.
+ * The capacity is always a power of two and a multiple of the group width, so groups never straddle the end of the array.
+ *
+ * Each control byte is either one of the two markers below (both have the high bit set) or, for a full slot, H2 of its key's hash.
+ * H1, the rest of the hash, picks the group where probing starts.
+ */
+
+#define GROUP_WIDTH 16
+
+#define CTRL_EMPTY   ((int8_t)-128) // 1000 0000
+#define CTRL_DELETED ((int8_t)-2)   // 1111 1110
+
+#define H1(hash) ((hash) >> 7)
+#define H2(hash) ((int8_t)((hash) & 0x7f))
+
+#define IS_FULL(control) ((control) >= 0)
+
+#define TABLE_GROW_CAPACITY(capacity) \
+    ((capacity) < GROUP_WIDTH ? GROUP_WIDTH : (capacity) * 2)
+
+typedef uint32_t GroupMask;
+
+static inline GroupMask matchByte(const int8_t *group, int8_t byte) {
+#ifdef TABLE_SSE2
+    __m128i control = _mm_loadu_si128((const __m128i*)group);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(byte), control));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        if (group[i] == byte) mask |= (GroupMask)1 << i;
+    }
+    return mask;
+#endif
+}
+
+static inline GroupMask matchEmptyOrDeleted(const int8_t *group) {
+#ifdef TABLE_SSE2
+    // Both markers have the high bit set, which is exactly the bit movemask collects
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)group));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < GROUP_WIDTH; i++) {
+        if (!IS_FULL(group[i])) mask |= (GroupMask)1 << i;
+    }
+    return mask;
+#endif
+}
+
+static inline int lowestBit(GroupMask mask) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(mask);
+#else
+    int bit = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        bit++;
+    }
+    return bit;
+#endif
+}
 
 void initTable(Table *table) {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
+    table->control = NULL;
+    table->hashes = NULL;
     table->entries = NULL;
 }
 
 void freeTable(Table *table) {
+    FREE_ARRAY(int8_t, table->control, table->capacity);
+    FREE_ARRAY(uint32_t, table->hashes, table->capacity);
     FREE_ARRAY(Entry, table->entries, table->capacity);
     initTable(table);
 }
 
-static Entry* findEntry(Entry *entries, int capacity, ObjString *key) {
-    uint32_t index = key->hash & (capacity - 1);
-    Entry *tombstone = NULL;
-    for (;;) {
-        Entry *entry = &entries[index];
-        if (entry->key == NULL) {
-            if (IS_NIL(entry->value)) {
-                // Empty entry
-                return tombstone != NULL ? tombstone : entry;
-            } else {
-                // We found a tombstone
-                if (tombstone == NULL) tombstone = entry;
-            }
-        } else if (entry->key == key) {
-            // We found the key
-            return entry;
+/*
+ * Probing walks whole groups instead of single slots. We step 1, 2, 3... groups away from the starting one.
+ * With a power of two number of groups, that triangular sequence visits every group exactly once before it repeats.
+ *
+ * A lookup can stop as soon as it sees a group with an empty slot in it: an insert for the key would have used that slot
+ * (or an earlier one), so the key can't live any further along the sequence.
+ */
+
+static int findEntry(Table *table, ObjString *key, uint32_t hash) {
+    int groupMask = (table->capacity / GROUP_WIDTH) - 1;
+    int group = (int)H1(hash) & groupMask;
+    int8_t fragment = H2(hash);
+
+    for (int step = 1;; step++) {
+        int base = group * GROUP_WIDTH;
+        const int8_t *control = &table->control[base];
+
+        for (GroupMask match = matchByte(control, fragment); match != 0; match &= match - 1) {
+            int index = base + lowestBit(match);
+            if (table->entries[index].key == key) return index;
         }
 
-        index = (index + 1) & (capacity - 1);
+        if (matchByte(control, CTRL_EMPTY) != 0) return -1;
+        group = (group + step) & groupMask;
+    }
+}
+
+static int findInsertSlot(int8_t *control, int capacity, uint32_t hash) {
+    int groupMask = (capacity / GROUP_WIDTH) - 1;
+    int group = (int)H1(hash) & groupMask;
+
+    for (int step = 1;; step++) {
+        int base = group * GROUP_WIDTH;
+        GroupMask free = matchEmptyOrDeleted(&control[base]);
+        if (free != 0) return base + lowestBit(free);
+        group = (group + step) & groupMask;
     }
 }
 
 bool tableGet(Table *table, ObjString *key, Value *value) {
     if (table->count == 0) return false;
 
-    Entry *entry = findEntry(table->entries, table->capacity, key);
-    if (entry->key == NULL) return false;
+    int index = findEntry(table, key, key->hash);
+    if (index == -1) return false;
 
-    *value = entry->value;
+    *value = table->entries[index].value;
     return true;
 }
 
+/*
+ * Everything gets allocated up front: reallocate() can kick off a collection, and the old arrays must still be intact while that happens.
+ * After that, rehashing only reads the cached hashes, never the keys themselves.
+ *
+ * Rehashing drops every tombstone, so this is also how we clean a table in place (same capacity) or shrink it.
+ */
+
 static void adjustCapacity(Table *table, int capacity) {
+    int8_t *control = ALLOCATE(int8_t, capacity);
+    uint32_t *hashes = ALLOCATE(uint32_t, capacity);
     Entry *entries = ALLOCATE(Entry, capacity);
+    memset(control, CTRL_EMPTY, capacity);
     for (int i = 0; i < capacity; i++) {
         entries[i].key = NULL;
         entries[i].value = NIL_VAL;
     }
 
     table->count = 0;
+    table->tombstones = 0;
     for (int i = 0; i < table->capacity; i++) {
-        Entry *entry = &table->entries[i];
-        if (entry->key == NULL) continue;
+        if (!IS_FULL(table->control[i])) continue;
 
-        Entry *dest = findEntry(entries, capacity, entry->key);
-        dest->key = entry->key;
-        dest->value = entry->value;
+        uint32_t hash = table->hashes[i];
+        int dest = findInsertSlot(control, capacity, hash);
+        control[dest] = H2(hash);
+        hashes[dest] = hash;
+        entries[dest] = table->entries[i];
         table->count++;
     }
 
+    FREE_ARRAY(int8_t, table->control, table->capacity);
+    FREE_ARRAY(uint32_t, table->hashes, table->capacity);
     FREE_ARRAY(Entry, table->entries, table->capacity);
+    table->control = control;
+    table->hashes = hashes;
     table->entries = entries;
     table->capacity = capacity;
 }
 
 bool tableSet(Table *table, ObjString *key, Value value) {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjustCapacity(table, capacity);
+    uint32_t hash = key->hash;
+    if (table->count > 0) {
+        int index = findEntry(table, key, hash);
+        if (index != -1) {
+            table->entries[index].value = value;
+            return false;
+        }
+    }
+
+    if (table->count + table->tombstones + 1 > table->capacity * TABLE_MAX_LOAD) {
+        // If it's mostly tombstones clogging the table, getting rid of them is enough
+        if (table->tombstones > 0 && table->tombstones >= table->capacity * TABLE_MAX_TOMBSTONES) {
+            adjustCapacity(table, table->capacity);
+        } else {
+            adjustCapacity(table, TABLE_GROW_CAPACITY(table->capacity));
+        }
     }
 
-    Entry *entry = findEntry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
+    int index = findInsertSlot(table->control, table->capacity, hash);
+    if (table->control[index] == CTRL_DELETED) table->tombstones--;
+    table->count++;
+
+    table->control[index] = H2(hash);
+    table->hashes[index] = hash;
+    table->entries[index].key = key;
+    table->entries[index].value = value;
+    return true;
+}
+
+/*
+ * A deleted slot normally has to become a tombstone so lookups keep probing past it.
+ * But if its group still has an empty slot, no probe sequence has ever gone on past this group, so the slot can simply go back to empty.
+ * Groups only lose their last empty slot on insertion, never regain one until the next rehash, which is what makes that safe.
+ */
+
+static void deleteAt(Table *table, int index) {
+    const int8_t *group = &table->control[index - (index % GROUP_WIDTH)];
+    if (matchByte(group, CTRL_EMPTY) != 0) {
+        table->control[index] = CTRL_EMPTY;
+    } else {
+        table->control[index] = CTRL_DELETED;
+        table->tombstones++;
+    }
+
+    table->entries[index].key = NULL;
+    table->entries[index].value = NIL_VAL;
+    table->count--;
+}
+
+/*
+ * When a table that was once big has mostly emptied out, we move it into a smaller array.
+ * The new size leaves the table about half as full as the grow threshold so that a few inserts right after don't make it grow right back.
+ */
 
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+static void shrinkIfSparse(Table *table) {
+    if (table->capacity <= GROUP_WIDTH || table->count >= table->capacity * TABLE_MIN_LOAD) return;
+
+    int capacity = GROUP_WIDTH;
+    while (capacity * TABLE_MAX_LOAD / 2 < table->count) {
+        capacity *= 2;
+    }
+    adjustCapacity(table, capacity);
 }
 
 bool tableDelete(Table *table, ObjString *key) {
     if (table->count == 0) return false;
 
-    Entry *entry = findEntry(table->entries, table->capacity, key);
+    int index = findEntry(table, key, key->hash);
+    if (index == -1) return false;
 
-    entry->key = NULL;
-    entry->value = BOOL_VAL(true);
+    deleteAt(table, index);
+    shrinkIfSparse(table);
     return true;
 }
 
 void tableAddAll(Table *from, Table *to) {
     for (int i = 0; i < from->capacity; i++) {
-        Entry *entry = &from->entries[i];
-        if (entry->key != NULL) {
-            tableSet(to, entry->key, entry->value);
+        if (IS_FULL(from->control[i])) {
+            tableSet(to, from->entries[i].key, from->entries[i].value);
         }
     }
 }
@@ -111,41 +268,50 @@ void tableAddAll(Table *from, Table *to) {
 ObjString* tableFindString(Table *table, const char *chars, int length, uint32_t hash) {
     if (table->count == 0) return NULL;
 
-    uint32_t index = hash & (table->capacity - 1);
-    for (;;) {
-        Entry *entry = &table->entries[index];
-        if (entry->key == NULL) {
-            // Stop if we find an empty non-tombsone entry
-            if (IS_NIL(entry->value)) return NULL;
-        } else if (entry->key->length == length &&
-            entry->key->hash == hash &&
-            memcmp(entry->key->chars, chars, length) == 0) {
-            // We found it
-            return entry->key;
+    int groupMask = (table->capacity / GROUP_WIDTH) - 1;
+    int group = (int)H1(hash) & groupMask;
+    int8_t fragment = H2(hash);
+
+    for (int step = 1;; step++) {
+        int base = group * GROUP_WIDTH;
+        const int8_t *control = &table->control[base];
+
+        for (GroupMask match = matchByte(control, fragment); match != 0; match &= match - 1) {
+            int index = base + lowestBit(match);
+            ObjString *key = table->entries[index].key;
+            if (table->hashes[index] == hash &&
+                key->length == length &&
+                memcmp(key->chars, chars, length) == 0) {
+                // We found it
+                return key;
+            }
         }
 
-        index = (index + 1) & (table->capacity - 1);
+        // Stop if the group has an empty slot in it
+        if (matchByte(control, CTRL_EMPTY) != 0) return NULL;
+        group = (group + step) & groupMask;
     }
 }
 
+/*
+ * This runs in the middle of a collection, so it must not allocate. That's why the string table never shrinks here,
+ * the tombstones left behind get cleaned the next time it fills up.
+ */
+
 void tableRemoveWhite(Table *table) {
     for (int i = 0; i < table->capacity; i++) {
-        Entry *entry = &table->entries[i];
-        if (entry->key != NULL && !entry->key->obj.isMarked) {
-            tableDelete(table, entry->key);
+        if (IS_FULL(table->control[i]) && !table->entries[i].key->obj.isMarked) {
+            deleteAt(table, i);
         }
     }
 }
 
 void markTable(Table *table) {
     for (int i = 0; i < table->capacity; i++) {
+        if (!IS_FULL(table->control[i])) continue;
+
         Entry *entry = &table->entries[i];
         markObject((Obj*)entry->key);
         markValue(entry->value);
     }
 }
-
-
-
-
-
@@ -13,11 +13,22 @@ typedef struct {
  * A hast table is an array of entries. As in our dynamic array earlier, we keep track of both the allocated size of the array (capacity)
  * and the number of key/value pairs currently stored in it (count).
  * The ratio of count to capacity is exactly the load factor of the hash table.
+ *
+ * The table is laid out like a SwissTable. Next to the entries there's a control array with one byte per slot:
+ * the high bit tells whether the slot is empty or deleted, and for full slots the low seven bits hold a fragment of the key's hash.
+ * Lookups scan the control bytes sixteen at a time and only touch an Entry when its fragment matches.
+ * The full hash of each key is cached in hashes, so growing the table never has to chase the key pointers.
+ *
+ * count only tracks live entries. Deleted slots that still have to be probed past are counted separately in tombstones,
+ * since both of them fill up the table as far as probing is concerned.
  */
 
 typedef struct {
     int count;
+    int tombstones;
     int capacity;
+    int8_t *control;
+    uint32_t *hashes;
     Entry *entries;
 } Table;
 
@@ -31,4 +42,4 @@ ObjString* tableFindString(Table *table, const char *chars, int length, uint32_t
 void tableRemoveWhite(Table *table);
 void markTable(Table *table);
 
-#endif //CFER_TABLE_H
\ No newline at end of file
+#endif //CFER_TABLE_H
@@ -0,0 +1,1314 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "memory.h"
+#include "optimizer.h"
+#include "tier.h"
+#include "vm.h"
+
+#ifdef DEBUG_PRINT_CODE
+#include "debug.h"
+#endif
+
+#define TIER_MAX_TEMPORARIES 16
+#define TIER_MAX_HEIGHT 512
+
+/*
+ * ---------------------------------------- SSA ----------------------------------------
+ *
+ * The bytecode keeps everything on the stack, locals included: local number n is just stack slot n.
+ * So the IR treats every stack slot as a variable. Walking a block, we keep the SSA value held by each slot,
+ * GET_LOCAL pushes the value in slot n, SET_LOCAL puts a value into it, and an OP_ADD makes a new value out of the top two.
+ *
+ * Where control flow merges, each slot gets a phi: a value that is whichever one the incoming edge brought along.
+ * We give every slot of every merge a phi and then remove the trivial ones, a phi whose inputs are all the same value
+ * (or itself, around a loop) is just that value. replacedBy records that, and resolve() follows it.
+ * What's left is the real SSA form, and a local read inside a loop either sees a phi of the loop header
+ * (it changes from one iteration to the next) or a value defined before the loop (it doesn't).
+ */
+
+typedef enum {
+    SSA_NONE,       // nothing known yet, only while types are being worked out
+    SSA_NUMBER,
+    SSA_BOOL,
+    SSA_NIL,
+    SSA_STRING,
+    SSA_ANY
+} SsaType;
+
+typedef enum {
+    DEF_PARAMETER,
+    DEF_CONSTANT,
+    DEF_OPERATION,  // an arithmetic, comparison or logic instruction
+    DEF_PHI,
+    DEF_OPAQUE      // anything else: a call, a global, an element, what OP_FOR_STEP writes to the counter
+} DefKind;
+
+typedef struct {
+    DefKind kind;
+    uint8_t opcode;
+    int operands[2];
+    int *phiOperands;       // one per predecessor of the block, and one more for the function's entry if the block is the first
+    int phiCount;
+    Value constant;
+    int block;
+    int replacedBy;
+    int canonical;          // the first value that computes the same thing
+    SsaType type;
+} SsaValue;
+
+typedef struct {
+    int first;              // instruction indices
+    int last;
+    int successors[2];
+    int successorCount;
+    int fallthrough;        // the successor reached by falling off the end, -1 if the block always jumps or returns
+    int *predecessors;
+    int predecessorCount;
+    int predecessorCapacity;
+    int order;              // position in reverse postorder, -1 if nothing reaches the block
+    int idom;
+    int entryHeight;
+    int *entryState;
+    int exitHeight;
+    int *exitState;
+    int fallthroughPush;    // OP_ITER_NEXT pushes the element only when it falls through
+    bool *loop;             // for a loop header, which blocks are in its loop
+    int preheader;          // the block that runs once on the way into the loop, PREHEADER_ENTRY if that's the function's prologue
+} Block;
+
+#define PREHEADER_ENTRY (-2)
+
+/*
+ * An expression like a * b + 1 is a run of instructions that reads locals and constants and leaves one value behind.
+ * We call that a tree. treeStart says where the tree ending at an instruction begins,
+ * and a tree can be replaced as a whole by anything else that leaves the same value.
+ */
+
+typedef struct {
+    int offset;
+    int block;
+    int target;             // the instruction a jump lands on, -1 otherwise
+    int result;             // the value the instruction leaves on top of the stack, -1 if none
+    int treeStart;          // -1 if the instruction doesn't end a tree
+    int droppedTree;        // for an OP_POP that throws a tree's value away, where that tree starts
+    bool hasOperation;
+    bool mayFail;
+} TierInstruction;
+
+typedef enum {
+    REWRITE_HOIST,          // compute the tree before the loop, read the slot in its place
+    REWRITE_SHARE,          // keep the tree, and also store its value
+    REWRITE_REUSE,          // read the value a REWRITE_SHARE stored in place of the tree
+    REWRITE_DROP            // the tree and the OP_POP after it go away
+} RewriteKind;
+
+typedef struct {
+    RewriteKind kind;
+    int start;
+    int end;
+    int temporary;
+    int header;
+} Rewrite;
+
+typedef struct {
+    ObjFunction *function;
+    Chunk *chunk;
+    uint64_t numberParams;
+
+    TierInstruction *instructions;
+    int count;
+    Block *blocks;
+    int blockCount;
+    int *order;
+    int orderCount;
+
+    SsaValue *values;
+    int valueCount;
+    int valueCapacity;
+    int entryValues[UINT8_COUNT];   // what the slots hold when the function starts: the callee, then the parameters
+    int entryHeight;
+
+    Rewrite *rewrites;
+    int rewriteCount;
+    int rewriteCapacity;
+    int *covered;           // the rewrite each instruction belongs to, -1 if none
+    int temporaries;
+} Tier;
+
+static int newValue(Tier *tier, DefKind kind, int block, SsaType type) {
+    if (tier->valueCount == tier->valueCapacity) {
+        int oldCapacity = tier->valueCapacity;
+        tier->valueCapacity = GROW_CAPACITY(oldCapacity);
+        tier->values = GROW_ARRAY(SsaValue, tier->values, oldCapacity, tier->valueCapacity);
+    }
+
+    SsaValue *value = &tier->values[tier->valueCount];
+    value->kind = kind;
+    value->opcode = 0;
+    value->operands[0] = -1;
+    value->operands[1] = -1;
+    value->phiOperands = NULL;
+    value->phiCount = 0;
+    value->constant = NIL_VAL;
+    value->block = block;
+    value->replacedBy = -1;
+    value->canonical = -1;
+    value->type = type;
+    return tier->valueCount++;
+}
+
+static int resolve(Tier *tier, int value) {
+    while (tier->values[value].replacedBy != -1) value = tier->values[value].replacedBy;
+    return value;
+}
+
+static SsaType constantType(Value value) {
+    if (IS_NUMBER(value)) return SSA_NUMBER;
+    if (IS_BOOL(value)) return SSA_BOOL;
+    if (IS_NIL(value)) return SSA_NIL;
+    if (IS_STRING(value)) return SSA_STRING;
+    return SSA_ANY;
+}
+
+static bool isOperation(uint8_t opcode) {
+    return opcode == OP_EQUAL || opcode == OP_GREATER || opcode == OP_LESS || opcode == OP_NOT || opcode == OP_NEGATE ||
+           (opcode >= OP_ADD && opcode <= OP_SHIFT_RIGHT);
+}
+
+static Value constantOperand(Chunk *chunk, int offset) {
+    uint8_t *code = &chunk->code[offset];
+    switch (code[0]) {
+        case OP_CONSTANT: return chunk->constants.values[code[1]];
+        case OP_CONSTANT_LONG:
+            return chunk->constants.values[(uint32_t)code[1] << 24 | (uint32_t)code[2] << 16 |
+                                           (uint32_t)code[3] << 8 | (uint32_t)code[4]];
+        case OP_TRUE: return BOOL_VAL(true);
+        case OP_FALSE: return BOOL_VAL(false);
+        default: return NIL_VAL;
+    }
+}
+
+/*
+ * ---------------------------------------- CONTROL FLOW ----------------------------------------
+ */
+
+static bool decode(Tier *tier) {
+    Chunk *chunk = tier->chunk;
+    int *indexAt = ALLOCATE(int, chunk->count + 1);
+
+    for (int offset = 0; offset < chunk->count; offset += instructionLength(chunk, offset)) {
+        switch (chunk->code[offset]) {
+            case OP_DEFINE_GLOBAL:
+            case OP_DEFINE_GLOBAL_LONG:
+            case OP_DEFINE_GLOBAL_PERM:
+            case OP_DEFINE_GLOBAL_PERM_LONG:
+            case OP_IMPORT:
+            case OP_GET_SUPER:
+            case OP_SUPER_INVOKE:
+            case OP_CLOSURE:
+            case OP_CLOSE_UPVALUE:
+            case OP_CLASS:
+            case OP_INHERIT:
+            case OP_METHOD:
+                FREE_ARRAY(int, indexAt, chunk->count + 1);
+                return false;
+            default:
+                break;
+        }
+        indexAt[offset] = tier->count++;
+    }
+    indexAt[chunk->count] = tier->count;
+
+    tier->instructions = ALLOCATE(TierInstruction, tier->count);
+    for (int offset = 0, i = 0; offset < chunk->count; offset += instructionLength(chunk, offset), i++) {
+        TierInstruction *instruction = &tier->instructions[i];
+        instruction->offset = offset;
+        instruction->block = -1;
+        instruction->result = -1;
+        instruction->treeStart = -1;
+        instruction->droppedTree = -1;
+        instruction->hasOperation = false;
+        instruction->mayFail = false;
+
+        int target = jumpTarget(chunk, offset);
+        instruction->target = target == -1 ? -1 : indexAt[target];
+    }
+
+    FREE_ARRAY(int, indexAt, chunk->count + 1);
+    return true;
+}
+
+static bool endsBlock(uint8_t opcode) {
+    switch (opcode) {
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_ITER_NEXT:
+        case OP_FOR_STEP:
+        case OP_CHECK_CALLEE:
+        case OP_INLINE_RETURN:
+        case OP_RETURN:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static void addPredecessor(Block *block, int predecessor) {
+    if (block->predecessorCount == block->predecessorCapacity) {
+        int oldCapacity = block->predecessorCapacity;
+        block->predecessorCapacity = GROW_CAPACITY(oldCapacity);
+        block->predecessors = GROW_ARRAY(int, block->predecessors, oldCapacity, block->predecessorCapacity);
+    }
+    block->predecessors[block->predecessorCount++] = predecessor;
+}
+
+static void buildBlocks(Tier *tier) {
+    bool *leader = ALLOCATE(bool, tier->count + 1);
+    memset(leader, 0, sizeof(bool) * (tier->count + 1));
+    leader[0] = true;
+
+    for (int i = 0; i < tier->count; i++) {
+        TierInstruction *instruction = &tier->instructions[i];
+        if (instruction->target != -1) leader[instruction->target] = true;
+        if (endsBlock(tier->chunk->code[instruction->offset])) leader[i + 1] = true;
+    }
+
+    for (int i = 0; i < tier->count; i++) {
+        if (leader[i]) tier->blockCount++;
+    }
+
+    tier->blocks = ALLOCATE(Block, tier->blockCount);
+    int current = -1;
+    for (int i = 0; i < tier->count; i++) {
+        if (leader[i]) {
+            Block *block = &tier->blocks[++current];
+            memset(block, 0, sizeof(Block));
+            block->first = i;
+            block->order = -1;
+            block->idom = -1;
+            block->fallthroughPush = -1;
+            block->preheader = -1;
+        }
+        tier->blocks[current].last = i;
+        tier->instructions[i].block = current;
+    }
+    FREE_ARRAY(bool, leader, tier->count + 1);
+
+    for (int b = 0; b < tier->blockCount; b++) {
+        Block *block = &tier->blocks[b];
+        TierInstruction *last = &tier->instructions[block->last];
+        uint8_t opcode = tier->chunk->code[last->offset];
+        int next = b + 1 < tier->blockCount ? b + 1 : -1;
+
+        block->fallthrough =
+            opcode == OP_JUMP || opcode == OP_LOOP || opcode == OP_INLINE_RETURN || opcode == OP_RETURN ? -1 : next;
+        if (block->fallthrough != -1) block->successors[block->successorCount++] = block->fallthrough;
+        if (last->target != -1 && tier->instructions[last->target].block != block->fallthrough) {
+            block->successors[block->successorCount++] = tier->instructions[last->target].block;
+        }
+    }
+}
+
+// Reverse postorder visits a block before anything it leads to, loops aside, which is the order SSA construction needs
+static void orderBlocks(Tier *tier) {
+    int *stack = ALLOCATE(int, tier->blockCount);
+    int *nextChild = ALLOCATE(int, tier->blockCount);
+    bool *visited = ALLOCATE(bool, tier->blockCount);
+    int *postorder = ALLOCATE(int, tier->blockCount);
+    memset(nextChild, 0, sizeof(int) * tier->blockCount);
+    memset(visited, 0, sizeof(bool) * tier->blockCount);
+
+    int depth = 0;
+    int count = 0;
+    stack[depth++] = 0;
+    visited[0] = true;
+
+    while (depth > 0) {
+        int b = stack[depth - 1];
+        Block *block = &tier->blocks[b];
+        if (nextChild[b] < block->successorCount) {
+            int successor = block->successors[nextChild[b]++];
+            if (!visited[successor]) {
+                visited[successor] = true;
+                stack[depth++] = successor;
+            }
+        } else {
+            postorder[count++] = b;
+            depth--;
+        }
+    }
+
+    tier->order = ALLOCATE(int, count);
+    tier->orderCount = count;
+    for (int i = 0; i < count; i++) {
+        tier->order[i] = postorder[count - 1 - i];
+        tier->blocks[tier->order[i]].order = i;
+    }
+
+    // Only edges out of reachable blocks count, a block nothing reaches can't bring anything into a merge
+    for (int i = 0; i < count; i++) {
+        Block *block = &tier->blocks[tier->order[i]];
+        for (int s = 0; s < block->successorCount; s++) {
+            addPredecessor(&tier->blocks[block->successors[s]], tier->order[i]);
+        }
+    }
+
+    FREE_ARRAY(int, stack, tier->blockCount);
+    FREE_ARRAY(int, nextChild, tier->blockCount);
+    FREE_ARRAY(bool, visited, tier->blockCount);
+    FREE_ARRAY(int, postorder, tier->blockCount);
+}
+
+/*
+ * Block a dominates block b if every path from the function's entry to b goes through a.
+ * This is the iterative algorithm from Cooper, Harvey and Kennedy's "A Simple, Fast Dominance Algorithm":
+ * each block's immediate dominator starts as its first processed predecessor and gets narrowed down until nothing changes.
+ */
+
+static void findDominators(Tier *tier) {
+    tier->blocks[0].idom = 0;
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int i = 1; i < tier->orderCount; i++) {
+            Block *block = &tier->blocks[tier->order[i]];
+            int idom = -1;
+
+            for (int p = 0; p < block->predecessorCount; p++) {
+                int predecessor = block->predecessors[p];
+                if (tier->blocks[predecessor].idom == -1) continue;
+                if (idom == -1) {
+                    idom = predecessor;
+                    continue;
+                }
+
+                int a = predecessor;
+                int b = idom;
+                while (a != b) {
+                    while (tier->blocks[a].order > tier->blocks[b].order) a = tier->blocks[a].idom;
+                    while (tier->blocks[b].order > tier->blocks[a].order) b = tier->blocks[b].idom;
+                }
+                idom = a;
+            }
+
+            if (block->idom != idom) {
+                block->idom = idom;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool dominates(Tier *tier, int a, int b) {
+    for (;;) {
+        if (a == b) return true;
+        if (b == 0) return false;
+        b = tier->blocks[b].idom;
+    }
+}
+
+/*
+ * An edge to a block that dominates where it starts is a loop's back edge, and the loop is every block that can reach
+ * the back edge without going through the header. Code can only be hoisted if there's a place before the header that runs
+ * once on the way in and never again: a single entry edge that falls straight through into it.
+ */
+
+static void findLoops(Tier *tier) {
+    int *worklist = ALLOCATE(int, tier->blockCount);
+
+    for (int i = 0; i < tier->orderCount; i++) {
+        int from = tier->order[i];
+        Block *block = &tier->blocks[from];
+
+        for (int s = 0; s < block->successorCount; s++) {
+            int header = block->successors[s];
+            if (!dominates(tier, header, from)) continue;
+
+            Block *loopHeader = &tier->blocks[header];
+            if (loopHeader->loop == NULL) {
+                loopHeader->loop = ALLOCATE(bool, tier->blockCount);
+                memset(loopHeader->loop, 0, sizeof(bool) * tier->blockCount);
+                loopHeader->loop[header] = true;
+            }
+
+            int pending = 0;
+            if (!loopHeader->loop[from]) {
+                loopHeader->loop[from] = true;
+                worklist[pending++] = from;
+            }
+            while (pending > 0) {
+                Block *inside = &tier->blocks[worklist[--pending]];
+                for (int p = 0; p < inside->predecessorCount; p++) {
+                    int predecessor = inside->predecessors[p];
+                    if (loopHeader->loop[predecessor]) continue;
+                    loopHeader->loop[predecessor] = true;
+                    worklist[pending++] = predecessor;
+                }
+            }
+        }
+    }
+
+    // A loop right at the start of the function (fun f(n) { while (n > 0) ... }) is entered from the prologue
+    if (tier->blocks[0].loop != NULL) tier->blocks[0].preheader = PREHEADER_ENTRY;
+
+    for (int b = 1; b < tier->blockCount; b++) {
+        Block *header = &tier->blocks[b];
+        if (header->loop == NULL) continue;
+
+        int entry = -1;
+        int entries = 0;
+        for (int p = 0; p < header->predecessorCount; p++) {
+            if (header->loop[header->predecessors[p]]) continue;
+            entry = header->predecessors[p];
+            entries++;
+        }
+
+        if (entries != 1) continue;
+        Block *before = &tier->blocks[entry];
+        if (before->fallthrough != b || before->last + 1 != header->first) continue;
+        if (tier->instructions[before->last].target == header->first) continue;
+        header->preheader = entry;
+    }
+
+    FREE_ARRAY(int, worklist, tier->blockCount);
+}
+
+/*
+ * ---------------------------------------- SSA CONSTRUCTION ----------------------------------------
+ */
+
+static int edgeHeight(Block *from, int to) {
+    return from->exitHeight + (to == from->fallthrough && from->fallthroughPush != -1 ? 1 : 0);
+}
+
+static int edgeValue(Block *from, int slot) {
+    return slot < from->exitHeight ? from->exitState[slot] : from->fallthroughPush;
+}
+
+typedef struct {
+    int values[TIER_MAX_HEIGHT];
+    int trees[TIER_MAX_HEIGHT];     // the instruction ending the tree that produced each slot, -1 if it's not a tree
+    int height;
+} SymbolicStack;
+
+static bool pushValue(SymbolicStack *stack, int value, int tree) {
+    if (stack->height == TIER_MAX_HEIGHT) return false;
+    stack->values[stack->height] = value;
+    stack->trees[stack->height] = tree;
+    stack->height++;
+    return true;
+}
+
+static bool popValues(SymbolicStack *stack, int count) {
+    if (stack->height < count) return false;
+    stack->height -= count;
+    return true;
+}
+
+static bool simulateBlock(Tier *tier, int b, SymbolicStack *stack) {
+    Block *block = &tier->blocks[b];
+    Chunk *chunk = tier->chunk;
+
+    for (int i = block->first; i <= block->last; i++) {
+        TierInstruction *instruction = &tier->instructions[i];
+        uint8_t *code = &chunk->code[instruction->offset];
+        uint8_t opcode = code[0];
+
+        if (isOperation(opcode)) {
+            int arity = opcode == OP_NOT || opcode == OP_NEGATE ? 1 : 2;
+            if (stack->height < arity) return false;
+
+            int top = stack->height - 1;
+            int tree = -1;
+            if (arity == 1 && stack->trees[top] == i - 1) {
+                tree = tier->instructions[i - 1].treeStart;
+            } else if (arity == 2 && stack->trees[top] == i - 1 && stack->trees[top - 1] != -1 &&
+                       tier->instructions[i - 1].treeStart == stack->trees[top - 1] + 1) {
+                tree = tier->instructions[stack->trees[top - 1]].treeStart;
+            }
+
+            int value = newValue(tier, DEF_OPERATION, b, SSA_NONE);
+            tier->values[value].opcode = opcode;
+            tier->values[value].operands[0] = stack->values[stack->height - arity];
+            if (arity == 2) tier->values[value].operands[1] = stack->values[top];
+
+            popValues(stack, arity);
+            pushValue(stack, value, tree == -1 ? -1 : i);
+            instruction->result = value;
+            instruction->treeStart = tree;
+            instruction->hasOperation = true;
+            continue;
+        }
+
+        switch (opcode) {
+            case OP_CONSTANT:
+            case OP_CONSTANT_LONG:
+            case OP_NIL:
+            case OP_TRUE:
+            case OP_FALSE: {
+                Value constant = constantOperand(chunk, instruction->offset);
+                int value = newValue(tier, DEF_CONSTANT, b, constantType(constant));
+                tier->values[value].constant = constant;
+                if (!pushValue(stack, value, i)) return false;
+                instruction->result = value;
+                instruction->treeStart = i;
+                break;
+            }
+            case OP_GET_LOCAL:
+                if (code[1] >= stack->height || !pushValue(stack, stack->values[code[1]], i)) return false;
+                instruction->result = stack->values[code[1]];
+                instruction->treeStart = i;
+                break;
+            case OP_SET_LOCAL:
+                if (code[1] >= stack->height) return false;
+                stack->values[code[1]] = stack->values[stack->height - 1];
+                stack->trees[code[1]] = -1;
+                stack->trees[stack->height - 1] = -1;
+                break;
+            case OP_POP:
+                if (stack->height == 0) return false;
+                if (stack->trees[stack->height - 1] == i - 1) instruction->droppedTree = tier->instructions[i - 1].treeStart;
+                popValues(stack, 1);
+                break;
+            case OP_SET_GLOBAL:
+            case OP_SET_GLOBAL_LONG:
+            case OP_SET_UPVALUE:
+                if (stack->height == 0) return false;
+                stack->trees[stack->height - 1] = -1;
+                break;
+            case OP_PRINT:
+                if (!popValues(stack, 1)) return false;
+                break;
+            case OP_ITER_INIT:
+                // The sequence may be replaced by a list of its keys
+                if (stack->height == 0) return false;
+                stack->values[stack->height - 1] = newValue(tier, DEF_OPAQUE, b, SSA_ANY);
+                stack->trees[stack->height - 1] = -1;
+                if (!pushValue(stack, newValue(tier, DEF_OPAQUE, b, SSA_NUMBER), -1)) return false;
+                break;
+            case OP_FOR_STEP:
+                if (code[1] >= stack->height) return false;
+                stack->values[code[1]] = newValue(tier, DEF_OPAQUE, b, SSA_NUMBER);
+                stack->trees[code[1]] = -1;
+                break;
+            case OP_ITER_NEXT:
+                if (code[1] + 1 >= stack->height) return false;
+                stack->values[code[1] + 1] = newValue(tier, DEF_OPAQUE, b, SSA_NUMBER);
+                stack->trees[code[1] + 1] = -1;
+                block->fallthroughPush = newValue(tier, DEF_OPAQUE, b, SSA_ANY);
+                break;
+            case OP_JUMP:
+            case OP_JUMP_IF_FALSE:
+            case OP_LOOP:
+                break;
+            case OP_CHECK_CALLEE:
+                if (code[2] >= stack->height) return false;
+                break;
+            case OP_INLINE_RETURN:
+                if (code[1] >= stack->height) return false;
+                stack->values[stack->height - 1 - code[1]] = stack->values[stack->height - 1];
+                stack->trees[stack->height - 1 - code[1]] = -1;
+                popValues(stack, code[1]);
+                break;
+            case OP_RETURN:
+                if (!popValues(stack, 1)) return false;
+                break;
+            default: {
+                // Everything left pops a fixed number of values and pushes one we know nothing about
+                int pops;
+                switch (opcode) {
+                    case OP_GET_GLOBAL:
+                    case OP_GET_GLOBAL_LONG:
+                    case OP_GET_UPVALUE: pops = 0; break;
+                    case OP_GET_PROPERTY: pops = 1; break;
+                    case OP_GET_ITEM:
+                    case OP_SET_PROPERTY: pops = 2; break;
+                    case OP_SET_ITEM: pops = 3; break;
+                    case OP_LIST: pops = code[1]; break;
+                    case OP_DICTIONARY: pops = code[1] * 2; break;
+                    case OP_CALL:
+                    case OP_TAIL_CALL: pops = code[1] + 1; break;
+                    case OP_INVOKE: pops = code[2] + 1; break;
+                    default: return false;
+                }
+                if (!popValues(stack, pops)) return false;
+                if (!pushValue(stack, newValue(tier, DEF_OPAQUE, b, SSA_ANY), -1)) return false;
+                break;
+            }
+        }
+    }
+
+    block->exitHeight = stack->height;
+    block->exitState = ALLOCATE(int, stack->height);
+    memcpy(block->exitState, stack->values, sizeof(int) * stack->height);
+    return true;
+}
+
+static bool buildSsa(Tier *tier, Value *args) {
+    SymbolicStack *stack = ALLOCATE(SymbolicStack, 1);
+    bool ok = true;
+
+    for (int i = 0; i < tier->orderCount && ok; i++) {
+        int b = tier->order[i];
+        Block *block = &tier->blocks[b];
+        stack->height = 0;
+
+        if (b == 0) {
+            tier->entryValues[0] = newValue(tier, DEF_OPAQUE, 0, SSA_ANY);
+            for (int param = 0; param < tier->function->arity; param++) {
+                bool number = param < 64 && IS_NUMBER(args[param]);
+                if (number) tier->numberParams |= (uint64_t)1 << param;
+                tier->entryValues[param + 1] = newValue(tier, DEF_PARAMETER, 0, number ? SSA_NUMBER : SSA_ANY);
+            }
+            tier->entryHeight = tier->function->arity + 1;
+
+            for (int slot = 0; slot < tier->entryHeight; slot++) {
+                int value = tier->entryValues[slot];
+                if (block->predecessorCount > 0) value = newValue(tier, DEF_PHI, 0, SSA_NONE);
+                pushValue(stack, value, -1);
+            }
+        } else {
+            // Reverse postorder guarantees at least one predecessor has already been simulated
+            Block *known = NULL;
+            int from = -1;
+            for (int p = 0; p < block->predecessorCount; p++) {
+                Block *predecessor = &tier->blocks[block->predecessors[p]];
+                if (predecessor->order < block->order) {
+                    known = predecessor;
+                    from = block->predecessors[p];
+                    break;
+                }
+            }
+            if (known == NULL) {
+                ok = false;
+                break;
+            }
+
+            stack->height = edgeHeight(known, b);
+            if (stack->height > TIER_MAX_HEIGHT) {
+                ok = false;
+                break;
+            }
+            for (int slot = 0; slot < stack->height; slot++) {
+                stack->trees[slot] = -1;
+                if (block->predecessorCount == 1) {
+                    stack->values[slot] = edgeValue(&tier->blocks[from], slot);
+                } else {
+                    stack->values[slot] = newValue(tier, DEF_PHI, b, SSA_NONE);
+                }
+            }
+        }
+
+        block->entryHeight = stack->height;
+        block->entryState = ALLOCATE(int, stack->height);
+        memcpy(block->entryState, stack->values, sizeof(int) * stack->height);
+        ok = simulateBlock(tier, b, stack);
+    }
+
+    FREE(SymbolicStack, stack);
+    if (!ok) return false;
+
+    // Every edge has to agree on how tall the stack is, and now that every block has run, the phis can be filled in
+    for (int i = 0; i < tier->orderCount; i++) {
+        int b = tier->order[i];
+        Block *block = &tier->blocks[b];
+
+        for (int p = 0; p < block->predecessorCount; p++) {
+            if (edgeHeight(&tier->blocks[block->predecessors[p]], b) != block->entryHeight) return false;
+        }
+        if (b == 0 ? block->predecessorCount == 0 : block->predecessorCount == 1) continue;
+
+        for (int slot = 0; slot < block->entryHeight; slot++) {
+            SsaValue *phi = &tier->values[block->entryState[slot]];
+            phi->phiCount = block->predecessorCount + (b == 0);
+            phi->phiOperands = ALLOCATE(int, phi->phiCount);
+            for (int p = 0; p < block->predecessorCount; p++) {
+                phi->phiOperands[p] = edgeValue(&tier->blocks[block->predecessors[p]], slot);
+            }
+            if (b == 0) phi->phiOperands[block->predecessorCount] = tier->entryValues[slot];
+        }
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int v = 0; v < tier->valueCount; v++) {
+            SsaValue *phi = &tier->values[v];
+            if (phi->kind != DEF_PHI || phi->replacedBy != -1 || phi->phiOperands == NULL) continue;
+
+            int unique = -1;
+            bool trivial = true;
+            for (int p = 0; p < phi->phiCount && trivial; p++) {
+                int operand = resolve(tier, phi->phiOperands[p]);
+                if (operand == v || operand == unique) continue;
+                if (unique == -1) {
+                    unique = operand;
+                } else {
+                    trivial = false;
+                }
+            }
+
+            if (trivial && unique != -1) {
+                phi->replacedBy = unique;
+                changed = true;
+            }
+        }
+    }
+    return true;
+}
+
+/*
+ * ---------------------------------------- TYPES ----------------------------------------
+ *
+ * Types start out optimistic (SSA_NONE) and only ever move up towards SSA_ANY, so going over the values until nothing changes
+ * terminates, and a loop counter that starts as a number and only ever has numbers added to it comes out as a number.
+ * An operation's type is what it produces if it doesn't raise an error. Whether it can raise one is a separate question, mayFail().
+ */
+
+static SsaType joinTypes(SsaType a, SsaType b) {
+    if (a == SSA_NONE) return b;
+    if (b == SSA_NONE || a == b) return a;
+    return SSA_ANY;
+}
+
+static SsaType typeOf(Tier *tier, int value) {
+    return value == -1 ? SSA_NONE : tier->values[resolve(tier, value)].type;
+}
+
+static SsaType operationType(uint8_t opcode, SsaType a, SsaType b) {
+    switch (opcode) {
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_NOT:
+            return SSA_BOOL;
+        case OP_ADD:
+            if (a == SSA_NONE || b == SSA_NONE) return SSA_NONE;
+            if (a == b && (a == SSA_NUMBER || a == SSA_STRING)) return a;
+            return SSA_ANY;
+        default:
+            return SSA_NUMBER;
+    }
+}
+
+static void inferTypes(Tier *tier) {
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int v = 0; v < tier->valueCount; v++) {
+            SsaValue *value = &tier->values[v];
+            if (value->replacedBy != -1) continue;
+
+            SsaType type = value->type;
+            if (value->kind == DEF_OPERATION) {
+                type = operationType(value->opcode, typeOf(tier, value->operands[0]), typeOf(tier, value->operands[1]));
+            } else if (value->kind == DEF_PHI && value->phiOperands != NULL) {
+                for (int p = 0; p < value->phiCount; p++) {
+                    type = joinTypes(type, typeOf(tier, value->phiOperands[p]));
+                }
+            }
+
+            if (type != value->type) {
+                value->type = type;
+                changed = true;
+            }
+        }
+    }
+}
+
+static bool mayFail(Tier *tier, int value) {
+    SsaValue *operation = &tier->values[value];
+    SsaType a = typeOf(tier, operation->operands[0]);
+    SsaType b = typeOf(tier, operation->operands[1]);
+
+    switch (operation->opcode) {
+        case OP_EQUAL:
+        case OP_NOT:
+            return false;
+        case OP_NEGATE:
+            return a != SSA_NUMBER;
+        case OP_ADD:
+            return !(a == b && (a == SSA_NUMBER || a == SSA_STRING));
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+        case OP_MODULO:
+        case OP_GREATER:
+        case OP_LESS:
+            return a != SSA_NUMBER || b != SSA_NUMBER;
+        default:
+            return true; // the bitwise operators also want whole numbers, which the types don't track
+    }
+}
+
+static void markFailures(Tier *tier) {
+    for (int i = 0; i < tier->count; i++) {
+        TierInstruction *instruction = &tier->instructions[i];
+        if (instruction->treeStart == -1) continue;
+
+        // A tree's operands come right before it, so by the time we get here they're already done
+        instruction->mayFail = instruction->hasOperation && mayFail(tier, instruction->result);
+        for (int j = instruction->treeStart; j < i && !instruction->mayFail; j++) {
+            instruction->mayFail = tier->instructions[j].mayFail;
+        }
+        for (int j = instruction->treeStart; j < i && !instruction->hasOperation; j++) {
+            instruction->hasOperation = tier->instructions[j].hasOperation;
+        }
+    }
+}
+
+/*
+ * Two operations compute the same thing when they're the same instruction applied to the same values.
+ * Constants are the same when their bits are, so 1 and 1.0 (an integer and a double) stay apart.
+ */
+
+static bool sameConstant(Value a, Value b) {
+#ifdef NAN_BOXING
+    return a == b;
+#else
+    if (a.type != b.type) return false;
+    if (IS_NUMBER(a)) return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+    return valuesEqual(a, b);
+#endif
+}
+
+static int canonicalOf(Tier *tier, int value) {
+    if (value == -1) return -1;
+    int canonical = tier->values[resolve(tier, value)].canonical;
+    return canonical == -1 ? resolve(tier, value) : canonical;
+}
+
+static void numberValues(Tier *tier) {
+    for (int v = 0; v < tier->valueCount; v++) {
+        SsaValue *value = &tier->values[v];
+        value->canonical = v;
+        if (value->replacedBy != -1) continue;
+
+        for (int earlier = 0; earlier < v; earlier++) {
+            SsaValue *candidate = &tier->values[earlier];
+            if (candidate->canonical != earlier || candidate->kind != value->kind || candidate->replacedBy != -1) continue;
+
+            if (value->kind == DEF_CONSTANT && sameConstant(candidate->constant, value->constant)) {
+                value->canonical = earlier;
+                break;
+            }
+            if (value->kind == DEF_OPERATION && candidate->opcode == value->opcode &&
+                canonicalOf(tier, candidate->operands[0]) == canonicalOf(tier, value->operands[0]) &&
+                canonicalOf(tier, candidate->operands[1]) == canonicalOf(tier, value->operands[1])) {
+                value->canonical = earlier;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * ---------------------------------------- REWRITES ----------------------------------------
+ */
+
+static bool isCovered(Tier *tier, int start, int end) {
+    for (int i = start; i <= end; i++) {
+        if (tier->covered[i] != -1) return true;
+    }
+    return false;
+}
+
+static int addRewrite(Tier *tier, RewriteKind kind, int start, int end, int temporary, int header) {
+    if (tier->rewriteCount == tier->rewriteCapacity) {
+        int oldCapacity = tier->rewriteCapacity;
+        tier->rewriteCapacity = GROW_CAPACITY(oldCapacity);
+        tier->rewrites = GROW_ARRAY(Rewrite, tier->rewrites, oldCapacity, tier->rewriteCapacity);
+    }
+
+    Rewrite *rewrite = &tier->rewrites[tier->rewriteCount];
+    rewrite->kind = kind;
+    rewrite->start = start;
+    rewrite->end = end;
+    rewrite->temporary = temporary;
+    rewrite->header = header;
+    for (int i = start; i <= end; i++) {
+        tier->covered[i] = tier->rewriteCount;
+    }
+    return tier->rewriteCount++;
+}
+
+/*
+ * A tree can move in front of a loop when every local it reads holds a value defined outside the loop,
+ * the same value is in the same slot just before the loop, and nothing in it can raise an error.
+ * The last part matters because the hoisted copy runs even when the loop body (or the branch the tree was on) never does.
+ */
+
+static bool canHoist(Tier *tier, int start, int end, int header) {
+    Block *loop = &tier->blocks[header];
+
+    for (int i = start; i <= end; i++) {
+        uint8_t *code = &tier->chunk->code[tier->instructions[i].offset];
+        if (code[0] != OP_GET_LOCAL) continue;
+
+        int value = resolve(tier, tier->instructions[i].result);
+        if (loop->loop[tier->values[value].block] && tier->values[value].kind != DEF_PARAMETER) return false;
+
+        int before;
+        if (loop->preheader == PREHEADER_ENTRY) {
+            before = code[1] < tier->entryHeight ? tier->entryValues[code[1]] : -1;
+        } else {
+            Block *preheader = &tier->blocks[loop->preheader];
+            before = code[1] < edgeHeight(preheader, header) ? edgeValue(preheader, code[1]) : -1;
+        }
+        if (before == -1 || resolve(tier, before) != value) return false;
+    }
+    return true;
+}
+
+static void hoistInvariants(Tier *tier) {
+    for (int i = tier->count - 1; i >= 0 && tier->temporaries < TIER_MAX_TEMPORARIES; i--) {
+        TierInstruction *instruction = &tier->instructions[i];
+        if (instruction->treeStart == -1 || !instruction->hasOperation || instruction->mayFail) continue;
+        if (tier->blocks[instruction->block].order == -1 || isCovered(tier, instruction->treeStart, i)) continue;
+
+        // The outermost loop it can leave is the one with the most blocks in it
+        int best = -1;
+        int bestSize = 0;
+        for (int b = 0; b < tier->blockCount; b++) {
+            Block *header = &tier->blocks[b];
+            if (header->loop == NULL || header->preheader == -1 || !header->loop[instruction->block]) continue;
+
+            int size = 0;
+            for (int inside = 0; inside < tier->blockCount; inside++) {
+                size += header->loop[inside];
+            }
+            if (size > bestSize && canHoist(tier, instruction->treeStart, i, b)) {
+                best = b;
+                bestSize = size;
+            }
+        }
+
+        if (best != -1) {
+            addRewrite(tier, REWRITE_HOIST, instruction->treeStart, i, tier->temporaries++, best);
+            i = instruction->treeStart;
+        }
+    }
+}
+
+/*
+ * The bigger trees are tried first, so a repeated a * b + c is shared as a whole rather than just its a * b.
+ * The tree that ran first has to dominate the one it replaces (run on every path that leads there), otherwise the slot
+ * might still hold nothing, or the value from some earlier, different iteration.
+ */
+
+static void shareSubexpressions(Tier *tier) {
+    int *trees = ALLOCATE(int, tier->count);
+    int count = 0;
+    for (int i = 0; i < tier->count; i++) {
+        TierInstruction *instruction = &tier->instructions[i];
+        if (instruction->treeStart == -1 || !instruction->hasOperation) continue;
+        if (tier->blocks[instruction->block].order == -1) continue;
+        trees[count++] = i;
+    }
+
+    // Insertion sort by size, largest first, the number of trees in a function is small
+    for (int i = 1; i < count; i++) {
+        int tree = trees[i];
+        int size = tree - tier->instructions[tree].treeStart;
+        int j = i;
+        while (j > 0 && trees[j - 1] - tier->instructions[trees[j - 1]].treeStart < size) {
+            trees[j] = trees[j - 1];
+            j--;
+        }
+        trees[j] = tree;
+    }
+
+    for (int n = 0; n < count && tier->temporaries <= TIER_MAX_TEMPORARIES; n++) {
+        int later = trees[n];
+        TierInstruction *use = &tier->instructions[later];
+        if (isCovered(tier, use->treeStart, later)) continue;
+
+        int canonical = canonicalOf(tier, use->result);
+        for (int m = 0; m < count; m++) {
+            int earlier = trees[m];
+            TierInstruction *source = &tier->instructions[earlier];
+            if (earlier == later || canonicalOf(tier, source->result) != canonical) continue;
+
+            bool first = source->block == use->block ? earlier < use->treeStart
+                                                     : dominates(tier, source->block, use->block);
+            if (!first) continue;
+
+            int shared = tier->covered[earlier];
+            if (shared != -1 && (tier->rewrites[shared].kind != REWRITE_SHARE || tier->rewrites[shared].end != earlier)) {
+                continue;
+            }
+            if (shared == -1) {
+                if (isCovered(tier, source->treeStart, earlier) || tier->temporaries == TIER_MAX_TEMPORARIES) continue;
+                shared = addRewrite(tier, REWRITE_SHARE, source->treeStart, earlier, tier->temporaries++, -1);
+            }
+
+            addRewrite(tier, REWRITE_REUSE, use->treeStart, later, tier->rewrites[shared].temporary, -1);
+            break;
+        }
+    }
+
+    FREE_ARRAY(int, trees, tier->count);
+}
+
+static void dropDeadTrees(Tier *tier) {
+    for (int i = 0; i < tier->count; i++) {
+        TierInstruction *pop = &tier->instructions[i];
+        if (pop->droppedTree == -1 || tier->instructions[i - 1].mayFail) continue;
+        if (isCovered(tier, pop->droppedTree, i)) continue;
+        addRewrite(tier, REWRITE_DROP, pop->droppedTree, i, -1, -1);
+    }
+}
+
+/*
+ * ---------------------------------------- EMIT ----------------------------------------
+ *
+ * The temporaries go in the slots right after the parameters, and everything the function kept above them moves up to make room.
+ * The new chunk starts by pushing a nil for each, and every other instruction is copied across with its slot numbers shifted.
+ * Jumps are patched last, once we know where everything landed.
+ */
+
+typedef struct {
+    Tier *tier;
+    Chunk *out;
+    int *landing;
+    bool fits;
+} Emitter;
+
+static int shiftSlot(Tier *tier, int slot) {
+    return slot > tier->function->arity ? slot + tier->temporaries : slot;
+}
+
+static void emitShifted(Emitter *emitter, int i) {
+    Tier *tier = emitter->tier;
+    int offset = tier->instructions[i].offset;
+    int length = instructionLength(tier->chunk, offset);
+    uint8_t bytes[8];
+    memcpy(bytes, &tier->chunk->code[offset], length);
+
+    int slot = -1;
+    switch (bytes[0]) {
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_ITER_NEXT:
+            slot = shiftSlot(tier, bytes[1]);
+            break;
+        case OP_FOR_STEP:
+            slot = shiftSlot(tier, bytes[1]);
+            if (!(bytes[2] & FOR_STEP_CONSTANT_BOUND)) {
+                int bound = shiftSlot(tier, bytes[3]);
+                if (bound > UINT8_MAX) emitter->fits = false;
+                bytes[3] = (uint8_t)bound;
+            }
+            break;
+        default:
+            break;
+    }
+    if (slot != -1) {
+        if (slot + (bytes[0] == OP_ITER_NEXT) > UINT8_MAX) emitter->fits = false;
+        bytes[1] = (uint8_t)slot;
+    }
+
+    for (int k = 0; k < length; k++) {
+        writeChunk(emitter->out, bytes[k], tier->chunk->lines[offset + k]);
+    }
+}
+
+static void emitSlot(Emitter *emitter, uint8_t opcode, int temporary, int line) {
+    writeChunk(emitter->out, opcode, line);
+    writeChunk(emitter->out, (uint8_t)(emitter->tier->function->arity + 1 + temporary), line);
+}
+
+static void patchJumps(Emitter *emitter) {
+    Chunk *out = emitter->out;
+
+    for (int offset = 0; offset < out->count && emitter->fits; offset += instructionLength(out, offset)) {
+        uint8_t opcode = out->code[offset];
+        if (opcode != OP_JUMP && opcode != OP_JUMP_IF_FALSE && opcode != OP_LOOP && opcode != OP_ITER_NEXT &&
+            opcode != OP_FOR_STEP && opcode != OP_CHECK_CALLEE && opcode != OP_INLINE_RETURN) {
+            continue;
+        }
+
+        // The jump operand (always the last two bytes) still holds the original instruction index we stashed there
+        int end = offset + instructionLength(out, offset);
+        int at = end - 2;
+        int target = emitter->landing[out->code[at] << 8 | out->code[at + 1]];
+        int distance = opcode == OP_LOOP || opcode == OP_FOR_STEP ? end - target : target - end;
+
+        if (distance < 0 || distance > UINT16_MAX) {
+            emitter->fits = false;
+            break;
+        }
+        out->code[at] = (distance >> 8) & 0xff;
+        out->code[at + 1] = distance & 0xff;
+    }
+}
+
+static bool emit(Tier *tier, Chunk *out) {
+    if (tier->count > UINT16_MAX || tier->function->arity + tier->temporaries >= UINT8_MAX) return false;
+
+    Emitter emitter;
+    emitter.tier = tier;
+    emitter.out = out;
+    emitter.landing = ALLOCATE(int, tier->count);
+    emitter.fits = true;
+
+    int firstLine = tier->chunk->lines[0];
+    for (int t = 0; t < tier->temporaries; t++) {
+        writeChunk(out, OP_NIL, firstLine);
+    }
+
+    for (int i = 0; i < tier->count; i++) {
+        TierInstruction *instruction = &tier->instructions[i];
+        Block *block = &tier->blocks[instruction->block];
+        int line = tier->chunk->lines[instruction->offset];
+
+        if (block->order == -1) {
+            emitter.landing[i] = out->count;
+            continue;
+        }
+
+        // Hoisted trees go just before their loop's header, where only the way in falls through them
+        if (i == block->first && block->loop != NULL) {
+            for (int r = 0; r < tier->rewriteCount; r++) {
+                Rewrite *rewrite = &tier->rewrites[r];
+                if (rewrite->kind != REWRITE_HOIST || rewrite->header != instruction->block) continue;
+
+                for (int j = rewrite->start; j <= rewrite->end; j++) {
+                    emitShifted(&emitter, j);
+                }
+                emitSlot(&emitter, OP_SET_LOCAL, rewrite->temporary, line);
+                writeChunk(out, OP_POP, line);
+            }
+        }
+
+        emitter.landing[i] = out->count;
+        int covered = tier->covered[i];
+        if (covered == -1) {
+            emitShifted(&emitter, i);
+
+            // Jumps keep the index of their target until patchJumps()
+            if (instruction->target != -1) {
+                int at = out->count - 2;
+                out->code[at] = (instruction->target >> 8) & 0xff;
+                out->code[at + 1] = instruction->target & 0xff;
+            }
+            continue;
+        }
+
+        Rewrite *rewrite = &tier->rewrites[covered];
+        switch (rewrite->kind) {
+            case REWRITE_HOIST:
+            case REWRITE_REUSE:
+                if (i == rewrite->end) emitSlot(&emitter, OP_GET_LOCAL, rewrite->temporary, line);
+                break;
+            case REWRITE_SHARE:
+                emitShifted(&emitter, i);
+                if (i == rewrite->end) emitSlot(&emitter, OP_SET_LOCAL, rewrite->temporary, line);
+                break;
+            case REWRITE_DROP:
+                break;
+        }
+    }
+
+    patchJumps(&emitter);
+    FREE_ARRAY(int, emitter.landing, tier->count);
+    return emitter.fits;
+}
+
+/*
+ * ---------------------------------------- TIER UP ----------------------------------------
+ */
+
+static void freeTier(Tier *tier) {
+    for (int v = 0; v < tier->valueCount; v++) {
+        SsaValue *value = &tier->values[v];
+        if (value->phiOperands != NULL) {
+            FREE_ARRAY(int, value->phiOperands, value->phiCount);
+        }
+    }
+    FREE_ARRAY(SsaValue, tier->values, tier->valueCapacity);
+
+    for (int b = 0; b < tier->blockCount; b++) {
+        Block *block = &tier->blocks[b];
+        FREE_ARRAY(int, block->predecessors, block->predecessorCapacity);
+        FREE_ARRAY(int, block->entryState, block->entryHeight);
+        FREE_ARRAY(int, block->exitState, block->exitHeight);
+        if (block->loop != NULL) FREE_ARRAY(bool, block->loop, tier->blockCount);
+    }
+    FREE_ARRAY(Block, tier->blocks, tier->blockCount);
+    FREE_ARRAY(int, tier->order, tier->orderCount);
+    FREE_ARRAY(TierInstruction, tier->instructions, tier->count);
+    FREE_ARRAY(Rewrite, tier->rewrites, tier->rewriteCapacity);
+    FREE_ARRAY(int, tier->covered, tier->count);
+}
+
+void tierUp(ObjFunction *function, Value *args) {
+    function->tierAttempted = true;
+    if (!vm.tiering) return;
+
+    Tier tier;
+    memset(&tier, 0, sizeof(Tier));
+    tier.function = function;
+    tier.chunk = &function->chunk;
+
+    if (!decode(&tier)) {
+        freeTier(&tier);
+        return;
+    }
+
+    buildBlocks(&tier);
+    orderBlocks(&tier);
+    findDominators(&tier);
+    findLoops(&tier);
+
+    tier.covered = ALLOCATE(int, tier.count);
+    for (int i = 0; i < tier.count; i++) {
+        tier.covered[i] = -1;
+    }
+
+    if (!buildSsa(&tier, args)) {
+        freeTier(&tier);
+        return;
+    }
+
+    inferTypes(&tier);
+    markFailures(&tier);
+    numberValues(&tier);
+
+    hoistInvariants(&tier);
+    shareSubexpressions(&tier);
+    dropDeadTrees(&tier);
+
+    if (tier.rewriteCount == 0) {
+        freeTier(&tier);
+        return;
+    }
+
+    Chunk *optimized = ALLOCATE(Chunk, 1);
+    initChunk(optimized);
+    for (int i = 0; i < function->chunk.constants.count; i++) {
+        writeValueArray(&optimized->constants, function->chunk.constants.values[i]);
+    }
+
+    if (!emit(&tier, optimized)) {
+        freeChunk(optimized);
+        FREE(Chunk, optimized);
+        freeTier(&tier);
+        return;
+    }
+
+    // Attached before the peephole pass runs, so any constant it folds into the chunk is already reachable by the GC
+    function->optimized = optimized;
+    function->numberParams = tier.numberParams;
+    // Every slot above the parameters moved up to make room for the temporaries
+    function->maxStack += tier.temporaries;
+    optimizeChunk(optimized);
+    freeTier(&tier);
+
+#ifdef DEBUG_PRINT_CODE
+    disassembleChunk(optimized, function->name != NULL ? function->name->chars : "<script>");
+#endif
+}
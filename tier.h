@@ -0,0 +1,33 @@
+#ifndef CFER_TIER_H
+#define CFER_TIER_H
+
+#include "object.h"
+
+/*
+ * The compiler gets one look at each piece of code, in the order it's written, so it can't notice that a + b is computed twice,
+ * or that a loop keeps working out the same n * width on every iteration. For most code that doesn't matter.
+ * For the few functions a program spends its time in, the optimizing tier takes a second look.
+ *
+ * call() counts calls to each function, and OP_LOOP and OP_FOR_STEP count iterations. Once a function's count reaches
+ * TIER_THRESHOLD, tierUp() rebuilds its bytecode as SSA: one value for every result, every local variable assignment and
+ * every merge of control flow. From that it works out the types it can be sure of, and then:
+ * - Hoists expressions that give the same result on every iteration out of their loop (loop-invariant code motion).
+ * - Computes an expression once when an identical one always ran before it (common subexpression elimination).
+ * - Drops expression statements whose result is thrown away and can't fail (dead code elimination).
+ * Results it keeps around live in extra frame slots reserved right after the parameters.
+ *
+ * Types come from the arguments of the call that crossed the threshold. A parameter that was a number then is assumed to stay one,
+ * which is what lets a * b move out of a loop (it can't raise an error, so running it earlier can't change what the program does).
+ * The assumption is recorded in numberParams and checked on every call: if it doesn't hold, that call runs the original chunk.
+ * The switch only ever happens on entry, a call that's already running keeps the chunk it started with.
+ *
+ * Functions that create closures are left alone, since a closure can change the function's locals behind its back,
+ * and so are a few rarely hot instructions the analysis doesn't model (super calls, class definitions, imports).
+ * Setting FER_TIER=off in the environment turns the tier off, to compare timings or rule it out.
+ */
+
+#define TIER_THRESHOLD 1000
+
+void tierUp(ObjFunction *function, Value *args);
+
+#endif //CFER_TIER_H
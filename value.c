@@ -46,6 +46,7 @@ void printValue(Value value) {
         case VAL_NIL: printf("nil"); break;
         case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
         case VAL_OBJ: printObject(value); break;
+        case VAL_EMPTY: printf("<empty>"); break;
     }
 #endif
 }
@@ -62,6 +63,7 @@ void printValue(Value value) {
 
 bool valuesEqual(Value a, Value b) {
 #ifdef NAN_BOXING
+    if (IS_INT(a) && IS_INT(b)) return a == b;
     if (IS_NUMBER(a) && IS_NUMBER(b)) {
         return AS_NUMBER(a) == AS_NUMBER(b);
     }
@@ -73,6 +75,7 @@ bool valuesEqual(Value a, Value b) {
         case VAL_NIL:       return true;
         case VAL_NUMBER:    return AS_NUMBER(a) == AS_NUMBER(b);
         case VAL_OBJ:       return AS_OBJ(a) == AS_OBJ(b);
+        case VAL_EMPTY:     return true;
         default:            return false; // Unreachable
     }
 #endif
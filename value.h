@@ -1,6 +1,7 @@
 #ifndef CFER_VALUE_H
 #define CFER_VALUE_H
 
+#include <math.h>
 #include <string.h>
 
 #include "common.h"
@@ -78,18 +79,38 @@ typedef struct ObjString ObjString;
 // This has set all the quiet NaN bits to 1. Exactly all the exponent bits, plus the quiet NaN bit, plus one extra to dodge that Intel value.
 #define QNAN ((uint64_t)0x7ffc000000000000)
 
+#define TAG_EMPTY   0 // 00
 #define TAG_NIL     1 // 01
 #define TAG_FALSE   2 // 10
 #define TAG_TRUE    3 // 11
 
+/*
+ * Numbers come in two encodings. Most are plain doubles, but a whole number that fits in 32 bits can also be stored as an integer:
+ * a quiet NaN with bit 48 set (no pointer reaches that high) and the integer in the low 32 bits.
+ *
+ * [0][11111111111][11][01][0000000000000000][................................]
+ *  sign  exponent  QNAN int      unused                  32-bit integer
+ *
+ * Both are the same Fer type. IS_NUMBER() accepts either one and AS_NUMBER() always gives back a double, so code that doesn't care keeps working unchanged.
+ * The point is the code that does care: the arithmetic, comparison and indexing instructions check IS_INT() first, and when both operands are integers
+ * they skip the conversions to and from double entirely. Any result that doesn't fit (an overflow, a fraction, a negative zero) is computed as a double instead,
+ * so the integers are purely an optimization and a program can't tell which encoding a number is in.
+ */
+
+#define TAG_INT     ((uint64_t)0x0001000000000000)
+
 typedef uint64_t Value;
 
 #define IS_BOOL(value)          ((value | 1) == TRUE_VAL)
 #define IS_NIL(value)           ((value) == NIL_VAL)
-#define IS_NUMBER(value)        (((value) & QNAN) != QNAN)
+#define IS_INT(value)           (((value) & (SIGN_BIT | QNAN | TAG_INT)) == (QNAN | TAG_INT))
+#define IS_DOUBLE(value)        (((value) & QNAN) != QNAN)
+#define IS_NUMBER(value)        (IS_DOUBLE(value) || IS_INT(value))
 #define IS_OBJ(value)           (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_EMPTY(value)         ((value) == EMPTY_VAL)
 
 #define AS_BOOL(value)          ((value) == TRUE_VAL)
+#define AS_INT(value)           ((int32_t)(uint32_t)(value))
 #define AS_NUMBER(value)        valueToNum(value)
 #define AS_OBJ(value)           ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
 
@@ -97,10 +118,15 @@ typedef uint64_t Value;
 #define FALSE_VAL               ((Value)(uint64_t)(QNAN | TAG_FALSE))
 #define TRUE_VAL                ((Value)(uint64_t)(QNAN | TAG_TRUE))
 #define NIL_VAL                 ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define EMPTY_VAL               ((Value)(uint64_t)(QNAN | TAG_EMPTY))
+#define INT_VAL(i)              ((Value)(QNAN | TAG_INT | (uint64_t)(uint32_t)(int32_t)(i)))
 #define NUMBER_VAL(num)         numToValue(num)
+#define INT_OR_NUMBER_VAL(num)  intOrNumberToValue(num)
 #define OBJ_VAL(obj)            (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
 
 static inline double valueToNum(Value value) {
+    if (IS_INT(value)) return (double)AS_INT(value);
+
     double num;
     memcpy(&num, &value, sizeof(Value));
     return num;
@@ -112,13 +138,23 @@ static inline Value numToValue(double num) {
     return value;
 }
 
+// Stores num as an integer if it is a whole number that fits (and isn't -0, which an integer can't represent), as a double otherwise
+static inline Value intOrNumberToValue(double num) {
+    if (num >= INT32_MIN && num <= INT32_MAX) {
+        int32_t integer = (int32_t)num;
+        if ((double)integer == num && (integer != 0 || !signbit(num))) return INT_VAL(integer);
+    }
+    return numToValue(num);
+}
+
 #else
 
 typedef enum {
     VAL_BOOL,
     VAL_NIL,
     VAL_NUMBER,
-    VAL_OBJ
+    VAL_OBJ,
+    VAL_EMPTY
 } ValueType;
 
 /*
@@ -161,6 +197,7 @@ typedef struct {
 #define IS_NIL(value)       ((value).type == VAL_NIL)
 #define IS_NUMBER(value)    ((value).type == VAL_NUMBER)
 #define IS_OBJ(value)       ((value).type == VAL_OBJ)
+#define IS_EMPTY(value)     ((value).type == VAL_EMPTY)
 
 #define AS_OBJ(value)       ((value).as.obj)
 #define AS_BOOL(value)      ((value).as.boolean)
@@ -170,9 +207,114 @@ typedef struct {
 #define NIL_VAL             ((Value){VAL_NIL, {.number = 0}})
 #define NUMBER_VAL(value)   ((Value){VAL_NUMBER, {.number = value}})
 #define OBJ_VAL(object)      ((Value){VAL_OBJ, {.obj = (Obj*)object}})
+#define EMPTY_VAL           ((Value){VAL_EMPTY, {.number = 0}})
+
+// Without NaN boxing there's no separate integer encoding, every number is a double and the integer fast paths compile away
+#define IS_INT(value)           ((void)(value), false)
+#define IS_DOUBLE(value)        IS_NUMBER(value)
+#define AS_INT(value)           ((int32_t)AS_NUMBER(value))
+#define INT_VAL(i)              NUMBER_VAL((double)(i))
+#define INT_OR_NUMBER_VAL(num)  NUMBER_VAL(num)
+
+#endif
+
+/*
+ * Integer versions of the arithmetic instructions, shared by the VM and the constant folder in optimizer.c so the two can't disagree.
+ * Each returns false when the exact result isn't a 32-bit integer,
+ * and the instruction then redoes the operation in doubles. Besides overflow, that covers a division with a remainder
+ * and any result that should be -0: 0 * -1 and 0 / -1 are -0 in doubles, and an integer has no negative zero.
+ */
+
+#if defined(__GNUC__) || defined(__clang__)
+
+static inline bool addInts(int32_t a, int32_t b, int32_t *result) {
+    return !__builtin_add_overflow(a, b, result);
+}
+
+static inline bool subtractInts(int32_t a, int32_t b, int32_t *result) {
+    return !__builtin_sub_overflow(a, b, result);
+}
+
+static inline bool multiplyInts(int32_t a, int32_t b, int32_t *result) {
+    if (__builtin_mul_overflow(a, b, result)) return false;
+    return *result != 0 || (a >= 0 && b >= 0);
+}
+
+#else
+
+// Without the overflow builtins, the exact result always fits in 64 bits, so we work it out there and see if it fits in 32
+static inline bool fitInt(int64_t wide, int32_t *result) {
+    if (wide < INT32_MIN || wide > INT32_MAX) return false;
+    *result = (int32_t)wide;
+    return true;
+}
+
+static inline bool addInts(int32_t a, int32_t b, int32_t *result) {
+    return fitInt((int64_t)a + b, result);
+}
+
+static inline bool subtractInts(int32_t a, int32_t b, int32_t *result) {
+    return fitInt((int64_t)a - b, result);
+}
+
+static inline bool multiplyInts(int32_t a, int32_t b, int32_t *result) {
+    if (!fitInt((int64_t)a * b, result)) return false;
+    return *result != 0 || (a >= 0 && b >= 0);
+}
 
 #endif
 
+static inline bool divideInts(int32_t a, int32_t b, int32_t *result) {
+    if (b == 0 || (a == INT32_MIN && b == -1) || a % b != 0) return false;
+    if (a == 0 && b < 0) return false;
+    *result = a / b;
+    return true;
+}
+
+/*
+ * % is a floored modulo: the result has the sign of the divisor, so x % n lands in [0, n) for any positive n, negative x included.
+ * That's the one bucketing and wrap-around code wants. A remainder of zero is always +0.
+ */
+
+static inline bool moduloInts(int32_t a, int32_t b, int32_t *result) {
+    if (b == 0) return false;
+    if (b == -1) { // INT32_MIN % -1 overflows in C
+        *result = 0;
+        return true;
+    }
+
+    int32_t remainder = a % b;
+    if (remainder != 0 && ((remainder < 0) != (b < 0))) remainder += b;
+    *result = remainder;
+    return true;
+}
+
+static inline double moduloNumbers(double a, double b) {
+    double remainder = fmod(a, b);
+    if (remainder != 0 && ((remainder < 0) != (b < 0))) remainder += b;
+    return remainder == 0 ? 0 : remainder;
+}
+
+/*
+ * The bitwise operators work on 32-bit two's complement integers. Their operands have to be whole numbers.
+ * Integers are used as they are, whole doubles outside the 32-bit range wrap around modulo 2^32 the way they would in C,
+ * so a hash like (h * 31 + c) & mask keeps working after the multiplication has spilled over into a double.
+ * The result is always an integer.
+ */
+
+static inline bool toInt32(Value value, int32_t *result) {
+    if (IS_INT(value)) {
+        *result = AS_INT(value);
+        return true;
+    }
+    if (!IS_NUMBER(value)) return false;
+
+    double number = AS_NUMBER(value);
+    if (number != trunc(number) || isinf(number)) return false; // NaN fails the first test
+    *result = (int32_t)(uint32_t)(int64_t)fmod(number, 4294967296.0);
+    return true;
+}
+
 typedef struct {
     int capacity;
     int count;
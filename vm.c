@@ -1,3 +1,5 @@
+#include <limits.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -6,9 +8,13 @@
 #include "common.h"
 #include "compiler.h"
 #include "debug.h"
+#include "kernels.h"
 #include "object.h"
 #include "memory.h"
+#include "jit.h"
 #include "natives.h"
+#include "registers.h"
+#include "tier.h"
 #include "vm.h"
 
 #include <stdio.h>
@@ -39,6 +45,8 @@ static void resetStack() {
  * the failed instruction is the previous one.
  */
 
+#define TRACE_FRAMES 16
+
 static void runtimeError(const char *format, ...) {
     va_list args;
     va_start(args, format);
@@ -46,11 +54,23 @@ static void runtimeError(const char *format, ...) {
     va_end(args);
     fputs("\n", stderr);
 
+    // A runaway recursion can be FRAMES_MAX deep, so past a point only the innermost and the outermost frames are shown
     for (int i = vm.frameCount - 1; i >= 0; i--) {
+        if (vm.frameCount > 2 * TRACE_FRAMES && i == vm.frameCount - 1 - TRACE_FRAMES) {
+            fprintf(stderr, "... %d more ...\n", vm.frameCount - 2 * TRACE_FRAMES);
+            i = TRACE_FRAMES - 1;
+        }
         CallFrame *frame = &vm.frames[i];
         ObjFunction *function = frame->closure->function;
-        size_t instruction = frame->ip - function->chunk.code - 1;
-        fprintf(stderr, "[line %d] in ", function->chunk.lines[instruction]);
+        size_t instruction = frame->ip - frame->chunk->code - 1;
+        int line = frame->chunk->lines[instruction];
+        // Inlined code has no frame of its own, so the function it came from gets a line of the trace here (see chunk.h)
+        int site = INLINE_SITE(line);
+        if (site != -1) {
+            fprintf(stderr, "[line %d] in %s()\n", SOURCE_LINE(line), function->inlineSites[site].name->chars);
+            line = function->inlineSites[site].line;
+        }
+        fprintf(stderr, "[line %d] in ", line);
         if (function->name == NULL) {
             fprintf(stderr, "script\n");
         } else {
@@ -61,6 +81,30 @@ static void runtimeError(const char *format, ...) {
     resetStack();
 }
 
+/*
+ * Most natives just hand back nil when they're given something they can't work with.
+ * For the ones where that would hide a real mistake, nativeError() records a message and the call fails with a runtime error
+ * as soon as the native returns, exactly as if the VM had raised it. The returned value is just there so natives can write
+ * return nativeError(...); and is never seen by the program.
+ *
+ * A native can also fail because a vmCall() it made failed. That error has already been reported (and the stack unwound),
+ * so the message is left empty and callValue() only has to pass the failure on. Only the first error of a native call counts.
+ */
+
+static bool nativeFailed = false;
+static char nativeErrorMessage[256];
+
+Value nativeError(const char *format, ...) {
+    if (nativeFailed) return NIL_VAL;
+
+    va_list args;
+    va_start(args, format);
+    vsnprintf(nativeErrorMessage, sizeof(nativeErrorMessage), format, args);
+    va_end(args);
+    nativeFailed = true;
+    return NIL_VAL;
+}
+
 static Value peek(int distance);
 void defineNative(const char *name, NativeFn function, int arity) {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
@@ -71,8 +115,56 @@ void defineNative(const char *name, NativeFn function, int arity) {
     pop();
 }
 
+/*
+ * Every string hash is keyed with vm.hashSeed, so it has to be chosen before the first string gets interned.
+ * Normally we pull it from the OS, falling back to mixing the clock, the time and an address (ASLR gives us a few bits there) if /dev/urandom isn't around.
+ *
+ * Setting FER_HASH_SEED pins the seed, which makes table layouts, and thus timings, reproducible between runs.
+ */
+
+static uint64_t chooseHashSeed() {
+    const char *pinned = getenv("FER_HASH_SEED");
+    if (pinned != NULL && pinned[0] != '\0') {
+        return strtoull(pinned, NULL, 0);
+    }
+
+    uint64_t seed = 0;
+    FILE *random = fopen("/dev/urandom", "rb");
+    if (random != NULL) {
+        size_t read = fread(&seed, sizeof(seed), 1, random);
+        fclose(random);
+        if (read == 1) return seed;
+    }
+
+    seed = (uint64_t)time(NULL) ^ ((uint64_t)clock() << 32) ^ (uint64_t)(uintptr_t)&seed;
+    seed ^= seed >> 33;
+    seed *= 0xff51afd7ed558ccdULL;
+    seed ^= seed >> 33;
+    return seed;
+}
+
 void initVM() {
+    // Both start out small, see growStack()
+    vm.frameCapacity = GROW_CAPACITY(0);
+    vm.frames = malloc(sizeof(CallFrame) * vm.frameCapacity);
+    vm.stack = malloc(sizeof(Value) * STACK_INITIAL);
+    if (vm.frames == NULL || vm.stack == NULL) exit(1);
+    vm.stackLimit = vm.stack + STACK_INITIAL;
     resetStack();
+    vm.hashSeed = chooseHashSeed();
+    // The optimizing tier rewrites stack code, so it only runs with the stack VM
+    const char *format = getenv("FER_VM");
+    vm.registerMode = format != NULL && strcmp(format, "register") == 0;
+    const char *tier = getenv("FER_TIER");
+    vm.tiering = !vm.registerMode && (tier == NULL || strcmp(tier, "off") != 0);
+#ifdef JIT_SUPPORTED
+    const char *jit = getenv("FER_JIT");
+    vm.jitting = !vm.registerMode && jit != NULL && strcmp(jit, "on") == 0;
+#else
+    vm.jitting = false;
+#endif
+    vm.compiledCode = false;
+    initKernels();
     vm.objects = NULL;
     vm.bytesAllocated = 0;
     vm.nextGC = 1024 * 1024;
@@ -99,6 +191,8 @@ void freeVM() {
     freeTable(&vm.modules);
     vm.initString = NULL;
     freeObjects();
+    free(vm.frames);
+    free(vm.stack);
 }
 
 void push(Value value) {
@@ -121,21 +215,131 @@ static Value peek(int distance) {
     return vm.stackTop[-1 - distance];
 }
 
+/*
+ * An optimized chunk was built assuming that some parameters would keep getting numbers (see tier.h).
+ * Each bit of numberParams is one of those, and a call that breaks any of them runs the original chunk instead.
+ */
+
+static bool guardsHold(ObjFunction *function, Value *args) {
+    // A plain walk over the bits, parameter lists are short and it needs no compiler builtins
+    uint64_t guards = function->numberParams;
+    for (int param = 0; guards != 0; param++, guards >>= 1) {
+        if ((guards & 1) && !IS_NUMBER(args[param])) return false;
+    }
+    return true;
+}
+
+/*
+ * call() makes sure a new frame has room before it starts, and that's the only place the stack and the frames grow (vmCall() too,
+ * for the callee and arguments it pushes). Growing the frames is a plain realloc(): run() picks up the top frame again after every call,
+ * and nothing else keeps a CallFrame pointer across one.
+ *
+ * The stack is another story, a lot of pointers point into it: stackTop, every frame's slots and every open upvalue's location.
+ * It's copied into a bigger array, then they're all moved over by the same distance before the old one is freed.
+ * Native code (see jit.h and aot.h) keeps slots and stackTop in registers or locals, but it leaves calls to run(), so it has always reloaded
+ * them by the time it runs again. The one pointer we can't fix is the args a native was called with. A native that calls back
+ * into Fer through vmCall() has to copy out whatever it still needs from args first.
+ */
+
+static void growFrames() {
+    // Never past FRAMES_MAX, so call() finds it full right at the limit
+    vm.frameCapacity = GROW_CAPACITY(vm.frameCapacity);
+    if (vm.frameCapacity > FRAMES_MAX) vm.frameCapacity = FRAMES_MAX;
+    vm.frames = realloc(vm.frames, sizeof(CallFrame) * vm.frameCapacity);
+    if (vm.frames == NULL) exit(1);
+}
+
+static void growStack(int needed) {
+    size_t count = vm.stackTop - vm.stack;
+    size_t capacity = vm.stackLimit - vm.stack;
+    while (capacity < count + needed) capacity *= 2;
+
+    Value *stack = malloc(sizeof(Value) * capacity);
+    if (stack == NULL) exit(1);
+    memcpy(stack, vm.stack, sizeof(Value) * count);
+
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = stack + (vm.frames[i].slots - vm.stack);
+    }
+    for (ObjUpvalue *upvalue = vm.openUpvalues; upvalue != NULL; upvalue = upvalue->next) {
+        upvalue->location = stack + (upvalue->location - vm.stack);
+    }
+
+    free(vm.stack);
+    vm.stack = stack;
+    vm.stackTop = stack + count;
+    vm.stackLimit = stack + capacity;
+}
+
+// Makes sure there's room for needed more values above stackTop
+static inline void reserveStack(int needed) {
+    if (vm.stackLimit - vm.stackTop < needed) growStack(needed);
+}
+
+/*
+ * While a frame runs register code (see registers.h), stackTop sits at the end of its registers rather than on top of some value.
+ * The GC marks everything below stackTop, so every register is a root whether or not it holds anything meaningful yet.
+ * That's only safe if no register ever holds a value the GC may have freed. A new frame's registers are cleared before it starts,
+ * and while a call runs, the caller's registers above the callee's aren't marked, so they're cleared again once it's back.
+ * restoreRegisters() does both: it clears from stackTop to the end of the frame's registers and moves stackTop there.
+ */
+
+static void restoreRegisters(CallFrame *frame) {
+    Value *top = frame->slots + frame->closure->function->registerCount;
+    for (Value *slot = vm.stackTop; slot < top; slot++) {
+        *slot = NIL_VAL;
+    }
+    vm.stackTop = top;
+}
+
+static void callRegisters(ObjClosure *closure, Value *slots) {
+    CallFrame *frame = &vm.frames[vm.frameCount++];
+    frame->closure = closure;
+    frame->chunk = closure->function->registers;
+    frame->ip = frame->chunk->code;
+    frame->slots = slots;
+    restoreRegisters(frame);
+}
+
 static bool call(ObjClosure *closure, int argCount) {
     if (argCount != closure->function->arity) {
         runtimeError("Expected %d arguments but got %d.", closure->function->arity, argCount);
         return false;
     }
 
-    if (vm.frameCount == FRAMES_MAX) {
-        runtimeError("Stack overflow.");
+    ObjFunction *function = closure->function;
+    if (vm.registerMode && function->registers == NULL && !compileRegisters(function)) {
+        runtimeError("'%s' is too large for the register VM.", function->name != NULL ? function->name->chars : "script");
         return false;
     }
 
+    // Before the stack is reserved, an optimized chunk needs a few more slots
+    if (vm.tiering || vm.jitting) function->hotness++;
+    if (function->optimized == NULL && !function->tierAttempted && vm.tiering && function->hotness >= TIER_THRESHOLD) {
+        tierUp(function, vm.stackTop - argCount);
+    }
+
+    if (vm.frameCount == vm.frameCapacity) {
+        if (vm.frameCount == FRAMES_MAX) {
+            runtimeError("Stack overflow.");
+            return false;
+        }
+        growFrames();
+    }
+    // stackTop is past the arguments, so this is a little more than the frame needs
+    reserveStack((vm.registerMode ? function->registerCount : function->maxStack) + STACK_SLACK);
+
+    Value *slots = vm.stackTop - argCount - 1;
+    if (vm.registerMode) {
+        callRegisters(closure, slots);
+        return true;
+    }
+
     CallFrame *frame = &vm.frames[vm.frameCount++];
     frame->closure = closure;
-    frame->ip = closure->function->chunk.code;
-    frame->slots = vm.stackTop - argCount - 1;
+    frame->chunk = function->optimized != NULL && guardsHold(function, slots + 1) ? function->optimized : &function->chunk;
+    frame->ip = frame->chunk->code;
+    frame->slots = slots;
     return true;
 }
 
@@ -165,6 +369,11 @@ static bool callValue(Value callee, int argCount) {
                 ObjNative *native = AS_NATIVE(callee);
                 NativeFn function = native->function;
                 Value result = function(argCount, vm.stackTop - argCount);
+                if (nativeFailed) {
+                    nativeFailed = false;
+                    if (nativeErrorMessage[0] != '\0') runtimeError("%s", nativeErrorMessage);
+                    return false;
+                }
                 vm.stackTop -= argCount + 1;
                 push(result);
                 return true;
@@ -251,6 +460,74 @@ static void closeUpvalues(Value *last) {
     }
 }
 
+/*
+ * A call in tail position (return f(x), see OP_TAIL_CALL) leaves the caller nothing to do but hand back whatever the callee returns,
+ * so the callee can have the caller's frame. The caller's upvalues are closed, the callee and its arguments slide down
+ * to where the caller's slots began, and the callee's frame takes the caller's place. Recursion in tail position then runs
+ * in a constant number of frames.
+ *
+ * For a closure that's simply popping the caller's frame before the call, once we know the call can't fail on its arity
+ * (the error should point at the caller). Anything else goes through callValue() first, and if that pushed a frame
+ * (a bound method, an initializer) it's moved down into the caller's. A native, or a class without an initializer,
+ * doesn't get a frame: its result is already on the stack, and the OP_RETURN that follows the tail call returns it.
+ *
+ * The register VM calls this too, and clears the callee's registers afterwards like after any call (FINISH_CALL()).
+ */
+
+static bool tailCall(int argCount) {
+    Value callee = peek(argCount);
+
+    if (IS_CLOSURE(callee) && AS_CLOSURE(callee)->function->arity == argCount) {
+        CallFrame *caller = &vm.frames[vm.frameCount - 1];
+        closeUpvalues(caller->slots);
+        Value *args = vm.stackTop - argCount - 1;
+        for (int i = 0; i <= argCount; i++) {
+            caller->slots[i] = args[i];
+        }
+        vm.stackTop = caller->slots + argCount + 1;
+        vm.frameCount--;
+        return call(AS_CLOSURE(callee), argCount);
+    }
+
+    int frameCount = vm.frameCount;
+    if (!callValue(callee, argCount)) return false;
+    if (vm.frameCount == frameCount) return true;
+
+    // The call may have moved the frames (see growFrames())
+    CallFrame *caller = &vm.frames[vm.frameCount - 2];
+    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+    closeUpvalues(caller->slots);
+    for (int i = 0; i <= argCount; i++) {
+        caller->slots[i] = frame->slots[i];
+    }
+    frame->slots = caller->slots;
+    *caller = *frame;
+    vm.frameCount--;
+    vm.stackTop = caller->slots + argCount + 1;
+    return true;
+}
+
+/*
+ * The compiler inlines some calls it can see the target of (see inlineCall() in compiler.c), but the name it saw can be rebound
+ * and a method can be overridden by the time the code runs. isCallee() is the check in front of the inlined code (OP_CHECK_CALLEE):
+ * would calling callee, the way a call, an invoke or a super invoke would, run function? callee is the closure,
+ * the receiver or the superclass. A field shadows a method, exactly like in invoke().
+ */
+
+bool isCallee(Value callee, ObjFunction *function) {
+    Value method;
+    if (IS_CLOSURE(callee)) return AS_CLOSURE(callee)->function == function;
+    if (IS_INSTANCE(callee)) {
+        ObjInstance *instance = AS_INSTANCE(callee);
+        if (tableGet(&instance->fields, function->name, &method)) return false;
+        return tableGet(&instance->cls->methods, function->name, &method) && AS_CLOSURE(method)->function == function;
+    }
+    if (IS_CLASS(callee)) {
+        return tableGet(&AS_CLASS(callee)->methods, function->name, &method) && AS_CLOSURE(method)->function == function;
+    }
+    return false;
+}
+
 static void defineMethod(ObjString *name) {
     Value method = peek(0);
     ObjClass *cls = AS_CLASS(peek(1));
@@ -273,22 +550,197 @@ bool isFalsey(Value value) {
  * We allocate a character array for the result and then copy the two halves in.
  */
 
-static void concatenate() {
-    ObjString *b = AS_STRING(peek(0));
-    ObjString *a = AS_STRING(peek(1));
-
+static ObjString* concatenateStrings(ObjString *a, ObjString *b) {
     int length = a->length + b->length;
     char *chars = ALLOCATE(char, length + 1);
     memcpy(chars, a->chars, a->length);
     memcpy(chars + a->length, b->chars, b->length);
     chars[length] = '\0';
 
-    ObjString *result = takeString(chars, length);
+    return takeString(chars, length);
+}
+
+// The operands stay on the stack until the result exists, so a collection triggered by the allocation can't free them
+static void concatenate() {
+    ObjString *result = concatenateStrings(AS_STRING(peek(1)), AS_STRING(peek(0)));
     pop();
     pop();
     push(OBJ_VAL(result));
 }
 
+/*
+ * The two halves of a for-in loop. isIterable() is checked once, by OP_ITER_INIT.
+ * iterateNext() runs once per element: it finds the element at *cursor, moves the cursor past it and returns true,
+ * or returns false once the sequence has run out.
+ *
+ * The cursor is a plain index. The bounds are read again every time,
+ * so a loop body that shrinks the list it's walking just ends the loop early instead of reading past the end.
+ *
+ * A dictionary can't be walked like that. Deleting or adding keys can rebuild its entry array (see dictionary.h),
+ * which squeezes out the holes and moves the entries under the cursor, so the loop would skip keys or see some twice.
+ * Instead, OP_ITER_INIT swaps the dictionary for a list of its keys, in insertion order, taken when the loop starts,
+ * and the loop walks that list. A key the body adds isn't visited, and a key the body deletes still is, if it wasn't yet.
+ */
+
+bool isIterable(Value value) {
+    return IS_LIST(value) || IS_FLOAT_ARRAY(value) || IS_DICTIONARY(value) || IS_STRING(value) || IS_RANGE(value);
+}
+
+// Replaces the dictionary in *sequence, a stack slot, with the list of its keys
+static void snapshotKeys(Value *sequence) {
+    Dictionary *items = &AS_DICTIONARY(*sequence)->items;
+    ObjList *keys = newList();
+    push(OBJ_VAL(keys));
+    keys->values = GROW_ARRAY(Value, keys->values, 0, items->count);
+    keys->capacity = items->count;
+    for (int i = 0; i < items->used; i++) {
+        if (!IS_EMPTY(items->entries[i].key)) keys->values[keys->count++] = items->entries[i].key;
+    }
+    *sequence = OBJ_VAL(keys);
+    pop();
+}
+
+bool iterateNext(Value sequence, int *cursor, Value *element) {
+    int index = *cursor;
+
+    switch (OBJ_TYPE(sequence)) {
+        case OBJ_LIST: {
+            ObjList *list = AS_LIST(sequence);
+            if (index >= list->count) return false;
+            *element = list->values[index];
+            break;
+        }
+        case OBJ_FLOAT_ARRAY: {
+            ObjFloatArray *array = AS_FLOAT_ARRAY(sequence);
+            if (index >= array->count) return false;
+            *element = NUMBER_VAL(array->values[index]);
+            break;
+        }
+        case OBJ_STRING: {
+            ObjString *string = AS_STRING(sequence);
+            if (index >= string->length) return false;
+            *element = OBJ_VAL(copyString(string->chars + index, 1));
+            break;
+        }
+        case OBJ_RANGE: {
+            ObjRange *range = AS_RANGE(sequence);
+            if (index >= range->count) return false;
+            *element = INT_OR_NUMBER_VAL(range->start + index * range->step);
+            break;
+        }
+        default:
+            return false;
+    }
+
+    *cursor = index + 1;
+    return true;
+}
+
+// Turns a number used as an index into an int. A double too big for an int comes back as -1, which every caller treats as out of bounds.
+static inline int toIndex(Value key) {
+    if (IS_INT(key)) return AS_INT(key);
+
+    double number = AS_NUMBER(key);
+    return number > -1 && number < INT_MAX ? (int)number : -1;
+}
+
+/*
+ * Subscripting, shared by both dispatch loops. They report the runtime error themselves and return false when there is one.
+ * The target, key and item must stay reachable by the GC while these run: setting a dictionary entry can allocate.
+ */
+
+static bool getItem(Value target, Value key, Value *result) {
+    if (IS_LIST(target)) {
+        if (!IS_NUMBER(key)) {
+            runtimeError("List index must be a number.");
+            return false;
+        }
+
+        ObjList *list = AS_LIST(target);
+        int index = toIndex(key);
+        if (0 > index || index >= list->count) {
+            runtimeError("List index is out of bounds.");
+            return false;
+        }
+
+        *result = list->values[index];
+        return true;
+    }
+
+    if (IS_FLOAT_ARRAY(target)) {
+        if (!IS_NUMBER(key)) {
+            runtimeError("Float array index must be a number.");
+            return false;
+        }
+
+        ObjFloatArray *array = AS_FLOAT_ARRAY(target);
+        int index = toIndex(key);
+        if (0 > index || index >= array->count) {
+            runtimeError("Float array index is out of bounds.");
+            return false;
+        }
+
+        *result = NUMBER_VAL(array->values[index]);
+        return true;
+    }
+
+    if (IS_DICTIONARY(target)) {
+        if (!dictionaryGet(&AS_DICTIONARY(target)->items, key, result)) *result = NIL_VAL;
+        return true;
+    }
+
+    runtimeError("Can only subscript lists, float arrays and dictionaries.");
+    return false;
+}
+
+static bool setItem(Value target, Value key, Value item) {
+    if (IS_LIST(target)) {
+        if (!IS_NUMBER(key)) {
+            runtimeError("List index must be a number.");
+            return false;
+        }
+
+        ObjList *list = AS_LIST(target);
+        int index = toIndex(key);
+        if (index < 0 || index >= list->count) {
+            runtimeError("List index is out of bounds.");
+            return false;
+        }
+
+        list->values[index] = item;
+        return true;
+    }
+
+    if (IS_FLOAT_ARRAY(target)) {
+        if (!IS_NUMBER(key)) {
+            runtimeError("Float array index must be a number.");
+            return false;
+        }
+        if (!IS_NUMBER(item)) {
+            runtimeError("Float array elements must be numbers.");
+            return false;
+        }
+
+        ObjFloatArray *array = AS_FLOAT_ARRAY(target);
+        int index = toIndex(key);
+        if (index < 0 || index >= array->count) {
+            runtimeError("Float array index is out of bounds.");
+            return false;
+        }
+
+        array->values[index] = AS_NUMBER(item);
+        return true;
+    }
+
+    if (IS_DICTIONARY(target)) {
+        dictionarySet(&AS_DICTIONARY(target)->items, key, item);
+        return true;
+    }
+
+    runtimeError("Can only subscript lists, float arrays and dictionaries.");
+    return false;
+}
+
 /*
  * This is the single most important function in all of cfer, by far.
  * When te interpreter executes a user's program, it will spend something like 90% of its time inside run().
@@ -334,28 +786,117 @@ static void concatenate() {
  * If each statement grew of shrank the stack, it might eventually overflow or underflow.
  */
 
-static InterpretResult run() {
+// Imports and the read() native load files through this. It lives with the VM and not in main.c, so programs built with --emit-c (see aot.h) have it too
+char* readFile(const char *path) {
+    FILE *file = fopen(path, "rb"); // Mode: "rb" (read binary) ensures that the OS doesn't "translate" anything (like '\n' to a line jump)
+                                                  // and it also ensures that ftell, gets the name of all the bytes in the file
+    if (file == NULL) {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        exit(74);
+    }
+
+    fseek(file, 0L, SEEK_END); // Moves the file cursor to the end of the file
+    size_t fileSize = ftell(file); // ftell asks the system "how many bytes away are we?" because we're at the end thanks to fseek
+                                   // the number returned is the size of the file.
+    rewind(file); // return the file cursor to the beginning of the file
+
+    char *buffer = (char*)malloc(fileSize + 1); // Then we allocate memory in the heap for the whole file, + 1 byte for the null character (\0)
+    if (buffer == NULL) {
+        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+        exit(74);
+    }
+    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file); // fread copies the bytes from the file to the buffer
+                                                                                    // and bytesRead is how many bytes were read
+                                                                                    // if everything goes well, bytesRead is the length of the file
+    if (bytesRead < fileSize) {
+        fprintf(stderr, "Cound not read file \"%s\".\n", path);
+        exit(74);
+    }
+    buffer[bytesRead] = '\0'; // The last element of the buffer should always be the null character
+
+    fclose(file);
+    return buffer;
+}
+
+/*
+ * Native code runs a frame from where it is until it gets to an instruction it leaves to run(), and returns with the frame's ip there.
+ * Code generated ahead of time (see aot.h) is used when there is some for the chunk the frame runs,
+ * otherwise the JIT's once the function is hot enough (see jit.h).
+ */
+
+static void enterNative(CallFrame *frame) {
+    ObjFunction *function = frame->closure->function;
+    if (function->compiled != NULL && frame->chunk == &function->chunk) {
+        function->compiled(frame, (int)(frame->ip - frame->chunk->code));
+    } else if (vm.jitting && function->hotness >= JIT_THRESHOLD) {
+        jitRun(frame);
+    }
+}
+
+static InterpretResult run(int exitFrame) {
     CallFrame *frame = &vm.frames[vm.frameCount - 1];
 #define READ_BYTE() (*frame->ip++)
-#define READ_CONSTANT() (frame->closure->function->chunk.constants.values[READ_BYTE()])
+#define READ_CONSTANT() (frame->chunk->constants.values[READ_BYTE()])
 #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
 #define READ_UINT32() (frame->ip += 4, (uint32_t)( \
     ((uint32_t)frame->ip[-4] << 24) | \
     ((uint32_t)frame->ip[-3] << 16) | \
     ((uint32_t)frame->ip[-2] << 8) | \
     (uint32_t)frame->ip[-1]))
-#define READ_LONG_CONSTANT() (frame->closure->function->chunk.constants.values[READ_UINT32()])
+#define READ_LONG_CONSTANT() (frame->chunk->constants.values[READ_UINT32()])
 #define READ_STRING() AS_STRING(READ_CONSTANT())
-#define READ_STRING_LONG() AS_STRING(frame->closure->function->chunk.constants.values[READ_UINT32()])
+#define READ_STRING_LONG() AS_STRING(frame->chunk->constants.values[READ_UINT32()])
 #define BINARY_OP(valueType, op) \
     do { \
         if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
             runtimeError("Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
         } \
         double b = AS_NUMBER(pop()); \
         double a = AS_NUMBER(pop()); \
         push(valueType(a op b)); \
     } while (false)
+#define ARITHMETIC_OP(intOp, op) \
+    do { \
+        Value b = peek(0); \
+        Value a = peek(1); \
+        int32_t result; \
+        if (IS_INT(a) && IS_INT(b) && intOp(AS_INT(a), AS_INT(b), &result)) { \
+            vm.stackTop--; \
+            vm.stackTop[-1] = INT_VAL(result); \
+        } else { \
+            BINARY_OP(NUMBER_VAL, op); \
+        } \
+    } while (false)
+#define BITWISE_OP(expression) \
+    do { \
+        int32_t a; \
+        int32_t b; \
+        if (!toInt32(peek(1), &a) || !toInt32(peek(0), &b)) { \
+            runtimeError("Operands must be integers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        vm.stackTop--; \
+        vm.stackTop[-1] = INT_VAL(expression); \
+    } while (false)
+#define COMPARISON_OP(op) \
+    do { \
+        Value b = peek(0); \
+        Value a = peek(1); \
+        if (IS_INT(a) && IS_INT(b)) { \
+            vm.stackTop--; \
+            vm.stackTop[-1] = BOOL_VAL(AS_INT(a) op AS_INT(b)); \
+        } else { \
+            BINARY_OP(BOOL_VAL, op); \
+        } \
+    } while (false)
+// Hands the frame to its native code, see enterNative(). Done on entry, after calls and returns and on loop back edges.
+#define ENTER_NATIVE() \
+    do { \
+        if (vm.compiledCode || vm.jitting) enterNative(frame); \
+    } while (false)
+
+    ENTER_NATIVE();
     for (;;) {
 #ifdef DEBUG_TRACE_EXECUTION
         printf("          ");
@@ -364,7 +905,7 @@ static InterpretResult run() {
             printValueDebug(*slot);
             printf(" ]");
         }
-        disassembleInstruction(&frame->closure->function->chunk, (int)(frame->ip - frame->closure->function->chunk.code));
+        disassembleInstruction(frame->chunk, (int)(frame->ip - frame->chunk->code));
 #endif
         uint8_t instruction;
         switch (instruction = READ_BYTE()) {
@@ -393,105 +934,23 @@ static InterpretResult run() {
                 break;
             }
             case OP_GET_ITEM: {
-                Value key = peek(0);
-                Value target = peek(1);
-
-                if (IS_LIST(target)) {
-                    if (!IS_NUMBER(key)) {
-                        runtimeError("List index must be a number.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-
-                    ObjList *list = AS_LIST(peek(1));
-                    int index = AS_NUMBER(key);
-                    if (0 > index || index >= list->count) {
-                        runtimeError("List index is out of bounds.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-
-                    pop(); // key = index
-                    pop(); // list
-
-                    push(list->values[index]);
-                    break;
-                }
-
-                if (IS_DICTIONARY(target)) {
-                    ObjDictionary *dictionary = AS_DICTIONARY(target);
-
-                    if (!IS_STRING(key)) {
-                        runtimeError("Dictionary index must be a string.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-
-                    Value value;
-                    if (tableGet(&dictionary->table, AS_STRING(key), &value)) {
-                        pop(); // key
-                        pop(); // dict
-                        push(value);
-                    } else {
-                        pop();
-                        pop();
-                        push(NIL_VAL);
-                    }
-                    break;
+                Value result;
+                if (!getItem(peek(1), peek(0), &result)) {
+                    return INTERPRET_RUNTIME_ERROR;
                 }
-
-                runtimeError("Can only subscript lists and dictionaries.");
-                return INTERPRET_RUNTIME_ERROR;
+                vm.stackTop--;
+                vm.stackTop[-1] = result;
+                break;
             }
             case OP_SET_ITEM: {
-                // Lists
-                // Stack: [ ... , list, index, value ] (top)
-
-                // Dictionaries
-                // Stack: [ ... , dict, key, value ] (top)
-
+                // Stack: [ ... , target, key, item ] (top), the item is left behind as the assignment's value
                 Value item = peek(0);
-                Value key = peek(1);
-                Value target = peek(2);
-
-                if (IS_LIST(target)) {
-                    if (!IS_NUMBER(key)) {
-                        runtimeError("List index must be a number.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-
-                    ObjList *list = AS_LIST(target);
-                    int index = AS_NUMBER(key);
-
-                    if (index < 0 || index >= list->count) {
-                        runtimeError("List index is out of bounds.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-
-                    list->values[index] = item;
-                    pop(); // value
-                    pop(); // index
-                    pop(); // list
-                    push(item);
-                    break;
-                }
-
-                if (IS_DICTIONARY(target)) {
-                    ObjDictionary *dictionary = AS_DICTIONARY(target);
-
-                    if (!IS_STRING(key)) {
-                        runtimeError("Dictionary index must be a string.");
-                        return INTERPRET_RUNTIME_ERROR;
-                    }
-
-                    tableSet(&dictionary->table, AS_STRING(key), item);
-
-                    pop(); // item
-                    pop(); // key
-                    pop(); // dictionary
-                    push(item);
-                    break;
+                if (!setItem(peek(2), peek(1), item)) {
+                    return INTERPRET_RUNTIME_ERROR;
                 }
-
-                runtimeError("Can only subscript lists and dictionaries.");
-                return INTERPRET_RUNTIME_ERROR;
+                vm.stackTop -= 2;
+                vm.stackTop[-1] = item;
+                break;
             }
             case OP_GET_GLOBAL: {
                 ObjString *name = READ_STRING();
@@ -629,10 +1088,14 @@ static InterpretResult run() {
                 push(BOOL_VAL(valuesEqual(a, b)));
                 break;
             }
-            case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
-            case OP_LESS: BINARY_OP(BOOL_VAL, <); break;
+            case OP_GREATER: COMPARISON_OP(>); break;
+            case OP_LESS: COMPARISON_OP(<); break;
             case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
+                int32_t result;
+                if (IS_INT(peek(0)) && IS_INT(peek(1)) && addInts(AS_INT(peek(1)), AS_INT(peek(0)), &result)) {
+                    vm.stackTop--;
+                    vm.stackTop[-1] = INT_VAL(result);
+                } else if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
                     concatenate();
                 } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
                     double b = AS_NUMBER(pop());
@@ -644,9 +1107,31 @@ static InterpretResult run() {
                 }
                 break;
             }
-            case OP_SUBTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE: BINARY_OP(NUMBER_VAL, /); break;
+            case OP_SUBTRACT: ARITHMETIC_OP(subtractInts, -); break;
+            case OP_MULTIPLY: ARITHMETIC_OP(multiplyInts, *); break;
+            case OP_DIVIDE: ARITHMETIC_OP(divideInts, /); break;
+            case OP_MODULO: {
+                Value b = peek(0);
+                Value a = peek(1);
+                int32_t result;
+                if (IS_INT(a) && IS_INT(b) && moduloInts(AS_INT(a), AS_INT(b), &result)) {
+                    vm.stackTop--;
+                    vm.stackTop[-1] = INT_VAL(result);
+                    break;
+                }
+                if (!IS_NUMBER(a) || !IS_NUMBER(b)) {
+                    runtimeError("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                vm.stackTop--;
+                vm.stackTop[-1] = NUMBER_VAL(moduloNumbers(AS_NUMBER(a), AS_NUMBER(b)));
+                break;
+            }
+            case OP_BIT_AND: BITWISE_OP(a & b); break;
+            case OP_BIT_OR: BITWISE_OP(a | b); break;
+            case OP_BIT_XOR: BITWISE_OP(a ^ b); break;
+            case OP_SHIFT_LEFT: BITWISE_OP((int32_t)((uint32_t)a << (b & 31))); break;
+            case OP_SHIFT_RIGHT: BITWISE_OP(a >> (b & 31)); break;
             case OP_NOT:
                 push(BOOL_VAL(isFalsey(pop())));
                 break;
@@ -655,17 +1140,23 @@ static InterpretResult run() {
                     runtimeError("Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
+                Value operand = pop();
+                if (IS_INT(operand) && AS_INT(operand) != 0 && AS_INT(operand) != INT32_MIN) {
+                    push(INT_VAL(-AS_INT(operand)));
+                } else {
+                    push(NUMBER_VAL(-AS_NUMBER(operand)));
+                }
                 break;
             }
             case OP_LIST: {
+                uint8_t count = READ_BYTE();
                 ObjList *list = newList();
-                list->count = READ_BYTE();
                 push(OBJ_VAL(list));
 
-                int oldCapacity = list->capacity;
-                list->capacity = GROW_CAPACITY(list->count);
-                list->values = GROW_ARRAY(Value, list->values, oldCapacity, list->capacity);
+                // count is only set once the array exists, a GC triggered by the allocation would otherwise walk a NULL array
+                list->values = GROW_ARRAY(Value, list->values, 0, GROW_CAPACITY(count));
+                list->capacity = GROW_CAPACITY(count);
+                list->count = count;
 
                 pop();
                 for (int i = list->count - 1; i >= 0; i--) {
@@ -679,11 +1170,12 @@ static InterpretResult run() {
                 ObjDictionary *dictionary = newDictionary();
                 push(OBJ_VAL(dictionary));
 
-                for (int i = 0; i < items; i++) {
+                // Walk the pairs from the deepest one up so they're inserted in source order
+                for (int i = items - 1; i >= 0; i--) {
                     Value value = peek((2 * i) + 1);
                     Value key = peek((2 * i) + 2);
 
-                    tableSet(&dictionary->table, AS_STRING(key), value);
+                    dictionarySet(&dictionary->items, key, value);
                 }
 
                 pop(); // dictionary
@@ -715,6 +1207,18 @@ static InterpretResult run() {
                     break;
                 }
 
+                if (strcmp(name->chars, "vector") == 0) {
+                    defineVectorNatives();
+                    push(NIL_VAL);
+                    break;
+                }
+
+                if (strcmp(name->chars, "matrix") == 0) {
+                    defineMatrixNatives();
+                    push(NIL_VAL);
+                    break;
+                }
+
                 Value moduleValue;
                 if (tableGet(&vm.modules, name, &moduleValue)) {
                     push(moduleValue);
@@ -732,7 +1236,9 @@ static InterpretResult run() {
                 ObjClosure *closure = newClosure(function);
                 pop();
                 push(OBJ_VAL(closure));
-                call(closure, 0);
+                if (!call(closure, 0)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
 
                 frame = &vm.frames[vm.frameCount - 1];
                 break;
@@ -755,23 +1261,120 @@ static InterpretResult run() {
             case OP_LOOP: {
                 uint16_t offset = READ_SHORT();
                 frame->ip -= offset;
+                frame->closure->function->hotness++;
+                ENTER_NATIVE();
                 break;
             }
-            case OP_CALL: {
-                int argCount = READ_BYTE();
-                if (!callValue(peek(argCount), argCount)) {
+            case OP_FOR_STEP: {
+                uint8_t slot = READ_BYTE();
+                uint8_t flags = READ_BYTE();
+                uint8_t boundIndex = READ_BYTE();
+                Value step = READ_CONSTANT();
+                uint16_t offset = READ_SHORT();
+                frame->closure->function->hotness++;
+
+                Value counter = frame->slots[slot];
+                Value bound = (flags & FOR_STEP_CONSTANT_BOUND)
+                    ? frame->chunk->constants.values[boundIndex]
+                    : frame->slots[boundIndex];
+
+                int32_t nextInt;
+                if (IS_INT(counter) && IS_INT(step) && IS_INT(bound)
+                    && ((flags & FOR_STEP_SUBTRACT) ? subtractInts(AS_INT(counter), AS_INT(step), &nextInt)
+                                                    : addInts(AS_INT(counter), AS_INT(step), &nextInt))) {
+                    frame->slots[slot] = INT_VAL(nextInt);
+
+                    int32_t limit = AS_INT(bound);
+                    bool again;
+                    switch (flags & FOR_STEP_COMPARISON) {
+                        case FOR_STEP_LESS:       again = nextInt < limit; break;
+                        case FOR_STEP_LESS_EQUAL: again = nextInt <= limit; break;
+                        case FOR_STEP_GREATER:    again = nextInt > limit; break;
+                        default:                  again = nextInt >= limit; break;
+                    }
+                    if (again) {
+                        frame->ip -= offset;
+                        ENTER_NATIVE();
+                    }
+                    break;
+                }
+
+                // The same errors as the OP_ADD / OP_SUBTRACT and the comparison this instruction stands for
+                if (!IS_NUMBER(counter)) {
+                    runtimeError((flags & FOR_STEP_SUBTRACT) ? "Operands must be numbers." : "Operands must be two numbers or two strings");
                     return INTERPRET_RUNTIME_ERROR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
-            }
-            case OP_INVOKE: {
+                if (!IS_NUMBER(bound)) {
+                    runtimeError("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                double next = (flags & FOR_STEP_SUBTRACT) ? AS_NUMBER(counter) - AS_NUMBER(step) : AS_NUMBER(counter) + AS_NUMBER(step);
+                frame->slots[slot] = NUMBER_VAL(next);
+
+                // <= and >= are written as !(a > b) and !(a < b), exactly like the compiler spells them, so NaN bounds behave the same
+                double limit = AS_NUMBER(bound);
+                bool again;
+                switch (flags & FOR_STEP_COMPARISON) {
+                    case FOR_STEP_LESS:       again = next < limit; break;
+                    case FOR_STEP_LESS_EQUAL: again = !(next > limit); break;
+                    case FOR_STEP_GREATER:    again = next > limit; break;
+                    default:                  again = !(next < limit); break;
+                }
+                if (again) {
+                    frame->ip -= offset;
+                    ENTER_NATIVE();
+                }
+                break;
+            }
+            case OP_ITER_INIT: {
+                if (!isIterable(peek(0))) {
+                    runtimeError("Can only iterate over lists, float arrays, dictionaries, strings and ranges.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (IS_DICTIONARY(peek(0))) snapshotKeys(&vm.stackTop[-1]);
+                push(INT_VAL(0));
+                break;
+            }
+            case OP_ITER_NEXT: {
+                uint8_t slot = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                int cursor = AS_INT(frame->slots[slot + 1]);
+                Value element;
+                if (iterateNext(frame->slots[slot], &cursor, &element)) {
+                    frame->slots[slot + 1] = INT_VAL(cursor);
+                    push(element);
+                } else {
+                    frame->ip += offset;
+                }
+                break;
+            }
+            case OP_CALL: {
+                int argCount = READ_BYTE();
+                if (!callValue(peek(argCount), argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm.frames[vm.frameCount - 1];
+                ENTER_NATIVE();
+                break;
+            }
+            case OP_TAIL_CALL: {
+                int argCount = READ_BYTE();
+                if (!tailCall(argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                frame = &vm.frames[vm.frameCount - 1];
+                ENTER_NATIVE();
+                break;
+            }
+            case OP_INVOKE: {
                 ObjString *method = READ_STRING();
                 int argCount = READ_BYTE();
                 if (!invoke(method, argCount)) {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frameCount - 1];
+                ENTER_NATIVE();
                 break;
             }
             case OP_SUPER_INVOKE: {
@@ -782,6 +1385,22 @@ static InterpretResult run() {
                     return INTERPRET_RUNTIME_ERROR;
                 }
                 frame = &vm.frames[vm.frameCount - 1];
+                ENTER_NATIVE();
+                break;
+            }
+            case OP_CHECK_CALLEE: {
+                ObjFunction *function = AS_FUNCTION(READ_CONSTANT());
+                int depth = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                if (!isCallee(peek(depth), function)) frame->ip += offset;
+                break;
+            }
+            case OP_INLINE_RETURN: {
+                int count = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                vm.stackTop[-1 - count] = vm.stackTop[-1];
+                vm.stackTop -= count;
+                frame->ip += offset;
                 break;
             }
             case OP_CLOSURE: {
@@ -814,7 +1433,10 @@ static InterpretResult run() {
 
                 vm.stackTop = frame->slots;
                 push(result);
+                if (vm.frameCount == exitFrame) return INTERPRET_OK;
+
                 frame = &vm.frames[vm.frameCount - 1];
+                ENTER_NATIVE();
                 break;
             }
             case OP_CLASS:
@@ -839,9 +1461,628 @@ static InterpretResult run() {
     }
 #undef READ_BYTE
 #undef READ_SHORT
+#undef READ_UINT32
 #undef READ_CONSTANT
+#undef READ_LONG_CONSTANT
 #undef READ_STRING
+#undef READ_STRING_LONG
 #undef BINARY_OP
+#undef ARITHMETIC_OP
+#undef BITWISE_OP
+#undef COMPARISON_OP
+#undef ENTER_NATIVE
+}
+
+/*
+ * runRegisters() is run() for the register format. Every instruction names the registers it reads and writes,
+ * R(n) being register n of the current frame and K(n) constant n, so there's no pushing and popping,
+ * but what each instruction does is the same as its stack counterpart, down to the error messages.
+ *
+ * The few instructions that hand control to other code (calls, imports) lower stackTop to just past their arguments first,
+ * since that's what callValue() and the natives expect, and put it back with restoreRegisters() once they're done.
+ */
+
+static InterpretResult runRegisters(int exitFrame) {
+    CallFrame *frame = &vm.frames[vm.frameCount - 1];
+#define READ_BYTE() (*frame->ip++)
+#define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
+#define READ_UINT32() (frame->ip += 4, (uint32_t)( \
+    ((uint32_t)frame->ip[-4] << 24) | \
+    ((uint32_t)frame->ip[-3] << 16) | \
+    ((uint32_t)frame->ip[-2] << 8) | \
+    (uint32_t)frame->ip[-1]))
+#define R(index) (frame->slots[index])
+#define K(index) (frame->chunk->constants.values[index])
+#define READ_STRING() AS_STRING(K(READ_BYTE()))
+#define READ_STRING_LONG() AS_STRING(K(READ_UINT32()))
+#define READ_OPERANDS() \
+    uint8_t a = READ_BYTE(); \
+    Value b = R(READ_BYTE()); \
+    Value c = R(READ_BYTE())
+#define READ_OPERANDS_CONSTANT() \
+    uint8_t a = READ_BYTE(); \
+    Value b = R(READ_BYTE()); \
+    Value c = K(READ_BYTE())
+#define ARITHMETIC_OP(intOp, op) \
+    do { \
+        int32_t result; \
+        if (IS_INT(b) && IS_INT(c) && intOp(AS_INT(b), AS_INT(c), &result)) { \
+            R(a) = INT_VAL(result); \
+        } else if (IS_NUMBER(b) && IS_NUMBER(c)) { \
+            R(a) = NUMBER_VAL(AS_NUMBER(b) op AS_NUMBER(c)); \
+        } else { \
+            runtimeError("Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+    } while (false)
+#define COMPARISON_OP(op) \
+    do { \
+        if (IS_INT(b) && IS_INT(c)) { \
+            R(a) = BOOL_VAL(AS_INT(b) op AS_INT(c)); \
+        } else if (IS_NUMBER(b) && IS_NUMBER(c)) { \
+            R(a) = BOOL_VAL(AS_NUMBER(b) op AS_NUMBER(c)); \
+        } else { \
+            runtimeError("Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+    } while (false)
+#define ADD_OP() \
+    do { \
+        int32_t result; \
+        if (IS_INT(b) && IS_INT(c) && addInts(AS_INT(b), AS_INT(c), &result)) { \
+            R(a) = INT_VAL(result); \
+        } else if (IS_STRING(b) && IS_STRING(c)) { \
+            R(a) = OBJ_VAL(concatenateStrings(AS_STRING(b), AS_STRING(c))); \
+        } else if (IS_NUMBER(b) && IS_NUMBER(c)) { \
+            R(a) = NUMBER_VAL(AS_NUMBER(c) + AS_NUMBER(b)); \
+        } else { \
+            runtimeError("Operands must be two numbers or two strings"); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+    } while (false)
+#define MODULO_OP() \
+    do { \
+        int32_t result; \
+        if (IS_INT(b) && IS_INT(c) && moduloInts(AS_INT(b), AS_INT(c), &result)) { \
+            R(a) = INT_VAL(result); \
+        } else if (IS_NUMBER(b) && IS_NUMBER(c)) { \
+            R(a) = NUMBER_VAL(moduloNumbers(AS_NUMBER(b), AS_NUMBER(c))); \
+        } else { \
+            runtimeError("Operands must be numbers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+    } while (false)
+#define BITWISE_OP(expression) \
+    do { \
+        int32_t x; \
+        int32_t y; \
+        if (!toInt32(b, &x) || !toInt32(c, &y)) { \
+            runtimeError("Operands must be integers."); \
+            return INTERPRET_RUNTIME_ERROR; \
+        } \
+        R(a) = INT_VAL(expression); \
+    } while (false)
+// After a call, either a new frame is running, or the callee already finished (a native, a class without init()) and the result is in place.
+// Which one is told by the frame count from before the call, frame itself may have been moved (see growFrames()).
+#define FINISH_CALL(frameCount) \
+    do { \
+        frame = &vm.frames[vm.frameCount - 1]; \
+        if (vm.frameCount == (frameCount)) restoreRegisters(frame); \
+    } while (false)
+    for (;;) {
+#ifdef DEBUG_TRACE_EXECUTION
+        printf("          ");
+        for (Value *slot = frame->slots; slot < vm.stackTop; slot++) {
+            printf("[ ");
+            printValueDebug(*slot);
+            printf(" ]");
+        }
+        printf("\n");
+        disassembleRegisterInstruction(frame->chunk, (int)(frame->ip - frame->chunk->code));
+#endif
+        switch (READ_BYTE()) {
+            case R_MOVE: {
+                uint8_t a = READ_BYTE();
+                R(a) = R(READ_BYTE());
+                break;
+            }
+            case R_LOAD_CONSTANT: {
+                uint8_t a = READ_BYTE();
+                R(a) = K(READ_BYTE());
+                break;
+            }
+            case R_LOAD_CONSTANT_LONG: {
+                uint8_t a = READ_BYTE();
+                R(a) = K(READ_UINT32());
+                break;
+            }
+            case R_LOAD_NIL: R(READ_BYTE()) = NIL_VAL; break;
+            case R_LOAD_TRUE: R(READ_BYTE()) = BOOL_VAL(true); break;
+            case R_LOAD_FALSE: R(READ_BYTE()) = BOOL_VAL(false); break;
+            case R_GET_GLOBAL:
+            case R_GET_GLOBAL_LONG: {
+                uint8_t a = READ_BYTE();
+                ObjString *name = frame->ip[-2] == R_GET_GLOBAL ? READ_STRING() : READ_STRING_LONG();
+                Value value;
+                if (!tableGet(&vm.globals, name, &value)) {
+                    runtimeError("Undefined variable '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                R(a) = value;
+                break;
+            }
+            case R_DEFINE_GLOBAL:
+            case R_DEFINE_GLOBAL_LONG:
+            case R_DEFINE_GLOBAL_PERM:
+            case R_DEFINE_GLOBAL_PERM_LONG: {
+                uint8_t op = frame->ip[-1];
+                Value value = R(READ_BYTE());
+                ObjString *name = op == R_DEFINE_GLOBAL || op == R_DEFINE_GLOBAL_PERM ? READ_STRING() : READ_STRING_LONG();
+                tableSet(&vm.globals, name, value);
+                if (op == R_DEFINE_GLOBAL_PERM || op == R_DEFINE_GLOBAL_PERM_LONG) {
+                    tableSet(&vm.globalPerms, name, BOOL_VAL(true));
+                }
+                break;
+            }
+            case R_SET_GLOBAL:
+            case R_SET_GLOBAL_LONG: {
+                uint8_t op = frame->ip[-1];
+                Value value = R(READ_BYTE());
+                ObjString *name = op == R_SET_GLOBAL ? READ_STRING() : READ_STRING_LONG();
+
+                Value dummy;
+                if (tableGet(&vm.globalPerms, name, &dummy)) {
+                    runtimeError("Cannot reassign global const '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (tableSet(&vm.globals, name, value)) {
+                    tableDelete(&vm.globals, name);
+                    runtimeError("Undefined variable '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                break;
+            }
+            case R_GET_UPVALUE: {
+                uint8_t a = READ_BYTE();
+                R(a) = *frame->closure->upvalues[READ_BYTE()]->location;
+                break;
+            }
+            case R_SET_UPVALUE: {
+                Value value = R(READ_BYTE());
+                *frame->closure->upvalues[READ_BYTE()]->location = value;
+                break;
+            }
+            case R_GET_ITEM: {
+                READ_OPERANDS();
+                Value result;
+                if (!getItem(b, c, &result)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                R(a) = result;
+                break;
+            }
+            case R_SET_ITEM: {
+                READ_OPERANDS();
+                Value item = R(READ_BYTE());
+                if (!setItem(b, c, item)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                R(a) = item;
+                break;
+            }
+            case R_GET_PROPERTY: {
+                uint8_t a = READ_BYTE();
+                Value receiver = R(READ_BYTE());
+                ObjString *name = READ_STRING();
+                if (!IS_INSTANCE(receiver)) {
+                    runtimeError("Only instances have properties.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                ObjInstance *instance = AS_INSTANCE(receiver);
+                Value value;
+                if (tableGet(&instance->fields, name, &value)) {
+                    R(a) = value;
+                    break;
+                }
+
+                if (!tableGet(&instance->cls->methods, name, &value)) {
+                    runtimeError("Undefined property '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                R(a) = OBJ_VAL(newBoundMethod(receiver, AS_CLOSURE(value)));
+                break;
+            }
+            case R_SET_PROPERTY: {
+                READ_OPERANDS();
+                ObjString *name = READ_STRING();
+                if (!IS_INSTANCE(b)) {
+                    runtimeError("Only instances have fields");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                tableSet(&AS_INSTANCE(b)->fields, name, c);
+                R(a) = c;
+                break;
+            }
+            case R_GET_SUPER: {
+                uint8_t a = READ_BYTE();
+                ObjString *name = READ_STRING();
+                ObjClass *superclass = AS_CLASS(R(a + 1));
+
+                Value method;
+                if (!tableGet(&superclass->methods, name, &method)) {
+                    runtimeError("Undefined property '%s'.", name->chars);
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                R(a) = OBJ_VAL(newBoundMethod(R(a), AS_CLOSURE(method)));
+                break;
+            }
+            case R_EQUAL: {
+                READ_OPERANDS();
+                R(a) = BOOL_VAL(valuesEqual(b, c));
+                break;
+            }
+            case R_GREATER: { READ_OPERANDS(); COMPARISON_OP(>); break; }
+            case R_LESS: { READ_OPERANDS(); COMPARISON_OP(<); break; }
+            case R_ADD: { READ_OPERANDS(); ADD_OP(); break; }
+            case R_SUBTRACT: { READ_OPERANDS(); ARITHMETIC_OP(subtractInts, -); break; }
+            case R_MULTIPLY: { READ_OPERANDS(); ARITHMETIC_OP(multiplyInts, *); break; }
+            case R_DIVIDE: { READ_OPERANDS(); ARITHMETIC_OP(divideInts, /); break; }
+            case R_MODULO: { READ_OPERANDS(); MODULO_OP(); break; }
+            case R_BIT_AND: { READ_OPERANDS(); BITWISE_OP(x & y); break; }
+            case R_BIT_OR: { READ_OPERANDS(); BITWISE_OP(x | y); break; }
+            case R_BIT_XOR: { READ_OPERANDS(); BITWISE_OP(x ^ y); break; }
+            case R_SHIFT_LEFT: { READ_OPERANDS(); BITWISE_OP((int32_t)((uint32_t)x << (y & 31))); break; }
+            case R_SHIFT_RIGHT: { READ_OPERANDS(); BITWISE_OP(x >> (y & 31)); break; }
+            case R_EQUAL_CONSTANT: {
+                READ_OPERANDS_CONSTANT();
+                R(a) = BOOL_VAL(valuesEqual(b, c));
+                break;
+            }
+            case R_GREATER_CONSTANT: { READ_OPERANDS_CONSTANT(); COMPARISON_OP(>); break; }
+            case R_LESS_CONSTANT: { READ_OPERANDS_CONSTANT(); COMPARISON_OP(<); break; }
+            case R_ADD_CONSTANT: { READ_OPERANDS_CONSTANT(); ADD_OP(); break; }
+            case R_SUBTRACT_CONSTANT: { READ_OPERANDS_CONSTANT(); ARITHMETIC_OP(subtractInts, -); break; }
+            case R_MULTIPLY_CONSTANT: { READ_OPERANDS_CONSTANT(); ARITHMETIC_OP(multiplyInts, *); break; }
+            case R_DIVIDE_CONSTANT: { READ_OPERANDS_CONSTANT(); ARITHMETIC_OP(divideInts, /); break; }
+            case R_MODULO_CONSTANT: { READ_OPERANDS_CONSTANT(); MODULO_OP(); break; }
+            case R_NOT: {
+                uint8_t a = READ_BYTE();
+                R(a) = BOOL_VAL(isFalsey(R(READ_BYTE())));
+                break;
+            }
+            case R_NEGATE: {
+                uint8_t a = READ_BYTE();
+                Value operand = R(READ_BYTE());
+                if (!IS_NUMBER(operand)) {
+                    runtimeError("Operand must be a number.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (IS_INT(operand) && AS_INT(operand) != 0 && AS_INT(operand) != INT32_MIN) {
+                    R(a) = INT_VAL(-AS_INT(operand));
+                } else {
+                    R(a) = NUMBER_VAL(-AS_NUMBER(operand));
+                }
+                break;
+            }
+            case R_LIST: {
+                uint8_t a = READ_BYTE();
+                uint8_t count = READ_BYTE();
+                ObjList *list = newList();
+                R(a + count) = OBJ_VAL(list);
+
+                list->values = GROW_ARRAY(Value, list->values, 0, GROW_CAPACITY(count));
+                list->capacity = GROW_CAPACITY(count);
+                list->count = count;
+                for (int i = 0; i < count; i++) {
+                    list->values[i] = R(a + i);
+                }
+                R(a) = OBJ_VAL(list);
+                break;
+            }
+            case R_DICTIONARY: {
+                uint8_t a = READ_BYTE();
+                uint8_t items = READ_BYTE();
+                ObjDictionary *dictionary = newDictionary();
+                R(a + 2 * items) = OBJ_VAL(dictionary);
+
+                for (int i = 0; i < items; i++) {
+                    dictionarySet(&dictionary->items, R(a + 2 * i), R(a + 2 * i + 1));
+                }
+                R(a) = OBJ_VAL(dictionary);
+                break;
+            }
+            case R_IMPORT: {
+                uint8_t a = READ_BYTE();
+                ObjString *name = READ_STRING();
+
+                if (strcmp(name->chars, "math") == 0) {
+                    defineMathNatives();
+                    R(a) = NIL_VAL;
+                    break;
+                }
+
+                if (strcmp(name->chars, "time") == 0) {
+                    defineTimeNatives();
+                    R(a) = NIL_VAL;
+                    break;
+                }
+
+                if (strcmp(name->chars, "io") == 0) {
+                    defineIONatives();
+                    R(a) = NIL_VAL;
+                    break;
+                }
+
+                if (strcmp(name->chars, "vector") == 0) {
+                    defineVectorNatives();
+                    R(a) = NIL_VAL;
+                    break;
+                }
+
+                if (strcmp(name->chars, "matrix") == 0) {
+                    defineMatrixNatives();
+                    R(a) = NIL_VAL;
+                    break;
+                }
+
+                Value moduleValue;
+                if (tableGet(&vm.modules, name, &moduleValue)) {
+                    R(a) = moduleValue;
+                    break;
+                }
+
+                tableSet(&vm.modules, name, NIL_VAL);
+
+                char *source = readFile(name->chars);
+                ObjFunction *function = compile(source);
+                free(source);
+                if (function == NULL) return INTERPRET_COMPILE_ERROR;
+
+                vm.stackTop = frame->slots + a;
+                push(OBJ_VAL(function));
+                ObjClosure *closure = newClosure(function);
+                pop();
+                push(OBJ_VAL(closure));
+                if (!call(closure, 0)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                frame = &vm.frames[vm.frameCount - 1];
+                break;
+            }
+            case R_PRINT: {
+                printValue(R(READ_BYTE()));
+                printf("\n");
+                break;
+            }
+            case R_JUMP: {
+                uint16_t offset = READ_SHORT();
+                frame->ip += offset;
+                break;
+            }
+            case R_JUMP_IF_FALSE: {
+                Value condition = R(READ_BYTE());
+                uint16_t offset = READ_SHORT();
+                if (isFalsey(condition)) frame->ip += offset;
+                break;
+            }
+            case R_LOOP: {
+                uint16_t offset = READ_SHORT();
+                frame->ip -= offset;
+                break;
+            }
+            case R_ITER_INIT: {
+                uint8_t a = READ_BYTE();
+                if (!isIterable(R(a))) {
+                    runtimeError("Can only iterate over lists, float arrays, dictionaries, strings and ranges.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (IS_DICTIONARY(R(a))) snapshotKeys(&R(a));
+                R(a + 1) = INT_VAL(0);
+                break;
+            }
+            case R_ITER_NEXT: {
+                uint8_t a = READ_BYTE();
+                uint8_t d = READ_BYTE();
+                uint16_t offset = READ_SHORT();
+                int cursor = AS_INT(R(a + 1));
+                Value element;
+                if (iterateNext(R(a), &cursor, &element)) {
+                    R(a + 1) = INT_VAL(cursor);
+                    R(d) = element;
+                } else {
+                    frame->ip += offset;
+                }
+                break;
+            }
+            case R_FOR_STEP: {
+                uint8_t slot = READ_BYTE();
+                uint8_t flags = READ_BYTE();
+                uint8_t boundIndex = READ_BYTE();
+                Value step = K(READ_BYTE());
+                uint16_t offset = READ_SHORT();
+
+                Value counter = R(slot);
+                Value bound = (flags & FOR_STEP_CONSTANT_BOUND) ? K(boundIndex) : R(boundIndex);
+
+                int32_t nextInt;
+                if (IS_INT(counter) && IS_INT(step) && IS_INT(bound)
+                    && ((flags & FOR_STEP_SUBTRACT) ? subtractInts(AS_INT(counter), AS_INT(step), &nextInt)
+                                                    : addInts(AS_INT(counter), AS_INT(step), &nextInt))) {
+                    R(slot) = INT_VAL(nextInt);
+
+                    int32_t limit = AS_INT(bound);
+                    bool again;
+                    switch (flags & FOR_STEP_COMPARISON) {
+                        case FOR_STEP_LESS:       again = nextInt < limit; break;
+                        case FOR_STEP_LESS_EQUAL: again = nextInt <= limit; break;
+                        case FOR_STEP_GREATER:    again = nextInt > limit; break;
+                        default:                  again = nextInt >= limit; break;
+                    }
+                    if (again) frame->ip -= offset;
+                    break;
+                }
+
+                // The same errors as the R_ADD / R_SUBTRACT and the comparison this instruction stands for
+                if (!IS_NUMBER(counter)) {
+                    runtimeError((flags & FOR_STEP_SUBTRACT) ? "Operands must be numbers." : "Operands must be two numbers or two strings");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                if (!IS_NUMBER(bound)) {
+                    runtimeError("Operands must be numbers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+
+                double next = (flags & FOR_STEP_SUBTRACT) ? AS_NUMBER(counter) - AS_NUMBER(step) : AS_NUMBER(counter) + AS_NUMBER(step);
+                R(slot) = NUMBER_VAL(next);
+
+                double limit = AS_NUMBER(bound);
+                bool again;
+                switch (flags & FOR_STEP_COMPARISON) {
+                    case FOR_STEP_LESS:       again = next < limit; break;
+                    case FOR_STEP_LESS_EQUAL: again = !(next > limit); break;
+                    case FOR_STEP_GREATER:    again = next > limit; break;
+                    default:                  again = !(next < limit); break;
+                }
+                if (again) frame->ip -= offset;
+                break;
+            }
+            case R_CALL: {
+                uint8_t a = READ_BYTE();
+                int argCount = READ_BYTE();
+                int frameCount = vm.frameCount;
+                vm.stackTop = frame->slots + a + argCount + 1;
+                if (!callValue(R(a), argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                FINISH_CALL(frameCount);
+                break;
+            }
+            case R_TAIL_CALL: {
+                uint8_t a = READ_BYTE();
+                int argCount = READ_BYTE();
+                int frameCount = vm.frameCount;
+                vm.stackTop = frame->slots + a + argCount + 1;
+                if (!tailCall(argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                FINISH_CALL(frameCount);
+                break;
+            }
+            case R_INVOKE: {
+                uint8_t a = READ_BYTE();
+                ObjString *method = READ_STRING();
+                int argCount = READ_BYTE();
+                int frameCount = vm.frameCount;
+                vm.stackTop = frame->slots + a + argCount + 1;
+                if (!invoke(method, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                FINISH_CALL(frameCount);
+                break;
+            }
+            case R_SUPER_INVOKE: {
+                uint8_t a = READ_BYTE();
+                ObjString *method = READ_STRING();
+                int argCount = READ_BYTE();
+                ObjClass *superclass = AS_CLASS(R(a + argCount + 1));
+                int frameCount = vm.frameCount;
+                vm.stackTop = frame->slots + a + argCount + 1;
+                if (!invokeFromClass(superclass, method, argCount)) {
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                FINISH_CALL(frameCount);
+                break;
+            }
+            case R_CHECK_CALLEE: {
+                uint8_t b = READ_BYTE();
+                ObjFunction *function = AS_FUNCTION(K(READ_BYTE()));
+                uint16_t offset = READ_SHORT();
+                if (!isCallee(R(b), function)) frame->ip += offset;
+                break;
+            }
+            case R_CLOSURE: {
+                uint8_t a = READ_BYTE();
+                ObjFunction *function = AS_FUNCTION(K(READ_BYTE()));
+                ObjClosure *closure = newClosure(function);
+                R(a) = OBJ_VAL(closure);
+                for (int i = 0; i < closure->upvalueCount; i++) {
+                    uint8_t isLocal = READ_BYTE();
+                    uint8_t index = READ_BYTE();
+                    if (isLocal) {
+                        closure->upvalues[i] = captureUpvalue(frame->slots + index);
+                    } else {
+                        closure->upvalues[i] = frame->closure->upvalues[index];
+                    }
+                }
+                break;
+            }
+            case R_CLOSE_UPVALUE:
+                closeUpvalues(frame->slots + READ_BYTE());
+                break;
+            case R_RETURN: {
+                Value result = R(READ_BYTE());
+                closeUpvalues(frame->slots);
+                vm.frameCount--;
+                if (vm.frameCount == 0) {
+                    vm.stackTop = vm.stack;
+                    return INTERPRET_OK;
+                }
+
+                // A native called us through vmCall(), which expects the result on top of the stack
+                if (vm.frameCount == exitFrame) {
+                    vm.stackTop = frame->slots;
+                    push(result);
+                    return INTERPRET_OK;
+                }
+
+                frame->slots[0] = result;
+                frame = &vm.frames[vm.frameCount - 1];
+                restoreRegisters(frame);
+                break;
+            }
+            case R_CLASS: {
+                uint8_t a = READ_BYTE();
+                R(a) = OBJ_VAL(newClass(READ_STRING()));
+                break;
+            }
+            case R_INHERIT: {
+                uint8_t a = READ_BYTE();
+                Value superclass = R(a);
+                if (!IS_CLASS(superclass)) {
+                    runtimeError("Superclass must be a class.");
+                    return INTERPRET_RUNTIME_ERROR;
+                }
+                tableAddAll(&AS_CLASS(superclass)->methods, &AS_CLASS(R(a + 1))->methods);
+                break;
+            }
+            case R_METHOD: {
+                uint8_t a = READ_BYTE();
+                tableSet(&AS_CLASS(R(a))->methods, READ_STRING(), R(a + 1));
+                break;
+            }
+        }
+    }
+#undef READ_BYTE
+#undef READ_SHORT
+#undef READ_UINT32
+#undef R
+#undef K
+#undef READ_STRING
+#undef READ_STRING_LONG
+#undef READ_OPERANDS
+#undef READ_OPERANDS_CONSTANT
+#undef ARITHMETIC_OP
+#undef COMPARISON_OP
+#undef ADD_OP
+#undef MODULO_OP
+#undef BITWISE_OP
+#undef FINISH_CALL
+}
+
+static InterpretResult execute(int exitFrame) {
+    return vm.registerMode ? runRegisters(exitFrame) : run(exitFrame);
 }
 
 /*
@@ -864,11 +2105,63 @@ InterpretResult interpret(const char *source) {
     ObjFunction *function = compile(source);
     if (function == NULL) return INTERPRET_COMPILE_ERROR;
 
+    return interpretFunction(function);
+}
+
+InterpretResult interpretFunction(ObjFunction *function) {
     push(OBJ_VAL(function));
     ObjClosure *closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
-    call(closure, 0);
+    if (!call(closure, 0)) return INTERPRET_RUNTIME_ERROR;
+
+    return execute(0);
+}
+
+/*
+ * vmCall() lets C code call any Fer callable and get its result back, the same way OP_CALL would.
+ * We push the callee and its arguments, let callValue() set up the call, and if that pushed a new frame (a closure or an initializer)
+ * we run a nested dispatch loop that returns as soon as that frame does. Natives and classes without init() finish right inside callValue().
+ *
+ * The callee and arguments sit on the VM stack for the whole call, so the GC sees them. The result is popped before we return,
+ * so if the caller is going to allocate before storing it somewhere reachable, it has to keep it alive itself (push it, say).
+ *
+ * If the call fails, the runtime error has already been reported with a full stack trace and the VM stack has been reset.
+ * vmCall() returns false and the native that called it must return straight away. Whatever it returns is ignored
+ * and the failure carries on up through every enclosing call.
+ *
+ * Fer calls don't use any C stack, but each vmCall() nests a whole dispatch loop, so those have a limit of their own,
+ * well below FRAMES_MAX: a callback that keeps calling map() on itself runs out of C stack long before it runs out of frames.
+ */
+
+#define CALLBACK_DEPTH_MAX 1000
+
+static int callbackDepth = 0;
 
-    return run();
+bool vmCall(Value callee, int argCount, Value *args, Value *result) {
+    if (callbackDepth == CALLBACK_DEPTH_MAX) {
+        runtimeError("Stack overflow.");
+        nativeFailed = true;
+        nativeErrorMessage[0] = '\0';
+        return false;
+    }
+
+    int exitFrame = vm.frameCount;
+    reserveStack(argCount + 1);
+    push(callee);
+    for (int i = 0; i < argCount; i++) {
+        push(args[i]);
+    }
+
+    callbackDepth++;
+    bool called = callValue(callee, argCount) && (vm.frameCount == exitFrame || execute(exitFrame) == INTERPRET_OK);
+    callbackDepth--;
+    if (!called) {
+        nativeFailed = true;
+        nativeErrorMessage[0] = '\0';
+        return false;
+    }
+
+    *result = pop();
+    return true;
 }
\ No newline at end of file
@@ -58,14 +58,19 @@
  *     stackTop
  *
  * ...stackTop always points just past the last item
- * The maximum number of values we can store on the stack (for now, at least) is 256.
  *
- * Giving out VM a fixed stack size means it's possible for some sequence of instructions to push too many values and run out of stack space.
- * We could grow the stack dynamically as needed, but for now, we'll keep it simple.
+ * The stack (and the array of call frames below) lives on the heap. It starts out small and grows when a call needs more room
+ * than is left, so a short script doesn't pay for a deep recursion it never makes. push() doesn't check anything:
+ * the compiler works out the most values each function ever has on the stack (maxStack, see object.h),
+ * and call() makes sure, once per call, that the new frame has that much room (see growStack() in vm.c).
+ * FRAMES_MAX is only there so runaway recursion ends in a "Stack overflow." instead of eating all the memory there is.
+ *
+ * STACK_SLACK is a few values more than that, for natives and the VM itself, which push the odd temporary to keep it safe from the GC.
  */
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+#define FRAMES_MAX 100000
+#define STACK_INITIAL UINT8_COUNT
+#define STACK_SLACK 16
 
 /*
  * A CallFrame represents a single ongoing function call.
@@ -74,28 +79,40 @@
  * When we return from a function, the vm will jump to the ip of the caller's CallFrame and resume from there
  *
  * Each time a function is called, we create one of these struct.
- * We could dynamically allocate them on the heap, but that's slow.
+ * We could dynamically allocate each of them on the heap, but that's slow.
  * Function calls are a core operation, so they need to be as fast as possible.
  * Fortunately, we can make the same observation we made for variables:
  * function calls have stack semantics.
  * If first() calls second(), the call to second() will complete before first() does.
+ * So they go in one array, which only has to grow once in a while when the calls get deeper than ever before.
+ *
+ * chunk is the chunk ip points into. That's the function's own chunk, unless call() picked the optimized one (see tier.h),
+ * so constants and line numbers have to be read through the frame and not the function.
  */
 
-typedef struct {
+typedef struct CallFrame {
     ObjClosure *closure;
+    Chunk *chunk;
     uint8_t *ip;
     Value *slots;
 } CallFrame;
 
 typedef struct {
-    CallFrame frames[FRAMES_MAX];
+    CallFrame *frames;
     int frameCount;
-    Value stack[STACK_MAX];
+    int frameCapacity;
+    Value *stack;
     Value *stackTop;
+    Value *stackLimit;
     Table globals;
     Table globalPerms;
     Table strings;
     Table modules;
+    uint64_t hashSeed;
+    bool tiering;
+    bool registerMode;
+    bool jitting;
+    bool compiledCode;
     ObjString *initString;
     ObjUpvalue *openUpvalues;
     size_t bytesAllocated;
@@ -128,9 +145,16 @@ extern VM vm;
 void initVM();
 void freeVM();
 InterpretResult interpret(const char *source);
+// Runs an already compiled script, see aot.h
+InterpretResult interpretFunction(ObjFunction *function);
 
 void defineNative(const char *name, NativeFn function, int arity);
+Value nativeError(const char *format, ...);
+bool vmCall(Value callee, int argCount, Value *args, Value *result);
 bool isFalsey(Value value);
+bool isIterable(Value value);
+bool iterateNext(Value sequence, int *cursor, Value *element);
+bool isCallee(Value callee, ObjFunction *function);
 
 /*
  * The stack protocol supports two operations